@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <omphalos/diag.h>
+#include <linux/mempolicy.h>
+#include <omphalos/affinity.h>
+
+#define NETCLASS "/sys/class/net/"
+
+int lex_cpulist(const char *s,cpu_set_t *cs){
+	char *e;
+
+	CPU_ZERO(cs);
+	for( ; ; ){
+		unsigned long lo,hi;
+
+		if(*s < '0' || *s > '9'){
+			return -1;
+		}
+		hi = lo = strtoul(s,&e,10);
+		if(*e == '-'){
+			s = e + 1;
+			if(*s < '0' || *s > '9'){
+				return -1;
+			}
+			hi = strtoul(s,&e,10);
+		}
+		if(hi < lo || hi >= CPU_SETSIZE){
+			return -1;
+		}
+		while(lo <= hi){
+			CPU_SET(lo++,cs);
+		}
+		if(*e != ','){
+			break;
+		}
+		s = e + 1;
+	}
+	if(*e && *e != '\n'){ // sysfs provides a trailing newline
+		return -1;
+	}
+	return CPU_COUNT(cs) ? 0 : -1;
+}
+
+// Read the first line of a sysfs or procfs file. No diagnostic on failure;
+// plenty of devices lack any given attribute.
+static int
+read_line(const char *path,char *buf,size_t len){
+	FILE *fp;
+	int r = 0;
+
+	if((fp = fopen(path,"r")) == NULL){
+		return -1;
+	}
+	if(fgets(buf,len,fp) == NULL){
+		r = -1;
+	}
+	fclose(fp);
+	return r;
+}
+
+static int
+read_cpulist(const char *path,cpu_set_t *cs){
+	char buf[BUFSIZ];
+
+	if(read_line(path,buf,sizeof(buf))){
+		return -1;
+	}
+	return lex_cpulist(buf,cs);
+}
+
+// Union of the CPUs servicing the device's MSI(-X) interrupts. The effective
+// affinity (4.13+) is where they actually land; the requested affinity is
+// usually far broader.
+static int
+irq_cpus(const char *name,cpu_set_t *cs){
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dir;
+
+	CPU_ZERO(cs);
+	snprintf(path,sizeof(path),NETCLASS "%s/device/msi_irqs",name);
+	if((dir = opendir(path)) == NULL){
+		return -1;
+	}
+	while( (d = readdir(dir)) ){
+		cpu_set_t icpus;
+
+		if(d->d_name[0] < '0' || d->d_name[0] > '9'){
+			continue;
+		}
+		snprintf(path,sizeof(path),"/proc/irq/%s/effective_affinity_list",d->d_name);
+		if(read_cpulist(path,&icpus)){
+			snprintf(path,sizeof(path),"/proc/irq/%s/smp_affinity_list",d->d_name);
+			if(read_cpulist(path,&icpus)){
+				continue;
+			}
+		}
+		CPU_OR(cs,cs,&icpus);
+	}
+	closedir(dir);
+	return CPU_COUNT(cs) ? 0 : -1;
+}
+
+// We want the CPUs local to the NIC's node, less any servicing its
+// interrupts: those are busy filling our rings from softirq context, and
+// we'd only be fighting them for the core. Should that leave nothing, we
+// take the whole node; we still share its caches and memory controller.
+int iface_placement(const char *name,cpu_set_t *cpus,int *node){
+	char path[PATH_MAX],buf[32];
+	cpu_set_t icpus,remain;
+
+	CPU_ZERO(cpus);
+	*node = -1;
+	// Nothing to gain on a single node, and something to lose by pinning.
+	if(read_cpulist("/sys/devices/system/node/online",&remain) ||
+			CPU_COUNT(&remain) < 2){
+		return -1;
+	}
+	snprintf(path,sizeof(path),NETCLASS "%s/device/numa_node",name);
+	if(read_line(path,buf,sizeof(buf)) || (*node = atoi(buf)) < 0){
+		*node = -1;
+		return -1;
+	}
+	snprintf(path,sizeof(path),NETCLASS "%s/device/local_cpulist",name);
+	if(read_cpulist(path,cpus)){
+		CPU_ZERO(cpus);
+		return -1;
+	}
+	if(irq_cpus(name,&icpus) == 0){
+		CPU_XOR(&remain,cpus,&icpus);
+		CPU_AND(&remain,&remain,cpus);
+		if(CPU_COUNT(&remain)){
+			*cpus = remain;
+		}
+	}
+	return 0;
+}
+
+int pin_thread(const cpu_set_t *cpus){
+	int r;
+
+	if( (r = pthread_setaffinity_np(pthread_self(),sizeof(*cpus),cpus)) ){
+		diagnostic("Couldn't set CPU affinity (%s?)",strerror(r));
+		return -1;
+	}
+	return 0;
+}
+
+// The kernel's maxnode is one greater than the number of bits it'll read.
+#define NODEMASK_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+int prefer_node(int node){
+	unsigned long mask;
+
+	if(node < 0 || (unsigned)node >= NODEMASK_BITS){
+		return 0;
+	}
+	mask = 1ul << node;
+	if(syscall(SYS_set_mempolicy,MPOL_PREFERRED,&mask,NODEMASK_BITS + 1)){
+		diagnostic("Couldn't prefer NUMA node %d (%s?)",node,strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int default_node(void){
+	if(syscall(SYS_set_mempolicy,MPOL_DEFAULT,NULL,0)){
+		diagnostic("Couldn't reset NUMA policy (%s?)",strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int bind_node(void *addr,size_t len,int node){
+	unsigned long mask;
+
+	if(node < 0 || (unsigned)node >= NODEMASK_BITS){
+		return 0;
+	}
+	mask = 1ul << node;
+	if(syscall(SYS_mbind,addr,len,MPOL_PREFERRED,&mask,NODEMASK_BITS + 1,0)){
+		diagnostic("Couldn't bind %zub to NUMA node %d (%s?)",len,node,strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+#undef NODEMASK_BITS
@@ -0,0 +1,36 @@
+#ifndef OMPHALOS_AFFINITY
+#define OMPHALOS_AFFINITY
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sched.h>
+#include <stddef.h>
+
+// Parse a kernel-style CPU list ("0-3,8,10-11"; see cpuset(7)). At least one
+// CPU must be named.
+int lex_cpulist(const char *,cpu_set_t *);
+
+// Find the named NIC's NUMA node (-1 if unknown, as for virtual devices and
+// single-node machines), and the CPUs we'd like to analyze its traffic on.
+// Returns -1, with the set empty, if we've no preference.
+int iface_placement(const char *,cpu_set_t *,int *);
+
+// Pin the calling thread to the given CPUs.
+int pin_thread(const cpu_set_t *);
+
+// Prefer the given NUMA node for the calling thread's subsequent allocations
+// (including kernel allocations made on its behalf, such as packet rings),
+// or return to the default policy. A negative node is a no-op.
+int prefer_node(int);
+int default_node(void);
+
+// Prefer the given NUMA node for the mapping's pages, when first touched.
+int bind_node(void *,size_t,int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
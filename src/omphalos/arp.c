@@ -1,10 +1,14 @@
 #include <assert.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <net/if_arp.h>
 #include <omphalos/tx.h>
 #include <omphalos/arp.h>
 #include <omphalos/diag.h>
+#include <omphalos/probe.h>
 #include <asm/byteorder.h>
+#include <omphalos/txsched.h>
+#include <omphalos/arpsweep.h>
 #include <omphalos/hwaddrs.h>
 #include <omphalos/netaddrs.h>
 #include <omphalos/omphalos.h>
@@ -58,7 +62,7 @@ void handle_arp_packet(omphalos_packet *op,const void *frame,size_t len){
 	// probably only ought admit LOCAL/UNICASTs FIXME.
 	if(ap->ar_pln <= sizeof(PROBESRC)){
 		if(memcmp(PROBESRC,saddr,ap->ar_pln)){
-			op->l3s = lookup_local_l3host(&op->tv,op->i,op->l2s,fam,saddr);
+			op->l3s = lookup_local_l3host(op->ts,op->i,op->l2s,fam,saddr);
 		}
 	}
 	switch(ap->ar_op){
@@ -67,6 +71,8 @@ void handle_arp_packet(omphalos_packet *op,const void *frame,size_t len){
 	}case __constant_ntohs(ARPOP_REPLY):{
 		int cat;
 
+		arp_sweep_reply(op->i,saddr,(const char *)saddr + ap->ar_pln,
+				(const char *)saddr + ap->ar_pln + ap->ar_hln);
 		// Sometimes, arp replies will be sent to the medium's broadcast
 		// address, but a host's network address. Don't look up l3d for
 		// a broadcast address. Hack! FIXME what we really want to do
@@ -76,7 +82,7 @@ void handle_arp_packet(omphalos_packet *op,const void *frame,size_t len){
 			daddr = (const char *)ap + sizeof(*ap) + ap->ar_hln * 2 + ap->ar_pln;
 			if(ap->ar_pln <= sizeof(PROBESRC)){
 				if(memcmp(PROBESRC,daddr,ap->ar_pln)){
-					op->l3d = lookup_local_l3host(&op->tv,op->i,op->l2d,fam,daddr);
+					op->l3d = lookup_local_l3host(op->ts,op->i,op->l2d,fam,daddr);
 				}
 			}
 		}
@@ -88,64 +94,60 @@ void handle_arp_packet(omphalos_packet *op,const void *frame,size_t len){
 	}}
 }
 
-static void
-prepare_arp_probe(const interface *i,void *frame,size_t *flen,
-			const void *haddr,size_t hln,const uint32_t *paddr,
-			const uint32_t *saddr){
-	struct tpacket_hdr *thdr;
+// The target hardware and protocol addresses (and the Ethernet destination)
+// are left zeroed, to be patched in by each probe.
+static int
+build_arp_probe(const interface *i,void *frame,size_t flen,int fam,const void *saddr){
+	const unsigned char zeroes[ETH_ALEN] = {};
 	unsigned char *payload;
-	struct ethhdr *ehdr;
 	struct arphdr *ahdr;
-	size_t tlen,pln;
+	size_t tlen,hln,pln;
 
-	pln = sizeof(*paddr);
-	thdr = frame;
-	if(*flen < sizeof(*thdr)){
+	assert(fam == AF_INET);
+	hln = i->addrlen;
+	pln = sizeof(uint32_t);
+	tlen = sizeof(struct ethhdr) + sizeof(*ahdr) + 2 * hln + 2 * pln;
+	if(flen < tlen){
 		diagnostic("%s %s frame too small for tx",__func__,i->name);
-		return;
-	}
-	tlen = thdr->tp_mac + sizeof(*ehdr) + sizeof(*ahdr)
-			+ 2 * hln + 2 * pln;
-	if(*flen < tlen){
-		diagnostic("%s %s frame too small for tx",__func__,i->name);
-		return;
+		return -1;
 	}
-	assert(hln == i->addrlen); // FIXME handle this case
 	// FIXME what about non-ethernet
-	ehdr = (struct ethhdr *)((char *)frame + thdr->tp_mac);
-	assert(prep_eth_header(ehdr,*flen - thdr->tp_mac,i,haddr,ETH_P_ARP) == sizeof(struct ethhdr));
-	thdr->tp_len = sizeof(struct ethhdr) + sizeof(struct arphdr)
-		+ hln * 2 + pln * 2;
-	ahdr = (struct arphdr *)((char *)ehdr + sizeof(*ehdr));
+	if(prep_eth_header(frame,flen,i,zeroes,ETH_P_ARP) != sizeof(struct ethhdr)){
+		return -1;
+	}
+	ahdr = (struct arphdr *)((char *)frame + sizeof(struct ethhdr));
 	ahdr->ar_hrd = htons(ARPHRD_ETHER);
 	ahdr->ar_pro = htons(ETH_P_IP);
 	ahdr->ar_hln = hln;
 	ahdr->ar_pln = pln;
 	ahdr->ar_op = htons(ARPOP_REQUEST);
-	// FIXME this is all horribly unsafe
 	payload = (unsigned char *)ahdr + sizeof(*ahdr);
 	// FIXME allow for spoofing
 	memcpy(payload,i->addr,hln);
 	memcpy(payload + hln,saddr,pln);
-	// FIXME need a source network address
-	memcpy(payload + hln + pln,haddr,hln);
-	memcpy(payload + hln + pln + hln,paddr,pln);
-	*flen = tlen;
+	return tlen;
 }
 
-void send_arp_req(interface *i,const void *hwaddr,const uint32_t *addr,
+int send_arp_req(interface *i,const void *hwaddr,const uint32_t *addr,
 						const uint32_t *saddr){
 	void *frame;
 	size_t flen;
+	probe p;
 
 	if(i->flags & IFF_NOARP){
-		return;
+		return -1;
+	}
+	if((frame = get_tx_frame(i,&flen)) == NULL){
+		return -1;
 	}
-	if( (frame = get_tx_frame(i,&flen)) ){
-		/*char addrstr[INET_ADDRSTRLEN];
-		inet_ntop(AF_INET,addr,addrstr,sizeof(addrstr));
-		diagnostic("Probing %s on %s",addrstr,i->name);*/
-		prepare_arp_probe(i,frame,&flen,hwaddr,i->addrlen,addr,saddr);
-		send_tx_frame(i,frame);
+	/*char addrstr[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET,addr,addrstr,sizeof(addrstr));
+	diagnostic("Probing %s on %s",addrstr,i->name);*/
+	if(probe_start(&p,i,frame,flen,PROBE_ARP,build_arp_probe,AF_INET,saddr)){
+		abort_tx_frame(i,frame);
+		return -1;
 	}
+	probe_l2dst(&p,hwaddr);
+	probe_arp_target(&p,hwaddr,addr);
+	return pace_tx_frame(i,frame,TXCLASS_SWEEP);
 }
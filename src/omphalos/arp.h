@@ -12,7 +12,8 @@ struct omphalos_packet;
 
 void handle_arp_packet(struct omphalos_packet *,const void *,size_t);
 
-void send_arp_req(struct interface *,const void *,const uint32_t *,const uint32_t *);
+// Returns 0 if the request was sent or deferred by the TX scheduler.
+int send_arp_req(struct interface *,const void *,const uint32_t *,const uint32_t *);
 
 static inline void
 send_arp_probe(interface *i,const uint32_t *addr){
@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include <linux/if.h>
+#include <arpa/inet.h>
+#include <omphalos/arp.h>
+#include <omphalos/diag.h>
+#include <omphalos/sweep.h>
+#include <omphalos/timing.h>
+#include <omphalos/txsched.h>
+#include <omphalos/arpsweep.h>
+#include <omphalos/omphalos.h>
+#include <omphalos/interface.h>
+
+#define ARPSWEEP_MIN_MASKBITS 16
+#define ARPSWEEP_MAX_RANGES 8
+
+typedef struct sweeprange {
+	uint32_t base;		// first address, host byte order
+	uint32_t count;		// addresses in the range
+	uint32_t offset;	// sweep index of base
+	uint32_t src;		// our address on the prefix, network byte order
+} sweeprange;
+
+typedef struct arpsweep {
+	sweeprange ranges[ARPSWEEP_MAX_RANGES];
+	unsigned rangecount;
+	uint32_t targets;	// sum of the ranges' counts
+	permutation perm;	// over the targets
+	uint32_t cursor;	// next permutation input
+	uint32_t probed,found;
+	uint64_t started,finished;	// mono_ns()
+	uint64_t *replied;	// bitmap of targets which have replied
+} arpsweep;
+
+// Is [base, base + count) wholly within [obase, obase + ocount)?
+static inline int
+range_within(uint32_t base,uint32_t count,uint32_t obase,uint32_t ocount){
+	return base >= obase && count <= ocount && base - obase <= ocount - count;
+}
+
+// Adds the prefix, unless a range already covers it. Any ranges it covers are
+// replaced by it; routes are ordered most-specific first, so a wider prefix
+// often follows narrower ones, possibly sharing their base.
+static void
+add_range(arpsweep *s,uint32_t base,uint32_t count,uint32_t src){
+	sweeprange *sr;
+	unsigned z;
+
+	for(z = 0 ; z < s->rangecount ; ){
+		sr = &s->ranges[z];
+		if(range_within(base,count,sr->base,sr->count)){
+			return;
+		}
+		if(range_within(sr->base,sr->count,base,count)){
+			*sr = s->ranges[--s->rangecount];
+			continue;
+		}
+		++z;
+	}
+	if(s->rangecount == ARPSWEEP_MAX_RANGES){
+		return;
+	}
+	sr = &s->ranges[s->rangecount++];
+	sr->base = base;
+	sr->count = count;
+	sr->src = src;
+}
+
+static const sweeprange *
+range_of_index(const arpsweep *s,uint32_t idx){
+	unsigned z;
+
+	for(z = 0 ; z < s->rangecount ; ++z){
+		if(idx - s->ranges[z].offset < s->ranges[z].count){
+			return &s->ranges[z];
+		}
+	}
+	return NULL;
+}
+
+void free_arp_sweep(interface *i){
+	arpsweep *s = i->arpsweep;
+
+	if(s){
+		free(s->replied);
+		free(s);
+		i->arpsweep = NULL;
+	}
+}
+
+int start_arp_sweep(interface *i){
+	const omphalos_ctx *octx = get_octx();
+	const ip4route *r;
+	arpsweep *s;
+	unsigned z;
+
+	if(!get_iface_opts(i->name)->arpsweep || octx->mode == OMPHALOS_MODE_SILENT){
+		return 0;
+	}
+	if((i->flags & IFF_NOARP) || i->bcast == NULL){
+		return 0;
+	}
+	if((s = malloc(sizeof(*s))) == NULL){
+		diagnostic("Couldn't allocate ARP sweep for %s",i->name);
+		return -1;
+	}
+	memset(s,0,sizeof(*s));
+	for(r = i->ip4r ; r ; r = r->next){
+		uint32_t hostmask;
+
+		if((r->addrs & ROUTE_HAS_VIA) || !(r->addrs & ROUTE_HAS_SRC)){
+			continue;
+		}
+		if(r->maskbits < ARPSWEEP_MIN_MASKBITS || r->maskbits > 30){
+			continue;
+		}
+		// Neither the network nor the broadcast address
+		hostmask = (1u << (32 - r->maskbits)) - 1;
+		add_range(s,(ntohl(r->dst) & ~hostmask) + 1,hostmask - 1,r->src);
+	}
+	for(z = 0 ; z < s->rangecount ; ++z){
+		s->ranges[z].offset = s->targets;
+		s->targets += s->ranges[z].count;
+	}
+	if(s->targets == 0){
+		free(s);
+		return 0;
+	}
+	if((s->replied = calloc((s->targets + 63) / 64,sizeof(*s->replied))) == NULL){
+		diagnostic("Couldn't allocate ARP sweep for %s",i->name);
+		free(s);
+		return -1;
+	}
+	permutation_init(&s->perm,s->targets);
+	s->started = mono_ns();
+	free_arp_sweep(i);
+	i->arpsweep = s;
+	list_sweeping(i);
+	diagnostic("[%s] ARP sweeping %u addresses in %u prefixes",
+			i->name,s->targets,s->rangecount);
+	return 0;
+}
+
+static void
+finish_sweep(interface *i,arpsweep *s){
+	s->finished = mono_ns();
+	diagnostic("[%s] ARP sweep complete, %u/%u replied",i->name,s->found,s->targets);
+}
+
+int arp_sweep_tick(interface *i){
+	arpsweep *s = i->arpsweep;
+	unsigned room,n = 0;
+
+	if(s == NULL || s->finished || (i->flags & IFF_NOARP)){
+		return -1;
+	}
+	room = tx_sched_room(i,TXCLASS_SWEEP);
+	while(n < room && n < SWEEP_TICK_MAX){
+		const sweeprange *sr;
+		uint32_t idx,addr;
+
+		if(s->cursor > s->perm.mask){
+			finish_sweep(i,s);
+			return -1;
+		}
+		if((idx = permute(&s->perm,s->cursor)) < s->targets){
+			sr = range_of_index(s,idx);
+			addr = htonl(sr->base + (idx - sr->offset));
+			if(addr != sr->src){
+				// Try this target again next time
+				if(send_arp_req(i,i->bcast,&addr,&sr->src)){
+					break;
+				}
+				++s->probed;
+				++n;
+			}
+		}
+		++s->cursor;
+	}
+	return n == SWEEP_TICK_MAX ? 0 : SWEEP_TICK_MSEC;
+}
+
+void arp_sweep_reply(interface *i,const void *spa,const void *tha,const void *tpa){
+	arpsweep *s = i->arpsweep;
+	uint32_t sender,target;
+	unsigned z;
+
+	if(s == NULL || memcmp(tha,i->addr,i->addrlen)){
+		return;
+	}
+	memcpy(&sender,spa,sizeof(sender));
+	memcpy(&target,tpa,sizeof(target));
+	sender = ntohl(sender);
+	lock_hosts(i);
+	for(z = 0 ; z < s->rangecount ; ++z){
+		const sweeprange *sr = &s->ranges[z];
+
+		if(sender - sr->base < sr->count && target == sr->src){
+			uint32_t idx = sr->offset + (sender - sr->base);
+			uint64_t bit = 1ull << (idx % 64);
+
+			if(!(s->replied[idx / 64] & bit)){
+				s->replied[idx / 64] |= bit;
+				++s->found;
+			}
+			break;
+		}
+	}
+	unlock_hosts(i);
+}
+
+int arp_sweep_stats(const interface *i,arpsweep_stats *st){
+	const arpsweep *s = i->arpsweep;
+	uint64_t ns;
+
+	if(s == NULL){
+		return -1;
+	}
+	st->targets = s->targets;
+	st->probed = s->probed;
+	st->found = s->found;
+	st->done = s->finished != 0;
+	ns = (s->finished ? s->finished : mono_ns()) - s->started;
+	st->pps = ns ? s->probed * 1000000000ull / ns : 0;
+	return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef OMPHALOS_ARPSWEEP
+#define OMPHALOS_ARPSWEEP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct interface;
+
+// Active enumeration of the interface's on-link IPv4 prefixes. Every address
+// is ARPed once, in a permuted order (so that no one segment of the prefix
+// sees a burst), paced as TXCLASS_SWEEP. The sweep keeps only its cursor: a
+// reply is credited to it if it's addressed to us, from within a swept
+// prefix, and the responder goes into the host tables through the usual
+// handle_arp_packet() path. Prefixes wider than /16, and those reached via a
+// gateway, aren't swept. Except as noted, calls require the interface lock.
+
+typedef struct arpsweep_stats {
+	uint32_t targets;	// addresses to be probed
+	uint32_t probed;	// probes sent
+	uint32_t found;		// distinct addresses which have replied
+	unsigned pps;		// probes per second, over the sweep's lifetime
+	int done;		// all targets have been probed
+} arpsweep_stats;
+
+// (Re)start a sweep of the interface's current on-link prefixes, if enabled
+// for the interface.
+int start_arp_sweep(struct interface *);
+
+// Send whatever probes the TX scheduler can take. Returns the msec until it
+// ought next be called, or -1 if no sweep is in progress. Called via
+// sweep_tick().
+int arp_sweep_tick(struct interface *);
+
+// Credit an ARP reply (sender protocol address, target hardware address and
+// target protocol address) to the sweep, if it's one of ours. Takes the host
+// lock, as rings' workers might credit replies concurrently.
+void arp_sweep_reply(struct interface *,const void *,const void *,const void *);
+
+// Returns -1 if no sweep has been started on the interface.
+int arp_sweep_stats(const struct interface *,arpsweep_stats *);
+
+void free_arp_sweep(struct interface *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
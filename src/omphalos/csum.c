@@ -1,5 +1,6 @@
 #include <zlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <linux/ip.h>
 #include <linux/udp.h>
@@ -10,50 +11,261 @@
 #include <omphalos/icmp.h>
 #include <omphalos/csum.h>
 
-uint16_t ipv4_csum(const void *hdr){
-	size_t len = ((const struct iphdr *)hdr)->ihl << 2u;
-	const uint16_t *cur;
-	uint32_t sum;
-	unsigned z;
+#define CSUM_SIMD_FLUSH 4096	// vector iterations between folds
+
+// The reference kernel: 16 bits at a time.
+static uint32_t
+csum_partial_scalar(const void *buf,size_t len){
+	const uint16_t *cur = buf;
+	uint32_t sum = 0;
+	size_t z;
 
-	sum = 0;
-	cur = hdr;
 	for(z = 0 ; z < len / sizeof(*cur) ; ++z){
 		sum += cur[z];
+		// Keep the carries from overflowing on large buffers.
+		if(sum & 0x80000000u){
+			sum = (sum & 0xffffu) + (sum >> 16u);
+		}
 	}
-	while(sum >> 16){
-		sum = (sum & 0xffff) + (sum >> 16);
+	if(len % 2){
+		sum += ((uint16_t)(((const unsigned char *)buf)[len - 1]));
 	}
-	return ~sum;
+	return sum;
 }
 
-// hdr must be a valid ICMPv4 header
-uint16_t icmp4_csum(const void *hdr,size_t dlen){
-	const struct icmphdr *ih = hdr;
-	const uint16_t *cur;
-	uint32_t sum,fold;
-	unsigned z;
+// Ones'-complement addition is associative over any word size, so long as
+// the carries are folded back in; summing 32-bit words into a 64-bit
+// accumulator leaves the carries in the upper half.
+static inline uint32_t
+fold64(uint64_t sum){
+	sum = (sum & 0xffffffffull) + (sum >> 32u);
+	sum = (sum & 0xffffffffull) + (sum >> 32u);
+	return csum_fold(sum);
+}
 
-	sum = 0;
-	// ICMPv4 checksum is over ICMP header and ICMP data (zero padded to
-	// make it a multiple of 16 bits). No pseudoheader.
-	cur = (const uint16_t *)ih;
-	for(z = 0 ; z < dlen / sizeof(*cur) ; ++z){
-		sum += cur[z];
+static inline uint64_t
+csum_tail(const unsigned char *buf,size_t len,uint64_t sum){
+	uint32_t w;
+
+	while(len >= sizeof(w)){
+		memcpy(&w,buf,sizeof(w));
+		sum += w;
+		buf += sizeof(w);
+		len -= sizeof(w);
+	}
+	if(len >= 2){
+		uint16_t h;
+
+		memcpy(&h,buf,sizeof(h));
+		sum += h;
+		buf += sizeof(h);
+		len -= sizeof(h);
 	}
-	if(dlen % 2){
-		sum += ((uint16_t)(((const unsigned char *)ih)[dlen - 1]));
+	if(len){
+		uint16_t h = 0;
+
+		// Zero-padded, in memory order
+		memcpy(&h,buf,1);
+		sum += h;
 	}
-	fold = 0;
-	for(z = 0 ; z < sizeof(sum) / 2 ; ++z){
-		fold += sum & 0xffffu;
-		sum >>= 16u;
+	return sum;
+}
+
+// Portable: 64 bits at a time, as two 32-bit halves.
+static uint32_t
+csum_partial_word64(const void *buf,size_t len){
+	const unsigned char *cur = buf;
+	uint64_t sum = 0;
+
+	while(len >= 4 * sizeof(uint64_t)){
+		uint64_t w[4];
+		unsigned z;
+
+		memcpy(w,cur,sizeof(w));
+		for(z = 0 ; z < sizeof(w) / sizeof(*w) ; ++z){
+			sum += (w[z] & 0xffffffffull) + (w[z] >> 32u);
+		}
+		cur += sizeof(w);
+		len -= sizeof(w);
 	}
-	fold = ~(fold & 0xffffu);
-	if(fold == 0u){
-		return 0xffffu;
+	return fold64(csum_tail(cur,len,sum));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Sums the 16-bit halves of each 32-bit lane into that lane, over two
+// independent accumulators. Each lane may take 32768 iterations before
+// overflowing; we fold well before that.
+__attribute__ ((target ("sse2"))) static uint32_t
+csum_partial_sse2(const void *buf,size_t len){
+	const __m128i mask = _mm_set1_epi32(0xffff);
+	const unsigned char *cur = buf;
+	uint64_t sum = 0;
+
+	while(len >= 2 * sizeof(__m128i)){
+		__m128i acc0 = _mm_setzero_si128(),acc1 = _mm_setzero_si128();
+		uint32_t lanes[4];
+		unsigned n;
+
+		for(n = 0 ; n < CSUM_SIMD_FLUSH && len >= 2 * sizeof(__m128i) ; ++n){
+			__m128i v0 = _mm_loadu_si128((const __m128i *)cur);
+			__m128i v1 = _mm_loadu_si128((const __m128i *)cur + 1);
+
+			acc0 = _mm_add_epi32(acc0,_mm_and_si128(v0,mask));
+			acc1 = _mm_add_epi32(acc1,_mm_srli_epi32(v0,16));
+			acc0 = _mm_add_epi32(acc0,_mm_and_si128(v1,mask));
+			acc1 = _mm_add_epi32(acc1,_mm_srli_epi32(v1,16));
+			cur += 2 * sizeof(__m128i);
+			len -= 2 * sizeof(__m128i);
+		}
+		_mm_storeu_si128((__m128i *)lanes,_mm_add_epi32(acc0,acc1));
+		sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
 	}
-	return fold;
+	return fold64(csum_tail(cur,len,sum));
+}
+
+__attribute__ ((target ("avx2"))) static uint32_t
+csum_partial_avx2(const void *buf,size_t len){
+	const __m256i mask = _mm256_set1_epi32(0xffff);
+	const unsigned char *cur = buf;
+	uint64_t sum = 0;
+
+	while(len >= 2 * sizeof(__m256i)){
+		__m256i acc0 = _mm256_setzero_si256(),acc1 = _mm256_setzero_si256();
+		uint32_t lanes[8];
+		unsigned n,z;
+
+		for(n = 0 ; n < CSUM_SIMD_FLUSH && len >= 2 * sizeof(__m256i) ; ++n){
+			__m256i v0 = _mm256_loadu_si256((const __m256i *)cur);
+			__m256i v1 = _mm256_loadu_si256((const __m256i *)cur + 1);
+
+			acc0 = _mm256_add_epi32(acc0,_mm256_and_si256(v0,mask));
+			acc1 = _mm256_add_epi32(acc1,_mm256_srli_epi32(v0,16));
+			acc0 = _mm256_add_epi32(acc0,_mm256_and_si256(v1,mask));
+			acc1 = _mm256_add_epi32(acc1,_mm256_srli_epi32(v1,16));
+			cur += 2 * sizeof(__m256i);
+			len -= 2 * sizeof(__m256i);
+		}
+		_mm256_storeu_si256((__m256i *)lanes,_mm256_add_epi32(acc0,acc1));
+		for(z = 0 ; z < sizeof(lanes) / sizeof(*lanes) ; ++z){
+			sum += lanes[z];
+		}
+	}
+	return fold64(csum_tail(cur,len,sum));
+}
+#endif
+
+static const struct {
+	const char *name;
+	uint32_t (*fxn)(const void *,size_t);
+} kernels[CSUM_KERNELS] = {
+	[CSUM_KERNEL_SCALAR] = { "scalar",	csum_partial_scalar,	},
+	[CSUM_KERNEL_WORD64] = { "word64",	csum_partial_word64,	},
+#if defined(__x86_64__) || defined(__i386__)
+	[CSUM_KERNEL_SSE2] = { "sse2",		csum_partial_sse2,	},
+	[CSUM_KERNEL_AVX2] = { "avx2",		csum_partial_avx2,	},
+#else
+	[CSUM_KERNEL_SSE2] = { "sse2",		NULL,			},
+	[CSUM_KERNEL_AVX2] = { "avx2",		NULL,			},
+#endif
+};
+
+// Usable before init_csum(), on any CPU.
+static csum_kernel kernel = CSUM_KERNEL_WORD64;
+static uint32_t (*csum_kernel_fxn)(const void *,size_t) = csum_partial_word64;
+
+int csum_kernel_supported(csum_kernel k){
+	if(k >= CSUM_KERNELS || kernels[k].fxn == NULL){
+		return 0;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(k == CSUM_KERNEL_SSE2){
+		return __builtin_cpu_supports("sse2");
+	}else if(k == CSUM_KERNEL_AVX2){
+		return __builtin_cpu_supports("avx2");
+	}
+#endif
+	return 1;
+}
+
+const char *csum_kernel_name(csum_kernel k){
+	return k < CSUM_KERNELS ? kernels[k].name : NULL;
+}
+
+csum_kernel get_csum_kernel(void){
+	return kernel;
+}
+
+int set_csum_kernel(csum_kernel k){
+	if(!csum_kernel_supported(k)){
+		return -1;
+	}
+	kernel = k;
+	csum_kernel_fxn = kernels[k].fxn;
+	return 0;
+}
+
+// The widest kernel this CPU supports.
+int init_csum(void){
+	int k;
+
+	for(k = CSUM_KERNELS - 1 ; k >= 0 ; --k){
+		if(set_csum_kernel(k) == 0){
+			return 0;
+		}
+	}
+	return -1;
+}
+
+uint32_t csum_partial(const void *buf,size_t len){
+	return csum_kernel_fxn(buf,len);
+}
+
+uint16_t ipv4_csum(const void *hdr){
+	size_t len = ((const struct iphdr *)hdr)->ihl << 2u;
+
+	return ~csum_fold(csum_partial(hdr,len));
+}
+
+// A computed transport checksum of zero is sent as all ones.
+static inline uint16_t
+transport_csum(uint32_t sum){
+	uint16_t fold = ~csum_fold(sum);
+
+	return fold ? fold : 0xffffu;
+}
+
+// hdr must be a valid ICMPv4 header
+uint16_t icmp4_csum(const void *hdr,size_t dlen){
+	// ICMPv4 checksum is over ICMP header and ICMP data (zero padded to
+	// make it a multiple of 16 bits). No pseudoheader.
+	return transport_csum(csum_partial(hdr,dlen));
+}
+
+// IPv4 pseudoheader: source addr, dest addr, 8 bits of 0, protocol, and
+// total transport length.
+static inline uint32_t
+pseudo4_sum(const struct iphdr *ih,unsigned proto,size_t len){
+	uint32_t sum;
+
+	sum = csum_partial(&ih->saddr,sizeof(ih->saddr) * 2);
+	sum += htons(proto);
+	sum += htons(len);
+	return sum;
+}
+
+// IPv6 pseudoheader: source addr, dest addr, transport length, 24 bits of 0
+// and next header.
+static inline uint32_t
+pseudo6_sum(const struct ip6_hdr *ih,unsigned proto,size_t len){
+	uint32_t sum;
+
+	sum = csum_partial(&ih->ip6_src,sizeof(ih->ip6_src) * 2);
+	sum += htons(proto);
+	sum += htons(len);
+	return sum;
 }
 
 // hdr must be a valid ipv4 header
@@ -61,40 +273,10 @@ uint16_t udp4_csum(const void *hdr){
 	const struct iphdr *ih = hdr;
 	const struct udphdr *uh = (const void *)((const char *)hdr + (ih->ihl << 2u));
 	uint16_t dlen = ntohs(uh->len);
-	const uint16_t *cur;
-	uint32_t sum,fold;
-	unsigned z;
 
-	sum = 0;
 	// UDP4 checksum is over UDP header, UDP data (zero padded to make it a
-	// multiple of 16 bits), and 12-byte IPv4 pseudoheader containing
-	// source addr, dest addr, 8 bits of 0, protocol, and total UDP length.
-	cur = (const uint16_t *)&ih->saddr;
-	sum += cur[0];
-	sum += cur[1];
-	cur = (const uint16_t *)&ih->daddr;
-	sum += cur[0];
-	sum += cur[1];
-	sum += htons(ih->protocol); // zeroes and protocol
-
-	sum += htons(dlen); // total length
-	cur = (const uint16_t *)uh; // now checksum over UDP header + data
-	for(z = 0 ; z < dlen / sizeof(*cur) ; ++z){
-		sum += cur[z];
-	}
-	if(dlen % 2){
-		sum += ((uint16_t)(((const unsigned char *)uh)[dlen - 1]));
-	}
-	fold = 0;
-	for(z = 0 ; z < sizeof(sum) / 2 ; ++z){
-		fold += sum & 0xffffu;
-		sum >>= 16u;
-	}
-	fold = ~(fold & 0xffffu);
-	if(fold == 0u){
-		return 0xffffu;
-	}
-	return fold;
+	// multiple of 16 bits), and the pseudoheader.
+	return transport_csum(pseudo4_sum(ih,IPPROTO_UDP,dlen) + csum_partial(uh,dlen));
 }
 
 // hdr must be a valid ipv6 header
@@ -103,99 +285,47 @@ uint16_t udp6_csum(const void *hdr){
 	// FIXME doesn't work for more than one IPv6 header!
 	const struct udphdr *uh = (const struct udphdr *)((const unsigned char *)hdr + 40);
 	uint16_t dlen = ntohs(uh->len);
-	const uint16_t *cur;
-	uint16_t fold;
-	uint32_t sum;
-	unsigned z;
-
-	sum = 0;
-	// UDP6 checksum is over UDP header, UDP data (zero padded to make it a
-	// multiple of 16 bits), and 40-byte IPv6 pseudoheader containing
-	// source addr, dest addr, UDP length, 24 bits of 0 and next header
-	sum += ih->ip6_src.s6_addr16[0];
-	sum += ih->ip6_src.s6_addr16[1];
-	sum += ih->ip6_src.s6_addr16[2];
-	sum += ih->ip6_src.s6_addr16[3];
-	sum += ih->ip6_src.s6_addr16[4];
-	sum += ih->ip6_src.s6_addr16[5];
-	sum += ih->ip6_src.s6_addr16[6];
-	sum += ih->ip6_src.s6_addr16[7]; // saddr
-	sum += ih->ip6_dst.s6_addr16[0];
-	sum += ih->ip6_dst.s6_addr16[1];
-	sum += ih->ip6_dst.s6_addr16[2];
-	sum += ih->ip6_dst.s6_addr16[3];
-	sum += ih->ip6_dst.s6_addr16[4];
-	sum += ih->ip6_dst.s6_addr16[5];
-	sum += ih->ip6_dst.s6_addr16[6];
-	sum += ih->ip6_dst.s6_addr16[7]; // daddr
-	sum += ih->ip6_ctlun.ip6_un1.ip6_un1_plen;
-	sum += htons(17); // zeroes and protocol
-	cur = (const uint16_t *)uh; // now checksum over UDP header + data
-	for(z = 0 ; z < dlen / sizeof(*cur) ; ++z){
-		sum += cur[z];
-	}
-	if(dlen % 2){
-		sum += ((uint16_t)(((const unsigned char *)uh)[dlen - 1]));
-	}
-	fold = 0;
-	for(z = 0 ; z < sizeof(sum) / 2 ; ++z){
-		fold += sum & 0xffffu;
-		sum >>= 16u;
-	}
-	fold = ~(fold & 0xffffu);
-	if(fold == 0u){
-		return 0xffffu;
-	}
-	return fold;
+
+	return transport_csum(pseudo6_sum(ih,IPPROTO_UDP,dlen) + csum_partial(uh,dlen));
 }
 
 uint16_t icmp6_csum(const void *hdr){
 	const struct ip6_hdr *ih = hdr;
 	// FIXME doesn't work for more than one IPv6 header!
 	const struct icmp6_hdr *ch = (const struct icmp6_hdr *)((const unsigned char *)hdr + 40);
-	uint16_t dlen = ntohs(ih->ip6_ctlun.ip6_un1.ip6_un1_plen) - sizeof(*ih);
-	const uint16_t *cur;
-	uint16_t fold;
-	uint32_t sum;
-	unsigned z;
+	uint16_t dlen = ntohs(ih->ip6_ctlun.ip6_un1.ip6_un1_plen);
 
-	sum = 0;
 	// ICMPv6 checksum works just like UDPv6
-	sum += ih->ip6_src.s6_addr16[0];
-	sum += ih->ip6_src.s6_addr16[1];
-	sum += ih->ip6_src.s6_addr16[2];
-	sum += ih->ip6_src.s6_addr16[3];
-	sum += ih->ip6_src.s6_addr16[4];
-	sum += ih->ip6_src.s6_addr16[5];
-	sum += ih->ip6_src.s6_addr16[6];
-	sum += ih->ip6_src.s6_addr16[7]; // saddr
-	sum += ih->ip6_dst.s6_addr16[0];
-	sum += ih->ip6_dst.s6_addr16[1];
-	sum += ih->ip6_dst.s6_addr16[2];
-	sum += ih->ip6_dst.s6_addr16[3];
-	sum += ih->ip6_dst.s6_addr16[4];
-	sum += ih->ip6_dst.s6_addr16[5];
-	sum += ih->ip6_dst.s6_addr16[6];
-	sum += ih->ip6_dst.s6_addr16[7]; // daddr
-	sum += ih->ip6_ctlun.ip6_un1.ip6_un1_plen;
-	sum += htons(IPPROTO_ICMP6); // zeroes and protocol
-	cur = (const uint16_t *)ch; // now checksum over ICMP header + data
-	for(z = 0 ; z < dlen / sizeof(*cur) ; ++z){
-		sum += cur[z];
-	}
-	if(dlen % 2){
-		sum += ((uint16_t)(((const unsigned char *)ch)[dlen - 1]));
-	}
-	fold = 0;
-	for(z = 0 ; z < sizeof(sum) / 2 ; ++z){
-		fold += sum & 0xffffu;
-		sum >>= 16u;
-	}
-	fold = ~(fold & 0xffffu);
-	if(fold == 0u){
-		return 0xffffu;
+	return transport_csum(pseudo6_sum(ih,IPPROTO_ICMP6,dlen) + csum_partial(ch,dlen));
+}
+
+uint16_t tcp4_csum(const void *hdr,size_t len){
+	const struct iphdr *ih = hdr;
+
+	return ~csum_fold(pseudo4_sum(ih,IPPROTO_TCP,len) +
+			csum_partial((const unsigned char *)hdr + (ih->ihl << 2u),len));
+}
+
+// hdr must be a valid ipv6 header
+uint16_t tcp6_csum(const void *hdr,size_t len){
+	const struct ip6_hdr *ih = hdr;
+
+	// FIXME doesn't work for more than one IPv6 header!
+	return ~csum_fold(pseudo6_sum(ih,IPPROTO_TCP,len) + csum_partial(ih + 1,len));
+}
+
+uint16_t rx_l4_csum(const void *hdr,unsigned proto,const void *seg,size_t len){
+	const struct iphdr *ih = hdr;
+	uint32_t sum = csum_partial(seg,len);
+
+	if(ih->version == 4){
+		if(proto != IPPROTO_ICMP){
+			sum += pseudo4_sum(ih,proto,len);
+		}
+	}else{
+		sum += pseudo6_sum(hdr,proto,len);
 	}
-	return fold;
+	return ~csum_fold(sum);
 }
 
 uint32_t ieee80211_fcs(const void *frame,size_t len){
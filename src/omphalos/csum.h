@@ -5,8 +5,27 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
+// Checksums are summed by one of several kernels, all giving the same
+// results. init_csum() selects the widest the CPU supports; until then, the
+// portable word64 kernel is used.
+typedef enum {
+	CSUM_KERNEL_SCALAR,	// 16 bits at a time (the reference)
+	CSUM_KERNEL_WORD64,	// 64 bits at a time, any CPU
+	CSUM_KERNEL_SSE2,	// 128 bits at a time (x86)
+	CSUM_KERNEL_AVX2,	// 256 bits at a time (x86)
+	CSUM_KERNELS
+} csum_kernel;
+
+int init_csum(void);
+int csum_kernel_supported(csum_kernel);
+const char *csum_kernel_name(csum_kernel);
+csum_kernel get_csum_kernel(void);
+// Returns -1 if the kernel isn't supported on this CPU.
+int set_csum_kernel(csum_kernel);
+
 uint16_t ipv4_csum(const void *) __attribute__ ((nonnull (1)));
 
 uint16_t udp4_csum(const void *) __attribute__ ((nonnull (1)));
@@ -15,8 +34,51 @@ uint16_t udp6_csum(const void *) __attribute__ ((nonnull (1)));
 uint16_t icmp4_csum(const void *,size_t) __attribute__ ((nonnull (1)));
 uint16_t icmp6_csum(const void *) __attribute__ ((nonnull (1)));
 
+// hdr must be a valid IP(v6) header, followed by len bytes of TCP segment
+uint16_t tcp4_csum(const void *,size_t) __attribute__ ((nonnull (1)));
+uint16_t tcp6_csum(const void *,size_t) __attribute__ ((nonnull (1)));
+
+// Verify a received transport segment of len bytes, checksum included,
+// against the pseudoheader of its IP(v6) header (ICMPv4 has none; IPv6
+// extension headers needn't lie between them). Returns 0 if it's good.
+uint16_t rx_l4_csum(const void *,unsigned,const void *,size_t)
+	__attribute__ ((nonnull (1, 3)));
+
 uint32_t ieee80211_fcs(const void *,size_t) __attribute__ ((nonnull (1)));
 
+// Ones'-complement sum of the bytes (zero-padded to 16 bits), taken 16 bits
+// at a time in memory order, as are the checksums above. It might not be
+// folded (see csum_fold()), and might not be the same from kernel to kernel
+// until it is.
+uint32_t csum_partial(const void *,size_t) __attribute__ ((nonnull (1)));
+
+static inline uint16_t
+csum_fold(uint32_t sum){
+	sum = (sum & 0xffffu) + (sum >> 16u);
+	sum = (sum & 0xffffu) + (sum >> 16u);
+	return sum;
+}
+
+// Incremental updates (RFC 1624, eqn. 3): HC' = ~(~HC + ~m + m'), as the 16
+// bits m covered by checksum HC become m'. Values are as they appear in the
+// packet. A 32-bit field is two such updates.
+static inline uint16_t
+csum_update16(uint16_t check,uint16_t oval,uint16_t nval){
+	return ~csum_fold((uint16_t)~check + (uint32_t)(uint16_t)~oval + nval);
+}
+
+static inline uint16_t
+csum_update32(uint16_t check,uint32_t oval,uint32_t nval){
+	check = csum_update16(check,oval & 0xffffu,nval & 0xffffu);
+	return csum_update16(check,oval >> 16u,nval >> 16u);
+}
+
+// Account for bytes newly covered by the checksum, given their csum_partial().
+static inline uint16_t
+csum_extend(uint16_t check,uint32_t sum){
+	return ~csum_fold((uint16_t)~check + (uint32_t)csum_fold(sum));
+}
+
 #ifdef __cplusplus
 }
 #endif
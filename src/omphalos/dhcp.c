@@ -8,6 +8,7 @@
 #include <omphalos/csum.h>
 #include <omphalos/dhcp.h>
 #include <omphalos/diag.h>
+#include <omphalos/txsched.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/ethernet.h>
 #include <omphalos/interface.h>
@@ -172,7 +173,7 @@ int dhcp4_probe(interface *i,const uint32_t *saddr){
 	ip->check = ipv4_csum(ip);
 	udp->check = udp4_csum(udp);
 	hdr->tp_len = off - hdr->tp_mac;
-	send_tx_frame(i,frame);
+	pace_tx_frame(i,frame,TXCLASS_SWEEP);
 	return 0;
 
 err:
@@ -220,7 +221,7 @@ int dhcp6_probe(interface *i,const uint128_t saddr){
 	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(off - hdr->tp_mac - sizeof(struct ethhdr) - sizeof(*ip));
 	udp->check = udp6_csum(udp);
 	hdr->tp_len = off - hdr->tp_mac;
-	send_tx_frame(i,frame);
+	pace_tx_frame(i,frame,TXCLASS_SWEEP);
 	return 0;
 
 err:
@@ -11,10 +11,12 @@
 #include <omphalos/diag.h>
 #include <omphalos/mdns.h>
 #include <omphalos/util.h>
+#include <omphalos/probe.h>
 #include <asm/byteorder.h>
 #include <omphalos/csum.h>
 #include <omphalos/route.h>
 #include <omphalos/resolv.h>
+#include <omphalos/txsched.h>
 #include <omphalos/service.h>
 #include <omphalos/ethernet.h>
 #include <omphalos/omphalos.h>
@@ -635,48 +637,39 @@ int tx_dns_ptr(int fam,const void *addr,const char *question){
 		abort_tx_frame(rp.i,frame);
 		return -1;
 	}
-	send_tx_frame(rp.i,frame);
+	pace_tx_frame(rp.i,frame,TXCLASS_NAMING);
 	return 0;
 }
 
-int setup_dns_ptr(const struct routepath *rp,int fam,const void *ns,unsigned port,
-			size_t flen,void *frame,const char *question,
-			unsigned sport){
-	struct tpacket_hdr *thdr;
-	uint16_t *totlen,tptr;
-	struct dnshdr *dnshdr;
+// A UDP probe with no payload, to be extended via probe_extend(). ttl4, if
+// non-zero, overrides the IPv4 TTL.
+static int
+build_udp_probe(const interface *i,void *frame,size_t flen,int fam,
+		const void *src,const void *hw,const void *dst,unsigned port,
+		unsigned ttl4){
 	struct udphdr *udp;
-	hwaddrint hw;
-	size_t tlen;
 	void *iphdr;
+	size_t tlen;
 	int r;
 
-	hw = get_hwaddr(rp->l2);
-	thdr = frame;
-	tlen = thdr->tp_mac;
-	if((r = prep_eth_header((char *)frame + tlen,flen - tlen,rp->i,&hw,
+	if((r = prep_eth_header(frame,flen,i,hw,
 				fam == AF_INET ? ETH_P_IP : ETH_P_IPV6)) < 0){
 		return -1;
 	}
-	tlen += r;
+	tlen = r;
 	iphdr = (char *)frame + tlen;
-	// Stash the <l3 headers' total size, so we can set tot_len when done
 	if(fam == AF_INET){
-		uint32_t src4 = rp->src[0];
-
-		totlen = &((struct iphdr *)iphdr)->tot_len;
-		r = prep_ipv4_header(iphdr,flen - tlen,src4,*(const uint32_t *)ns,IPPROTO_UDP);
-		if(sport == htons(MDNS_UDP_PORT)){ // FIXME grim hack!
-			((struct iphdr *)iphdr)->ttl = MDNS_IPV4_TTL;
+		r = prep_ipv4_header(iphdr,flen - tlen,*(const uint32_t *)src,
+					*(const uint32_t *)dst,IPPROTO_UDP);
+		if(r >= 0 && ttl4){
+			((struct iphdr *)iphdr)->ttl = ttl4;
 		}
-		*totlen = tlen;
 	}else if(fam == AF_INET6){
-		uint128_t src6;
+		uint128_t src6,dst6;
 
-		assign128(src6,rp->src);
-		totlen = &((struct ip6_hdr *)iphdr)->ip6_ctlun.ip6_un1.ip6_un1_plen;
-		r = prep_ipv6_header(iphdr,flen - tlen,src6,ns,IPPROTO_UDP);
-		*totlen = tlen + r;
+		assign128(src6,src);
+		assign128(dst6,dst);
+		r = prep_ipv6_header(iphdr,flen - tlen,src6,dst6,IPPROTO_UDP);
 	}else{
 		return -1;
 	}
@@ -689,39 +682,86 @@ int setup_dns_ptr(const struct routepath *rp,int fam,const void *ns,unsigned por
 	}
 	udp = (struct udphdr *)((char *)frame + tlen);
 	udp->dest = htons(port);
-	udp->source = sport;
-	udp->check = 0u;
+	udp->source = htons(port);
+	udp->len = htons(sizeof(*udp));
 	tlen += sizeof(*udp);
-	if(flen - tlen < sizeof(*dnshdr) + strlen(question) + 1 + 4){
+	if(fam == AF_INET){
+		((struct iphdr *)iphdr)->tot_len = htons(r + sizeof(*udp));
+		((struct iphdr *)iphdr)->check = ipv4_csum(iphdr);
+		udp->check = udp4_csum(iphdr);
+	}else{
+		((struct ip6_hdr *)iphdr)->ip6_ctlun.ip6_un1.ip6_un1_plen = udp->len;
+		udp->check = udp6_csum(iphdr);
+	}
+	return tlen;
+}
+
+// Destination addresses and ports are patched in by each query.
+static int
+build_dns_probe(const interface *i,void *frame,size_t flen,int fam,const void *src){
+	const uint128_t zeroes = { 0, 0, 0, 0 };
+
+	return build_udp_probe(i,frame,flen,fam,src,zeroes,zeroes,0,0);
+}
+
+int build_mdns_probe(const interface *i,void *frame,size_t flen,int fam,const void *src){
+	const uint128_t net6 = { __constant_htonl(0xff020000u), 0, 0,
+					__constant_htonl(0x000000fbu) };
+	const uint32_t net4 = MDNS_NET4;
+
+	if(fam == AF_INET){
+		return build_udp_probe(i,frame,flen,fam,src,"\x01\x00\x5e\x00\x00\xfb",
+					&net4,MDNS_UDP_PORT,MDNS_IPV4_TTL);
+	}
+	return build_udp_probe(i,frame,flen,fam,src,"\x33\x33\x00\x00\x00\xfb",
+				net6,MDNS_UDP_PORT,0);
+}
+
+int setup_dns_ptr(const struct routepath *rp,int fam,const void *ns,unsigned port,
+			size_t flen,void *frame,const char *question,
+			unsigned sport){
+	struct dnshdr *dnshdr;
+	size_t qlen,avail;
+	uint16_t tptr;
+	hwaddrint hw;
+	char *dat;
+	probe p;
+	int r;
+
+	if(fam != AF_INET && fam != AF_INET6){
+		return -1;
+	}
+	if(sport == htons(MDNS_UDP_PORT)){ // FIXME grim hack!
+		r = probe_start(&p,rp->i,frame,flen,PROBE_MDNS,build_mdns_probe,fam,rp->src);
+	}else{
+		r = probe_start(&p,rp->i,frame,flen,PROBE_DNS,build_dns_probe,fam,rp->src);
+	}
+	if(r){
+		return -1;
+	}
+	hw = get_hwaddr(rp->l2);
+	probe_l2dst(&p,&hw);
+	probe_l3dst(&p,ns);
+	probe_ports(&p,sport,htons(port));
+	probe_ip4id(&p,random());
+	dnshdr = probe_tail(&p,&avail);
+	qlen = strlen(question) + 1;
+	if(avail < sizeof(*dnshdr) + qlen + 4){
 		return -1;
 	}
-	dnshdr = (struct dnshdr *)((char *)frame + tlen);
 	dnshdr->id = random();
 	dnshdr->flags = htons(0x0100u);
 	dnshdr->qdcount = htons(1);
 	dnshdr->ancount = 0;
 	dnshdr->nscount = 0;
 	dnshdr->arcount = 0;
-	tlen += sizeof(struct dnshdr);
-	udp->len = sizeof(struct udphdr) + sizeof(struct dnshdr);
-	strcpy((char *)frame + tlen,question);
-	tlen += strlen(question) + 1;
+	dat = (char *)dnshdr + sizeof(*dnshdr);
+	memcpy(dat,question,qlen);
 	tptr = DNS_TYPE_PTR;
-	memcpy((char *)frame + tlen,&tptr,2);
+	memcpy(dat + qlen,&tptr,2);
 	tptr = DNS_CLASS_IN;
-	memcpy((char *)frame + tlen + 2,&tptr,2);
-	tlen += 4;
-	thdr->tp_len = tlen - thdr->tp_mac;
-	udp->len += strlen(question) + 1 + 4;
-	udp->len = htons(udp->len);
-	*totlen = htons(tlen - *totlen);
-	if(fam == AF_INET){
-		((struct iphdr *)iphdr)->check = ipv4_csum(iphdr);
-		udp->check = udp4_csum(iphdr);
-	}else{
-		udp->check = udp6_csum(iphdr);
-	}
-	return 0;
+	memcpy(dat + qlen + 2,&tptr,2);
+	return probe_extend(&p,sizeof(*dnshdr) + qlen + 4);
 }
 
 char *rev_dns_a(const void *i4){
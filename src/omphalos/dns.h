@@ -8,6 +8,7 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
+struct interface;
 struct routepath;
 struct omphalos_packet;
 
@@ -41,6 +42,10 @@ int setup_dns_ptr(const struct routepath *,int,const void *,unsigned,size_t,
 			void *,const char *,unsigned)
 			__attribute__ ((nonnull (1,3,6,7)));
 
+// Probe template builder (see probe.h) for UDP to the mDNS group, from port
+// 5353. The payload is left to the caller.
+int build_mdns_probe(const struct interface *,void *,size_t,int,const void *);
+
 // Generate reverse DNS lookup strings
 char *rev_dns_a(const void *);		// Expects a 32-bit IPv4 address
 char *rev_dns_aaaa(const void *);	// Expects a 128-bit IPv6 address
@@ -0,0 +1,205 @@
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <omphalos/diag.h>
+#include <omphalos/epoch.h>
+
+#define EPOCH_OFFLINE UINT64_MAX
+
+typedef struct participant {
+	uint64_t seen;		// global epoch at last quiescent state (atomic)
+	struct participant *next;
+} participant;
+
+// Retirement bumps the epoch, tagging the entry with the new value. A
+// participant which has since seen a value at least that large has passed
+// through a quiescent state after the entry became unreachable.
+static uint64_t global_epoch = 1;
+
+static pthread_mutex_t plock = PTHREAD_MUTEX_INITIALIZER; // participants
+static participant *participants;
+
+static pthread_mutex_t rlock = PTHREAD_MUTEX_INITIALIZER; // retired, pending
+static epoch_entry *retired;	// newest (largest epoch) first
+static unsigned pending;	// entries on retired (atomic)
+
+// Held while destroying, so that entries are always destroyed in the order
+// they were retired, even across reclaimers.
+static pthread_mutex_t dlock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t self_key;	// calling thread's participant
+
+static void
+create_self_key(void){
+	if(pthread_key_create(&self_key,NULL)){
+		diagnostic("%s couldn't create TSD key",__func__);
+	}
+}
+
+static inline participant *
+get_self(void){
+	pthread_once(&key_once,create_self_key);
+	return pthread_getspecific(self_key);
+}
+
+// Publish that we've seen the current epoch. Subsequent reads of shared
+// pointers mustn't be reordered before the publication.
+static inline void
+observe_epoch(participant *p){
+	__atomic_store_n(&p->seen,__atomic_load_n(&global_epoch,__ATOMIC_SEQ_CST),
+				__ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+int epoch_register(void){
+	participant *p;
+
+	if(get_self()){
+		return 0;
+	}
+	if((p = malloc(sizeof(*p))) == NULL){
+		diagnostic("%s couldn't allocate participant",__func__);
+		return -1;
+	}
+	observe_epoch(p);
+	if(pthread_setspecific(self_key,p)){
+		diagnostic("%s couldn't set TSD",__func__);
+		free(p);
+		return -1;
+	}
+	pthread_mutex_lock(&plock);
+	p->next = participants;
+	participants = p;
+	pthread_mutex_unlock(&plock);
+	return 0;
+}
+
+void epoch_unregister(void){
+	participant *p,**prev;
+
+	if((p = get_self()) == NULL){
+		return;
+	}
+	pthread_mutex_lock(&plock);
+	for(prev = &participants ; *prev != p ; prev = &(*prev)->next){
+		;
+	}
+	*prev = p->next;
+	pthread_mutex_unlock(&plock);
+	pthread_setspecific(self_key,NULL);
+	free(p);
+}
+
+// Takes a newest-first list, and destroys oldest first. Requires dlock.
+static void
+destroy_entries(epoch_entry *e){
+	epoch_entry *tmp,*fifo = NULL;
+
+	while( (tmp = e) ){
+		e = e->next;
+		tmp->next = fifo;
+		fifo = tmp;
+	}
+	while( (tmp = fifo) ){
+		fifo = fifo->next;
+		tmp->fxn(tmp);
+	}
+}
+
+// Everything retired no later than the oldest epoch any online participant
+// has seen is safe. The epoch is read before the participants, so that an
+// entry retired while we scan, which a participant might yet hold, is never
+// considered.
+static void
+reclaim(void){
+	epoch_entry **prev,*e,*tmp;
+	const participant *p;
+	unsigned count;
+	uint64_t safe;
+
+	if(__atomic_load_n(&pending,__ATOMIC_RELAXED) == 0){
+		return;
+	}
+	// Someone else is reclaiming, or participants are changing; we'll
+	// try again next time.
+	if(pthread_mutex_trylock(&dlock)){
+		return;
+	}
+	safe = __atomic_load_n(&global_epoch,__ATOMIC_SEQ_CST);
+	if(pthread_mutex_trylock(&plock)){
+		pthread_mutex_unlock(&dlock);
+		return;
+	}
+	for(p = participants ; p ; p = p->next){
+		uint64_t seen = __atomic_load_n(&p->seen,__ATOMIC_ACQUIRE);
+
+		if(seen < safe){
+			safe = seen;
+		}
+	}
+	pthread_mutex_unlock(&plock);
+	pthread_mutex_lock(&rlock);
+	// Newest first, so everything from the first safe entry on is safe
+	for(prev = &retired ; (e = *prev) ; prev = &e->next){
+		if(e->epoch <= safe){
+			break;
+		}
+	}
+	*prev = NULL;
+	for(count = 0, tmp = e ; tmp ; tmp = tmp->next){
+		++count;
+	}
+	__atomic_sub_fetch(&pending,count,__ATOMIC_RELAXED);
+	pthread_mutex_unlock(&rlock);
+	destroy_entries(e);
+	pthread_mutex_unlock(&dlock);
+}
+
+void epoch_quiescent(void){
+	participant *p;
+
+	if( (p = get_self()) ){
+		observe_epoch(p);
+	}
+	reclaim();
+}
+
+void epoch_offline(void){
+	participant *p;
+
+	if( (p = get_self()) ){
+		__atomic_store_n(&p->seen,EPOCH_OFFLINE,__ATOMIC_RELEASE);
+	}
+}
+
+void epoch_online(void){
+	participant *p;
+
+	if( (p = get_self()) ){
+		observe_epoch(p);
+	}
+}
+
+void epoch_retire(epoch_entry *e,void (*fxn)(epoch_entry *)){
+	e->fxn = fxn;
+	pthread_mutex_lock(&rlock);
+	e->epoch = __atomic_add_fetch(&global_epoch,1,__ATOMIC_SEQ_CST);
+	e->next = retired;
+	retired = e;
+	__atomic_add_fetch(&pending,1,__ATOMIC_RELAXED);
+	pthread_mutex_unlock(&rlock);
+}
+
+void epoch_drain(void){
+	epoch_entry *e;
+
+	pthread_mutex_lock(&dlock);
+	pthread_mutex_lock(&rlock);
+	e = retired;
+	retired = NULL;
+	__atomic_store_n(&pending,0,__ATOMIC_RELAXED);
+	pthread_mutex_unlock(&rlock);
+	destroy_entries(e);
+	pthread_mutex_unlock(&dlock);
+}
@@ -0,0 +1,60 @@
+#ifndef OMPHALOS_EPOCH
+#define OMPHALOS_EPOCH
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Quiescent-state-based reclamation (QSBR), for objects whose pointers are
+// handed out without a lock held (lookup_global_l3host()). A writer unlinks
+// the object from everything a reader could find it through, then retires it;
+// it's destroyed once each participating thread has passed through a
+// quiescent state, i.e. has held no such pointer at some point since.
+//
+// Readers pay nothing beyond announcing quiescence between units of work
+// (frames, netlink messages, keystrokes), and going offline around anything
+// which might block, so that a sleeping thread doesn't hold up reclamation.
+// An offline thread mustn't retain any pointers. Threads which never touch
+// such objects needn't register; calls from unregistered threads are no-ops
+// (save epoch_retire()).
+
+// Embed one in any object to be retired.
+typedef struct epoch_entry {
+	struct epoch_entry *next;
+	uint64_t epoch;			// global epoch at retirement
+	void (*fxn)(struct epoch_entry *);
+} epoch_entry;
+
+// Register the calling thread as a participant, online. Returns -1 on
+// failure, in which case the thread mustn't touch retirable objects.
+int epoch_register(void);
+
+// Unregister the calling thread, which must hold no pointers.
+void epoch_unregister(void);
+
+// The calling thread holds no pointers to retirable objects. Reclaims
+// anything which has become safe to destroy.
+void epoch_quiescent(void);
+
+// Bracket anything which might block. Going offline is a quiescent state.
+void epoch_offline(void);
+void epoch_online(void);
+
+// Destroy the object via the callback once all participants have quiesced.
+// The object must already be unreachable by readers. Callable from any
+// thread; the callback might be invoked from any participant. Objects are
+// destroyed in the order they were retired, so a container retired after its
+// contents (see slab.h) outlives their callbacks.
+void epoch_retire(epoch_entry *,void (*)(epoch_entry *));
+
+// Destroy everything retired, regardless of participants. Only for use once
+// all other participants have exited or gone offline for good.
+void epoch_drain(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,13 +8,18 @@
 #include <linux/sockios.h>
 #include <linux/version.h>
 #include <linux/ethtool.h>
+#include <linux/net_tstamp.h>
 #include <omphalos/diag.h>
 #include <omphalos/ethtool.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/interface.h>
 
-static inline int
-ethtool_docmd(const char *name,void *unsafe){
+#ifndef SIOCGHWTSTAMP
+#define SIOCGHWTSTAMP 0x89b1
+#endif
+
+static int
+sockios_docmd(const char *name,unsigned long req,void *unsafe){
 	struct ifreq ifr;
 	int fd;
 
@@ -29,8 +34,11 @@ ethtool_docmd(const char *name,void *unsafe){
 		diagnostic("Couldn't open ethtool fd (%s?)",strerror(errno));
 		return -1;
 	}
-	if(ioctl(fd,SIOCETHTOOL,&ifr)){ // no diagnostic here; specialize
+	if(ioctl(fd,req,&ifr)){ // no diagnostic here; specialize
+		int e = errno;
+
 		close(fd);
+		errno = e;
 		return -1;
 	}
 	if(close(fd)){
@@ -40,6 +48,51 @@ ethtool_docmd(const char *name,void *unsafe){
 	return 0;
 }
 
+static inline int
+ethtool_docmd(const char *name,void *unsafe){
+	return sockios_docmd(name,SIOCETHTOOL,unsafe);
+}
+
+// Have the NIC timestamp every received frame. A filter already in place
+// (say, ptp4l's) is left alone, lest we break its user. Returns 1 if we
+// changed the configuration, 0 if stamping was already enabled.
+int iface_rx_hwtstamp(const char *name){
+	struct hwtstamp_config hc;
+
+	memset(&hc,0,sizeof(hc));
+	if(sockios_docmd(name,SIOCGHWTSTAMP,&hc) == 0){
+		if(hc.rx_filter != HWTSTAMP_FILTER_NONE){
+			return 0;
+		}
+	}else{ // pre-3.14, or unsupported; try to set it regardless
+		memset(&hc,0,sizeof(hc));
+		hc.tx_type = HWTSTAMP_TX_OFF;
+	}
+	hc.rx_filter = HWTSTAMP_FILTER_ALL;
+	if(sockios_docmd(name,SIOCSHWTSTAMP,&hc)){
+		diagnostic("Couldn't enable RX timestamping on %s (%s?)",name,strerror(errno));
+		return -1;
+	}
+	return 1;
+}
+
+// Undo iface_rx_hwtstamp(), leaving the TX configuration alone.
+int iface_rx_hwtstamp_restore(const char *name){
+	struct hwtstamp_config hc;
+
+	memset(&hc,0,sizeof(hc));
+	if(sockios_docmd(name,SIOCGHWTSTAMP,&hc)){
+		hc.tx_type = HWTSTAMP_TX_OFF;
+	}
+	hc.flags = 0;
+	hc.rx_filter = HWTSTAMP_FILTER_NONE;
+	if(sockios_docmd(name,SIOCSHWTSTAMP,&hc)){
+		diagnostic("Couldn't disable RX timestamping on %s (%s?)",name,strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
 int iface_driver_info(const char *name,struct ethtool_drvinfo *drv){
 	drv->cmd = ETHTOOL_GDRVINFO;
 	if(ethtool_docmd(name,drv)){
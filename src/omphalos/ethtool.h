@@ -28,6 +28,11 @@ int iface_ethtool_info(const char *,struct ethtool_cmd *);
 int iface_offload_info(const char *,unsigned *,unsigned *);
 int iface_offloaded_p(const interface *,unsigned);
 
+// Enable (returning 1 if we changed anything) or disable NIC hardware
+// timestamping of all received frames (SIOCSHWTSTAMP).
+int iface_rx_hwtstamp(const char *);
+int iface_rx_hwtstamp_restore(const char *);
+
 // Check for LRO/GRO/GSO use on the interface -- if they're active, we want to
 // use RX frames larger than the MTU.
 static inline int
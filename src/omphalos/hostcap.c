@@ -0,0 +1,113 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omphalos/diag.h>
+#include <omphalos/hostcap.h>
+#include <omphalos/hwaddrs.h>
+#include <omphalos/netaddrs.h>
+#include <omphalos/interface.h>
+
+static hostcaps totalcaps;
+
+int lex_host_caps(const char *str,hostcaps *caps){
+	unsigned *fields[] = { &caps->nodes, &caps->hosts, &caps->services, };
+	unsigned long ul;
+	unsigned z;
+	char *e;
+
+	memset(caps,0,sizeof(*caps));
+	if(strcmp(str,"none") == 0){
+		return 0;
+	}
+	for(z = 0 ; z < sizeof(fields) / sizeof(*fields) ; ++z){
+		if(*str < '0' || *str > '9'){
+			return -1;
+		}
+		errno = 0;
+		ul = strtoul(str,&e,10);
+		if(errno || ul > UINT32_MAX){
+			return -1;
+		}
+		*fields[z] = ul;
+		if(*e == '\0'){
+			return 0;
+		}
+		if(*e != ':'){
+			return -1;
+		}
+		str = e + 1;
+	}
+	return -1;
+}
+
+static int
+caps_setup(const char *caps,const char *def,hostcaps *hc){
+	if(lex_host_caps(caps ? caps : def,hc)){
+		diagnostic("Invalid host caps: %s",caps ? caps : def);
+		return -1;
+	}
+	return 0;
+}
+
+int init_host_caps(const char *caps){
+	hostcaps hc;
+
+	if(caps_setup(caps,HOSTCAP_DEFAULT_TOTAL,&hc)){
+		return -1;
+	}
+	hc.services = 0;
+	totalcaps = hc;
+	return 0;
+}
+
+int prepare_host_caps(interface *i,const char *caps){
+	return caps_setup(caps,HOSTCAP_DEFAULT,&i->hostcap);
+}
+
+// How many objects must go, given our count and cap, and the process's.
+static inline unsigned
+excess(unsigned count,unsigned cap,unsigned total,unsigned totalcap){
+	unsigned e = 0;
+
+	if(cap && count > cap){
+		e = count - cap;
+	}
+	if(totalcap && total > totalcap && total - totalcap > e){
+		e = total - totalcap;
+	}
+	return e;
+}
+
+static inline unsigned
+l3excess(const interface *i){
+	return excess(i->ip4hosts.count + i->ip6hosts.count + i->cells.count,
+			i->hostcap.hosts,count_l3hosts(),totalcaps.hosts);
+}
+
+static inline unsigned
+l2excess(const interface *i){
+	return excess(i->l2hosts.count,i->hostcap.nodes,count_l2hosts(),
+					totalcaps.nodes);
+}
+
+int hosts_over_caps(interface *i){
+	int r;
+
+	lock_hosts(i);
+	r = l3excess(i) || l2excess(i);
+	unlock_hosts(i);
+	return r;
+}
+
+// Hosts go first, since they pin the nodes they refer to.
+void trim_hosts(interface *i){
+	unsigned e;
+
+	if( (e = l3excess(i)) ){
+		i->l3evicted += evict_l3hosts(i,e);
+	}
+	if( (e = l2excess(i)) ){
+		i->l2evicted += evict_l2hosts(i,e);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef OMPHALOS_HOSTCAP
+#define OMPHALOS_HOSTCAP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct interface;
+
+// Bounds on the state we keep for what we see on the wire, so that a flood
+// of randomized addresses can't starve us of memory. Each interface caps its
+// l2hosts (nodes), its l3hosts (hosts), and each host's l4srvs (services);
+// the process caps nodes and hosts across all interfaces. Past a cap, idle
+// objects are evicted (CLOCK: anything looked up since the hand last passed
+// gets a second chance), and the UI told via the omphalos_iface eviction
+// callbacks. Nodes and hosts are checked after each batch of frames has been
+// analyzed, and services as they're observed.
+//
+// Never evicted: our own and the broadcast hardware addresses, nodes to
+// which a host still refers, hosts learned from the kernel rather than the
+// wire (lookup_local_l3host()), and the current frame's nodes.
+
+typedef struct hostcaps {
+	unsigned nodes;		// l2hosts, 0 for unlimited
+	unsigned hosts;		// l3hosts (all families), 0 for unlimited
+	unsigned services;	// l4srvs per host, 0 for unlimited
+} hostcaps;
+
+#define HOSTCAP_DEFAULT "16384:65536:64"	// per interface
+#define HOSTCAP_DEFAULT_TOTAL "65536:262144"	// across all interfaces
+
+// Parse "nodes[:hosts[:services]]", or "none". Omitted and 0 caps are
+// unlimited.
+int lex_host_caps(const char *,hostcaps *);
+
+// Set the process-wide caps (NULL for the default). Services aren't capped
+// process-wide.
+int init_host_caps(const char *);
+
+// Set the interface's caps (NULL for the default).
+int prepare_host_caps(struct interface *,const char *);
+
+// Evict idle nodes and hosts until the interface, and the process, are within
+// their caps (or nothing more is idle). Requires the interface lock.
+void trim_hosts(struct interface *);
+
+// Has trim_hosts() any work to do? Takes the host lock, but other rings might
+// meanwhile add hosts, or trim them, so it's only a hint as to whether the
+// interface lock is worth taking.
+int hosts_over_caps(struct interface *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,41 +1,148 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <arpa/inet.h>
 #include <net/if_arp.h>
 #include <omphalos/iana.h>
+#include <omphalos/slab.h>
+#include <omphalos/epoch.h>
 #include <linux/rtnetlink.h>
 #include <omphalos/hwaddrs.h>
+#include <omphalos/ndsweep.h>
 #include <omphalos/ethernet.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/interface.h>
 
-// No need to store addrlen, since all objects in a given arena have the
-// same length of hardware address.
+// No need to store addrlen, since all objects in a given table have the
+// same length of hardware address. Fields touched per frame come first; at
+// 104 bytes, cache-line alignment would cost more than it'd save.
 typedef struct l2host {
-	hwaddrint hwaddr;		// hardware address
-	const wchar_t *devname;		// text description based off lladdress
-	struct l2host *next;
+	hwaddrint hwaddr;		// hardware address (first: the slab
+					//  overwrites it once we're freed)
 	uintmax_t srcpkts,dstpkts;	// stats
+	int recent;			// CLOCK reference bit
+	unsigned refs;			// l3hosts referring to us (atomic)
 	interface *i;
 	void *opaque;
+	struct l2host *next,*prev;	// l2table's list
+	const wchar_t *devname;		// text description based off lladdress
+	struct slab *slab;		// whence we came
+	epoch_entry retire;		// see evict_l2hosts()
 } l2host;
 
+// The key is kept alongside the host, so that probing needn't chase
+// pointers. Empty slots have a NULL l2.
+typedef struct l2slot {
+	hwaddrint hwaddr;
+	l2host *l2;
+} l2slot;
+
+#define L2TABLE_MIN_SLOTS 64
+
+static unsigned l2hosts_live;	// across all interfaces (atomic)
+
+// Fibonacci hashing: the multiply pushes every byte of the address into the
+// high bits, which index the table.
+static inline unsigned
+l2hash(hwaddrint hw,unsigned size){
+	return (hw * 0x9e3779b97f4a7c15ull) >> (64 - __builtin_ctz(size));
+}
+
+static l2slot *
+l2table_probe(const l2table *t,hwaddrint hw){
+	unsigned idx = l2hash(hw,t->size);
+	l2slot *s;
+
+	while((s = &t->slots[idx])->l2 && s->hwaddr != hw){
+		idx = (idx + 1) & (t->size - 1);
+	}
+	return s;
+}
+
+// Keep the load factor at or below one half, so probe sequences stay short.
+static int
+l2table_reserve(l2table *t){
+	l2slot *slots,*old;
+	unsigned size,z;
+
+	if((t->count + 1) * 2 <= t->size){
+		return 0;
+	}
+	size = t->size ? t->size * 2 : L2TABLE_MIN_SLOTS;
+	if((slots = calloc(size,sizeof(*slots))) == NULL){
+		return -1;
+	}
+	old = t->slots;
+	t->slots = slots;
+	z = t->size;
+	t->size = size;
+	while(z--){
+		if(old[z].l2){
+			*l2table_probe(t,old[z].hwaddr) = old[z];
+		}
+	}
+	free(old);
+	t->hand = 0;
+	return 0;
+}
+
+// Remove the host at this slot, shifting back any entries which probed past
+// it (Knuth's Algorithm R), so that no tombstones are needed.
+static void
+l2table_remove(l2table *t,unsigned idx){
+	const unsigned mask = t->size - 1;
+	unsigned z;
+
+	for(z = (idx + 1) & mask ; t->slots[z].l2 ; z = (z + 1) & mask){
+		const unsigned home = l2hash(t->slots[z].hwaddr,t->size);
+
+		// Can the entry at z move back to idx? Only if idx is no
+		// earlier in its probe sequence than its home slot.
+		if(((z - home) & mask) >= ((z - idx) & mask)){
+			t->slots[idx] = t->slots[z];
+			idx = z;
+		}
+	}
+	t->slots[idx].l2 = NULL;
+	--t->count;
+}
+
+static l2host *
+l2table_alloc(l2table *t){
+	if(t->slab == NULL){
+		if((t->slab = create_slab(sizeof(l2host),sizeof(void *))) == NULL){
+			return NULL;
+		}
+	}
+	return slab_alloc(t->slab);
+}
+
+static inline void
+l2table_hit(l2table *t,l2host *l2){
+	l2->recent = 1;
+	if(t->last[0] != l2){
+		t->last[1] = t->last[0];
+		t->last[0] = l2;
+	}
+}
+
 static inline l2host *
 create_l2host(interface *,const void *) __attribute__ ((malloc));
 
-// FIXME replace internals with LRU acquisition...
 // FIXME caller must set ->next
 static inline l2host *
 create_l2host(interface *i,const void *hwaddr){
 	l2host *l2;
 
-	if( (l2 = malloc(sizeof(*l2))) ){
+	if( (l2 = l2table_alloc(&i->l2hosts)) ){
+		l2->slab = i->l2hosts.slab;
 		l2->dstpkts = l2->srcpkts = 0;
 		l2->hwaddr = 0;
 		memcpy(&l2->hwaddr,hwaddr,i->addrlen);
 		l2->opaque = NULL;
+		l2->refs = 0;
 		l2->i = i;
 		if((i->flags & IFF_BROADCAST) && i->bcast &&
 				memcmp(hwaddr,i->bcast,i->addrlen) == 0){
@@ -50,44 +157,154 @@ create_l2host(interface *i,const void *hwaddr){
 	return l2;
 }
 
-// FIXME strictly proof-of-concept. we'll want a trie- or hash-based
-// lookup, backed by an arena-allocated LRU, etc...
-l2host *lookup_l2host(interface *i,const void *hwaddr){
+// Called twice per frame, so the last-hit cache is checked before hashing.
+static l2host *
+lookup_l2host_locked(interface *i,const void *hwaddr){
 	const omphalos_ctx *octx = get_octx();
-	l2host *l2,**prev;
+	l2table *t = &i->l2hosts;
 	hwaddrint hwcmp;
+	l2slot *slot;
+	l2host *l2;
 
 	hwcmp = 0;
 	memcpy(&hwcmp,hwaddr,i->addrlen);
-	for(prev = &i->l2hosts ; (l2 = *prev) ; prev = &l2->next){
-		if(l2->hwaddr == hwcmp){
-			// Move it to the front of the list, splicing it out
-			*prev = l2->next;
-			l2->next = i->l2hosts;
-			i->l2hosts = l2;
+	if( (l2 = t->last[0]) && l2->hwaddr == hwcmp){
+		return l2;
+	}
+	if( (l2 = t->last[1]) && l2->hwaddr == hwcmp){
+		l2table_hit(t,l2);
+		return l2;
+	}
+	if(t->size){
+		if( (l2 = l2table_probe(t,hwcmp)->l2) ){
+			l2table_hit(t,l2);
 			return l2;
 		}
 	}
-	l2 = create_l2host(i,hwaddr);
+	l2 = l2table_reserve(t) ? NULL : create_l2host(i,hwaddr);
 	assert(l2);
 	if(l2){
-		l2->next = i->l2hosts;
-		i->l2hosts = l2;
+		slot = l2table_probe(t,hwcmp);
+		slot->hwaddr = hwcmp;
+		slot->l2 = l2;
+		++t->count;
+		__atomic_add_fetch(&l2hosts_live,1,__ATOMIC_RELAXED);
+		l2->prev = NULL;
+		if( (l2->next = t->list) ){
+			l2->next->prev = l2;
+		}
+		t->list = l2;
+		l2table_hit(t,l2);
 		if(octx->iface.neigh_event){
 			l2->opaque = octx->iface.neigh_event(i,l2);
 		}
+		nd_sweep_l2host(i,hwaddr);
 	}
 	return l2;
 }
 
-void cleanup_l2hosts(l2host **list){
-	l2host *l2,*tmp;
+l2host *lookup_l2host(interface *i,const void *hwaddr){
+	l2host *l2;
+
+	lock_hosts(i);
+	l2 = lookup_l2host_locked(i,hwaddr);
+	unlock_hosts(i);
+	return l2;
+}
+
+// Our own and the broadcast addresses, anything an l3host refers to, and the
+// last-hit cache (the frame being analyzed) are never idle.
+static inline int
+l2host_pinned(const interface *i,const l2table *t,const l2host *l2){
+	if(l2 == t->last[0] || l2 == t->last[1]){
+		return 1;
+	}
+	if(__atomic_load_n(&l2->refs,__ATOMIC_RELAXED)){
+		return 1;
+	}
+	if(i->addr && memcmp(&l2->hwaddr,i->addr,i->addrlen) == 0){
+		return 1;
+	}
+	if(i->bcast && memcmp(&l2->hwaddr,i->bcast,i->addrlen) == 0){
+		return 1;
+	}
+	return 0;
+}
+
+// Invoked once no reader can hold the node (see epoch.h).
+static void
+free_l2host(epoch_entry *e){
+	l2host *l2 = (l2host *)((char *)e - offsetof(l2host,retire));
+
+	slab_free(l2->slab,l2);
+}
+
+// CLOCK over the slots: a host seen since the hand last passed is spared,
+// and loses its reference bit. Two passes clear every bit, so past them
+// everything left is pinned. Removal shifts a later entry into the hand's
+// slot, so the hand only advances past survivors. An evicted node might
+// still be held by a reader which reached it through a host of the global
+// l3host table, so it's retired rather than immediately freed back to the
+// slab (whence it could be reissued as another node).
+unsigned evict_l2hosts(interface *i,unsigned n){
+	const omphalos_ctx *octx = get_octx();
+	l2table *t = &i->l2hosts;
+	unsigned evicted,steps;
+
+	evicted = 0;
+	for(steps = 0 ; evicted < n && t->count && steps < t->size * 2 ; ){
+		l2host *l2 = t->slots[t->hand].l2;
 
-	for(l2 = *list ; l2 ; l2 = tmp){
-		tmp = l2->next;
-		free(l2);
+		if(l2 == NULL || l2host_pinned(i,t,l2)){
+			t->hand = (t->hand + 1) & (t->size - 1);
+			++steps;
+			continue;
+		}
+		if(l2->recent){
+			l2->recent = 0;
+			t->hand = (t->hand + 1) & (t->size - 1);
+			++steps;
+			continue;
+		}
+		l2table_remove(t,t->hand);
+		__atomic_sub_fetch(&l2hosts_live,1,__ATOMIC_RELAXED);
+		if(octx->iface.neigh_evicted){
+			octx->iface.neigh_evicted(i,l2,l2->opaque);
+		}
+		if(l2->prev){
+			l2->prev->next = l2->next;
+		}else{
+			t->list = l2->next;
+		}
+		if(l2->next){
+			l2->next->prev = l2->prev;
+		}
+		epoch_retire(&l2->retire,free_l2host);
+		++evicted;
 	}
-	*list = NULL;
+	return evicted;
+}
+
+unsigned count_l2hosts(void){
+	return __atomic_load_n(&l2hosts_live,__ATOMIC_RELAXED);
+}
+
+void l2_retain(l2host *l2){
+	__atomic_add_fetch(&l2->refs,1,__ATOMIC_RELAXED);
+}
+
+void l2_release(l2host *l2){
+	__atomic_sub_fetch(&l2->refs,1,__ATOMIC_RELAXED);
+}
+
+// Retired hosts might still refer to our hosts, and be held by readers of the
+// global l3host table, so the slab is retired along with them (after any
+// nodes we've retired, which are thus freed to it first).
+void cleanup_l2hosts(l2table *t){
+	__atomic_sub_fetch(&l2hosts_live,t->count,__ATOMIC_RELAXED);
+	retire_slab(t->slab);
+	free(t->slots);
+	memset(t,0,sizeof(*t));
 }
 
 void hwntop(const void *hwaddr,size_t len,char *buf){
@@ -162,12 +379,13 @@ const wchar_t *get_devname(const l2host *l2){
 	return l2->devname;
 }
 
+// Several rings' workers might see the same node at once.
 void l2srcpkt(l2host *l2){
-	++l2->srcpkts;
+	__atomic_add_fetch(&l2->srcpkts,1,__ATOMIC_RELAXED);
 }
 
 void l2dstpkt(l2host *l2){
-	++l2->dstpkts;
+	__atomic_add_fetch(&l2->dstpkts,1,__ATOMIC_RELAXED);
 }
 
 uintmax_t get_srcpkts(const l2host *l2){
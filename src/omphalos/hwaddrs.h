@@ -9,15 +9,45 @@ extern "C" {
 #include <stdint.h>
 
 struct l2host;
+struct l2slot;
+struct slab;
 struct interface;
 
 // We don't handle any hardware addresses longer than 64 bits...yet...
 typedef uint64_t hwaddrint;
 
+// An interface's l2hosts, indexed by an open-addressed hash on the hwaddrint
+// and fronted by the last two hosts found (most frames are a burst between
+// the same pair). Hosts are carved from the table's slab. Evicted hosts are
+// retired (see epoch.h) before being freed back to it, and its chunks are
+// retired only when the table is cleaned up, so a reader never sees a host's
+// memory reused until it has quiesced. Lookups take the interface's host
+// lock (see lock_hosts()). A zeroed l2table is a valid, empty table.
+typedef struct l2table {
+	struct l2slot *slots;	// linear probing, power-of-2 entries
+	unsigned size;		// entries in slots
+	unsigned count;		// hosts in the table
+	unsigned hand;		// CLOCK hand, a slot index (see hostcap.h)
+	struct l2host *last[2];	// most recent hits, most recent first
+	struct l2host *list;	// all hosts, newest first, for iteration
+	struct slab *slab;	// created with the first host
+} l2table;
+
 struct l2host *lookup_l2host(struct interface *,const void *)
 		__attribute__ ((nonnull (1,2)));
 
-void cleanup_l2hosts(struct l2host **) __attribute__ ((nonnull (1)));
+void cleanup_l2hosts(l2table *) __attribute__ ((nonnull (1)));
+
+// Evict up to this many idle l2hosts from the interface. Returns the number
+// evicted. Requires the interface lock.
+unsigned evict_l2hosts(struct interface *,unsigned) __attribute__ ((nonnull (1)));
+
+// l2hosts across all interfaces
+unsigned count_l2hosts(void);
+
+// An l3host referring to an l2host pins it against eviction.
+void l2_retain(struct l2host *) __attribute__ ((nonnull (1)));
+void l2_release(struct l2host *) __attribute__ ((nonnull (1)));
 
 // Each byte becomes two ASCII characters + separator or nul
 #define HWADDRSTRLEN(len) ((len) == 0 ? 1 : (len == 1) ? 2 : (len) * 3)
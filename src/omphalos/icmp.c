@@ -1,3 +1,5 @@
+#include <assert.h>
+#include <stdlib.h>
 #include <linux/ip.h>
 #include <linux/icmp.h>
 #include <netinet/ip6.h>
@@ -9,7 +11,9 @@
 #include <omphalos/csum.h>
 #include <omphalos/icmp.h>
 #include <omphalos/diag.h>
+#include <omphalos/probe.h>
 #include <linux/if_packet.h>
+#include <omphalos/txsched.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/ethernet.h>
 #include <omphalos/interface.h>
@@ -133,87 +137,100 @@ void handle_icmp6_packet(omphalos_packet *op,const void *frame,size_t len){
 #define PING4_PAYLOAD_LEN 20
 
 // Always goes to ff02::2 (ALL-HOSTS), from each source address.
-int tx_ipv4_bcast_pings(interface *i,const uint32_t *saddr){
-	struct tpacket_hdr *thdr;
+static int
+build_ipv4_bcast_ping(const interface *i,void *frame,size_t flen,int fam,const void *saddr){
 	struct icmphdr *icmp;
 	struct iphdr *ip;
-	size_t flen,tlen;
-	void *frame;
+	size_t tlen;
 	int r;
 
-	if((frame = get_tx_frame(i,&flen)) == NULL){
-		return -1;
-	}
-	thdr = frame;
-	tlen = thdr->tp_mac;
-	if((r = prep_eth_bcast((char *)frame + tlen,flen - tlen,i,ETH_P_IP)) < 0){
-		abort_tx_frame(i,frame);
+	assert(fam == AF_INET);
+	if((r = prep_eth_bcast(frame,flen,i,ETH_P_IP)) < 0){
 		return -1;
 	}
-	tlen += r;
+	tlen = r;
 	ip = (struct iphdr *)((char *)frame + tlen);
 	// FIXME get bcast address appropriate for route
-	if((r = prep_ipv4_bcast(ip,flen - tlen,*saddr,IPPROTO_ICMP)) < 0){
-		abort_tx_frame(i,frame);
+	if((r = prep_ipv4_bcast(ip,flen - tlen,*(const uint32_t *)saddr,IPPROTO_ICMP)) < 0){
 		return -1;
 	}
 	tlen += r;
 	if(flen - tlen < sizeof(*icmp) + PING4_PAYLOAD_LEN){
-		abort_tx_frame(i,frame);
 		return -1;
 	}
 	icmp = (struct icmphdr *)((char *)frame + tlen);
 	icmp->type = ICMP_ECHO;
 	icmp->code = 0;
 	tlen += sizeof(*icmp) + PING4_PAYLOAD_LEN;
-	thdr->tp_len = tlen;
 	ip->tot_len = htons((const char *)icmp - (const char *)ip + sizeof(*icmp) + PING4_PAYLOAD_LEN);
 	icmp->checksum = 0;
 	icmp->checksum = icmp4_csum(icmp,sizeof(*icmp));
 	ip->check = ipv4_csum(ip);
-	return send_tx_frame(i,frame);
+	return tlen;
 }
 
-// Always goes to ff02::2 (ALL-HOSTS), from each source address.
-int tx_ipv6_bcast_pings(interface *i,const uint128_t saddr){
+int tx_ipv4_bcast_pings(interface *i,const uint32_t *saddr){
+	size_t flen;
+	void *frame;
+	probe p;
+
+	if((frame = get_tx_frame(i,&flen)) == NULL){
+		return -1;
+	}
+	if(probe_start(&p,i,frame,flen,PROBE_PING,build_ipv4_bcast_ping,AF_INET,saddr)){
+		abort_tx_frame(i,frame);
+		return -1;
+	}
+	probe_ip4id(&p,random());
+	return pace_tx_frame(i,frame,TXCLASS_SWEEP);
+}
+
+static int
+build_ipv6_bcast_ping(const interface *i,void *frame,size_t flen,int fam,const void *saddr){
 	const unsigned char hw[ETH_ALEN] = { 0x33, 0x33, 0x00, 0x00, 0x00, 0x01 };
 	uint128_t net = { htonl(0xff020000ul), htonl(0x0ul),
 				htonl(0x0ul), htonl(0x1ul) };
-	struct tpacket_hdr *thdr;
 	struct icmp6_hdr *icmp;
 	struct ip6_hdr *ip;
-	size_t flen,tlen;
-	void *frame;
+	uint128_t src;
+	size_t tlen;
 	int r;
 
-	if((frame = get_tx_frame(i,&flen)) == NULL){
-		return -1;
-	}
-	thdr = frame;
-	tlen = thdr->tp_mac;
-	if((r = prep_eth_header((char *)frame + tlen,flen - tlen,i,
-					hw,ETH_P_IPV6)) < 0){
-		abort_tx_frame(i,frame);
+	assert(fam == AF_INET6);
+	assign128(src,saddr);
+	if((r = prep_eth_header(frame,flen,i,hw,ETH_P_IPV6)) < 0){
 		return -1;
 	}
-	tlen += r;
+	tlen = r;
 	ip = (struct ip6_hdr *)((char *)frame + tlen);
-	if((r = prep_ipv6_header(ip,flen - tlen,saddr,net,IPPROTO_ICMP6)) < 0){
-		abort_tx_frame(i,frame);
+	if((r = prep_ipv6_header(ip,flen - tlen,src,net,IPPROTO_ICMP6)) < 0){
 		return -1;
 	}
 	tlen += r;
 	if(flen - tlen < sizeof(*icmp)){
-		abort_tx_frame(i,frame);
 		return -1;
 	}
 	icmp = (struct icmp6_hdr *)((char *)frame + tlen);
 	icmp->icmp6_type = ICMP6_ECHO_REQUEST;
 	icmp->icmp6_code = 0;
-	tlen += sizeof(*icmp);
-	thdr->tp_len = tlen;
-	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(thdr->tp_len -
-		((const char *)icmp - (const char *)frame));
+	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(sizeof(*icmp));
 	icmp->icmp6_cksum = icmp6_csum(ip);
-	return send_tx_frame(i,frame);
+	return tlen + sizeof(*icmp);
+}
+
+// Always goes to ff02::1 (ALL-HOSTS), from each source address. Nothing
+// varies between probes from a given source, so the template goes out as is.
+int tx_ipv6_bcast_pings(interface *i,const uint128_t saddr){
+	size_t flen;
+	void *frame;
+	probe p;
+
+	if((frame = get_tx_frame(i,&flen)) == NULL){
+		return -1;
+	}
+	if(probe_start(&p,i,frame,flen,PROBE_PING,build_ipv6_bcast_ping,AF_INET6,saddr)){
+		abort_tx_frame(i,frame);
+		return -1;
+	}
+	return pace_tx_frame(i,frame,TXCLASS_SWEEP);
 }
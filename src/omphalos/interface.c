@@ -10,11 +10,21 @@
 #include <omphalos/128.h>
 #include <omphalos/util.h>
 #include <omphalos/irda.h>
+#include <omphalos/slab.h>
+#include <omphalos/tx.h>
+#include <omphalos/xdp.h>
 #include <omphalos/hdlc.h>
 #include <omphalos/ietf.h>
+#include <omphalos/probe.h>
+#include <omphalos/sweep.h>
+#include <omphalos/synscan.h>
+#include <omphalos/ndsweep.h>
+#include <omphalos/arpsweep.h>
 #include <omphalos/service.h>
+#include <omphalos/ethtool.h>
 #include <omphalos/hwaddrs.h>
 #include <omphalos/netlink.h>
+#include <omphalos/txsched.h>
 #include <omphalos/psocket.h>
 #include <omphalos/firewire.h>
 #include <omphalos/omphalos.h>
@@ -59,18 +69,54 @@ init_iface(interface *iface){
 		pthread_mutexattr_destroy(&attr);
 		return -1;
 	}
+	// Services are observed both within and beneath host lookups
+	if(pthread_mutex_init(&iface->hostlock,&attr)){
+		pthread_mutex_destroy(&iface->lock);
+		pthread_mutexattr_destroy(&attr);
+		return -1;
+	}
+	if(pthread_mutex_init(&iface->statlock,NULL)){
+		pthread_mutex_destroy(&iface->hostlock);
+		pthread_mutex_destroy(&iface->lock);
+		pthread_mutexattr_destroy(&attr);
+		return -1;
+	}
+	if(pthread_mutex_init(&iface->waitlock,NULL)){
+		pthread_mutex_destroy(&iface->statlock);
+		pthread_mutex_destroy(&iface->hostlock);
+		pthread_mutex_destroy(&iface->lock);
+		pthread_mutexattr_destroy(&attr);
+		return -1;
+	}
+	if(pthread_cond_init(&iface->waitcond,NULL)){
+		pthread_mutex_destroy(&iface->waitlock);
+		pthread_mutex_destroy(&iface->statlock);
+		pthread_mutex_destroy(&iface->hostlock);
+		pthread_mutex_destroy(&iface->lock);
+		pthread_mutexattr_destroy(&attr);
+		return -1;
+	}
 	if(timestat_prep(&iface->fps,IFACE_TIMESTAT_USECS,IFACE_TIMESTAT_SLOTS)){
+		pthread_cond_destroy(&iface->waitcond);
+		pthread_mutex_destroy(&iface->waitlock);
+		pthread_mutex_destroy(&iface->statlock);
+		pthread_mutex_destroy(&iface->hostlock);
 		pthread_mutex_destroy(&iface->lock);
 		pthread_mutexattr_destroy(&attr);
 		return -1;
 	}
 	if(timestat_prep(&iface->bps,IFACE_TIMESTAT_USECS,IFACE_TIMESTAT_SLOTS)){
 		timestat_destroy(&iface->fps);
+		pthread_cond_destroy(&iface->waitcond);
+		pthread_mutex_destroy(&iface->waitlock);
+		pthread_mutex_destroy(&iface->statlock);
+		pthread_mutex_destroy(&iface->hostlock);
 		pthread_mutex_destroy(&iface->lock);
 		pthread_mutexattr_destroy(&attr);
 		return -1;
 	}
-	iface->fd4 = iface->fd6udp = iface->fd6icmp = iface->rfd =iface->fd = -1;
+	iface->fd4 = iface->fd6 = iface->rfd =iface->fd = -1;
+	iface->numanode = -1;
 	assert(pthread_mutexattr_destroy(&attr) == 0);
 	return 0;
 }
@@ -79,8 +125,54 @@ int init_interfaces(void){
 	return 0;
 }
 
+int list_rxworker(interface *i,rxworker *w){
+	pthread_mutexattr_t attr;
+	int r = -1;
+
+	if(pthread_mutexattr_init(&attr)){
+		return -1;
+	}
+	// As the interface lock, so that lock_interface() might nest
+	if(pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE_NP) == 0){
+		if(pthread_mutex_init(&w->own,&attr) == 0){
+			rxworker **prev;
+
+			pthread_mutex_lock(&w->own);
+			w->lock = &w->own;
+			// Appended, so that workers' locks are always taken in
+			// the order in which they were listed
+			for(prev = &i->rxworkers ; *prev ; prev = &(*prev)->next){
+				;
+			}
+			w->next = NULL;
+			*prev = w;
+			r = 0;
+		}
+	}
+	pthread_mutexattr_destroy(&attr);
+	return r;
+}
+
+void unlist_rxworker(interface *i,rxworker *w){
+	rxworker **prev;
+
+	for(prev = &i->rxworkers ; *prev != w ; prev = &(*prev)->next){
+		assert(*prev);
+	}
+	*prev = w->next;
+	w->lock = &i->lock;
+	pthread_mutex_unlock(&w->own);
+	if( (errno = pthread_mutex_destroy(&w->own)) ){
+		diagnostic("Error cleaning mutex: %s",strerror(errno));
+	}
+}
+
 #define STAT(fp,i,x) if((i)->x) { if(fprintf((fp),"<"#x">%ju</"#x">",(i)->x) < 0){ return -1; } }
 int print_iface_stats(FILE *fp,const interface *i,interface *agg,const char *decorator){
+	arpsweep_stats as;
+	synscan_stats ss;
+	ndsweep_stats ns;
+
 	if(i->name == NULL){
 		if(fprintf(fp,"<%s>",decorator) < 0){
 			return -1;
@@ -94,6 +186,38 @@ int print_iface_stats(FILE *fp,const interface *i,interface *agg,const char *dec
 	STAT(fp,i,truncated);
 	STAT(fp,i,noprotocol);
 	STAT(fp,i,malformed);
+	STAT(fp,i,csumtrusted);
+	STAT(fp,i,ip4csumerrs);
+	STAT(fp,i,tcpcsumerrs);
+	STAT(fp,i,udpcsumerrs);
+	STAT(fp,i,icmpcsumerrs);
+	STAT(fp,i,l2evicted);
+	STAT(fp,i,l3evicted);
+	STAT(fp,i,l4evicted);
+	STAT(fp,i,rxbatches);
+	STAT(fp,i,rxbatchmax);
+	if(arp_sweep_stats(i,&as) == 0){
+		if(fprintf(fp,"<arpsweep><targets>%u</targets><probed>%u</probed>"
+				"<found>%u</found><pps>%u</pps></arpsweep>",
+				as.targets,as.probed,as.found,as.pps) < 0){
+			return -1;
+		}
+	}
+	if(nd_sweep_stats(i,&ns) == 0){
+		if(fprintf(fp,"<ndsweep><prefixes>%u</prefixes><neighbours>%u</neighbours>"
+				"<probed>%u</probed><found>%u</found></ndsweep>",
+				ns.prefixes,ns.neighbours,ns.probed,ns.found) < 0){
+			return -1;
+		}
+	}
+	if(syn_scan_stats(i,&ss) == 0){
+		if(fprintf(fp,"<synscan><hosts>%u</hosts><ports>%u</ports>"
+				"<probed>%u</probed><open>%u</open><closed>%u</closed>"
+				"</synscan>",ss.hosts + ss.pending,ss.ports,ss.probed,
+				ss.open,ss.closed) < 0){
+			return -1;
+		}
+	}
 	if(fprintf(fp,"</%s>",decorator) < 0){
 		return -1;
 	}
@@ -102,6 +226,18 @@ int print_iface_stats(FILE *fp,const interface *i,interface *agg,const char *dec
 		agg->truncated += i->truncated;
 		agg->noprotocol += i->noprotocol;
 		agg->malformed += i->malformed;
+		agg->csumtrusted += i->csumtrusted;
+		agg->ip4csumerrs += i->ip4csumerrs;
+		agg->tcpcsumerrs += i->tcpcsumerrs;
+		agg->udpcsumerrs += i->udpcsumerrs;
+		agg->icmpcsumerrs += i->icmpcsumerrs;
+		agg->l2evicted += i->l2evicted;
+		agg->l3evicted += i->l3evicted;
+		agg->l4evicted += i->l4evicted;
+		agg->rxbatches += i->rxbatches;
+		if(i->rxbatchmax > agg->rxbatchmax){
+			agg->rxbatchmax = i->rxbatchmax;
+		}
 	}
 	return 0;
 }
@@ -137,6 +273,40 @@ int idx_of_iface(const interface *i){
 	return i - interfaces;
 }
 
+// Closing the sockets doesn't release our mappings of their rings. Fanout
+// rings beyond the first are unmapped by reap_thread().
+void unmap_iface_rings(interface *i){
+	void *txm = i->txm;
+
+	// Senders don't take the lock. Shut them out, and wait on any holding
+	// a frame, before tearing down what they might be using.
+	if(i->ts){
+		__atomic_store_n(&i->txm,NULL,__ATOMIC_SEQ_CST);
+		purge_tx_sched(i);
+		release_self_tx(i);
+		release_tx_sched(i);
+	}
+	if(i->xdp){
+		close_xdp(i,i->xdp);
+		i->xdp = NULL;
+	}
+	if(i->rs){
+		unmap_psocket(i->rxm,i->rs);
+		i->rxm = NULL;
+		i->rs = 0;
+	}
+	if(i->ts){
+		unmap_psocket(txm,i->ts);
+		i->ts = 0;
+	}
+	if(i->txrs){
+		unmap_psocket(i->txr,i->txrs);
+		i->txr = NULL;
+		i->txrs = 0;
+		i->txqueued = 0;
+	}
+}
+
 // We don't destroy the mutex lock here; it exists for the life of the program.
 // We mustn't memset() the iface blindly, or else the lock will be destroyed!
 void free_iface(interface *i){
@@ -155,17 +325,26 @@ void free_iface(interface *i){
 	}
 	// Must reap thread prior to closing the fd's, lest some other thread
 	// be allocated that fd, and have the packet socket thread use it.
-	Pthread_mutex_lock(&i->lock);
+	lock_interface(i);
 	diagnostic("Shutting down %s",i->name);
+	// reap_thread() drops and retakes the lock, which we hold
 	if(i->pmarsh){
-		Pthread_mutex_unlock(&i->lock);
 		reap_thread(i);
-		Pthread_mutex_lock(&i->lock);
 	}
 	if(i->opaque && octx->iface_removed){
 		octx->iface_removed(i,i->opaque);
 		i->opaque = NULL;
 	}
+	unmap_iface_rings(i);
+	free_probe_templates(i);
+	unlist_sweeping(i);
+	free_arp_sweep(i);
+	free_nd_sweep(i);
+	free_syn_scan(i);
+	if(i->hwtstamp){
+		iface_rx_hwtstamp_restore(i->name);
+		i->hwtstamp = 0;
+	}
 	if(i->rfd >= 0){
 		if(close(i->rfd)){
 			diagnostic("[%s] Error closing %d: %s",i->name,i->rfd,strerror(errno));
@@ -184,17 +363,11 @@ void free_iface(interface *i){
 		}
 		i->fd4 = -1;
 	}
-	if(i->fd6udp >= 0){
-		if(close(i->fd6udp)){
-			diagnostic("[%s] Error closing %d: %s",i->name,i->fd6udp,strerror(errno));
-		}
-		i->fd6udp = -1;
-	}
-	if(i->fd6icmp >= 0){
-		if(close(i->fd6icmp)){
-			diagnostic("[%s] Error closing %d: %s",i->name,i->fd6icmp,strerror(errno));
+	if(i->fd6 >= 0){
+		if(close(i->fd6)){
+			diagnostic("[%s] Error closing %d: %s",i->name,i->fd6,strerror(errno));
 		}
-		i->fd6icmp = -1;
+		i->fd6 = -1;
 	}
 	while(i->ip6r){
 		struct ip6route *r6 = i->ip6r->next;
@@ -212,8 +385,6 @@ void free_iface(interface *i){
 	timestat_destroy(&i->bps);
 	free(i->topinfo.devname);
 	i->topinfo.devname = NULL;
-	free(i->truncbuf);
-	i->truncbuf = NULL;
 	free(i->name);
 	i->name = NULL;
 	free(i->addr);
@@ -224,7 +395,12 @@ void free_iface(interface *i){
 	cleanup_l3hosts(&i->ip6hosts);
 	cleanup_l3hosts(&i->ip4hosts);
 	cleanup_l2hosts(&i->l2hosts);
-	Pthread_mutex_unlock(&i->lock);
+	// After the hosts, so that they're destroyed first (see epoch.h)
+	retire_slab(i->l4slab);
+	i->l4slab = NULL;
+	retire_slab(i->l3slab);
+	i->l3slab = NULL;
+	unlock_interface(i);
 
 	// Mark it unused
 	ifaces[idx] = 0;
@@ -241,6 +417,12 @@ void cleanup_interfaces(void){
 		if( (r = pthread_mutex_destroy(&interfaces[i].lock)) ){
 			diagnostic("Couldn't destroy lock on %d (%s?)",i,strerror(r));
 		}
+		if( (r = pthread_cond_destroy(&interfaces[i].waitcond)) ){
+			diagnostic("Couldn't destroy condvar on %d (%s?)",i,strerror(r));
+		}
+		if( (r = pthread_mutex_destroy(&interfaces[i].waitlock)) ){
+			diagnostic("Couldn't destroy lock on %d (%s?)",i,strerror(r));
+		}
 	}
 }
 
@@ -305,7 +487,7 @@ int add_route4(interface *i,const uint32_t *dst,const uint32_t *via,
 				memcpy(&(*prev)->src,src,sizeof(*src));
 			}
 		}
-		assert(lookup_local_l3host(NULL,i,l2,AF_INET,src));
+		assert(lookup_local_l3host(0,i,l2,AF_INET,src));
 	}
 	if(r->addrs & ROUTE_HAS_VIA && r->maskbits < 32){
 		if( (l3 = lookup_global_l3host(AF_INET,via)) ){
@@ -361,7 +543,7 @@ int add_route6(interface *i,const uint128_t dst,const uint128_t via,
 				assign128((*prev)->src,src);
 			}
 		}
-		assert(lookup_local_l3host(NULL,i,l2,AF_INET6,src));
+		assert(lookup_local_l3host(0,i,l2,AF_INET6,src));
 	}
 	if(r->addrs & ROUTE_HAS_VIA && r->maskbits < 128){
 		if( (l3 = lookup_global_l3host(AF_INET6,via)) ){
@@ -10,6 +10,7 @@ extern "C" {
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <sched.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <linux/if.h>
@@ -20,12 +21,23 @@ extern "C" {
 #include <omphalos/timing.h>
 #include <omphalos/nl80211.h>
 #include <omphalos/hwaddrs.h>
+#include <omphalos/netaddrs.h>
+#include <omphalos/hostcap.h>
 
 struct l2host;
 struct l3host;
+struct slab;
 struct in_addr;
 struct in6_addr;
 struct psocket_marsh;
+struct rxworker;
+struct xdp_iface;
+struct selftx;
+struct txsched;
+struct probe_template;
+struct arpsweep;
+struct synscan;
+struct ndsweep;
 struct omphalos_packet;
 
 // bitmasks for the routes' 'addrs' field
@@ -62,12 +74,41 @@ typedef void (*analyzefxn)(struct omphalos_packet *,const void *,size_t);
 #define IFACE_TIMESTAT_USECS 250000	// 10Hz sampling
 #define IFACE_TIMESTAT_SLOTS 12		// x12 samples == 3s history
 
+// The analysis state of one RX ring (or XSK). With a single ring, its lock is
+// the interface lock, and analysis has the interface to itself. With several
+// (fanout, or one XSK per RX queue), each is analyzed under a lock of its
+// own, and listed on the interface: lock_interface() then takes every listed
+// worker's lock after the interface's. Workers share the host tables under
+// the interface's host lock (see lock_hosts()), and count into their own
+// stats, folded into the interface's after each batch (see fold_rx_stats()).
+typedef struct rxworker {
+	struct interface *i;
+	pthread_mutex_t *lock;		// &i->lock, or &own if listed
+	pthread_mutex_t own;
+	uintmax_t frames,bytes;		// since the last fold
+	uintmax_t truncated,truncated_recovered;
+	uintmax_t malformed,noprotocol,csumtrusted,drops;
+	uint64_t lastts;		// of the last frame counted
+	unsigned spinusecs;		// adaptive spin budget (see ring_spin())
+	// For recvfrom()ing truncated packets (see PACKET_COPY_THRESH sockopt)
+	void *truncbuf;
+	size_t truncbuflen;
+	struct rxworker *next;		// listed on the interface
+} rxworker;
+
 typedef struct interface {
 	// Packet analysis entry point
 	analyzefxn analyzer;
 
 	// Lock (packet thread vs netlink layer vs UI)
 	pthread_mutex_t lock;
+	unsigned lockwaiters;		// Threads blocked in lock_interface()
+	unsigned lockgen;		// lock_interface() acquisitions
+	pthread_mutex_t waitlock;	// Guards lockgen, for waitcond
+	pthread_cond_t waitcond;	// Broadcast upon each acquisition
+	struct rxworker *rxworkers;	// Rings analyzed under their own locks
+	pthread_mutex_t hostlock;	// Host tables, given several rxworkers
+	pthread_mutex_t statlock;	// Folding rxworkers' stats into ours
 
 	// Lifetime stats
 	uintmax_t frames;		// Frames received on the interface
@@ -75,22 +116,31 @@ typedef struct interface {
 	uintmax_t truncated;		// Packet didn't fit in ringbuffer frame
 	uintmax_t truncated_recovered;	// We were able to recvfrom() the packet
 	uintmax_t noprotocol;		// Packets without protocol handler
+	uintmax_t csumtrusted;		// L4 checksums vouched for by the kernel
+	uintmax_t ip4csumerrs;		// Bad IPv4 header checksums (atomic)
+	uintmax_t tcpcsumerrs;		// Bad TCP checksums (--csum-verify, atomic)
+	uintmax_t udpcsumerrs;		// Bad UDP checksums (--csum-verify, atomic)
+	uintmax_t icmpcsumerrs;		// Bad ICMP(v6) checksums (--csum-verify, atomic)
+	uintmax_t l2evicted;		// Nodes evicted past their cap
+	uintmax_t l3evicted;		// Hosts evicted past their cap
+	uintmax_t l4evicted;		// Services evicted past their cap
 	uintmax_t bytes;		// Total bytes sniffed
 	uintmax_t drops;		// PACKET_STATISTICS @ TP_STATUS_LOSING
+	uintmax_t rxbatches;		// RX lock holds which analyzed frames
+	uintmax_t rxbatchmax;		// Most frames analyzed in one lock hold
+	// TX stats are updated atomically, without the lock (see tx.c).
 	uintmax_t txframes;		// Frames generated by omphalos
 	uintmax_t txbytes;		// Total bytes generated by omphalos
 	uintmax_t txaborts;		// TX frames handed out but aborted
 	uintmax_t txerrors;		// TX frames we failed to send
+	uintmax_t txdeferred;		// TX frames held back by the scheduler
+	uintmax_t txshed;		// TX frames the scheduler dropped
 
 	// Finite time domain stats
 	timestat fps,bps;		// frames and bits per second
 
 	struct psocket_marsh *pmarsh;	// State for packet socket thread
 
-	// For recvfrom()ing truncated packets (see PACKET_COPY_THRESH sockopt)
-	void *truncbuf;
-	size_t truncbuflen;
-
 	unsigned arptype;	// from rtnetlink(7) ifi_type
 	unsigned flags;		// from rtnetlink(7) ifi_flags
 	size_t l2hlen;		// static l2 header length
@@ -104,13 +154,35 @@ typedef struct interface {
 	void *rxm;		// RX packet ring buffer
 	size_t rs;		// RX packet ring size in bytes
 	struct tpacket_req rtpr;// RX packet ring descriptor
+	int rtpver;		// RX packet ring version (TPACKET_V[13])
+	struct xdp_iface *xdp;	// AF_XDP sockets, replacing rfd and rxm
+	int hwtstamp;		// we enabled NIC RX timestamping (SIOCSHWTSTAMP)
+	unsigned busypoll;	// max usecs to spin on an empty ring, 0 to sleep
+	int csumverify;		// verify L4 checksums on RX (see ip.c)
+	hostcaps hostcap;	// bounds on l2hosts, l3hosts and l4srvs
+	int numanode;		// NUMA node for rings, -1 for no preference
+	cpu_set_t rxcpus;	// CPUs for capture threads, empty for any
 	int fd;			// TX PF_PACKET socket
-	void *txm;		// TX packet ring buffer
-	int fd4,fd6udp,fd6icmp;	// Fallback IPv4 and IPv6 TX raw sockets
-	size_t ts;		// TX packet ring size in bytes
-	struct tpacket_req ttpr;// TX packet ring descriptor
-	unsigned txidx;		// Index of next frame for TX
-	void *curtxm;		// Location of next frame for TX
+	void *txm;		// TX frame staging buffer, NULL when closed
+	int fd4,fd6;		// Fallback IPv4 and IPv6 TX raw sockets
+	size_t ts;		// TX staging buffer size in bytes
+	struct tpacket_req ttpr;// TX staging buffer descriptor
+	unsigned txhead;	// Staging frames handed out, ever (atomic)
+	unsigned txinflight;	// Staging frames currently held (atomic)
+	void *txr;		// Kernel PACKET_TX_RING, NULL to send() each frame
+	size_t txrs;		// TX ring size in bytes
+	struct tpacket_req txrpr;// TX ring descriptor
+	unsigned txrhead;	// Next TX ring slot to fill (atomic)
+	unsigned txqueued;	// Slots queued since the last flush (atomic)
+	unsigned txbatch;	// Open TX batches, deferring flushes (atomic)
+	struct selftx *selftx;	// Self-directed frames awaiting sendmmsg()
+	struct txsched *txsched;// Pacing for the frames we originate
+	struct probe_template *probes;	// Prebuilt probe frames (see probe.h)
+	struct arpsweep *arpsweep;	// Active ARP enumeration (see arpsweep.h)
+	struct ndsweep *ndsweep;	// Active IPv6 enumeration (see ndsweep.h)
+	struct synscan *synscan;	// Active TCP enumeration (see synscan.h)
+	struct interface *sweepnext;	// Next interface being swept (see sweep.h)
+	int sweeplisted;	// On the list of interfaces being swept
 	struct ethtool_drvinfo drv;	// ethtool driver info
 	unsigned offload;	// offloading settings
 	unsigned offloadmask;	// which offloading settings are valid
@@ -134,8 +206,9 @@ typedef struct interface {
 
 	uint128_t ip6defsrc;	// default ipv6 source FIXME
 
-	struct l2host *l2hosts;
-	struct l3host *ip4hosts,*ip6hosts,*cells;
+	l2table l2hosts;
+	l3table ip4hosts,ip6hosts,cells;
+	struct slab *l3slab,*l4slab;	// l3hosts and l4srvs (see slab.h)
 
 	void *opaque;		// opaque callback state
 } interface;
@@ -156,6 +229,10 @@ hwaddrstr(const interface *i){
 }
 
 void free_iface(interface *);
+
+// Unmap the interface's RX and TX rings, and close any XSKs. The lock must
+// be held, and the packet socket threads reaped.
+void unmap_iface_rings(interface *);
 void cleanup_interfaces(void);
 
 int print_all_iface_stats(FILE *,interface *);
@@ -185,7 +262,7 @@ int down_interface(const interface *);
 
 static inline int
 interface_sniffing_p(const interface *i){
-	return (i->rfd >= 0);
+	return (i->rfd >= 0 || i->xdp);
 }
 
 static inline int
@@ -208,18 +285,119 @@ interface_virtual_p(const interface *i){
 	return i->settings_valid == SETTINGS_INVALID;
 }
 
+// Waiters announce themselves, so that the packet threads can cut their
+// batches short and get out of the way (see interface_contended()). Listed
+// rxworkers are only listed and unlisted with the interface lock held, and
+// each is locked before it's listed (see list_rxworker()).
 static inline void
 lock_interface(interface *i){
-	int r = pthread_mutex_lock(&i->lock);
+	rxworker *w;
+	int r;
+
+	__atomic_add_fetch(&i->lockwaiters,1,__ATOMIC_RELAXED);
+	r = pthread_mutex_lock(&i->lock);
+	for(w = i->rxworkers ; w ; w = w->next){
+		r |= pthread_mutex_lock(&w->own);
+	}
+	r |= pthread_mutex_lock(&i->waitlock);
+	__atomic_sub_fetch(&i->lockwaiters,1,__ATOMIC_RELAXED);
+	++i->lockgen;
+	r |= pthread_cond_broadcast(&i->waitcond);
+	r |= pthread_mutex_unlock(&i->waitlock);
 	assert(r == 0);
 }
 
+// Returns 0 if we got the interface to ourselves, without waiting.
+static inline int
+trylock_interface(interface *i){
+	rxworker *w,*f;
+
+	if(pthread_mutex_trylock(&i->lock)){
+		return -1;
+	}
+	for(w = i->rxworkers ; w ; w = w->next){
+		if(pthread_mutex_trylock(&w->own)){
+			for(f = i->rxworkers ; f != w ; f = f->next){
+				pthread_mutex_unlock(&f->own);
+			}
+			pthread_mutex_unlock(&i->lock);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static inline int
+interface_contended(const interface *i){
+	return __atomic_load_n(&i->lockwaiters,__ATOMIC_RELAXED);
+}
+
+// For the packet threads, holding none of the interface's locks: sleep until
+// someone waiting in lock_interface() has acquired the interface, or nobody
+// is waiting any longer. Mutexes aren't fair; were we to simply retake our
+// lock, we'd likely win it right back.
+static inline void
+await_interface(interface *i){
+	unsigned gen;
+
+	pthread_mutex_lock(&i->waitlock);
+	gen = i->lockgen;
+	while(interface_contended(i) && i->lockgen == gen){
+		pthread_cond_wait(&i->waitcond,&i->waitlock);
+	}
+	pthread_mutex_unlock(&i->waitlock);
+}
+
+// For the packet threads, each holding its worker's lock exactly once: if
+// anyone's waiting in lock_interface(), release the lock until they've
+// acquired it.
+static inline void
+yield_rxworker(rxworker *w){
+	if(interface_contended(w->i)){
+		pthread_mutex_unlock(w->lock);
+		await_interface(w->i);
+		pthread_mutex_lock(w->lock);
+	}
+}
+
 static inline void
 unlock_interface(interface *i){
-	int r = pthread_mutex_unlock(&i->lock);
+	rxworker *w;
+	int r = 0;
+
+	for(w = i->rxworkers ; w ; w = w->next){
+		r |= pthread_mutex_unlock(&w->own);
+	}
+	r |= pthread_mutex_unlock(&i->lock);
 	assert(r == 0);
 }
 
+// Give the worker a lock of its own, and list it on the interface, which must
+// be held (once) via lock_interface(). The new lock is taken on the holder's
+// behalf, lest the worker analyze anything before the interface is unlocked.
+int list_rxworker(interface *,rxworker *);
+
+// Unlist a worker which is no longer running (or never ran), and destroy its
+// lock. The interface must be held via lock_interface().
+void unlist_rxworker(interface *,rxworker *);
+
+// Only with several rxworkers is there anyone to exclude from the host
+// tables. Nobody entitled to use them could see the list change: it's only
+// changed with every worker's lock held.
+static inline void
+lock_hosts(interface *i){
+	if(i->rxworkers){
+		pthread_mutex_lock(&i->hostlock);
+	}
+}
+
+static inline void
+unlock_hosts(interface *i){
+	if(i->rxworkers){
+		pthread_mutex_unlock(&i->hostlock);
+	}
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <netinet/ip.h>
 #include <linux/tcp.h>
+#include <linux/udp.h>
 #include <linux/igmp.h>
 #include <linux/l2tp.h>
 #include <netinet/ip6.h>
@@ -83,6 +84,50 @@ handle_igmp_packet(omphalos_packet *op,const void *frame,size_t len){
 	// FIXME
 }
 
+// With --csum-verify, check a TCP, UDP or ICMP(v6) segment's checksum
+// (hdr is its IP(v6) header), unless the kernel got there first. A bad one
+// is counted against its protocol, and the packet marked malformed (and
+// thus sent to the plog); one the kernel vouched for is marked csumtrusted.
+// Returns non-zero if the segment ought be dropped.
+static int
+bad_l4_csum(omphalos_packet *op,const void *hdr,unsigned proto,
+			const void *seg,size_t len){
+	interface *i = op->i;
+	uintmax_t *errs;
+	uint16_t cs;
+
+	if(!i->csumverify){
+		return 0;
+	}
+	if(op->csumok){
+		op->csumtrusted = 1;
+		return 0;
+	}
+	if(proto == IPPROTO_UDP){
+		const struct udphdr *udp = seg;
+
+		// A zero UDP checksum means none was computed (IPv4 only)
+		if(len < sizeof(*udp) || (udp->check == 0 &&
+				((const struct iphdr *)hdr)->version == 4)){
+			return 0;
+		}
+	}
+	if((cs = rx_l4_csum(hdr,proto,seg,len)) == 0){
+		return 0;
+	}
+	switch(proto){
+		case IPPROTO_TCP: errs = &i->tcpcsumerrs; break;
+		case IPPROTO_UDP: errs = &i->udpcsumerrs; break;
+		default: errs = &i->icmpcsumerrs; break;
+	}
+	__atomic_add_fetch(errs,1,__ATOMIC_RELAXED);
+	op->malformed = 1;
+	diagnostic("[%s] bad %s checksum (%04hx)",i->name,
+		proto == IPPROTO_TCP ? "TCP" : proto == IPPROTO_UDP ? "UDP" :
+		proto == IPPROTO_ICMP ? "ICMP" : "ICMPv6",cs);
+	return 1;
+}
+
 void handle_ipv6_packet(omphalos_packet *op,const void *frame,size_t len){
 	const struct ip6_hdr *ip = frame;
 	uint16_t plen;
@@ -108,8 +153,8 @@ void handle_ipv6_packet(omphalos_packet *op,const void *frame,size_t len){
 	}
 	memcpy(op->l3saddr,&ip->ip6_src,16);
 	memcpy(op->l3daddr,&ip->ip6_dst,16);
-	op->l3s = lookup_l3host(&op->tv,op->i,op->l2s,AF_INET6,&ip->ip6_src);
-	op->l3d = lookup_l3host(&op->tv,op->i,op->l2d,AF_INET6,&ip->ip6_dst);
+	op->l3s = lookup_l3host(op->ts,op->i,op->l2s,AF_INET6,&ip->ip6_src);
+	op->l3d = lookup_l3host(op->ts,op->i,op->l2d,AF_INET6,&ip->ip6_dst);
 	// Don't just subtract payload length from frame length, since the
 	// frame might have been padded up to a minimum size.
 	const void *nhdr = (const char *)ip + sizeof(*ip);
@@ -117,16 +162,24 @@ void handle_ipv6_packet(omphalos_packet *op,const void *frame,size_t len){
 	while(nhdr){
 	switch(next){ // "upper-level" protocols end the packet
 		case IPPROTO_TCP:{
-			handle_tcp_packet(op,nhdr,plen);
+			if(!bad_l4_csum(op,ip,next,nhdr,plen)){
+				handle_tcp_packet(op,nhdr,plen);
+			}
 			nhdr = NULL;
 		break; }case IPPROTO_UDP:{
-			handle_udp_packet(op,nhdr,plen);
+			if(!bad_l4_csum(op,ip,next,nhdr,plen)){
+				handle_udp_packet(op,nhdr,plen);
+			}
 			nhdr = NULL;
 		break; }case IPPROTO_ICMP:{
-			handle_icmp_packet(op,nhdr,plen);
+			if(!bad_l4_csum(op,ip,next,nhdr,plen)){
+				handle_icmp_packet(op,nhdr,plen);
+			}
 			nhdr = NULL;
 		break; }case IPPROTO_ICMP6:{
-			handle_icmp6_packet(op,nhdr,plen);
+			if(!bad_l4_csum(op,ip,next,nhdr,plen)){
+				handle_icmp6_packet(op,nhdr,plen);
+			}
 			nhdr = NULL;
 		break; }case IPPROTO_SCTP:{
 			handle_sctp_packet(op,nhdr,plen);
@@ -208,6 +261,7 @@ void handle_ipv4_packet(omphalos_packet *op,const void *frame,size_t len){
 		return;
 	}
 	if(ipv4_csum(frame)){
+		__atomic_add_fetch(&op->i->ip4csumerrs,1,__ATOMIC_RELAXED);
 		op->malformed = 1;
 		diagnostic("[%s] bad IPv4 checksum (%04hx)",op->i->name,ipv4_csum(frame));
 		return;
@@ -224,10 +278,17 @@ void handle_ipv4_packet(omphalos_packet *op,const void *frame,size_t len){
 				op->i->name,len,ntohs(ip->tot_len));
 		return;
 	}
+	// tot_len covers the header, lest the payload length underflow below
+	if(ntohs(ip->tot_len) < hlen){
+		op->malformed = 1;
+		diagnostic("[%s] IPv4 tot_len malformed: %hu < hdrlen %u",
+				op->i->name,ntohs(ip->tot_len),hlen);
+		return;
+	}
 	memcpy(op->l3saddr,&ip->saddr,4);
 	memcpy(op->l3daddr,&ip->daddr,4);
-	op->l3s = lookup_l3host(&op->tv,op->i,op->l2s,AF_INET,&ip->saddr);
-	op->l3d = lookup_l3host(&op->tv,op->i,op->l2d,AF_INET,&ip->daddr);
+	op->l3s = lookup_l3host(op->ts,op->i,op->l2s,AF_INET,&ip->saddr);
+	op->l3d = lookup_l3host(op->ts,op->i,op->l2d,AF_INET,&ip->daddr);
 
 	// FIXME need reassemble fragments
 	if((ip->frag_off & __constant_ntohs(0x1f)) || (ip->frag_off & __constant_ntohs(0x20))){
@@ -239,11 +300,17 @@ void handle_ipv4_packet(omphalos_packet *op,const void *frame,size_t len){
 
 	switch(ip->protocol){
 	case IPPROTO_TCP:{
-		handle_tcp_packet(op,nhdr,nlen);
+		if(!bad_l4_csum(op,ip,ip->protocol,nhdr,nlen)){
+			handle_tcp_packet(op,nhdr,nlen);
+		}
 	break; }case IPPROTO_UDP:{
-		handle_udp_packet(op,nhdr,nlen);
+		if(!bad_l4_csum(op,ip,ip->protocol,nhdr,nlen)){
+			handle_udp_packet(op,nhdr,nlen);
+		}
 	break; }case IPPROTO_ICMP:{
-		handle_icmp_packet(op,nhdr,nlen);
+		if(!bad_l4_csum(op,ip,ip->protocol,nhdr,nlen)){
+			handle_icmp_packet(op,nhdr,nlen);
+		}
 	break; }case IPPROTO_SCTP:{
 		handle_sctp_packet(op,nhdr,nlen);
 	break; }case IPPROTO_GRE:{
@@ -3,6 +3,7 @@
 #include <omphalos/tx.h>
 #include <omphalos/diag.h>
 #include <omphalos/lltd.h>
+#include <omphalos/txsched.h>
 #include <omphalos/service.h>
 #include <omphalos/netaddrs.h>
 #include <omphalos/ethernet.h>
@@ -303,12 +304,12 @@ handle_lltd_tlvs(omphalos_packet *op,const void *frame,size_t len){
 		struct l3host *l3;
 
 		if(ip){
-			l3 = lookup_local_l3host(NULL,op->i,op->l2s,AF_INET,ip);
+			l3 = lookup_local_l3host(0,op->i,op->l2s,AF_INET,ip);
 			name_l3host_absolute(op->i,op->l2s,l3,name,NAMING_LEVEL_MDNS);
 			observe_service(op->i,op->l2s,l3,0,0,L"LLTD",NULL);
 		}
 		if(ip6){
-			l3 = lookup_local_l3host(NULL,op->i,op->l2s,AF_INET6,ip6);
+			l3 = lookup_local_l3host(0,op->i,op->l2s,AF_INET6,ip6);
 			name_l3host_absolute(op->i,op->l2s,l3,name,NAMING_LEVEL_MDNS);
 			observe_service(op->i,op->l2s,l3,0,0,L"LLTD",NULL);
 		}
@@ -466,7 +467,7 @@ int initiate_lltd(int fam,interface *i,const void *addr){
 	memset(disc,0,sizeof(*disc));
 	tlen += sizeof(*disc);
 	thdr->tp_len = tlen - thdr->tp_mac;
-	return send_tx_frame(i,frame);
+	return pace_tx_frame(i,frame,TXCLASS_SWEEP);
 
 err:
 	abort_tx_frame(i,frame);
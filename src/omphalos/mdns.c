@@ -1,5 +1,6 @@
 #include <ctype.h>
 #include <assert.h>
+#include <stdlib.h>
 #include <linux/ip.h>
 #include <linux/udp.h>
 #include <sys/socket.h>
@@ -12,7 +13,9 @@
 #include <omphalos/csum.h>
 #include <asm/byteorder.h>
 #include <omphalos/diag.h>
+#include <omphalos/probe.h>
 #include <omphalos/route.h>
+#include <omphalos/txsched.h>
 #include <omphalos/service.h>
 #include <omphalos/hwaddrs.h>
 #include <omphalos/ethernet.h>
@@ -20,8 +23,6 @@
 #include <omphalos/omphalos.h>
 #include <omphalos/interface.h>
 
-#define MDNS_NET4 __constant_htonl(0xe00000fbul)
-
 struct natpmphdr {
 	uint8_t ver;
 	uint8_t op;
@@ -103,14 +104,14 @@ int tx_mdns_ptr(interface *i,const char *str,int fam,const void *lookup){
 			return -1;
 		}
 		mcast_netaddr = MDNS_NET4;
-		if( (rp.l3 = lookup_local_l3host(NULL,i,rp.l2,AF_INET,&mcast_netaddr)) ){
+		if( (rp.l3 = lookup_local_l3host(0,i,rp.l2,AF_INET,&mcast_netaddr)) ){
 			if( (frame = get_tx_frame(i,&flen)) ){
 				if(setup_dns_ptr(&rp,AF_INET,&mcast_netaddr,
 							MDNS_UDP_PORT,flen,frame,str,
 							htons(MDNS_UDP_PORT))){
 					abort_tx_frame(i,frame);
 				}else{
-					send_tx_frame(i,frame);
+					pace_tx_frame(i,frame,TXCLASS_NAMING);
 					ret = 0;
 				}
 			}
@@ -127,7 +128,7 @@ int tx_mdns_ptr(interface *i,const char *str,int fam,const void *lookup){
 		mcast_netaddr[1] = __constant_htonl(0x00000000u);
 		mcast_netaddr[2] = __constant_htonl(0x00000000u);
 		mcast_netaddr[3] = __constant_htonl(0x000000fbu);
-		if((rp.l3 = lookup_local_l3host(NULL,i,rp.l2,AF_INET6,&mcast_netaddr)) == NULL){
+		if((rp.l3 = lookup_local_l3host(0,i,rp.l2,AF_INET6,&mcast_netaddr)) == NULL){
 			return -1;
 		}
 		if((frame = get_tx_frame(i,&flen)) == NULL){
@@ -137,7 +138,7 @@ int tx_mdns_ptr(interface *i,const char *str,int fam,const void *lookup){
 			abort_tx_frame(i,frame);
 			return -1;
 		}
-		send_tx_frame(i,frame);
+		pace_tx_frame(i,frame,TXCLASS_NAMING);
 	}
 	return ret;
 }
@@ -213,123 +214,39 @@ setup_service_probe(char *frame,size_t len,const char *name){
 }
 
 static int
-tx_sd4(interface *i,const char *name,const uint32_t *saddr){
-	const unsigned char hw[ETH_ALEN] = { 0x01, 0x00, 0x5e, 0x00, 0x00, 0xfb };
-	uint32_t net = MDNS_NET4;
-	struct tpacket_hdr *thdr;
-	struct udphdr *udp;
-	struct iphdr *ip;
-	size_t flen,tlen;
-	void *frame;
-	int r;
-
-	if((frame = get_tx_frame(i,&flen)) == NULL){
-		return -1;
-	}
-	thdr = frame;
-	tlen = thdr->tp_mac;
-	if((r = prep_eth_header((char *)frame + tlen,flen - tlen,i,
-					hw,ETH_P_IP)) < 0){
-		abort_tx_frame(i,frame);
-		return -1;
-	}
-	tlen += r;
-	ip = (struct iphdr *)((char *)frame + tlen);
-	if((r = prep_ipv4_header(ip,flen - tlen,*saddr,net,IPPROTO_UDP)) < 0){
-		abort_tx_frame(i,frame);
-		return -1;
-	}
-	tlen += r;
-	if(flen - tlen < sizeof(*udp)){
-		abort_tx_frame(i,frame);
-		return -1;
-	}
-	udp = (struct udphdr *)((char *)frame + tlen);
-	udp->source = htons(MDNS_UDP_PORT);
-	udp->dest = htons(MDNS_UDP_PORT);
-	tlen += sizeof(*udp);
-	if(name == NULL){
-		r = setup_service_enum((char *)frame + tlen,flen - tlen);
-	}else{
-		r = setup_service_probe((char *)frame + tlen,flen - tlen,name);
-	}
-	if(r < 0){
-		abort_tx_frame(i,frame);
-		return -1;
-	}
-	tlen += r;
-	ip->tot_len = htons(tlen - ((const char *)ip - (const char *)frame));
-	ip->check = ipv4_csum(ip);
-	udp->len = htons(ntohs(ip->tot_len) - ip->ihl * 4u);
-	udp->check = udp4_csum(ip);
-	thdr->tp_len = tlen - thdr->tp_mac;
-	return send_tx_frame(i,frame);
-}
-
-static int
-tx_sd6(interface *i,const char *name,const uint128_t saddr){
-	const unsigned char hw[ETH_ALEN] = { 0x33, 0x33, 0x00, 0x00, 0x00, 0xfb };
-	uint128_t net = { htonl(0xff020000ul), htonl(0x0ul),
-				htonl(0x0ul), htonl(0xfbul) };
-	struct tpacket_hdr *thdr;
-	struct udphdr *udp;
-	struct ip6_hdr *ip;
-	size_t flen,tlen;
-	void *frame;
+tx_sd(int fam,interface *i,const char *name,const void *saddr){
+	size_t flen,avail;
+	void *frame,*dat;
+	probe p;
 	int r;
 
 	if((frame = get_tx_frame(i,&flen)) == NULL){
 		return -1;
 	}
-	thdr = frame;
-	tlen = thdr->tp_mac;
-	if((r = prep_eth_header((char *)frame + tlen,flen - tlen,i,
-					hw,ETH_P_IPV6)) < 0){
-		abort_tx_frame(i,frame);
-		return -1;
-	}
-	tlen += r;
-	ip = (struct ip6_hdr *)((char *)frame + tlen);
-	if((r = prep_ipv6_header(ip,flen - tlen,saddr,net,IPPROTO_UDP)) < 0){
-		abort_tx_frame(i,frame);
-		return -1;
-	}
-	tlen += r;
-	if(flen - tlen < sizeof(*udp)){
+	if(probe_start(&p,i,frame,flen,PROBE_MDNS,build_mdns_probe,fam,saddr)){
 		abort_tx_frame(i,frame);
 		return -1;
 	}
-	udp = (struct udphdr *)((char *)frame + tlen);
-	udp->source = htons(MDNS_UDP_PORT);
-	udp->dest = htons(MDNS_UDP_PORT);
-	tlen += sizeof(*udp);
+	probe_ip4id(&p,random());
+	dat = probe_tail(&p,&avail);
 	if(name == NULL){
-		r = setup_service_enum((char *)frame + tlen,flen - tlen);
+		r = setup_service_enum(dat,avail);
 	}else{
-		r = setup_service_probe((char *)frame + tlen,flen - tlen,name);
+		r = setup_service_probe(dat,avail,name);
 	}
-	if(r < 0){
+	if(r < 0 || probe_extend(&p,r)){
 		abort_tx_frame(i,frame);
 		return -1;
 	}
-	tlen += r;
-	thdr->tp_len = tlen;
-	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(thdr->tp_len -
-		((const char *)udp - (const char *)frame));
-	udp->len = ip->ip6_ctlun.ip6_un1.ip6_un1_plen;
-	udp->check = udp6_csum(ip);
-	thdr->tp_len -= thdr->tp_mac;
-	return send_tx_frame(i,frame);
+	return pace_tx_frame(i,frame,TXCLASS_SWEEP);
 }
 
 int mdns_sd_enumerate(int fam,interface *i,const void *saddr){
 	if(!(i->flags & IFF_MULTICAST)){
 		return 0;
 	}
-	if(fam == AF_INET){
-		return tx_sd4(i,NULL,saddr);
-	}else if(fam == AF_INET6){
-		return tx_sd6(i,NULL,saddr);
+	if(fam == AF_INET || fam == AF_INET6){
+		return tx_sd(fam,i,NULL,saddr);
 	}
 	return -1;
 }
@@ -338,10 +255,8 @@ int mdns_sd_probe(int fam,interface *i,const char *name,const void *saddr){
 	if(!(i->flags & IFF_MULTICAST)){
 		return 0;
 	}
-	if(fam == AF_INET){
-		return tx_sd4(i,name,saddr);
-	}else if(fam == AF_INET6){
-		return tx_sd6(i,name,saddr);
+	if(fam == AF_INET || fam == AF_INET6){
+		return tx_sd(fam,i,name,saddr);
 	}
 	return -1;
 }
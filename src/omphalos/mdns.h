@@ -6,6 +6,9 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <asm/byteorder.h>
+
+#define MDNS_NET4 __constant_htonl(0xe00000fbul)
 
 struct l2host;
 struct l3host;
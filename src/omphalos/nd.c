@@ -8,6 +8,7 @@
 #include <omphalos/resolv.h>
 #include <omphalos/hwaddrs.h>
 #include <omphalos/service.h>
+#include <omphalos/ndsweep.h>
 #include <omphalos/netaddrs.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/ethernet.h>
@@ -214,6 +215,7 @@ void handle_nd_neighad(struct omphalos_packet *op,const void *frame __attribute_
 		return;
 	}
 	len -= 16;
+	nd_sweep_reply(op->i,(const char *)frame + 4);
 	frame = (const char *)frame + 20;
 	while(len){
 		const struct icmp6_op *iop = frame;
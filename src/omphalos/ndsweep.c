@@ -0,0 +1,434 @@
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <omphalos/ip.h>
+#include <omphalos/tx.h>
+#include <omphalos/128.h>
+#include <omphalos/csum.h>
+#include <omphalos/diag.h>
+#include <omphalos/probe.h>
+#include <omphalos/sweep.h>
+#include <omphalos/hwaddrs.h>
+#include <omphalos/txsched.h>
+#include <omphalos/ndsweep.h>
+#include <omphalos/ethernet.h>
+#include <omphalos/omphalos.h>
+#include <omphalos/interface.h>
+
+#define NDSWEEP_MAX_PREFIXES 8
+#define NDSWEEP_MAX_MACS 4096
+#define MLD_QUERY_MSEC 1000	// maximum response delay we request (< 32768)
+#define MLD_QRV 2		// robustness variable (RFC 3810 9.1)
+#define MLD_QQIC 125		// query interval in seconds (RFC 3810 9.2)
+
+// Multicast probes yet to be sent from a prefix's source
+#define NDMC_ROUTERS	0x1
+#define NDMC_MLD	0x2
+
+typedef struct ndprefix {
+	unsigned char prefix[8];	// the /64
+	uint128_t src;		// our address on it
+	unsigned mcast;		// NDMC_* probes pending
+	unsigned nextmac;	// MACs solicited on this prefix
+	uint64_t replied[NDSWEEP_MAX_MACS / 64];	// by index into macs
+} ndprefix;
+
+typedef struct ndsweep {
+	ndprefix prefixes[NDSWEEP_MAX_PREFIXES];
+	unsigned prefixcount;
+	hwaddrint *macs;	// unicast neighbours, in order of discovery
+	unsigned maccount,macalloc;
+	uint32_t probed,found;
+} ndsweep;
+
+static int
+build_router_ping(const interface *i,void *frame,size_t flen,int fam,const void *saddr){
+	const unsigned char hw[ETH_ALEN] = { 0x33, 0x33, 0x00, 0x00, 0x00, 0x02 };
+	const uint128_t net = { __constant_htonl(0xff020000ul), 0, 0,
+				__constant_htonl(0x2ul) };
+	struct icmp6_hdr *icmp;
+	struct ip6_hdr *ip;
+	uint128_t src;
+	size_t tlen;
+	int r;
+
+	if(fam != AF_INET6){
+		return -1;
+	}
+	assign128(src,saddr);
+	if((r = prep_eth_header(frame,flen,i,hw,ETH_P_IPV6)) < 0){
+		return -1;
+	}
+	tlen = r;
+	ip = (struct ip6_hdr *)((char *)frame + tlen);
+	if((r = prep_ipv6_header(ip,flen - tlen,src,net,IPPROTO_ICMPV6)) < 0){
+		return -1;
+	}
+	tlen += r;
+	if(flen - tlen < sizeof(*icmp)){
+		return -1;
+	}
+	icmp = (struct icmp6_hdr *)((char *)frame + tlen);
+	memset(icmp,0,sizeof(*icmp));
+	icmp->icmp6_type = ICMP6_ECHO_REQUEST;
+	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(sizeof(*icmp));
+	icmp->icmp6_cksum = icmp6_csum(ip);
+	return tlen + sizeof(*icmp);
+}
+
+// An MLDv2 general query (RFC 3810 5.1): the MLDv1 query, extended with
+// flags, the querier's interval and a source count. An MLDv1 query would be
+// answered too, but would push every MLDv2 listener on the link into MLDv1
+// compatibility mode for the Older Version Querier Present Timeout.
+typedef struct mld2_query {
+	struct mld_hdr hdr;
+	uint8_t flags;		// Resv:4, S:1, QRV:3
+	uint8_t qqic;
+	uint16_t nsrcs;
+} mld2_query;
+
+#define MLD2_SUPPRESS 0x08	// S: routers don't update their timers
+
+// It must come from a link-local address with a hop limit of 1, and carry the
+// Router Alert option. Multicast routers on the link will take part in
+// querier election against our (link-local) source; suppressing router-side
+// processing keeps them from otherwise acting on the query.
+static int
+build_mld_query(const interface *i,void *frame,size_t flen,int fam,const void *saddr){
+	const unsigned char hw[ETH_ALEN] = { 0x33, 0x33, 0x00, 0x00, 0x00, 0x01 };
+	const uint128_t net = { __constant_htonl(0xff020000ul), 0, 0,
+				__constant_htonl(0x1ul) };
+	// Next header, length, Router Alert (MLD), PadN
+	const unsigned char hbh[8] = { IPPROTO_ICMPV6, 0, 5, 2, 0, 0, 1, 0 };
+	struct mld2_query *mld;
+	struct ip6_hdr *ip;
+	uint128_t src;
+	uint32_t sum;
+	size_t tlen;
+	int r;
+
+	if(fam != AF_INET6){
+		return -1;
+	}
+	assign128(src,saddr);
+	if((r = prep_eth_header(frame,flen,i,hw,ETH_P_IPV6)) < 0){
+		return -1;
+	}
+	tlen = r;
+	ip = (struct ip6_hdr *)((char *)frame + tlen);
+	if((r = prep_ipv6_header(ip,flen - tlen,src,net,IPPROTO_HOPOPTS)) < 0){
+		return -1;
+	}
+	tlen += r;
+	if(flen - tlen < sizeof(hbh) + sizeof(*mld)){
+		return -1;
+	}
+	ip->ip6_ctlun.ip6_un1.ip6_un1_hlim = 1;
+	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(sizeof(hbh) + sizeof(*mld));
+	memcpy((char *)frame + tlen,hbh,sizeof(hbh));
+	tlen += sizeof(hbh);
+	mld = (struct mld2_query *)((char *)frame + tlen);
+	memset(mld,0,sizeof(*mld));
+	mld->hdr.mld_type = MLD_LISTENER_QUERY;
+	mld->hdr.mld_maxdelay = htons(MLD_QUERY_MSEC);
+	mld->flags = MLD2_SUPPRESS | MLD_QRV;
+	mld->qqic = MLD_QQIC;
+	// icmp6_csum() assumes no extension headers
+	sum = csum_partial(&ip->ip6_src,sizeof(ip->ip6_src) * 2);
+	sum += htons(sizeof(*mld));
+	sum += htons(IPPROTO_ICMPV6);
+	sum += csum_partial(mld,sizeof(*mld));
+	mld->hdr.mld_cksum = ~csum_fold(sum);
+	return tlen + sizeof(*mld);
+}
+
+// Destination and target are patched in per probe.
+static int
+build_ns_probe(const interface *i,void *frame,size_t flen,int fam,const void *saddr){
+	const uint128_t zeroes = ZERO128;
+	struct nd_neighbor_solicit *ns;
+	struct nd_opt_hdr *opt;
+	struct ip6_hdr *ip;
+	uint128_t src;
+	size_t tlen;
+	int r;
+
+	if(fam != AF_INET6 || i->addrlen != ETH_ALEN){
+		return -1;
+	}
+	assign128(src,saddr);
+	if((r = prep_eth_header(frame,flen,i,zeroes,ETH_P_IPV6)) < 0){
+		return -1;
+	}
+	tlen = r;
+	ip = (struct ip6_hdr *)((char *)frame + tlen);
+	if((r = prep_ipv6_header(ip,flen - tlen,src,zeroes,IPPROTO_ICMPV6)) < 0){
+		return -1;
+	}
+	tlen += r;
+	if(flen - tlen < sizeof(*ns) + sizeof(*opt) + ETH_ALEN){
+		return -1;
+	}
+	// RFC 4861 requires a hop limit of 255 on ND messages
+	ip->ip6_ctlun.ip6_un1.ip6_un1_hlim = 255;
+	ns = (struct nd_neighbor_solicit *)((char *)frame + tlen);
+	memset(ns,0,sizeof(*ns));
+	ns->nd_ns_type = ND_NEIGHBOR_SOLICIT;
+	opt = (struct nd_opt_hdr *)(ns + 1);
+	opt->nd_opt_type = ND_OPT_SOURCE_LINKADDR;
+	opt->nd_opt_len = 1;	// in units of 8 octets
+	memcpy(opt + 1,i->addr,ETH_ALEN);
+	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(sizeof(*ns) + sizeof(*opt) + ETH_ALEN);
+	ns->nd_ns_cksum = icmp6_csum(ip);
+	return tlen + sizeof(*ns) + sizeof(*opt) + ETH_ALEN;
+}
+
+// hw, dst and target are provided only for PROBE_NS.
+static int
+send_nd_probe(interface *i,probe_type type,probe_builder build,const void *src,
+		const void *hw,const void *dst,const void *target){
+	void *frame;
+	size_t flen;
+	probe p;
+
+	if((frame = get_tx_frame(i,&flen)) == NULL){
+		return -1;
+	}
+	if(probe_start(&p,i,frame,flen,type,build,AF_INET6,src)){
+		abort_tx_frame(i,frame);
+		return -1;
+	}
+	if(target){
+		probe_l2dst(&p,hw);
+		probe_l3dst(&p,dst);
+		probe_nd_target(&p,target);
+	}
+	return pace_tx_frame(i,frame,TXCLASS_SWEEP);
+}
+
+// The modified EUI-64 address of the MAC on the prefix.
+static void
+eui64_candidate(const ndprefix *pf,hwaddrint hw,unsigned char *addr){
+	unsigned char mac[ETH_ALEN];
+
+	memcpy(mac,&hw,sizeof(mac));
+	memcpy(addr,pf->prefix,sizeof(pf->prefix));
+	addr[8] = mac[0] ^ 0x02;	// universal/local bit
+	addr[9] = mac[1];
+	addr[10] = mac[2];
+	addr[11] = 0xff;
+	addr[12] = 0xfe;
+	addr[13] = mac[3];
+	addr[14] = mac[4];
+	addr[15] = mac[5];
+}
+
+static int
+solicit_candidate(interface *i,const ndprefix *pf,hwaddrint hw){
+	unsigned char hwdst[ETH_ALEN] = { 0x33, 0x33, 0xff, 0, 0, 0 };
+	unsigned char target[16],group[16] = { 0xff, 0x02, 0, 0, 0, 0, 0, 0,
+						0, 0, 0, 0x01, 0xff, 0, 0, 0 };
+
+	eui64_candidate(pf,hw,target);
+	// The solicited-node group, and its multicast MAC
+	memcpy(group + 13,target + 13,3);
+	memcpy(hwdst + 3,target + 13,3);
+	return send_nd_probe(i,PROBE_NS,build_ns_probe,pf->src,hwdst,group,target);
+}
+
+static ndsweep *
+get_nd_sweep(interface *i){
+	const omphalos_ctx *octx = get_octx();
+	ndsweep *s;
+
+	if( (s = i->ndsweep) ){
+		return s;
+	}
+	if(!get_iface_opts(i->name)->ndsweep || octx->mode == OMPHALOS_MODE_SILENT){
+		return NULL;
+	}
+	if(i->addrlen != ETH_ALEN || i->bcast == NULL){
+		return NULL;
+	}
+	if((s = malloc(sizeof(*s))) == NULL){
+		diagnostic("Couldn't allocate ND sweep for %s",i->name);
+		return NULL;
+	}
+	memset(s,0,sizeof(*s));
+	i->ndsweep = s;
+	return s;
+}
+
+void free_nd_sweep(interface *i){
+	ndsweep *s = i->ndsweep;
+
+	if(s){
+		free(s->macs);
+		free(s);
+		i->ndsweep = NULL;
+	}
+}
+
+int start_nd_sweep(interface *i,const void *addr){
+	const unsigned char *a = addr;
+	ndprefix *pf;
+	ndsweep *s;
+	unsigned z;
+
+	if((s = get_nd_sweep(i)) == NULL){
+		return 0;
+	}
+	for(z = 0 ; z < s->prefixcount ; ++z){
+		if(memcmp(s->prefixes[z].prefix,a,sizeof(pf->prefix)) == 0){
+			return 0;
+		}
+	}
+	if(s->prefixcount == NDSWEEP_MAX_PREFIXES){
+		return 0;
+	}
+	pf = &s->prefixes[s->prefixcount++];
+	memcpy(pf->prefix,a,sizeof(pf->prefix));
+	assign128(pf->src,addr);
+	pf->mcast = NDMC_ROUTERS;
+	// MLD queries must come from link-local addresses (fe80::/10)
+	if(a[0] == 0xfe && (a[1] & 0xc0) == 0x80){
+		pf->mcast |= NDMC_MLD;
+	}
+	pf->nextmac = 0;
+	memset(pf->replied,0,sizeof(pf->replied));
+	list_sweeping(i);
+	diagnostic("[%s] ND sweeping a /64 with %u known neighbours",i->name,s->maccount);
+	return 0;
+}
+
+void nd_sweep_l2host(interface *i,const void *hwaddr){
+	const unsigned char *mac = hwaddr;
+	hwaddrint hw = 0;
+	ndsweep *s;
+
+	if((s = get_nd_sweep(i)) == NULL){
+		return;
+	}
+	// Neither group addresses nor our own
+	if((mac[0] & 0x01) || memcmp(hwaddr,i->addr,ETH_ALEN) == 0){
+		return;
+	}
+	if(s->maccount == s->macalloc){
+		unsigned n = s->macalloc ? s->macalloc * 2 : 16;
+		hwaddrint *tmp;
+
+		if(n > NDSWEEP_MAX_MACS){
+			return;
+		}
+		if((tmp = realloc(s->macs,sizeof(*tmp) * n)) == NULL){
+			return;
+		}
+		s->macs = tmp;
+		s->macalloc = n;
+	}
+	memcpy(&hw,hwaddr,ETH_ALEN);
+	s->macs[s->maccount++] = hw;
+	if(s->prefixcount){
+		list_sweeping(i);
+	}
+}
+
+int nd_sweep_tick(interface *i){
+	ndsweep *s = i->ndsweep;
+	unsigned room,n = 0,z;
+
+	if(s == NULL){
+		return -1;
+	}
+	room = tx_sched_room(i,TXCLASS_SWEEP);
+	for(z = 0 ; z < s->prefixcount ; ++z){
+		ndprefix *pf = &s->prefixes[z];
+
+		while(n < room && n < SWEEP_TICK_MAX){
+			// Try any failed probe again next time
+			if(pf->mcast & NDMC_ROUTERS){
+				if(send_nd_probe(i,PROBE_RPING,build_router_ping,pf->src,
+							NULL,NULL,NULL)){
+					return SWEEP_TICK_MSEC;
+				}
+				pf->mcast &= ~NDMC_ROUTERS;
+			}else if(pf->mcast & NDMC_MLD){
+				if(send_nd_probe(i,PROBE_MLDQ,build_mld_query,pf->src,
+							NULL,NULL,NULL)){
+					return SWEEP_TICK_MSEC;
+				}
+				pf->mcast &= ~NDMC_MLD;
+			}else if(pf->nextmac < s->maccount){
+				if(solicit_candidate(i,pf,s->macs[pf->nextmac])){
+					return SWEEP_TICK_MSEC;
+				}
+				++pf->nextmac;
+			}else{
+				break;
+			}
+			++s->probed;
+			++n;
+		}
+		if(pf->mcast || pf->nextmac < s->maccount){
+			return n == SWEEP_TICK_MAX ? 0 : SWEEP_TICK_MSEC;
+		}
+	}
+	return -1;
+}
+
+// Each candidate is credited once, and only if we've solicited it: repeated
+// and unsolicited advertisements are common.
+void nd_sweep_reply(interface *i,const void *target){
+	const unsigned char *t = target;
+	ndsweep *s = i->ndsweep;
+	unsigned char mac[ETH_ALEN];
+	hwaddrint hw = 0;
+	unsigned z,m;
+
+	// Only modified EUI-64 interface identifiers are of our making
+	if(s == NULL || t[11] != 0xff || t[12] != 0xfe){
+		return;
+	}
+	for(z = 0 ; z < s->prefixcount ; ++z){
+		if(memcmp(s->prefixes[z].prefix,t,sizeof(s->prefixes[z].prefix)) == 0){
+			break;
+		}
+	}
+	if(z == s->prefixcount){
+		return;
+	}
+	// Invert eui64_candidate()
+	mac[0] = t[8] ^ 0x02;
+	mac[1] = t[9];
+	mac[2] = t[10];
+	memcpy(mac + 3,t + 13,3);
+	memcpy(&hw,mac,sizeof(mac));
+	lock_hosts(i);
+	for(m = 0 ; m < s->prefixes[z].nextmac ; ++m){
+		if(s->macs[m] == hw){
+			ndprefix *pf = &s->prefixes[z];
+			uint64_t bit = 1ull << (m % 64);
+
+			if(!(pf->replied[m / 64] & bit)){
+				pf->replied[m / 64] |= bit;
+				++s->found;
+			}
+			break;
+		}
+	}
+	unlock_hosts(i);
+}
+
+int nd_sweep_stats(const interface *i,ndsweep_stats *st){
+	const ndsweep *s = i->ndsweep;
+
+	if(s == NULL){
+		return -1;
+	}
+	st->prefixes = s->prefixcount;
+	st->neighbours = s->maccount;
+	st->probed = s->probed;
+	st->found = s->found;
+	return 0;
+}
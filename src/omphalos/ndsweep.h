@@ -0,0 +1,60 @@
+#ifndef OMPHALOS_NDSWEEP
+#define OMPHALOS_NDSWEEP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct interface;
+
+// Active enumeration of on-link IPv6 neighbours. An IPv6 prefix can't be
+// swept, so we instead ask the link who's there, and guess. For each of our
+// addresses, its /64 is taken as an on-link prefix, and we:
+//
+//  - ping the all-routers group (all-nodes is pinged by query_network()),
+//  - send an MLDv2 general query from link-local sources, drawing a report
+//    (from its link-local address) from every node with a multicast
+//    listener, i.e. every node doing ND,
+//  - solicit the modified EUI-64 address (RFC 4291) of each unicast MAC we
+//    know of on the link, on each prefix, via its solicited-node group.
+//
+// Responders enter the host tables through the usual RX paths. Everything is
+// paced as TXCLASS_SWEEP. Except as noted, calls require the interface lock.
+
+typedef struct ndsweep_stats {
+	unsigned prefixes;	// /64s being solicited
+	unsigned neighbours;	// MACs from which candidates are derived
+	uint32_t probed;	// probes sent
+	uint32_t found;		// solicited candidates which have advertised
+} ndsweep_stats;
+
+// Add the /64 of this address of ours to the sweep, creating it if enabled
+// for the interface.
+int start_nd_sweep(struct interface *,const void *);
+
+// A hardware address, first seen on the link. Requires the host lock (see
+// lock_hosts()), under which it's discovered.
+void nd_sweep_l2host(struct interface *,const void *);
+
+// Send whatever probes the TX scheduler can take. Returns the msec until it
+// ought next be called, or -1 if there's nothing to send. Called via
+// sweep_tick().
+int nd_sweep_tick(struct interface *);
+
+// Credit a Neighbor Advertisement for this target to the sweep, if it's a
+// candidate we've solicited, and hasn't already been credited. Takes the host
+// lock, as rings' workers might credit advertisements concurrently.
+void nd_sweep_reply(struct interface *,const void *);
+
+// Returns -1 if no sweep has been started on the interface.
+int nd_sweep_stats(const struct interface *,ndsweep_stats *);
+
+void free_nd_sweep(struct interface *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <wchar.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <omphalos/arp.h>
@@ -7,9 +8,12 @@
 #include <omphalos/util.h>
 #include <omphalos/diag.h>
 #include <omphalos/ietf.h>
+#include <omphalos/slab.h>
+#include <omphalos/epoch.h>
 #include <omphalos/route.h>
 #include <omphalos/resolv.h>
 #include <omphalos/service.h>
+#include <omphalos/synscan.h>
 #include <omphalos/hwaddrs.h>
 #include <omphalos/netaddrs.h>
 #include <omphalos/omphalos.h>
@@ -19,47 +23,93 @@
 // Don't want to backoff name resolution attempts to more than 2^9s or so.
 #define MAX_BACKOFF_EXP		9
 
+// Hosts are carved from their interface's slab (see slab.h), aligned to a
+// cache line. Everything touched on the per-frame lookup and accounting path
+// comes first, so that it occupies a single line.
 typedef struct l3host {
-	wchar_t *name;
-	int fam;	// FIXME kill determine from addr relative to arenas
+	uint64_t hash;		// l3hash() of the address
 	union {
 		uint32_t ip4;
 		uint128_t ip6;
 		char mac[ETH_ALEN];
 	} addr;		// FIXME sigh
+	int fam;	// FIXME kill determine from addr relative to arenas
+	int recent;		// CLOCK reference bit
+	struct l2host *l2;	// FIXME we only keep the most recent l2host
+				// seen with this address. ought keep all, or
+				// at the very least one per interface...
+	struct l3host *next;	// next within the interface
 	uintmax_t srcpkts,dstpkts;
+	// Cold: naming, UI and eviction state
+	wchar_t *name;
 	namelevel nlevel;
 	unsigned nosrvs;	// FIXME kill oughtn't be necessary
 	// FIXME use usec-based ticks taken from the omphalos_packet *!
 	time_t nextnametry;	// next time we can attempt name resolution
 	unsigned nametries;	// number of times we've tried name resolution
 	struct l4srv *services;	// services observed providing
-	struct l3host *next;	// next within the interface
-	struct l2host *l2;	// FIXME we only keep the most recent l2host
-				// seen with this address. ought keep all, or
-				// at the very least one per interface...
+	struct l3host *prev;	// previous within the interface
+	struct l2host *uil2;	// l2host given to the first host_event
+				//  taking opaque state (the UI's parent)
 	void *opaque;		// UI state
-	struct l3host *gnext;	// next globally
-	pthread_mutex_t nlock;	// naming lock
+	int pinned;		// learned from the kernel, never evicted
+	int dead;		// unlinked and retired, under its naming lock
+	struct slab *slab;	// whence we came
+	epoch_entry retire;	// see epoch.h
 } l3host;
 
+// Naming is rare next to lookup, so rather than a mutex per host, hosts
+// share a naming lock selected by their hash.
+#define NAMELOCK_STRIPES 64	// must be a power of 2
+
+static pthread_mutex_t namelocks[NAMELOCK_STRIPES] = {
+	[0 ... NAMELOCK_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+static inline pthread_mutex_t *
+namelock(const l3host *l3){
+	return &namelocks[l3->hash & (NAMELOCK_STRIPES - 1)];
+}
+
+// The full hash is kept alongside the host, so that probing needn't chase
+// pointers but on a likely match. Empty slots have a NULL l3.
+typedef struct l3slot {
+	uint64_t hash;
+	l3host *l3;
+} l3slot;
+
+#define L3TABLE_MIN_SLOTS 64
+#define L3HOST_ALIGN 64		// a cache line
+#define L3_GLOBAL_STRIPES 16	// must be a power of 2
+
+static unsigned l3hosts_live;	// IPv4 and IPv6, across all interfaces (atomic)
+
 static l3host external_l3 = {
 	.name = L"external",
 	.fam = AF_INET,
 	.nosrvs = 1,
 }; // FIXME augh
 
+// Every interface's hosts of a family. An address seen on several interfaces
+// has a host on each. The table is split into stripes by the low bits of the
+// hash (slots are indexed by its high bits), each with its own lock, so that
+// lookups from the route and naming code rarely contend with one another, or
+// with the packet threads' insertions.
 static struct globalhosts {
-	struct l3host *head;
-	pthread_mutex_t lock;
+	struct hoststripe {
+		pthread_mutex_t lock;
+		l3table t;
+	} stripes[L3_GLOBAL_STRIPES];
 	size_t addrlen;
 } ipv4hosts = {
-	.head = NULL,
-	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.stripes = {
+		[0 ... L3_GLOBAL_STRIPES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER, },
+	},
 	.addrlen = 4,
 },ipv6hosts = {
-	.head = NULL,
-	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.stripes = {
+		[0 ... L3_GLOBAL_STRIPES - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER, },
+	},
 	.addrlen = 16,
 };
 
@@ -77,48 +127,198 @@ static l3host unspecified_ipv4 = {
 	.nosrvs = 1,
 };
 
+// Addresses of up to 128 bits (IPv4, IPv6, BSSIDs), zero-padded, folded and
+// finalized (MurmurHash3's fmix64) so that every bit reaches both ends.
+static inline uint64_t
+l3hash(const void *addr,size_t len){
+	uint64_t w[2] = { 0, 0 };
+	uint64_t h;
+
+	memcpy(w,addr,len);
+	h = w[0] ^ (w[1] * 0x9e3779b97f4a7c15ull);
+	h ^= h >> 33u;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33u;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33u;
+	return h;
+}
+
+static inline unsigned
+l3slot_idx(const l3table *t,uint64_t hash){
+	return hash >> (64 - __builtin_ctz(t->size));
+}
+
+// Returns the slot holding this address, or the empty slot ending its probe.
+static l3slot *
+l3table_probe(const l3table *t,uint64_t hash,const void *addr,size_t len){
+	unsigned idx = l3slot_idx(t,hash);
+	l3slot *s;
+
+	while( (s = &t->slots[idx])->l3 ){
+		if(s->hash == hash && memcmp(&s->l3->addr,addr,len) == 0){
+			break;
+		}
+		idx = (idx + 1) & (t->size - 1);
+	}
+	return s;
+}
+
+static l3host *
+l3table_find(const l3table *t,uint64_t hash,const void *addr,size_t len){
+	if(t->size == 0){
+		return NULL;
+	}
+	return l3table_probe(t,hash,addr,len)->l3;
+}
+
+// Keep the load factor at or below one half, so probe sequences stay short.
+static int
+l3table_reserve(l3table *t,unsigned minsize){
+	l3slot *slots,*old;
+	unsigned size,z;
+
+	if((t->count + 1) * 2 <= t->size){
+		return 0;
+	}
+	size = t->size ? t->size * 2 : minsize;
+	if((slots = calloc(size,sizeof(*slots))) == NULL){
+		return -1;
+	}
+	old = t->slots;
+	t->slots = slots;
+	z = t->size;
+	t->size = size;
+	while(z--){
+		if(old[z].l3){
+			unsigned idx = l3slot_idx(t,old[z].hash);
+
+			while(slots[idx].l3){
+				idx = (idx + 1) & (size - 1);
+			}
+			slots[idx] = old[z];
+		}
+	}
+	free(old);
+	t->hand = 0;
+	return 0;
+}
+
+// The caller must have made room with l3table_reserve(). The same address
+// can be inserted more than once (see globalhosts).
+static void
+l3table_insert(l3table *t,l3host *l3){
+	unsigned idx = l3slot_idx(t,l3->hash);
+
+	while(t->slots[idx].l3){
+		idx = (idx + 1) & (t->size - 1);
+	}
+	t->slots[idx].hash = l3->hash;
+	t->slots[idx].l3 = l3;
+	++t->count;
+}
+
+// Remove the host at this slot, closing the gap by shifting back any entries
+// which probed past it (Knuth's Algorithm R), so no tombstones are needed.
+static void
+l3table_remove_slot(l3table *t,unsigned idx){
+	const unsigned mask = t->size - 1;
+	unsigned z;
+
+	for(z = (idx + 1) & mask ; t->slots[z].l3 ; z = (z + 1) & mask){
+		const unsigned home = l3slot_idx(t,t->slots[z].hash);
+
+		// Can the entry at z move back to idx? Only if idx is no
+		// earlier in its probe sequence than its home slot.
+		if(((z - home) & mask) >= ((z - idx) & mask)){
+			t->slots[idx] = t->slots[z];
+			idx = z;
+		}
+	}
+	t->slots[idx].l3 = NULL;
+	--t->count;
+}
+
+// Remove this very host, if it's present.
+static void
+l3table_remove(l3table *t,const l3host *l3){
+	const unsigned mask = t->size - 1;
+	unsigned idx;
+
+	if(t->size == 0){
+		return;
+	}
+	for(idx = l3slot_idx(t,l3->hash) ; t->slots[idx].l3 != l3 ; idx = (idx + 1) & mask){
+		if(t->slots[idx].l3 == NULL){
+			return;
+		}
+	}
+	l3table_remove_slot(t,idx);
+}
+
 static inline struct globalhosts *
 get_global_hosts(int fam){
-	struct globalhosts *ret;
-
 	switch(fam){
 		case AF_INET:
-			ret = &ipv4hosts;
-			break;
+			return &ipv4hosts;
 		case AF_INET6:
-			ret = &ipv6hosts;
-			break;
-		default:
-			ret = NULL;
-			break;
+			return &ipv6hosts;
+	}
+	return NULL;
+}
+
+// Returns the stripe of the family's global table for this hash, locked.
+static inline struct hoststripe *
+lock_global_stripe(int fam,uint64_t hash){
+	struct globalhosts *gh;
+	struct hoststripe *hs;
+
+	if((gh = get_global_hosts(fam)) == NULL){
+		return NULL;
 	}
-	if(ret){
-		if(pthread_mutex_lock(&ret->lock)){
-			ret = NULL;
+	hs = &gh->stripes[hash & (L3_GLOBAL_STRIPES - 1)];
+	if(pthread_mutex_lock(&hs->lock)){
+		return NULL;
+	}
+	return hs;
+}
+
+// l3hosts pin the l2hosts they refer to against eviction (see hostcap.h).
+static inline void
+l3_set_l2(struct l2host **ref,struct l2host *l2){
+	if(*ref != l2){
+		if(*ref){
+			l2_release(*ref);
 		}
+		if(l2){
+			l2_retain(l2);
+		}
+		*ref = l2;
 	}
-	return ret;
 }
 
-// FIXME like the l2addrs, need do this in constant space via LRU or something
+// Bounded in number by hostcap.h. Requires the host lock (see lock_hosts()).
 static l3host *
-create_l3host(int fam,const void *addr,size_t len){
+create_l3host(interface *i,int fam,const void *addr,size_t len,uint64_t hash){
 	l3host *r;
 
 	assert(len <= sizeof(r->addr));
-	if( (r = Malloc(sizeof(*r))) ){
-		struct globalhosts *gh;
-		int ret;
-
-		if( (ret = pthread_mutex_init(&r->nlock,NULL)) ){
-			diagnostic("%s couldn't initialize mutex (%s?)",
-					__func__,strerror(ret));
-			free(r);
+	if(i->l3slab == NULL){
+		if((i->l3slab = create_slab(sizeof(*r),L3HOST_ALIGN)) == NULL){
+			diagnostic("%s couldn't create slab on %s",__func__,i->name);
 			return NULL;
 		}
+	}
+	if( (r = slab_alloc(i->l3slab)) ){
+		struct hoststripe *hs;
+
+		r->slab = i->l3slab;
+		r->dead = 0;
 		r->opaque = NULL;
 		r->name = NULL;
-		r->l2 = NULL;
+		r->l2 = r->uil2 = NULL;
+		r->recent = 1;
+		r->pinned = 0;
 		r->fam = fam;
 		r->srcpkts = r->dstpkts = 0;
 		r->nlevel = 0;
@@ -127,12 +327,15 @@ create_l3host(int fam,const void *addr,size_t len){
 		r->nextnametry = 0;
 		r->nametries = 0;
 		memcpy(&r->addr,addr,len);
-		if( (gh = get_global_hosts(fam)) ){
-			r->gnext = gh->head;
-			gh->head = r;
-			pthread_mutex_unlock(&gh->lock);
-		}else{
-			r->gnext = NULL;
+		r->hash = hash;
+		if( (hs = lock_global_stripe(fam,hash)) ){
+			if(l3table_reserve(&hs->t,L3TABLE_MIN_SLOTS / 4) == 0){
+				l3table_insert(&hs->t,r);
+				__atomic_add_fetch(&l3hosts_live,1,__ATOMIC_RELAXED);
+			}else{
+				diagnostic("%s couldn't grow global table",__func__);
+			}
+			pthread_mutex_unlock(&hs->lock);
 		}
 	}
 	return r;
@@ -163,8 +366,9 @@ void name_l3host_absolute(const interface *i,struct l2host *l2,l3host *l3,
 
 void wname_l3host_absolute(const interface *i,struct l2host *l2,l3host *l3,
 				const wchar_t *name,namelevel nlevel){
-	pthread_mutex_lock(&l3->nlock);
-	if(l3->nlevel < nlevel){
+	pthread_mutex_lock(namelock(l3));
+	// A reader of the global table might name a host as it's retired
+	if(!l3->dead && l3->nlevel < nlevel){
 		wchar_t *tmp;
 
 		if( (tmp = wcsdup(name)) ){
@@ -175,44 +379,44 @@ void wname_l3host_absolute(const interface *i,struct l2host *l2,l3host *l3,
 			l3->nlevel = nlevel;
 			if(octx->iface.host_event){
 				l3->opaque = octx->iface.host_event(i,l2,l3);
+				if(l3->opaque && l3->uil2 == NULL){
+					l3_set_l2(&l3->uil2,l2);
+				}
 			}
 		}
 	}
-	pthread_mutex_unlock(&l3->nlock);
+	pthread_mutex_unlock(namelock(l3));
 }
 
 // An interface-scoped lookup without lower-level information. It doesn't
 // create a new entry if none exists. No support for BSSID lookup.
 struct l3host *find_l3host(interface *i,int fam,const void *addr){
-        l3host *l3;
-	typeof(l3->addr) cmp;
+	const l3table *t;
+	l3host *l3;
 	size_t len;
 
 	switch(fam){
 		case AF_INET:
 			len = 4;
-			l3 = i->ip4hosts;
+			t = &i->ip4hosts;
 			break;
 		case AF_INET6:
 			len = 16;
-			l3 = i->ip6hosts;
+			t = &i->ip6hosts;
 			break;
 		default:
 			return NULL; // FIXME
 	}
-	assert(len <= sizeof(cmp));
-	memcpy(&cmp,addr,sizeof(cmp));
-	while(l3){
-		if(memcmp(&l3->addr,&cmp,len) == 0){
-			return l3;
-		}
-		l3 = l3->next;
+	lock_hosts(i);
+	if( (l3 = l3table_find(t,l3hash(addr,len),addr,len)) ){
+		l3->recent = 1;
 	}
-	return NULL;
+	unlock_hosts(i);
+	return l3;
 }
 
 static inline void
-update_l3name(const struct timeval *tv,struct l2host *l2,l3host *l3,
+update_l3name(time_t now,struct l2host *l2,l3host *l3,
 		dnstxfxn dnsfxn,char *(*revstrfxn)(const void *),int cat,
 		const void *addr,interface *i,int fam){
 	char *rev;
@@ -224,7 +428,7 @@ update_l3name(const struct timeval *tv,struct l2host *l2,l3host *l3,
 	if(l3->name && l3->nlevel > NAMING_LEVEL_NXDOMAIN){
 		return;
 	}else if(l3->nlevel <= NAMING_LEVEL_NXDOMAIN){
-		if(tv->tv_sec <= l3->nextnametry){
+		if(now <= l3->nextnametry){
 			return;
 		}
 	}
@@ -236,7 +440,7 @@ update_l3name(const struct timeval *tv,struct l2host *l2,l3host *l3,
 	}
 	++l3->nametries;
 	// FIXME add a random factor to avoid thundering herds!
-	l3->nextnametry = tv->tv_sec + (1u << (l3->nametries > MAX_BACKOFF_EXP ?
+	l3->nextnametry = now + (1u << (l3->nametries > MAX_BACKOFF_EXP ?
 					MAX_BACKOFF_EXP : l3->nametries));
 	if(queue_for_naming(i,l3,dnsfxn,rev,fam,addr)){
 		wname_l3host_absolute(i,l2,l3,L"Resolution failed",NAMING_LEVEL_FAIL);
@@ -244,14 +448,15 @@ update_l3name(const struct timeval *tv,struct l2host *l2,l3host *l3,
 	free(rev);
 }
 
-// Interface lock needs be held upon entry
+// Host lock needs be held upon entry (see lock_hosts())
 static l3host *
-lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
+lookup_l3host_common(time_t now,interface *i,struct l2host *l2,
 			int fam,const void *addr,int knownlocal){
 	char *(*revstrfxn)(const void *);
-        l3host *l3,**prev,**orig;
-	typeof(l3->addr) cmp;
 	dnstxfxn dnsfxn;
+	uint64_t hash;
+	l3table *t;
+	l3host *l3;
 	size_t len;
 	int cat;
 
@@ -260,7 +465,7 @@ lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
 			const uint32_t zaddr = 0;
 
 			len = 4;
-			orig = &i->ip4hosts;
+			t = &i->ip4hosts;
 			dnsfxn = tx_dns_ptr;
 			revstrfxn = rev_dns_a;
 			if(memcmp(addr,&zaddr,len) == 0){
@@ -271,7 +476,7 @@ lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
 			const uint128_t zaddr = ZERO128;
 
 			len = 16;
-			orig = &i->ip6hosts;
+			t = &i->ip6hosts;
 			dnsfxn = tx_dns_ptr;
 			revstrfxn = rev_dns_aaaa;
 			if(memcmp(addr,&zaddr,len) == 0){
@@ -280,7 +485,7 @@ lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
 			break;
 		}case AF_BSSID:{
 			len = ETH_ALEN;
-			orig = &i->cells;
+			t = &i->cells;
 			dnsfxn = NULL;
 			revstrfxn = NULL;
 			break;
@@ -291,18 +496,13 @@ lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
 	}
 	cat = l2categorize(i,l2);
 	// FIXME probably want to make this per-node
-	assert(len <= sizeof(cmp));
-	memcpy(&cmp,addr,len);
-	for(prev = orig ; (l3 = *prev) ; prev = &l3->next){
-		if(memcmp(&l3->addr,&cmp,len) == 0){
-			// Move it to the front of the list, splicing it out
-			*prev = l3->next;
-			l3->next = *orig;
-			*orig = l3;
-			l3->l2 = l2; // FIXME ought indicate a change!
-			update_l3name(tv,l2,l3,dnsfxn,revstrfxn,cat,addr,i,fam);
-			return l3;
-		}
+	hash = l3hash(addr,len);
+	if( (l3 = l3table_find(t,hash,addr,len)) ){
+		l3_set_l2(&l3->l2,l2); // FIXME ought indicate a change!
+		l3->recent = 1;
+		l3->pinned |= knownlocal;
+		update_l3name(now,l2,l3,dnsfxn,revstrfxn,cat,addr,i,fam);
+		return l3;
 	}
 	if(!(i->flags & IFF_NOARP) && !knownlocal){
 		if(cat == RTN_UNICAST || cat == RTN_LOCAL){
@@ -311,9 +511,9 @@ lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
 			// Determine whether there's a known route
 			if(get_unicast_address(i,fam,addr,&ss) == NULL){
 				if(fam == AF_INET){
-					// Issue a non-destructive ARP probe
-					// FIXME need rate-limiting!
-					//send_arp_probe(i,addr);
+					// Issue a non-destructive ARP probe,
+					// paced with the other sweeps
+					send_arp_probe(i,addr);
 				}
 				return &external_l3;
 			}
@@ -323,12 +523,21 @@ lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
 			}
 		}
 	}
-        if( (l3 = create_l3host(fam,addr,len)) ){
+	if(l3table_reserve(t,L3TABLE_MIN_SLOTS)){
+		diagnostic("%s couldn't grow table on %s",__func__,i->name);
+		return NULL;
+	}
+        if( (l3 = create_l3host(i,fam,addr,len,hash)) ){
 		char *rev;
 
-                l3->next = *orig;
-                *orig = l3;
-		l3->l2 = l2;
+		l3table_insert(t,l3);
+		l3->prev = NULL;
+                if( (l3->next = t->list) ){
+			l3->next->prev = l3;
+		}
+                t->list = l3;
+		l3_set_l2(&l3->l2,l2);
+		l3->pinned = knownlocal;
 		// handle 127.0.0.1 and ::1 as special cases, but look up local
 		// addresses otherwise. multicast and broadcast are only named
 		// via special case static lookups.
@@ -359,7 +568,7 @@ lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
 				// Calls the host event if necessary
 				wname_l3host_absolute(i,l2,l3,L"Resolving...",NAMING_LEVEL_RESOLVING);
 				++l3->nextnametry;
-				l3->nextnametry = tv->tv_sec + 1;
+				l3->nextnametry = now + 1;
 				if(queue_for_naming(i,l3,dnsfxn,rev,fam,addr)){
 					wname_l3host_absolute(i,l2,l3,L"Resolution failed",NAMING_LEVEL_FAIL);
 				}
@@ -368,31 +577,37 @@ lookup_l3host_common(const struct timeval *tv,interface *i,struct l2host *l2,
 			if(is_router(fam,addr)){
 				observe_service(i,l2,l3,IPPROTO_IP,4,L"Router",NULL);
 			}
+			// Verified on-link above
+			if(cat == RTN_UNICAST && fam != AF_BSSID && !knownlocal &&
+					!(i->flags & IFF_NOARP)){
+				syn_scan_host(i,l2,fam,addr);
+			}
 		}
         }
         return l3;
 }
 
-// Browse the global list. Don't create the host if it doesn't exist. Since
-// references are handed out without a lock held, we cannot destroy an l3host
-// which is on the global list! This is fundamentally unsafe, really FIXME.
+// Browse the global table. Don't create the host if it doesn't exist. The
+// reference is handed out without a lock held; hosts are only destroyed via
+// epoch_retire(), so it remains valid until the calling thread next passes
+// through a quiescent state (see epoch.h). The host might meanwhile have been
+// evicted, or its interface destroyed, in which case it's marked dead.
 struct l3host *lookup_global_l3host(int fam,const void *addr){
 	struct globalhosts *gh;
+	struct hoststripe *hs;
+	uint64_t hash;
 	l3host *l3;
-	typeof(l3->addr) cmp;
 
-	// locks the globalhosts entry on success
 	if((gh = get_global_hosts(fam)) == NULL){
 		return NULL;
 	}
-	assert(gh->addrlen <= sizeof(cmp));
-	memcpy(&cmp,addr,gh->addrlen);
-	for(l3 = gh->head ; l3 ; l3 = l3->gnext){
-		if(memcmp(&l3->addr,&cmp,gh->addrlen) == 0){
-			break;
-		}
+	hash = l3hash(addr,gh->addrlen);
+	// locks the stripe on success
+	if((hs = lock_global_stripe(fam,hash)) == NULL){
+		return NULL;
 	}
-	pthread_mutex_unlock(&gh->lock);
+	l3 = l3table_find(&hs->t,hash,addr,gh->addrlen);
+	pthread_mutex_unlock(&hs->lock);
 	return l3;
 }
 
@@ -403,28 +618,30 @@ struct l3host *lookup_global_l3host(int fam,const void *addr){
 // returned is different from the wire address, an ARP probe is directed to the
 // link-layer address (this is all handled by get_route()). ARP replies are
 // link-layer only, and thus processed directly (name_l2host_local()).
-l3host *lookup_l3host(const struct timeval *tv,interface *i,struct l2host *l2,
+l3host *lookup_l3host(uint64_t ns,interface *i,struct l2host *l2,
 				int fam,const void *addr){
-	struct timeval t;
+	l3host *l3;
 
-	if(tv){
-		t = *tv;
-	}else{
-		gettimeofday(&t,NULL);
+	if(ns == 0){
+		ns = now_ns();
 	}
-	return lookup_l3host_common(&t,i,l2,fam,addr,0);
+	lock_hosts(i);
+	l3 = lookup_l3host_common(ns / NSEC_PER_SEC,i,l2,fam,addr,0);
+	unlock_hosts(i);
+	return l3;
 }
 
-l3host *lookup_local_l3host(const struct timeval *tv,interface *i,
+l3host *lookup_local_l3host(uint64_t ns,interface *i,
 			struct l2host *l2,int fam,const void *addr){
-	struct timeval t;
+	l3host *l3;
 
-	if(tv){
-		t = *tv;
-	}else{
-		gettimeofday(&t,NULL);
+	if(ns == 0){
+		ns = now_ns();
 	}
-	return lookup_l3host_common(&t,i,l2,fam,addr,1);
+	lock_hosts(i);
+	l3 = lookup_l3host_common(ns / NSEC_PER_SEC,i,l2,fam,addr,1);
+	unlock_hosts(i);
+	return l3;
 }
 
 void name_l3host_local(const interface *i,struct l2host *l2,l3host *l3,int family,const void *name,
@@ -502,26 +719,143 @@ int l3ntop(const l3host *l3,char *buf,size_t buflen){
 	return inet_ntop(l3->fam,&l3->addr,buf,buflen) != buf;
 }
 
-void cleanup_l3hosts(l3host **list){
+// Take the host out of the global table, returning whether it was there.
+static int
+unlist_global_l3host(l3host *l3){
+	struct hoststripe *hs;
+	unsigned count;
+
+	if((hs = lock_global_stripe(l3->fam,l3->hash)) == NULL){
+		return 0;
+	}
+	count = hs->t.count;
+	l3table_remove(&hs->t,l3);
+	count -= hs->t.count;
+	pthread_mutex_unlock(&hs->lock);
+	if(count){
+		__atomic_sub_fetch(&l3hosts_live,1,__ATOMIC_RELAXED);
+	}
+	return count;
+}
+
+// Invoked once no reader can hold the host (see epoch.h).
+static void
+free_l3host(epoch_entry *e){
+	l3host *l3 = (l3host *)((char *)e - offsetof(l3host,retire));
+
+	free_services(l3->services);
+	free(l3->name);
+	slab_free(l3->slab,l3);
+}
+
+// CLOCK over the table's slots, as evict_l2hosts(). Evicts at most one host,
+// returning whether it did.
+static int
+evict_l3host(interface *i,l3table *t){
+	const omphalos_ctx *octx = get_octx();
+	unsigned steps;
+	l3host *l3;
+
+	for(steps = 0 ; t->count && steps < t->size * 2 ; ++steps){
+		if( (l3 = t->slots[t->hand].l3) && !l3->pinned){
+			if(!l3->recent){
+				break;
+			}
+			l3->recent = 0;
+		}
+		t->hand = (t->hand + 1) & (t->size - 1);
+	}
+	if(t->count == 0 || steps >= t->size * 2){
+		return 0;
+	}
+	l3table_remove_slot(t,t->hand);
+	unlist_global_l3host(l3);
+	if(l3->prev){
+		l3->prev->next = l3->next;
+	}else{
+		t->list = l3->next;
+	}
+	if(l3->next){
+		l3->next->prev = l3->prev;
+	}
+	pthread_mutex_lock(namelock(l3));
+	l3->dead = 1;
+	pthread_mutex_unlock(namelock(l3));
+	// Services go with the host, without their own callbacks
+	if(octx->iface.host_evicted){
+		octx->iface.host_evicted(i,l3->uil2 ? l3->uil2 : l3->l2,l3,l3->opaque);
+	}
+	// Our nodes can now be evicted in turn. Global readers might yet
+	// load them through us, but evicted nodes are retired too, and thus
+	// remain valid until such readers quiesce.
+	l3_set_l2(&l3->uil2,NULL);
+	l3_set_l2(&l3->l2,NULL);
+	epoch_retire(&l3->retire,free_l3host);
+	return 1;
+}
+
+unsigned evict_l3hosts(interface *i,unsigned n){
+	l3table *tabs[] = { &i->ip4hosts, &i->ip6hosts, &i->cells, };
+	unsigned evicted = 0;
+
+	while(evicted < n){
+		l3table *t;
+		unsigned z;
+
+		// Try the fullest table first, falling back to the others
+		// should all its hosts be pinned or busy
+		for(z = 0 ; z < sizeof(tabs) / sizeof(*tabs) - 1 ; ++z){
+			unsigned y;
+
+			for(y = z + 1 ; y < sizeof(tabs) / sizeof(*tabs) ; ++y){
+				if(tabs[y]->count > tabs[z]->count){
+					t = tabs[z];
+					tabs[z] = tabs[y];
+					tabs[y] = t;
+				}
+			}
+		}
+		for(z = 0 ; z < sizeof(tabs) / sizeof(*tabs) ; ++z){
+			if(evict_l3host(i,tabs[z])){
+				break;
+			}
+		}
+		if(z == sizeof(tabs) / sizeof(*tabs)){
+			break;
+		}
+		++evicted;
+	}
+	return evicted;
+}
+
+unsigned count_l3hosts(void){
+	return __atomic_load_n(&l3hosts_live,__ATOMIC_RELAXED);
+}
+
+// The nodes go along with their interface (see cleanup_l2hosts()), and
+// needn't be released.
+void cleanup_l3hosts(l3table *t){
 	l3host *l3,*tmp;
 
-	for(l3 = *list ; l3 ; l3 = tmp){
+	for(l3 = t->list ; l3 ; l3 = tmp){
 		tmp = l3->next;
-		pthread_mutex_destroy(&l3->nlock);
-		free_services(l3->services);
-		free(l3->name);
-		free(l3);
+		unlist_global_l3host(l3);
+		pthread_mutex_lock(namelock(l3));
+		l3->dead = 1;
+		pthread_mutex_unlock(namelock(l3));
+		epoch_retire(&l3->retire,free_l3host);
 	}
-	*list = NULL;
-	// FIXME ensure all globall3host lists are empty
+	free(t->slots);
+	memset(t,0,sizeof(*t));
 }
 
+// Several rings' workers might see the same host at once.
 void l3_srcpkt(l3host *l3){
-	++l3->srcpkts;
+	__atomic_add_fetch(&l3->srcpkts,1,__ATOMIC_RELAXED);
 }
 
 void l3_dstpkt(l3host *l3){
-	++l3->dstpkts;
+	__atomic_add_fetch(&l3->dstpkts,1,__ATOMIC_RELAXED);
 }
 
 uintmax_t l3_get_srcpkt(const l3host *l3){
@@ -12,6 +12,7 @@ extern "C" {
 
 struct l2host;
 struct l3host;
+struct l3slot;
 struct interface;
 
 #define AF_BSSID (AF_MAX + 1)
@@ -38,15 +39,30 @@ typedef enum {
 	NAMING_LEVEL_MAX
 } namelevel;
 
+// An open-addressed hash of l3hosts, keyed on their addresses (IPv4, IPv6 or
+// BSSID). Each interface has one per family, protected by its host lock (see
+// lock_hosts()); the global tables are striped across several of these. Since
+// lookup_global_l3host() hands out unlocked references, evicted and cleaned
+// up hosts are retired to epoch.h rather than freed. A zeroed l3table is a
+// valid, empty table.
+typedef struct l3table {
+	struct l3slot *slots;	// linear probing, power-of-2 entries
+	unsigned size;		// entries in slots
+	unsigned count;		// hosts in the table
+	unsigned hand;		// CLOCK hand, a slot index (see hostcap.h)
+	struct l3host *list;	// all hosts, newest first (interface tables)
+} l3table;
+
 // Look up an l3 address, creating an l3host if the address isn't known on
 // this l2host. A route check will be performed; if no local route to this host
-// exists, an ARP request will be issued rather than adding the host.
-struct l3host *lookup_l3host(const struct timeval *tv,struct interface *,
+// exists, an ARP request will be issued rather than adding the host. The
+// timestamp (ns since the epoch) drives naming retries; 0 means "now".
+struct l3host *lookup_l3host(uint64_t,struct interface *,
 				struct l2host *,int,const void *);
 
 // Look up an l3 address known to be local (perhaps we got it from the host's
 // ARP cache, or it's our own address). No ARP/route lookup will be performed.
-struct l3host *lookup_local_l3host(const struct timeval *tv,struct interface *,
+struct l3host *lookup_local_l3host(uint64_t,struct interface *,
 					struct l2host *,int,const void *);
 
 // Look up an l3 address on this interface, ignoring l2host information. Does
@@ -73,7 +89,15 @@ char *netaddrstr(int,const void *) __attribute__ ((nonnull (2)));
 // Get a string representation of the l3host's network address
 int l3ntop(const struct l3host *,char *,size_t) __attribute__ ((nonnull (1,2)));
 
-void cleanup_l3hosts(struct l3host **list) __attribute__ ((nonnull (1)));
+// Frees the table's hosts, having removed them from the global tables.
+void cleanup_l3hosts(l3table *) __attribute__ ((nonnull (1)));
+
+// Evict up to this many idle l3hosts from the interface, from its fullest
+// tables first. Returns the number evicted. Requires the interface lock.
+unsigned evict_l3hosts(struct interface *,unsigned) __attribute__ ((nonnull (1)));
+
+// IPv4 and IPv6 l3hosts across all interfaces
+unsigned count_l3hosts(void);
 
 // Accessors
 const wchar_t *get_l3name(const struct l3host *) __attribute__ ((nonnull (1)));
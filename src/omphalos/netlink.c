@@ -18,7 +18,10 @@
 #include <linux/if_addr.h>
 #include <linux/netlink.h>
 #include <linux/version.h>
+#include <omphalos/tx.h>
+#include <omphalos/xdp.h>
 #include <omphalos/diag.h>
+#include <omphalos/epoch.h>
 #include <omphalos/route.h>
 #include <omphalos/sysfs.h>
 #include <linux/rtnetlink.h>
@@ -29,13 +32,23 @@
 #include <omphalos/ethtool.h>
 #include <omphalos/hwaddrs.h>
 #include <omphalos/psocket.h>
+#include <omphalos/hostcap.h>
+#include <omphalos/rxpool.h>
+#include <omphalos/affinity.h>
 #include <omphalos/netaddrs.h>
+#include <omphalos/txsched.h>
 #include <omphalos/wireless.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/interface.h>
 
 #define OFFLOAD_MTU (32678 - (int)TPACKET2_HDRLEN)
 
+// Adaptive RX rings double on loss and halve when idle, staying within a
+// factor of 1 << RING_ADAPT_SHIFT of the configured size. A ring is idle once
+// RING_IDLE_USECS pass without a frame.
+#define RING_ADAPT_SHIFT 3u
+#define RING_IDLE_USECS (60 * 1000000)
+
 // External cancellation, tested in input-handling loops. This only works
 // without a mutex lock (memory barrier, more precisely) because we
 // restrict signal handling to the input-handling threads (via initial
@@ -197,7 +210,7 @@ handle_rtm_newneigh(const struct nlmsghdr *nl){
 			lock_interface(iface);
 			l2 = lookup_l2host(iface,ll);
 			if(ad){
-				lookup_local_l3host(NULL,iface,l2,nd->ndm_family,ad);
+				lookup_local_l3host(0,iface,l2,nd->ndm_family,ad);
 			}
 			unlock_interface(iface);
 		}
@@ -414,36 +427,186 @@ typedef struct psocket_marsh {
 	pthread_cond_t cond;
 	pthread_mutex_t lock;
 	pthread_t tid;
+	// The RX ring serviced by this thread. The first thread services the
+	// interface's own ring (i->rfd, i->rxm etc). In fanout mode, each
+	// further thread owns a ring of its own, and is chained via next.
+	int fd;
+	void *rxm;
+	size_t rs;
+	struct tpacket_req rtpr;
+	int rtpver;
+	unsigned idx;		// index of next frame (V1) or block (V3)
+	void *cur;		// address of next frame or block
+	unsigned mtu;		// max frame the ring was sized for
+	size_t minring,maxring;	// adaptive sizing bounds, 0 if not adaptive
+	int grow;		// losses were seen; grow when next quiescent
+	unsigned idleticks;	// consecutive poll timeouts without frames
+	struct rxpool_reg *preg;// set if serviced by the worker pool (no tid)
+	struct xsk *xsk;	// set for an AF_XDP socket (fd is owned by i->xdp)
+	rxworker w;		// analysis state, listed given several rings
+	struct psocket_marsh *next;
 } psocket_marsh;
 
+static inline int
+ring_ready(const psocket_marsh *pm){
+	if(pm->xsk){
+		return xsk_ready(pm->xsk);
+	}
+	if(pm->rtpver == TPACKET_V3){
+		return ring_block_ready(pm->cur);
+	}
+	return ring_frame_ready(pm->cur);
+}
+
+// Analyze up to ctx->rxbatch TPACKET_V1 frames or XSK descriptors, or a
+// single TPACKET_V3 block.
+// We'll wait on the first frame (block) if necessary, but the remainder of a
+// batch is only taken if ready. A batch is cut short should anyone want the
+// interface. The worker's lock must be held upon entry. With several rings
+// (fanout, or an XSK per queue), each runs under its own worker's lock, and
+// they analyze in parallel, meeting only on the host lock (see rxworker).
 static int
-ring_packet_loop(psocket_marsh *pm){
-	// FIXME either send pm and nothing or everything else this aliases
-	unsigned idx = 0;
-	void *rxm;
+ring_batch(psocket_marsh *pm){
+	const unsigned batch = pm->ctx->rxbatch ? pm->ctx->rxbatch : 1;
+	unsigned n = 0;
+	int r;
+
+	if(pm->xsk){
+		r = handle_xsk_batch(&pm->w,pm->xsk,batch);
+	}else if(pm->rtpver == TPACKET_V3){
+		if((r = handle_ring_block(&pm->w,pm->fd,pm->cur)) == 0){
+			pm->cur += incblock(&pm->idx,&pm->rtpr);
+		}
+	}else do{
+		if((r = handle_ring_packet(&pm->w,pm->fd,pm->cur)) == 0){
+			pm->cur += inclen(&pm->idx,&pm->rtpr);
+		}
+	}while(r == 0 && ++n < batch && ring_frame_ready(pm->cur) &&
+			!interface_contended(pm->i));
+	// Losses are counted by the worker, and thus were ours.
+	if(pm->w.drops){
+		pm->grow = 1;
+	}
+	if(fold_rx_stats(&pm->w)){
+		pm->idleticks = 0;
+	}else if(r == 1){
+		++pm->idleticks;
+	}
+	trim_rx_hosts(&pm->w);
+	return r;
+}
+
+// Adaptive sizing: grow a lossy ring, or shrink an idle one. This must only
+// be called by whoever services the ring, with the worker's lock held (once),
+// and only once everything it's taken has been returned. The kernel might be
+// filling a frame (or V3 block) as we pull the ring out from under it; the
+// few such frames lost are the price of the resize. The interface's own ring
+// is mirrored into the interface, so it's resized with the interface held:
+// a lone ring's worker has it already, but a listed one must take it.
+static int
+ring_adapt(psocket_marsh *pm){
+	const int mirrored = pm->fd == pm->i->rfd && pm->w.lock != &pm->i->lock;
+	size_t target,rs;
 
-	rxm = pm->i->rxm;
+	if(pm->maxring == 0 || ring_ready(pm)){
+		return 0;
+	}
+	if(pm->grow){
+		pm->grow = 0;
+		if(pm->rs >= pm->maxring){
+			return 0;
+		}
+		target = pm->rs * 2 > pm->maxring ? pm->maxring : pm->rs * 2;
+	}else if(pm->idleticks >= RING_IDLE_USECS / IFACE_TIMESTAT_USECS){
+		pm->idleticks = 0;
+		if(pm->rs / 2 < pm->minring){
+			return 0;
+		}
+		target = pm->rs / 2;
+	}else{
+		return 0;
+	}
+	if(mirrored){
+		pthread_mutex_unlock(pm->w.lock);
+		lock_interface(pm->i);
+	}
+	prefer_node(pm->i->numanode);
+	rs = resize_rx_psocket(&pm->w,pm->fd,pm->rtpver,pm->mtu,target,
+					&pm->rxm,pm->rs,&pm->rtpr);
+	if(pm->i->numanode >= 0){
+		default_node();
+	}
+	if(rs != pm->rs){
+		diagnostic("Resized %s RX ring %zu->%zub",pm->i->name,pm->rs,rs);
+	}
+	pm->rs = rs;
+	pm->cur = pm->rxm;
+	pm->idx = 0;
+	if(pm->fd == pm->i->rfd){
+		pm->i->rxm = pm->rxm;
+		pm->i->rs = pm->rs;
+		pm->i->rtpr = pm->rtpr;
+	}
+	if(mirrored){
+		unlock_interface(pm->i);
+		pthread_mutex_lock(pm->w.lock);
+	}
+	return rs ? 0 : -1;
+}
+
+static int
+ring_packet_loop(psocket_marsh *pm){
 	while(!pm->cancelled){
 		int r;
 
-		if( (r = pthread_mutex_lock(&pm->i->lock)) ){
+		if( (r = pthread_mutex_lock(pm->w.lock)) ){
 			diagnostic("Couldn't lock %s (%s?)",pm->i->name,strerror(r));
 			return -1;
 		}
-		if((r = handle_ring_packet(pm->i,pm->i->rfd,rxm)) == 0){
-			rxm += inclen(&idx,&pm->i->rtpr);
-		}else if(r < 0){
-			pthread_mutex_unlock(&pm->i->lock);
+		if(ring_batch(pm) < 0 || ring_adapt(pm)){
+			pthread_mutex_unlock(pm->w.lock);
 			return -1;
 		}
-		if( (r = pthread_mutex_unlock(&pm->i->lock)) ){
+		if( (r = pthread_mutex_unlock(pm->w.lock)) ){
 			diagnostic("Couldn't unlock %s (%s?)",pm->i->name,strerror(r));
 			return -1;
 		}
+		epoch_quiescent();
+		// Let any waiters through first (see await_interface()).
+		if(interface_contended(pm->i)){
+			await_interface(pm->i);
+		}
 	}
 	return 0;
 }
 
+// Worker pool callback (see rxpool.h): analyze what's ready on the ring,
+// without blocking. We bound the work done per dispatch, so that one busy
+// ring can't monopolize a worker; if anything remains, epoll will hand it
+// right back out. We're never woken for an idle ring, so pooled rings only
+// ever grow.
+#define RXPOOL_MAX_BATCHES 16
+static int
+ring_drain(void *unsafe){
+	psocket_marsh *pm = unsafe;
+	unsigned batches = 0;
+	int r = 0;
+
+	pthread_mutex_lock(pm->w.lock);
+	while(ring_ready(pm) && batches++ < RXPOOL_MAX_BATCHES){
+		if((r = ring_batch(pm)) < 0){
+			break;
+		}
+		yield_rxworker(&pm->w);
+	}
+	if(r >= 0){
+		r = ring_adapt(pm);
+	}
+	pthread_mutex_unlock(pm->w.lock);
+	return r < 0 ? -1 : 0;
+}
+#undef RXPOOL_MAX_BATCHES
+
 static void *
 psocket_thread(void *unsafe){
 	psocket_marsh *pm = unsafe;
@@ -452,12 +615,19 @@ psocket_thread(void *unsafe){
 	if(pthread_setspecific(omphalos_ctx_key,pm->ctx)){
 		return "couldn't set TSD";
 	}
+	if(CPU_COUNT(&pm->i->rxcpus)){
+		pin_thread(&pm->i->rxcpus);
+	}
 	// We control thread exit via the global cancelled value, set in the
 	// signal handler. We don't want actual pthread cancellation, as it's
 	// unsafe for the user callback's duration, and thus we'd need switch
 	// between enabled and disabled status.
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+	if(epoch_register()){
+		return "couldn't register with the reclaimer";
+	}
 	r = ring_packet_loop(pm);
+	epoch_unregister();
 	// 'cancelled' has been set globally. We must ensure that our death
 	// signal has been sent before safely exiting.
 	pthread_mutex_lock(&pm->lock);
@@ -468,8 +638,39 @@ psocket_thread(void *unsafe){
 	return r ? "calamitous error" : PTHREAD_CANCELED;
 }
 
+// Start servicing the ring, either via a thread of its own or the pool.
+static int
+launch_ring(psocket_marsh *pm){
+	pm->cur = pm->rxm;
+	pm->idx = 0;
+	if(rxpool_active()){
+		if((pm->preg = rxpool_add(pm->fd,ring_drain,pm)) == NULL){
+			return -1;
+		}
+		return 0;
+	}
+	if(pthread_create(&pm->tid,NULL,psocket_thread,pm)){
+		return -1;
+	}
+	return 0;
+}
+
+// The interface's own ring (that of the first psocket_marsh) and any XSKs
+// are closed by our callers; further fanout rings are torn down here. A
+// listed worker is unlisted, for which the interface must be held via
+// lock_interface().
 static void
 pmarsh_destroy(psocket_marsh *pm){
+	if(pm->w.lock != &pm->i->lock){
+		unlist_rxworker(pm->i,&pm->w);
+	}
+	free(pm->w.truncbuf);
+	if(pm->fd >= 0 && pm->fd != pm->i->rfd && !pm->xsk){
+		if(pm->rs){
+			unmap_psocket(pm->rxm,pm->rs);
+		}
+		close(pm->fd);
+	}
 	if( (errno = pthread_cond_destroy(&pm->cond)) ){
 		diagnostic("Error cleaning condvar: %s",strerror(errno));
 	}
@@ -480,6 +681,7 @@ pmarsh_destroy(psocket_marsh *pm){
 }
 
 void reap_thread(interface *i){
+	psocket_marsh *pm;
 	void *ret;
 
 	// See psocket_thread(); we disable pthread cancellation. Send a
@@ -495,35 +697,69 @@ void reap_thread(interface *i){
 	//  - we use a condvar signal (safe) to wake it up following
 	//  - the thread wakes, dies, and is joined
 	//  - we safely close the fd and free the pmarsh
-	pthread_mutex_lock(&i->pmarsh->lock);
-		if(!i->pmarsh->cancelled){
-			if( (errno = pthread_kill(i->pmarsh->tid,SIGCHLD)) ){
-				diagnostic("Couldn't signal thread (%s?)",strerror(errno));
-			} // FIXME check return codes here
-			i->pmarsh->cancelled = 1;
+	//
+	// In fanout mode, we signal each thread before joining any of them.
+	// Rings serviced by the worker pool need merely be deregistered. We're
+	// called with the interface held via lock_interface(), and thus with
+	// every listed worker's lock, which must be released for it to exit.
+	for(pm = i->pmarsh ; pm ; pm = pm->next){
+		if(pm->preg){
+			continue;
+		}
+		pthread_mutex_lock(&pm->lock);
+			if(!pm->cancelled){
+				if( (errno = pthread_kill(pm->tid,SIGCHLD)) ){
+					diagnostic("Couldn't signal thread (%s?)",strerror(errno));
+				} // FIXME check return codes here
+				pm->cancelled = 1;
+			}
+		pthread_cond_signal(&pm->cond);
+		pthread_mutex_unlock(&pm->lock);
+	}
+	unlock_interface(i);
+	for(pm = i->pmarsh ; pm ; pm = pm->next){
+		if(pm->preg){
+			rxpool_del(pm->preg);
+			pm->preg = NULL;
+			continue;
 		}
-	pthread_cond_signal(&i->pmarsh->cond);
-	pthread_mutex_unlock(&i->pmarsh->lock);
-	pthread_mutex_unlock(&i->lock);
-	if( (errno = pthread_join(i->pmarsh->tid,&ret)) ){
-		diagnostic("Couldn't join thread (%s?)",strerror(errno));
-	/*}else if(ret != PTHREAD_CANCELED){
-		diagnostic("%s thread returned error on exit (%s)",
-				i->name,(char *)ret);*/
-	}
-	pthread_mutex_lock(&i->lock);
-	pmarsh_destroy(i->pmarsh);
-	i->pmarsh = NULL;
+		if( (errno = pthread_join(pm->tid,&ret)) ){
+			diagnostic("Couldn't join thread (%s?)",strerror(errno));
+		/*}else if(ret != PTHREAD_CANCELED){
+			diagnostic("%s thread returned error on exit (%s)",
+					i->name,(char *)ret);*/
+		}
+	}
+	lock_interface(i);
+	while( (pm = i->pmarsh) ){
+		i->pmarsh = pm->next;
+		pmarsh_destroy(pm);
+	}
 }
 
 static psocket_marsh *
-pmarsh_create(void){
+pmarsh_create(interface *i,unsigned mtu){
+	const iface_opts *io = get_iface_opts(i->name);
 	psocket_marsh *ret;
 
 	if( (ret = malloc(sizeof(*ret))) ){
+		memset(ret,0,sizeof(*ret));
 		if(pthread_mutex_init(&ret->lock,NULL) == 0){
 			if(pthread_cond_init(&ret->cond,NULL) == 0){
+				ret->ctx = get_octx();
+				ret->i = i;
 				ret->cancelled = 0;
+				ret->fd = -1;
+				ret->mtu = mtu;
+				ret->w.i = i;
+				ret->w.lock = &i->lock;
+				ret->w.spinusecs = i->busypoll;
+				if(io->adaptive){
+					size_t base = io->rxring ? io->rxring : RX_RING_DEFAULT_BYTES;
+
+					ret->minring = base >> RING_ADAPT_SHIFT;
+					ret->maxring = base << RING_ADAPT_SHIFT;
+				}
 				return ret;
 			}
 			pthread_mutex_destroy(&ret->lock);
@@ -533,31 +769,168 @@ pmarsh_create(void){
 	return NULL;
 }
 
+// Open an RX packet socket, and attach any configured capture filter. Should
+// the filter fail, we capture unfiltered rather than not at all.
+static int
+rx_packet_socket(const interface *iface){
+	const iface_opts *io = get_iface_opts(iface->name);
+	int fd;
+
+	if((fd = packet_socket(ETH_P_ALL)) >= 0){
+		if(io->filter && filter_psocket(fd,iface->arptype,io->filter)){
+			diagnostic("Capturing unfiltered on %s",iface->name);
+		}
+		// Without NIC support, we still get software timestamps.
+		if(io->hwtstamp){
+			timestamp_psocket(fd);
+		}
+		if(io->busypoll){
+			busypoll_socket(fd,io->busypoll);
+		}
+	}
+	return fd;
+}
+
+// Set up a further RX ring in the interface's fanout group, and its thread,
+// analyzing under a lock of its own. On failure, everything's been cleaned
+// up.
+static int
+prepare_fanout_ring(interface *iface,int idx,int mtu,unsigned *group){
+	const iface_opts *io = get_iface_opts(iface->name);
+	const omphalos_ctx *ctx = get_octx();
+	psocket_marsh *pm;
+
+	if((pm = pmarsh_create(iface,mtu)) == NULL){
+		return -1;
+	}
+	if((pm->fd = rx_packet_socket(iface)) >= 0){
+		if((pm->rs = mmap_rx_psocket(pm->fd,idx,mtu,io->rxring,&pm->rxm,
+						&pm->rtpr,&pm->rtpver)) > 0){
+			if(join_psocket_fanout(pm->fd,idx,ctx->fanoutmode,group) == 0){
+				if(list_rxworker(iface,&pm->w) == 0 && launch_ring(pm) == 0){
+					pm->next = iface->pmarsh->next;
+					iface->pmarsh->next = pm;
+					return 0;
+				}
+			}
+			unmap_psocket(pm->rxm,pm->rs);
+		}
+		close(pm->fd);
+		pm->fd = -1;
+	}
+	pmarsh_destroy(pm);
+	return -1;
+}
+
+// One thread (or pool registration) per XSK, each bound to an RX queue. There
+// is no fanout here; the NIC's RSS already spreads flows over the queues.
+// Given several queues, each is analyzed under a lock of its own.
+static int
+prepare_xdp_socks(interface *iface,int idx){
+	const iface_opts *io = get_iface_opts(iface->name);
+	psocket_marsh *pm;
+	unsigned q;
+
+	if((iface->xdp = open_xdp(iface,idx,io->xdp,io->rxring,io->hugepages,
+						iface->numanode)) == NULL){
+		return -1;
+	}
+	for(q = 0 ; q < iface->xdp->nqueues ; ++q){
+		if((pm = pmarsh_create(iface,iface->mtu)) == NULL){
+			break;
+		}
+		pm->minring = pm->maxring = 0;
+		pm->xsk = xsk_nth(iface->xdp,q);
+		pm->fd = xsk_fd(iface->xdp,q);
+		if(io->busypoll){
+			busypoll_socket(pm->fd,io->busypoll);
+		}
+		if((iface->xdp->nqueues > 1 && list_rxworker(iface,&pm->w)) ||
+				launch_ring(pm)){
+			pmarsh_destroy(pm);
+			break;
+		}
+		pm->next = iface->pmarsh;
+		iface->pmarsh = pm;
+	}
+	if(q < iface->xdp->nqueues){
+		// reap_thread() drops and retakes the lock, which we hold.
+		if(iface->pmarsh){
+			reap_thread(iface);
+		}
+		close_xdp(iface,iface->xdp);
+		iface->xdp = NULL;
+		return -1;
+	}
+	return 0;
+}
+
 static int
 prepare_rx_socket(interface *iface,int idx,int offload){
+	const iface_opts *io = get_iface_opts(iface->name);
+	const omphalos_ctx *ctx = get_octx();
 	int mtu;
 
-	if((iface->rfd = packet_socket(ETH_P_ALL)) >= 0){
+	iface->busypoll = io->busypoll;
+	iface->csumverify = io->csumverify;
+	if(prepare_host_caps(iface,io->hostcap)){
+		return -1;
+	}
+	if(io->xdp != XDP_BACKEND_NONE){
+		if(prepare_xdp_socks(iface,idx) == 0){
+			return 0;
+		}
+		diagnostic("Falling back to PACKET_MMAP on %s",iface->name);
+	}
+	if(io->hwtstamp && !iface->hwtstamp){
+		iface->hwtstamp = iface_rx_hwtstamp(iface->name) > 0;
+	}
+	if((iface->rfd = rx_packet_socket(iface)) >= 0){
 		mtu = iface->mtu;
 		if(offload && mtu < OFFLOAD_MTU){
 			mtu = OFFLOAD_MTU;
 		}
-		if((iface->rs = mmap_rx_psocket(iface->rfd,idx,mtu,&iface->rxm,
-						&iface->rtpr)) > 0){
-			if( (iface->pmarsh = pmarsh_create()) ){
-				iface->pmarsh->ctx = get_octx();
-				iface->pmarsh->i = iface;
-				iface->curtxm = iface->txm;
-				iface->txidx = 0;
-				if(pthread_create(&iface->pmarsh->tid,NULL,
-						psocket_thread,iface->pmarsh) == 0){
+		if((iface->rs = mmap_rx_psocket(iface->rfd,idx,mtu,io->rxring,
+				&iface->rxm,&iface->rtpr,&iface->rtpver)) > 0){
+			unsigned group = 0;
+
+			if(ctx->fanout > 1){
+				if(join_psocket_fanout(iface->rfd,idx,ctx->fanoutmode,&group)){
+					unmap_psocket(iface->rxm,iface->rs);
+					close(iface->rfd);
+					iface->rfd = -1;
+					return -1;
+				}
+			}
+			if( (iface->pmarsh = pmarsh_create(iface,mtu)) ){
+				iface->pmarsh->fd = iface->rfd;
+				iface->pmarsh->rxm = iface->rxm;
+				iface->pmarsh->rs = iface->rs;
+				iface->pmarsh->rtpr = iface->rtpr;
+				iface->pmarsh->rtpver = iface->rtpver;
+				// With fanout, each ring is analyzed under a
+				// lock of its own, this first one included.
+				if((ctx->fanout <= 1 || list_rxworker(iface,&iface->pmarsh->w) == 0)
+						&& launch_ring(iface->pmarsh) == 0){
+					unsigned r;
+
+					// A partial fanout group is still useful;
+					// the kernel balances over whoever joined.
+					for(r = 1 ; r < ctx->fanout ; ++r){
+						if(prepare_fanout_ring(iface,idx,mtu,&group)){
+							diagnostic("Only %u/%u fanout rings on %s",
+									r,ctx->fanout,iface->name);
+							break;
+						}
+					}
 					return 0;
 				}
 				pmarsh_destroy(iface->pmarsh);
 				iface->pmarsh = NULL;
 			}
+			unmap_psocket(iface->rxm,iface->rs);
 		}
-		close(iface->rfd); // munmaps
+		close(iface->rfd);
 		iface->rfd = -1;
 	}
 	return -1;
@@ -587,19 +960,13 @@ raw_socket(const interface *i,int fam,int protocol){
 		slevel = IPPROTO_IPV6;
 		sopt = IPV6_MULTICAST_IF;
 		loopopt = IPV6_MULTICAST_LOOP;
-		if(protocol == IPPROTO_UDP){
-			sarg = &idx;
-			slen = sizeof(idx);
-			proto = IPPROTO_UDP;
-			type = SOCK_RAW;
-		}else if(protocol == IPPROTO_ICMPV6){
-			sarg = &idx;
-			slen = sizeof(idx);
-			proto = IPPROTO_ICMPV6;
-			type = SOCK_RAW;
-		}else{
-			assert(0);
-		}
+		// IPPROTO_RAW implies IPV6_HDRINCL, as it does IP_HDRINCL for
+		// IPv4; we supply the IPv6 header, and thus any transport.
+		assert(protocol == IPPROTO_RAW);
+		sarg = &idx;
+		slen = sizeof(idx);
+		proto = IPPROTO_RAW;
+		type = SOCK_RAW;
 	}else{
 		assert(0);
 	}
@@ -631,29 +998,82 @@ raw_socket(const interface *i,int fam,int protocol){
 	return sd;
 }
 
+// Decide where the interface's capture threads run, and its rings live:
+// near the NIC, unless configured otherwise.
+static void
+place_iface(interface *iface){
+	const iface_opts *io = get_iface_opts(iface->name);
+	int node;
+
+	iface_placement(iface->name,&iface->rxcpus,&node);
+	if(io->cpus){
+		if(strcmp(io->cpus,"any") == 0 || lex_cpulist(io->cpus,&iface->rxcpus)){
+			CPU_ZERO(&iface->rxcpus);
+		}
+	}
+	if(io->numanode){
+		node = strcmp(io->numanode,"any") ? atoi(io->numanode) : -1;
+	}
+	iface->numanode = node;
+}
+
+// Without a kernel TX ring, we fall back to a copying send() per frame.
+static void
+prepare_tx_ring(interface *iface,int idx){
+	const iface_opts *io = get_iface_opts(iface->name);
+
+	if((iface->txrs = mmap_txring_psocket(iface->fd,idx,iface->mtu,io->txring,
+					&iface->txr,&iface->txrpr)) == 0){
+		diagnostic("Sending each frame on %s",iface->name);
+		iface->txr = NULL;
+		return;
+	}
+	iface->txrhead = 0;
+	iface->txqueued = 0;
+}
+
 static int
 prepare_packet_sockets(interface *iface,int idx,int offload){
-	if((iface->fd6udp = raw_socket(iface,AF_INET6,IPPROTO_UDP)) >= 0){
-		if((iface->fd6icmp = raw_socket(iface,AF_INET6,IPPROTO_ICMPV6)) >= 0){
-			if((iface->fd4 = raw_socket(iface,AF_INET,0)) >= 0){
-				if((iface->fd = packet_socket(ETH_P_ALL)) >= 0){
-					if((iface->ts = mmap_tx_psocket(iface->fd,idx,
-							iface->mtu,&iface->txm,&iface->ttpr)) > 0){
-						if(prepare_rx_socket(iface,idx,offload) == 0){
-							return 0;
+	const iface_opts *io = get_iface_opts(iface->name);
+	void *txm;
+
+	if((iface->fd6 = raw_socket(iface,AF_INET6,IPPROTO_RAW)) >= 0){
+		if((iface->fd4 = raw_socket(iface,AF_INET,0)) >= 0){
+			if((iface->fd = packet_socket(ETH_P_ALL)) >= 0){
+				if((iface->ts = mmap_tx_psocket(iface->fd,idx,
+						iface->mtu,io->txring,io->hugepages,
+						&txm,&iface->ttpr)) > 0){
+					bind_node(txm,iface->ts,iface->numanode);
+					prepare_tx_ring(iface,idx);
+					if(prepare_self_tx(iface) == 0){
+						if(prepare_tx_sched(iface,io->txrate) == 0){
+							if(prepare_rx_socket(iface,idx,offload) == 0){
+								// Senders don't take the lock (see
+								// get_tx_frame()); publish the
+								// buffer once all else is ready.
+								iface->txhead = 0;
+								__atomic_store_n(&iface->txm,txm,__ATOMIC_RELEASE);
+								return 0;
+							}
+							release_tx_sched(iface);
 						}
+						release_self_tx(iface);
+					}
+					if(iface->txrs){
+						unmap_psocket(iface->txr,iface->txrs);
+						iface->txr = NULL;
+						iface->txrs = 0;
 					}
-					close(iface->fd); // munmaps
-					iface->fd = -1;
+					unmap_psocket(txm,iface->ts);
 				}
-				close(iface->fd4);
-				iface->fd4 = -1;
+				close(iface->fd);
+				iface->fd = -1;
 			}
-			close(iface->fd6icmp);
-			iface->fd6icmp = -1;
+			close(iface->fd4);
+			iface->fd4 = -1;
 		}
-		close(iface->fd6udp);
-		iface->fd6udp = -1;
+		close(iface->fd6);
+		iface->fd6 = -1;
 	}
 	diagnostic("Unable to open packet sockets on %s",iface->name);
 	return -1;
@@ -916,13 +1336,21 @@ handle_newlink_locked(interface *iface,const struct ifinfomsg *ii,const struct n
 		if(iface->bcast && (iface->flags & IFF_BROADCAST)){
 			lookup_l2host(iface,iface->bcast);
 		}
+		// Ring pages are allocated by the kernel on our behalf, and
+		// thus follow our memory policy. Threads created here inherit
+		// it, too, which suits them.
+		place_iface(iface);
+		prefer_node(iface->numanode);
 		r = prepare_packet_sockets(iface,ii->ifi_index,iface_uses_offloading(iface));
+		if(iface->numanode >= 0){
+			default_node();
+		}
 		if(r){
 			// Everything needs already be closed/freed by here
-			iface->txidx = iface->rfd = iface->fd = -1;
+			iface->rfd = iface->fd = -1;
 			memset(&iface->rtpr,0,sizeof(iface->rtpr));
 			memset(&iface->ttpr,0,sizeof(iface->ttpr));
-			iface->curtxm = iface->rxm = iface->txm = NULL;
+			iface->rxm = iface->txm = NULL;
 			iface->ts = iface->rs = 0;
 		}
 	}else{
@@ -931,6 +1359,7 @@ handle_newlink_locked(interface *iface,const struct ifinfomsg *ii,const struct n
 		if(iface->pmarsh && !(iface->flags & IFF_UP)){
 			// See note in free_iface() about operation ordering here.
 			reap_thread(iface);
+			unmap_iface_rings(iface);
 			close(iface->rfd);
 			close(iface->fd);
 			memset(&iface->ttpr,0,sizeof(iface->ttpr));
@@ -955,12 +1384,9 @@ handle_rtm_newlink(const struct nlmsghdr *nl){
 		diagnostic("Invalid interface index: %d",ii->ifi_index);
 		return -1;
 	}
-	if( (r = pthread_mutex_lock(&iface->lock)) ){
-		diagnostic("Couldn't get lock for %d (%s?)",ii->ifi_index,strerror(r));
-		return -1;
-	}
+	lock_interface(iface);
 	r = handle_newlink_locked(iface,ii,nl);
-	pthread_mutex_unlock(&iface->lock);
+	unlock_interface(iface);
 	return r;
 }
 
@@ -1084,7 +1510,12 @@ netlink_thread(void){
 	if((pfd[1].fd = watch_init()) < 0){
 		return -1;
 	}
+	if(epoch_register()){
+		watch_stop();
+		return -1;
+	}
 	if((pfd[0].fd = netlink_socket()) < 0){
+		epoch_unregister();
 		watch_stop();
 		return -1;
 	}
@@ -1104,9 +1535,11 @@ netlink_thread(void){
 		unsigned z;
 
 		errno = 0;
+		epoch_offline();
 		while((events = poll(pfd,sizeof(pfd) / sizeof(*pfd),-1)) == 0){
 			diagnostic("Spontaneous wakeup on netlink socket %d",pfd[0].fd);
 		}
+		epoch_online();
 		if(events < 0){
 			if(errno != EINTR){
 				diagnostic("Error polling core sockets (%s?)",strerror(errno));
@@ -1121,9 +1554,11 @@ netlink_thread(void){
 			}
 			pfd[z].revents = 0;
 		}
+		epoch_quiescent();
 	}
 done:
 	diagnostic("Shutting down (cancelled = %u)...",cancelled);
+	epoch_unregister();
 	watch_stop();
 	close(pfd[0].fd);
 	return cancelled ? 0 : -1;
@@ -9,9 +9,13 @@
 #include <signal.h>
 #include <pcap/pcap.h>
 #include <sys/socket.h>
+#include <linux/if_packet.h>
 #include <omphalos/usb.h>
+#include <omphalos/xdp.h>
 #include <omphalos/pci.h>
 #include <omphalos/diag.h>
+#include <omphalos/epoch.h>
+#include <omphalos/csum.h>
 #include <omphalos/iana.h>
 #include <omphalos/lltd.h>
 #include <omphalos/pcap.h>
@@ -19,8 +23,14 @@
 #include <omphalos/privs.h>
 #include <omphalos/route.h>
 #include <omphalos/resolv.h>
+#include <omphalos/rxpool.h>
+#include <omphalos/affinity.h>
 #include <omphalos/procfs.h>
+#include <omphalos/psocket.h>
 #include <omphalos/signals.h>
+#include <omphalos/hostcap.h>
+#include <omphalos/txsched.h>
+#include <omphalos/synscan.h>
 #include <omphalos/hwaddrs.h>
 #include <omphalos/netlink.h>
 #include <omphalos/omphalos.h>
@@ -35,6 +45,8 @@
 // usbutils' 'update-usbids'
 #define DEFAULT_USBIDS_FILENAME OMPHALOS_DATADIR "/" PACKAGE_NAME "/" "usb.ids"
 #define DEFAULT_RESOLVCONF_FILENAME "/etc/resolv.conf"
+#define DEFAULT_RXBATCH 64
+#define DEFAULT_BUSY_POLL_USECS 50
 
 pthread_key_t omphalos_ctx_key;
 
@@ -55,6 +67,16 @@ static const struct omphalos_mode {
 	{ OMPHALOS_MODE_MAX,		NULL,		}
 };
 
+static const struct fanout_mode {
+	int mode;
+	const char *str;
+} fanout_modes[] = {
+	{ PACKET_FANOUT_HASH,		"hash",	},
+	{ PACKET_FANOUT_CPU,		"cpu",	},
+	{ PACKET_FANOUT_LB,		"lb",	},
+	{ -1,				NULL,	}
+};
+
 static void
 usage(const char *arg0,int ret){
 	FILE *fp = ret == EXIT_SUCCESS ? stdout : stderr;
@@ -79,6 +101,39 @@ usage(const char *arg0,int ret){
 		fprintf(fp,"%s%s",omphalos_modes[e].str,e + 1 == OMPHALOS_MODE_MAX ? ": Operating mode.\n" : "|");
 	}
 	fprintf(fp," '%s' by default. See documentation for details.\n",DEFAULT_MODESTRING);
+	fprintf(fp,"--batch=frames: Max RX frames analyzed per interface lock.\n");
+	fprintf(fp," %u by default, 1 to disable batching.\n",DEFAULT_RXBATCH);
+	fprintf(fp,"--fanout=hash|cpu|lb[:rings]: Capture with several rings per interface.\n");
+	fprintf(fp," One ring per online CPU by default.\n");
+	fprintf(fp,"--workers[=threads]: Service all RX rings from a pool of threads.\n");
+	fprintf(fp," One per online CPU by default.\n");
+	fprintf(fp,"--iface=name: Apply subsequent per-interface options only to name.\n");
+	fprintf(fp,"--filter=expression|discovery: Kernel-side RX capture filter (per-interface).\n");
+	fprintf(fp,"--rxring=bytes[K|M|G]: RX ring size (per-interface, %uMiB by default).\n",
+			(unsigned)(RX_RING_DEFAULT_BYTES >> 20u));
+	fprintf(fp,"--txring=bytes[K|M|G]: TX ring size (per-interface, %uKiB by default).\n",
+			(unsigned)(TX_RING_DEFAULT_BYTES >> 10u));
+	fprintf(fp,"--hugepages: Back TX staging buffers with huge pages (per-interface).\n");
+	fprintf(fp,"--adaptive-rings: Grow RX rings on loss, shrink when idle (per-interface).\n");
+	fprintf(fp,"--hwtstamp: Use NIC hardware RX timestamps (per-interface).\n");
+	fprintf(fp,"--xdp[=copy|zerocopy]: Capture via AF_XDP, bypassing the stack (per-interface).\n");
+	fprintf(fp,"--busy-poll[=usecs]: Spin on empty RX rings (per-interface, %uus by default).\n",
+			DEFAULT_BUSY_POLL_USECS);
+	fprintf(fp,"--cpus=list|any: Capture CPUs (per-interface, NIC-local by default).\n");
+	fprintf(fp,"--numa-node=node|any: Ring memory node (per-interface, NIC's by default).\n");
+	fprintf(fp,"--txrate=pps[:bits[K|M|G]]|none: Probe rate limit (per-interface, %s by default).\n",
+			TXSCHED_DEFAULT_RATE);
+	fprintf(fp,"--total-txrate=pps[:bits[K|M|G]]|none: Probe rate limit across interfaces.\n");
+	fprintf(fp," %s by default.\n",TXSCHED_DEFAULT_TOTAL_RATE);
+	fprintf(fp,"--arp-sweep: ARP every address on on-link IPv4 prefixes (per-interface).\n");
+	fprintf(fp,"--nd-sweep: Solicit likely neighbours on on-link IPv6 prefixes (per-interface).\n");
+	fprintf(fp,"--syn-scan[=ports]: SYN scan on-link hosts (per-interface).\n");
+	fprintf(fp," %s by default.\n",SYNSCAN_DEFAULT_PORTS);
+	fprintf(fp,"--csum-verify: Verify L4 checksums not checked by the NIC (per-interface).\n");
+	fprintf(fp,"--host-cap=nodes[:hosts[:services]]|none: State bounds (per-interface).\n");
+	fprintf(fp," %s by default.\n",HOSTCAP_DEFAULT);
+	fprintf(fp,"--total-host-cap=nodes[:hosts]|none: State bounds across interfaces.\n");
+	fprintf(fp," %s by default.\n",HOSTCAP_DEFAULT_TOTAL);
 	exit(ret);
 }
 
@@ -94,6 +149,204 @@ lex_omphalos_mode(const char *str){
 	return OMPHALOS_MODE_MAX;
 }
 
+// Parse a positive integer no greater than UINT_MAX.
+static int
+lex_unsigned(const char *str,unsigned *val){
+	unsigned long ul;
+	char *e;
+
+	if(*str < '0' || *str > '9'){
+		return -1;
+	}
+	errno = 0;
+	ul = strtoul(str,&e,0);
+	if(*e || errno || ul == 0 || ul > UINT_MAX){
+		return -1;
+	}
+	*val = ul;
+	return 0;
+}
+
+// Parse a positive byte count, with an optional K, M or G (binary) suffix.
+static int
+lex_size(const char *str,size_t *val){
+	unsigned long long ull;
+	unsigned shift = 0;
+	char *e;
+
+	if(*str < '0' || *str > '9'){
+		return -1;
+	}
+	errno = 0;
+	ull = strtoull(str,&e,0);
+	if(errno || ull == 0){
+		return -1;
+	}
+	switch(*e){
+		case 'K': case 'k': shift = 10; ++e; break;
+		case 'M': case 'm': shift = 20; ++e; break;
+		case 'G': case 'g': shift = 30; ++e; break;
+	}
+	if(*e || ull > (SIZE_MAX >> shift)){
+		return -1;
+	}
+	*val = (size_t)ull << shift;
+	return 0;
+}
+
+static unsigned
+online_cpus(void){
+	long cpus;
+
+	if((cpus = sysconf(_SC_NPROCESSORS_ONLN)) <= 0){
+		cpus = 1;
+	}
+	return cpus;
+}
+
+// "mode[:rings]", where rings defaults to the number of online processors.
+static int
+lex_fanout(char *str,omphalos_ctx *pctx){
+	const typeof(*fanout_modes) *f;
+	char *rings;
+
+	if( (rings = strchr(str,':')) ){
+		*rings++ = '\0';
+		if(lex_unsigned(rings,&pctx->fanout)){
+			return -1;
+		}
+	}else{
+		pctx->fanout = online_cpus();
+	}
+	for(f = fanout_modes ; f->str ; ++f){
+		if(strcmp(str,f->str) == 0){
+			pctx->fanoutmode = f->mode;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Find or create the iface_opts for name (NULL for the global settings).
+// Named entries are kept ahead of the global one.
+static iface_opts *
+iface_scope(omphalos_ctx *pctx,const char *name){
+	iface_opts *io,**prev;
+
+	for(prev = &pctx->ifopts ; (io = *prev) ; prev = &io->next){
+		if(io->name == NULL ? name == NULL : (name && strcmp(io->name,name) == 0)){
+			return io;
+		}
+	}
+	if((io = malloc(sizeof(*io))) == NULL){
+		return NULL;
+	}
+	memset(io,0,sizeof(*io));
+	io->name = name;
+	if(name){
+		prev = &pctx->ifopts;
+	}
+	io->next = *prev;
+	*prev = io;
+	return io;
+}
+
+// Named entries inherit whatever they didn't set from the global entry.
+static void
+inherit_iface_opts(omphalos_ctx *pctx){
+	const iface_opts *global = iface_scope(pctx,NULL);
+	iface_opts *io;
+
+	for(io = pctx->ifopts ; io != global ; io = io->next){
+		if(io->filter == NULL){
+			io->filter = global->filter;
+		}
+		if(io->rxring == 0){
+			io->rxring = global->rxring;
+		}
+		if(io->txring == 0){
+			io->txring = global->txring;
+		}
+		if(io->hugepages == 0){
+			io->hugepages = global->hugepages;
+		}
+		if(io->adaptive == 0){
+			io->adaptive = global->adaptive;
+		}
+		if(io->hwtstamp == 0){
+			io->hwtstamp = global->hwtstamp;
+		}
+		if(io->xdp == XDP_BACKEND_NONE){
+			io->xdp = global->xdp;
+		}
+		if(io->busypoll == 0){
+			io->busypoll = global->busypoll;
+		}
+		if(io->cpus == NULL){
+			io->cpus = global->cpus;
+		}
+		if(io->numanode == NULL){
+			io->numanode = global->numanode;
+		}
+		if(io->txrate == NULL){
+			io->txrate = global->txrate;
+		}
+		if(io->arpsweep == 0){
+			io->arpsweep = global->arpsweep;
+		}
+		if(io->ndsweep == 0){
+			io->ndsweep = global->ndsweep;
+		}
+		if(io->synscan == NULL){
+			io->synscan = global->synscan;
+		}
+		if(io->csumverify == 0){
+			io->csumverify = global->csumverify;
+		}
+		if(io->hostcap == NULL){
+			io->hostcap = global->hostcap;
+		}
+	}
+}
+
+const iface_opts *get_iface_opts(const char *name){
+	const omphalos_ctx *octx = get_octx();
+	const iface_opts *io;
+
+	for(io = octx->ifopts ; io->name ; io = io->next){
+		if(strcmp(io->name,name) == 0){
+			break;
+		}
+	}
+	return io;
+}
+
+// Capabilities we keep after dropping privileges. Beyond packet sockets,
+// SIOCSHWTSTAMP, attaching XDP programs, and raising SO_BUSY_POLL above the
+// net.core.busy_read sysctl want CAP_NET_ADMIN; loading XDP programs
+// wants CAP_SYS_ADMIN (CAP_BPF only arrived in 5.8), and CAP_IPC_LOCK exempts
+// UMEMs from RLIMIT_MEMLOCK.
+static unsigned
+retained_caps(const omphalos_ctx *pctx,cap_value_t *caps){
+	int netadmin = 0,xdp = 0;
+	const iface_opts *io;
+	unsigned n = 0;
+
+	for(io = pctx->ifopts ; io ; io = io->next){
+		netadmin |= io->hwtstamp || io->xdp || io->busypoll;
+		xdp |= io->xdp != XDP_BACKEND_NONE;
+	}
+	caps[n++] = CAP_NET_RAW;
+	if(netadmin){
+		caps[n++] = CAP_NET_ADMIN;
+	}
+	if(xdp){
+		caps[n++] = CAP_SYS_ADMIN;
+		caps[n++] = CAP_IPC_LOCK;
+	}
+	return n;
+}
+
 static void
 version(const char *arg0){
 	fprintf(stdout,"%s %s\n",PACKAGE,VERSION);
@@ -114,6 +367,28 @@ enum {
 	OPT_PLOG,
 	OPT_RESOLV,
 	OPT_MODE,
+	OPT_BATCH,
+	OPT_FANOUT,
+	OPT_WORKERS,
+	OPT_IFACE,
+	OPT_FILTER,
+	OPT_RXRING,
+	OPT_TXRING,
+	OPT_HUGEPAGES,
+	OPT_ADAPTIVE,
+	OPT_HWTSTAMP,
+	OPT_XDP,
+	OPT_BUSYPOLL,
+	OPT_CPUS,
+	OPT_NUMANODE,
+	OPT_TXRATE,
+	OPT_TOTALTXRATE,
+	OPT_ARPSWEEP,
+	OPT_NDSWEEP,
+	OPT_SYNSCAN,
+	OPT_CSUMVERIFY,
+	OPT_HOSTCAP,
+	OPT_TOTALHOSTCAP,
 };
 
 int omphalos_setup(int argc,char * const *argv,omphalos_ctx *pctx){
@@ -148,6 +423,116 @@ int omphalos_setup(int argc,char * const *argv,omphalos_ctx *pctx){
 			.has_arg = 2,
 			.flag = NULL,
 			.val = OPT_MODE,
+		},{
+			.name = "batch",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_BATCH,
+		},{
+			.name = "fanout",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_FANOUT,
+		},{
+			.name = "workers",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_WORKERS,
+		},{
+			.name = "iface",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_IFACE,
+		},{
+			.name = "filter",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_FILTER,
+		},{
+			.name = "rxring",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_RXRING,
+		},{
+			.name = "txring",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_TXRING,
+		},{
+			.name = "hugepages",
+			.has_arg = 0,
+			.flag = NULL,
+			.val = OPT_HUGEPAGES,
+		},{
+			.name = "adaptive-rings",
+			.has_arg = 0,
+			.flag = NULL,
+			.val = OPT_ADAPTIVE,
+		},{
+			.name = "hwtstamp",
+			.has_arg = 0,
+			.flag = NULL,
+			.val = OPT_HWTSTAMP,
+		},{
+			.name = "xdp",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_XDP,
+		},{
+			.name = "busy-poll",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_BUSYPOLL,
+		},{
+			.name = "cpus",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_CPUS,
+		},{
+			.name = "numa-node",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_NUMANODE,
+		},{
+			.name = "txrate",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_TXRATE,
+		},{
+			.name = "total-txrate",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_TOTALTXRATE,
+		},{
+			.name = "arp-sweep",
+			.has_arg = 0,
+			.flag = NULL,
+			.val = OPT_ARPSWEEP,
+		},{
+			.name = "nd-sweep",
+			.has_arg = 0,
+			.flag = NULL,
+			.val = OPT_NDSWEEP,
+		},{
+			.name = "syn-scan",
+			.has_arg = 2,
+			.flag = NULL,
+			.val = OPT_SYNSCAN,
+		},{
+			.name = "csum-verify",
+			.has_arg = 0,
+			.flag = NULL,
+			.val = OPT_CSUMVERIFY,
+		},{
+			.name = "host-cap",
+			.has_arg = 1,
+			.flag = NULL,
+			.val = OPT_HOSTCAP,
+		},{
+			.name = "total-host-cap",
+			.has_arg = 1,
+			.flag = NULL,
+			.val = OPT_TOTALHOSTCAP,
 		},
 		{
 			.name = NULL,
@@ -157,11 +542,15 @@ int omphalos_setup(int argc,char * const *argv,omphalos_ctx *pctx){
 		}
 	};
 	// FIXME maybe CAP_SETPCAP as well?
-	const cap_value_t caparray[] = { CAP_NET_RAW, };
+	cap_value_t caparray[4];
 	const char *user = NULL,*mode = NULL;
+	iface_opts *scope;
 	int opt,longidx;
 	
 	memset(pctx,0,sizeof(*pctx));
+	if((scope = iface_scope(pctx,NULL)) == NULL){
+		return -1;
+	}
 	opterr = 0; // disallow getopt() diagnostic to stderr
 	while((opt = getopt_long(argc,argv,":hf:u:p",ops,&longidx)) >= 0){
 		switch(opt){
@@ -215,6 +604,284 @@ int omphalos_setup(int argc,char * const *argv,omphalos_ctx *pctx){
 			}
 			mode = optarg;
 			break;
+		}case OPT_BATCH:{
+			if(pctx->rxbatch){
+				fprintf(stderr,"Provided --batch twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(lex_unsigned(optarg,&pctx->rxbatch)){
+				fprintf(stderr,"Invalid batch size: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			break;
+		}case OPT_FANOUT:{
+			if(pctx->fanout){
+				fprintf(stderr,"Provided --fanout twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(lex_fanout(optarg,pctx)){
+				fprintf(stderr,"Invalid fanout: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			break;
+		}case OPT_IFACE:{
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if((scope = iface_scope(pctx,optarg)) == NULL){
+				return -1;
+			}
+			break;
+		}case OPT_FILTER:{
+			if(scope->filter){
+				fprintf(stderr,"Provided --filter twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->filter = optarg;
+			break;
+		}case OPT_RXRING:{
+			if(scope->rxring){
+				fprintf(stderr,"Provided --rxring twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(lex_size(optarg,&scope->rxring)){
+				fprintf(stderr,"Invalid ring size: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			break;
+		}case OPT_TXRING:{
+			if(scope->txring){
+				fprintf(stderr,"Provided --txring twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(lex_size(optarg,&scope->txring)){
+				fprintf(stderr,"Invalid ring size: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			break;
+		}case OPT_HUGEPAGES:{
+			if(scope->hugepages){
+				fprintf(stderr,"Provided --hugepages twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->hugepages = 1;
+			break;
+		}case OPT_ADAPTIVE:{
+			if(scope->adaptive){
+				fprintf(stderr,"Provided --adaptive-rings twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->adaptive = 1;
+			break;
+		}case OPT_HWTSTAMP:{
+			if(scope->hwtstamp){
+				fprintf(stderr,"Provided --hwtstamp twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->hwtstamp = 1;
+			break;
+		}case OPT_XDP:{
+			if(scope->xdp){
+				fprintf(stderr,"Provided --xdp twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				scope->xdp = XDP_BACKEND_ANY;
+			}else if(strcmp(optarg,"copy") == 0){
+				scope->xdp = XDP_BACKEND_COPY;
+			}else if(strcmp(optarg,"zerocopy") == 0){
+				scope->xdp = XDP_BACKEND_ZEROCOPY;
+			}else{
+				fprintf(stderr,"Invalid XDP mode: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			break;
+		}case OPT_BUSYPOLL:{
+			if(scope->busypoll){
+				fprintf(stderr,"Provided --busy-poll twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				scope->busypoll = DEFAULT_BUSY_POLL_USECS;
+			}else if(lex_unsigned(optarg,&scope->busypoll)){
+				fprintf(stderr,"Invalid busy poll interval: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			break;
+		}case OPT_CPUS:{
+			cpu_set_t cpus;
+
+			if(scope->cpus){
+				fprintf(stderr,"Provided --cpus twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(strcmp(optarg,"any") && lex_cpulist(optarg,&cpus)){
+				fprintf(stderr,"Invalid CPU list: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->cpus = optarg;
+			break;
+		}case OPT_NUMANODE:{
+			unsigned node;
+
+			if(scope->numanode){
+				fprintf(stderr,"Provided --numa-node twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(strcmp(optarg,"any") && strcmp(optarg,"0") && lex_unsigned(optarg,&node)){
+				fprintf(stderr,"Invalid NUMA node: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->numanode = optarg;
+			break;
+		}case OPT_TXRATE:{
+			uint64_t bps;
+			unsigned pps;
+
+			if(scope->txrate){
+				fprintf(stderr,"Provided --txrate twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(lex_txrate(optarg,&pps,&bps)){
+				fprintf(stderr,"Invalid TX rate: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->txrate = optarg;
+			break;
+		}case OPT_TOTALTXRATE:{
+			uint64_t bps;
+			unsigned pps;
+
+			if(pctx->txrate){
+				fprintf(stderr,"Provided --total-txrate twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(lex_txrate(optarg,&pps,&bps)){
+				fprintf(stderr,"Invalid TX rate: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			pctx->txrate = optarg;
+			break;
+		}case OPT_ARPSWEEP:{
+			if(scope->arpsweep){
+				fprintf(stderr,"Provided --arp-sweep twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->arpsweep = 1;
+			break;
+		}case OPT_NDSWEEP:{
+			if(scope->ndsweep){
+				fprintf(stderr,"Provided --nd-sweep twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->ndsweep = 1;
+			break;
+		}case OPT_SYNSCAN:{
+			uint16_t ports[SYNSCAN_MAX_PORTS];
+
+			if(scope->synscan){
+				fprintf(stderr,"Provided --syn-scan twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				scope->synscan = SYNSCAN_DEFAULT_PORTS;
+			}else if(lex_syn_ports(optarg,ports,SYNSCAN_MAX_PORTS) < 0){
+				fprintf(stderr,"Invalid port list: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}else{
+				scope->synscan = optarg;
+			}
+			break;
+		}case OPT_CSUMVERIFY:{
+			if(scope->csumverify){
+				fprintf(stderr,"Provided --csum-verify twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->csumverify = 1;
+			break;
+		}case OPT_HOSTCAP:{
+			hostcaps hc;
+
+			if(scope->hostcap){
+				fprintf(stderr,"Provided --host-cap twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(lex_host_caps(optarg,&hc)){
+				fprintf(stderr,"Invalid host caps: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			scope->hostcap = optarg;
+			break;
+		}case OPT_TOTALHOSTCAP:{
+			hostcaps hc;
+
+			if(pctx->hostcap){
+				fprintf(stderr,"Provided --total-host-cap twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				fprintf(stderr,"Option requires parameter: '%s'\n",ops[longidx].name);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(lex_host_caps(optarg,&hc) || hc.services){
+				fprintf(stderr,"Invalid host caps: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			pctx->hostcap = optarg;
+			break;
+		}case OPT_WORKERS:{
+			if(pctx->rxworkers){
+				fprintf(stderr,"Provided --workers twice\n");
+				usage(argv[0],EXIT_FAILURE);
+			}
+			if(!optarg){
+				pctx->rxworkers = online_cpus();
+			}else if(lex_unsigned(optarg,&pctx->rxworkers)){
+				fprintf(stderr,"Invalid worker count: %s\n",optarg);
+				usage(argv[0],EXIT_FAILURE);
+			}
+			break;
 		}case OPT_PLOG:{
 			if(pctx->plog){
 				fprintf(stderr,"Provided --plog twice\n");
@@ -287,6 +954,13 @@ int omphalos_setup(int argc,char * const *argv,omphalos_ctx *pctx){
 	if(mode == NULL){
 		mode = DEFAULT_MODESTRING;
 	}
+	if(pctx->rxbatch == 0){
+		pctx->rxbatch = DEFAULT_RXBATCH;
+	}
+	if(pctx->fanout == 0){
+		pctx->fanout = 1;
+	}
+	inherit_iface_opts(pctx);
 	if((pctx->mode = lex_omphalos_mode(mode)) == OMPHALOS_MODE_MAX){
 		fprintf(stderr,"Invalid operating mode: %s\n",mode);
 		usage(argv[0],-1);
@@ -300,7 +974,7 @@ int omphalos_setup(int argc,char * const *argv,omphalos_ctx *pctx){
 			return -1;
 		}
 	}else{
-		if(handle_priv_drop(user,caparray,sizeof(caparray) / sizeof(*caparray))){
+		if(handle_priv_drop(user,caparray,retained_caps(pctx,caparray))){
 			return -1;
 		}
 	}
@@ -346,9 +1020,16 @@ int omphalos_init(const omphalos_ctx *pctx){
 	if(pthread_setspecific(omphalos_ctx_key,pctx)){
 		return -1;
 	}
+	if(init_csum()){
+		return -1;
+	}
+	diagnostic("Using %s checksum kernel",csum_kernel_name(get_csum_kernel()));
 	if(init_lltd_service()){
 		return -1;
 	}
+	if(init_host_caps(pctx->hostcap)){
+		return -1;
+	}
 	if(pctx->pcapfn){
 		if(handle_pcap_file(pctx)){
 			return -1;
@@ -357,6 +1038,17 @@ int omphalos_init(const omphalos_ctx *pctx){
 		if(init_pci_support()){
 			diagnostic("Warning: no PCI support available");
 		}
+		if(init_tx_sched(pctx->txrate)){
+			return -1;
+		}
+		if(init_syn_scan()){
+			return -1;
+		}
+		if(pctx->rxworkers){
+			if(init_rxpool(pctx,pctx->rxworkers)){
+				return -1;
+			}
+		}
 		if(handle_netlink_socket()){
 			return -1;
 		}
@@ -365,14 +1057,24 @@ int omphalos_init(const omphalos_ctx *pctx){
 }
 
 void omphalos_cleanup(const omphalos_ctx *pctx){
+	iface_opts *io,*next;
+
 	cleanup_pcap(pctx);
 	cleanup_naming();
 	free_routes();
 	cleanup_interfaces();
+	stop_rxpool();
+	stop_syn_scan();
 	stop_lltd_service();
 	cleanup_iana_naming();
 	stop_pci_support();
 	stop_usb_support();
 	cleanup_procfs();
+	// Capture and netlink threads are gone; UI threads are offline
+	epoch_drain();
+	for(io = pctx->ifopts ; io ; io = next){
+		next = io->next;
+		free(io);
+	}
 	pthread_key_delete(omphalos_ctx_key);
 }
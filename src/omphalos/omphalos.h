@@ -21,7 +21,9 @@ struct interface;
 
 // State for each packet
 typedef struct omphalos_packet {
-	struct timeval tv;
+	uint64_t ts;			// ns since the epoch (CLOCK_REALTIME)
+	uint64_t hwts;			// NIC's raw RX timestamp (ns, in its
+					//  own clock), or 0 if there's none
 	struct interface *i;
 	struct l2host *l2s,*l2d;
 	uint16_t pcap_ethproto;		// See pcap-linktype's DLT_LINUX_SLL.
@@ -31,6 +33,10 @@ typedef struct omphalos_packet {
 	struct l3host *l3s,*l3d;
 	uint128_t l3saddr,l3daddr;
 	uint16_t l4src,l4dst;
+	unsigned csumok;		// L4 checksums needn't be verified: the
+					//  NIC vouched for them, or they're
+					//  ours and not yet computed
+	unsigned csumtrusted;		// csumok spared an L4 verification
 	unsigned malformed;
 	unsigned noproto;
 } omphalos_packet;
@@ -78,6 +84,16 @@ typedef struct omphalos_iface {
 	void *(*srv_event)(const struct interface *,struct l2host *,
 				struct l3host *,struct l4srv *);
 
+	// Eviction callbacks, invoked as nodes, hosts and services are dropped
+	// to stay within their caps (see hostcap.h), with the object's opaque
+	// value. The object must not be referenced following return. A host's
+	// services are evicted along with it, without their own callbacks.
+	void (*neigh_evicted)(const struct interface *,struct l2host *,void *);
+	void (*host_evicted)(const struct interface *,struct l2host *,
+				struct l3host *,void *);
+	void (*srv_evicted)(const struct interface *,struct l2host *,
+				struct l3host *,struct l4srv *,void *);
+
 	// Network metastatus change callback, fed by network analysis. Covers
 	// everything from /proc to DNS to routing.
 	void (*network_event)(void);
@@ -93,6 +109,31 @@ typedef enum {
 	OMPHALOS_MODE_MAX
 } omphalos_mode_enum;
 
+// Per-interface settings, configured on startup based off command-line
+// options. Options preceding any --iface apply to all interfaces (the entry
+// with a NULL name); those following --iface=name apply only to that
+// interface, which otherwise inherits the global settings.
+typedef struct iface_opts {
+	const char *name;	 // interface name, NULL for the global defaults
+	const char *filter;	 // pcap-filter(7) expression, or "discovery"
+	size_t rxring;		 // RX ring size in bytes, 0 for the default
+	size_t txring;		 // TX ring size in bytes, 0 for the default
+	int hugepages;		 // back anonymous rings with huge pages
+	int adaptive;		 // grow the RX ring on loss, shrink when idle
+	int hwtstamp;		 // request NIC hardware RX timestamps
+	int xdp;		 // an xdp_backend, XDP_BACKEND_NONE for PACKET_MMAP
+	unsigned busypoll;	 // usecs to spin on an empty RX ring, 0 to sleep
+	const char *cpus;	 // capture CPU list, or "any"; NULL to infer
+	const char *numanode;	 // NUMA node for rings, or "any"; NULL to infer
+	const char *txrate;	 // paced TX "pps[:bits]", or "none"; NULL for default
+	int arpsweep;		 // ARP every address on on-link IPv4 prefixes
+	int ndsweep;		 // solicit likely neighbours on on-link IPv6 prefixes
+	const char *synscan;	 // TCP ports to SYN scan on-link hosts, NULL for none
+	int csumverify;		 // verify L4 checksums not vouched for by the kernel
+	const char *hostcap;	 // "nodes[:hosts[:services]]", or "none"; NULL for default
+	struct iface_opts *next;
+} iface_opts;
+
 // Process-scope settings, generally configured on startup based off
 // command-line options.
 typedef struct omphalos_ctx {
@@ -102,6 +143,13 @@ typedef struct omphalos_ctx {
 	const char *usbidsfn;	 // USB ID database in update-usbids(8) format
 	omphalos_mode_enum mode; // operating mode
 	int nopromiscuous;	 // do not make newly-discovered devices promiscous
+	unsigned rxbatch;	 // max RX frames analyzed per ring lock
+	unsigned fanout;	 // RX rings per interface (PACKET_FANOUT if > 1)
+	int fanoutmode;		 // PACKET_FANOUT_{HASH,CPU,LB}
+	unsigned rxworkers;	 // RX worker pool size, 0 for a thread per ring
+	const char *txrate;	 // paced TX across all interfaces; NULL for default
+	const char *hostcap;	 // "nodes[:hosts]" across all interfaces; NULL for default
+	iface_opts *ifopts;	 // per-interface settings, global entry last
 	omphalos_iface iface;
 	pcap_t *plogp;
 	pcap_dumper_t *plog;
@@ -113,6 +161,10 @@ extern pthread_key_t omphalos_ctx_key;
 // Retrieve this thread's omphalos_ctx
 const omphalos_ctx *get_octx(void);
 
+// Look up the settings for the named interface, falling back to the global
+// settings. Always returns a valid iface_opts.
+const iface_opts *get_iface_opts(const char *);
+
 // Parse the command line for common arguments (a UI introducing its own
 // CLI arguments would need to extract them before calling, as stands
 // FIXME). Initializes and prepares an omphalos_ctx.
@@ -12,6 +12,8 @@
 #include <omphalos/irda.h>
 #include <omphalos/pcap.h>
 #include <omphalos/diag.h>
+#include <omphalos/epoch.h>
+#include <omphalos/hostcap.h>
 #include <linux/if_ether.h>
 #include <omphalos/hwaddrs.h>
 #include <omphalos/ethernet.h>
@@ -86,6 +88,8 @@ postprocess(pcap_marshal *pm,omphalos_packet *packet,interface *iface,
 	if(pm->octx->packet_read){
 		pm->octx->packet_read(packet);
 	}
+	trim_hosts(iface);
+	epoch_quiescent();
 }
 
 // FIXME need to call back even on truncations etc. move function pointer
@@ -106,8 +110,9 @@ handle_pcap_direct(u_char *gi,const struct pcap_pkthdr *h,const u_char *bytes){
 	}
 	memset(&packet,0,sizeof(packet));
 	packet.i = iface;
+	packet.ts = pcap_ts_ns(h);
 	pm->handler(&packet,bytes,h->len);
-	gettimeofday(&phdr.ts,NULL);
+	phdr.ts = h->ts;
 	phdr.len = h->len;
 	phdr.caplen = h->caplen;
 	postprocess(pm,&packet,iface,&phdr,bytes);
@@ -142,6 +147,7 @@ handle_pcap_cooked(u_char *gi,const struct pcap_pkthdr *h,const u_char *bytes){
 	}
 	memset(&packet,0,sizeof(packet));
 	packet.i = iface;
+	packet.ts = pcap_ts_ns(h);
 	packet.i->addrlen = ntohs(sll->hwlen);
 	assert(packet.i->addrlen <= sizeof(addr));
 	memcpy(addr,sll->hwaddr,packet.i->addrlen);
@@ -176,19 +182,26 @@ int handle_pcap_file(const omphalos_ctx *pctx){
 		.octx = &pctx->iface,
 		.i = &pcap_file_interface,
 	};
+	const iface_opts *io;
 	pcap_t *pcap;
 
 	free(pmarsh.i->name);
 	diagnostic("Processing pcap file %s",pctx->pcapfn);
 	memset(pmarsh.i,0,sizeof(*pmarsh.i));
-	pmarsh.i->fd4 = pmarsh.i->fd6udp = pmarsh.i->fd6icmp =
-		pmarsh.i->fd = pmarsh.i->rfd = -1;
+	pmarsh.i->fd4 = pmarsh.i->fd6 = pmarsh.i->fd = pmarsh.i->rfd = -1;
 	pmarsh.i->flags = IFF_BROADCAST | IFF_UP | IFF_LOWER_UP;
 	// FIXME set up remainder of interface as best we can...
 	if((pmarsh.i->name = strdup(pctx->pcapfn)) == NULL){
 		return -1;
 	}
-	if((pcap = pcap_open_offline(pctx->pcapfn,ebuf)) == NULL){
+	// Only the global options can apply to a pcap file
+	io = get_iface_opts(pmarsh.i->name);
+	pmarsh.i->csumverify = io->csumverify;
+	if(prepare_host_caps(pmarsh.i,io->hostcap)){
+		return -1;
+	}
+	if((pcap = pcap_open_offline_with_tstamp_precision(pctx->pcapfn,
+				PCAP_TSTAMP_PRECISION_NANO,ebuf)) == NULL){
 		diagnostic("Couldn't open pcap input %s (%s?)",pctx->pcapfn,ebuf);
 		return -1;
 	}
@@ -252,11 +265,17 @@ int handle_pcap_file(const omphalos_ctx *pctx){
 		pcap_close(pcap);
 		return -1;
 	}
+	if(epoch_register()){
+		pcap_close(pcap);
+		return -1;
+	}
 	if(pcap_loop(pcap,-1,fxn,(u_char *)&pmarsh)){
 		diagnostic("Error processing pcap file %s (%s?)",pctx->pcapfn,pcap_geterr(pcap));
+		epoch_unregister();
 		pcap_close(pcap);
 		return -1;
 	}
+	epoch_unregister();
 	pcap_close(pcap);
 	return 0;
 }
@@ -364,7 +383,8 @@ int log_pcap_packet(struct pcap_pkthdr *h,void *sp,size_t l2len,const struct pca
 pcap_dumper_t *init_pcap_write(pcap_t **p,const char *fn){
 	pcap_dumper_t *pd;
 
-	if((*p = pcap_open_dead(DLT_LINUX_SLL,0)) == NULL){
+	if((*p = pcap_open_dead_with_tstamp_precision(DLT_LINUX_SLL,0,
+					PCAP_TSTAMP_PRECISION_NANO)) == NULL){
 		return NULL;
 	}
 	if((pd = pcap_dump_open(*p,fn)) == NULL){
@@ -8,6 +8,7 @@ extern "C" {
 #include <pcap.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <omphalos/timing.h>
 
 struct interface;
 struct pcap_pkthdr;
@@ -20,9 +21,22 @@ int handle_pcap_file(const struct omphalos_ctx *);
 int print_pcap_stats(FILE *fp,struct interface *);
 void cleanup_pcap(const struct omphalos_ctx *);
 
-// Output to a PCAP savefile
+// Output to a PCAP savefile, with nanosecond timestamps.
 pcap_dumper_t *init_pcap_write(pcap_t **,const char *);
 
+// Savefiles (both read and written) are opened with nanosecond precision,
+// whereupon ts.tv_usec is actually nanoseconds.
+static inline void
+pcap_set_ts(struct pcap_pkthdr *h,uint64_t ns){
+	h->ts.tv_sec = ns / NSEC_PER_SEC;
+	h->ts.tv_usec = ns % NSEC_PER_SEC;
+}
+
+static inline uint64_t
+pcap_ts_ns(const struct pcap_pkthdr *h){
+	return (uint64_t)h->ts.tv_sec * NSEC_PER_SEC + h->ts.tv_usec;
+}
+
 struct pcap_ll { // see pcap-datalink(7), "DLT_LINUX_SSL"
 	uint16_t pkttype;		// Packet type, NBO
 					//  0 for unicast to us
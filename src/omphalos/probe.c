@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/if_arp.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <omphalos/128.h>
+#include <omphalos/csum.h>
+#include <omphalos/diag.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <omphalos/probe.h>
+#include <omphalos/interface.h>
+
+// Big enough for any of our fixed probes, the largest being an SSDP M-SEARCH.
+#define PROBE_TEMPLATE_BYTES 256
+
+typedef struct probe_template {
+	probe_type type;
+	int fam;
+	uint128_t src;		// IPv4 addresses are zero-extended
+	size_t len;		// bytes of frame
+	struct probe_template *next;
+	unsigned char frame[PROBE_TEMPLATE_BYTES];
+} probe_template;
+
+static void
+probe_key(int fam,const void *src,uint128_t key){
+	if(fam == AF_INET6){
+		assign128(key,src);
+	}else{
+		key[0] = *(const uint32_t *)src;
+		key[1] = key[2] = key[3] = 0;
+	}
+}
+
+static inline size_t
+l2len(const interface *i){
+	return i->addrlen == ETH_ALEN ? ETH_HLEN : 0;
+}
+
+static const probe_template *
+find_template(const interface *i,probe_type type,int fam,const uint128_t key){
+	const probe_template *t;
+
+	for(t = __atomic_load_n(&i->probes,__ATOMIC_ACQUIRE) ; t ; t = t->next){
+		if(t->type != type || t->fam != fam || !equal128(t->src,key)){
+			continue;
+		}
+		// Built against a previous hardware address?
+		if(l2len(i) && memcmp(t->frame + ETH_ALEN,i->addr,ETH_ALEN)){
+			continue;
+		}
+		return t;
+	}
+	return NULL;
+}
+
+// Two threads might race to build the same template; the loser's is merely
+// never found.
+static const probe_template *
+build_template(interface *i,probe_type type,probe_builder build,int fam,
+					const void *src,const uint128_t key){
+	probe_template *t;
+	int r;
+
+	if((t = malloc(sizeof(*t))) == NULL){
+		diagnostic("Couldn't allocate probe template for %s",i->name);
+		return NULL;
+	}
+	memset(t,0,sizeof(*t));
+	if((r = build(i,t->frame,sizeof(t->frame),fam,src)) < 0){
+		diagnostic("Couldn't build probe template %d for %s",type,i->name);
+		free(t);
+		return NULL;
+	}
+	t->type = type;
+	t->fam = fam;
+	assign128(t->src,key);
+	t->len = r;
+	t->next = __atomic_load_n(&i->probes,__ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&i->probes,&t->next,t,0,
+				__ATOMIC_RELEASE,__ATOMIC_RELAXED)){
+		;
+	}
+	return t;
+}
+
+int probe_start(probe *p,interface *i,void *frame,size_t flen,probe_type type,
+			probe_builder build,int fam,const void *src){
+	struct tpacket_hdr *thdr = frame;
+	const probe_template *t;
+	uint128_t key;
+
+	probe_key(fam,src,key);
+	if((t = find_template(i,type,fam,key)) == NULL){
+		if((t = build_template(i,type,build,fam,src,key)) == NULL){
+			return -1;
+		}
+	}
+	if(flen < thdr->tp_mac + t->len){
+		return -1;
+	}
+	p->frame = frame;
+	p->flen = flen;
+	p->fam = fam;
+	p->l2 = (unsigned char *)frame + thdr->tp_mac;
+	memcpy(p->l2,t->frame,t->len);
+	p->len = t->len;
+	p->l3 = p->l2 + l2len(i);
+	if(type == PROBE_ARP){
+		p->l4 = NULL;
+	}else if(fam == AF_INET){
+		p->l4 = p->l3 + ((const struct iphdr *)p->l3)->ihl * 4u;
+	}else{
+		p->l4 = p->l3 + sizeof(struct ip6_hdr);
+	}
+	thdr->tp_len = p->len;
+	return 0;
+}
+
+// The transport checksum covering the IP pseudo-header, if any.
+static uint16_t *
+pseudo_check(const probe *p,int *udp){
+	unsigned proto;
+
+	*udp = 0;
+	if(p->l4 == NULL){
+		return NULL;
+	}
+	if(p->fam == AF_INET){
+		proto = ((const struct iphdr *)p->l3)->protocol;
+	}else{
+		proto = ((const struct ip6_hdr *)p->l3)->ip6_ctlun.ip6_un1.ip6_un1_nxt;
+	}
+	if(proto == IPPROTO_UDP){
+		*udp = 1;
+		return &((struct udphdr *)p->l4)->check;
+	}else if(proto == IPPROTO_TCP){
+		return &((struct tcphdr *)p->l4)->check;
+	}else if(proto == IPPROTO_ICMPV6){
+		return &((struct icmp6_hdr *)p->l4)->icmp6_cksum;
+	}
+	return NULL;
+}
+
+// A computed UDP checksum of zero is transmitted as all ones; zero means
+// none was computed.
+static inline void
+set_check(uint16_t *check,uint16_t val,int udp){
+	*check = (udp && val == 0) ? 0xffffu : val;
+}
+
+void probe_l2dst(probe *p,const void *hwaddr){
+	if(p->l3 - p->l2 == ETH_HLEN){
+		memcpy(p->l2,hwaddr,ETH_ALEN);
+	}
+}
+
+void probe_l3dst(probe *p,const void *addr){
+	uint16_t *check;
+	int udp;
+
+	check = pseudo_check(p,&udp);
+	if(p->fam == AF_INET){
+		struct iphdr *ip = (struct iphdr *)p->l3;
+		const uint32_t dst = *(const uint32_t *)addr;
+
+		ip->check = csum_update32(ip->check,ip->daddr,dst);
+		if(check){
+			set_check(check,csum_update32(*check,ip->daddr,dst),udp);
+		}
+		ip->daddr = dst;
+	}else{
+		struct ip6_hdr *ip = (struct ip6_hdr *)p->l3;
+		uint32_t dst[4];
+		unsigned z;
+
+		memcpy(dst,addr,sizeof(dst));
+		if(check){
+			uint16_t c = *check;
+
+			for(z = 0 ; z < 4 ; ++z){
+				c = csum_update32(c,ip->ip6_dst.s6_addr32[z],dst[z]);
+			}
+			set_check(check,c,udp);
+		}
+		memcpy(&ip->ip6_dst,dst,sizeof(dst));
+	}
+}
+
+void probe_ip4id(probe *p,uint16_t id){
+	struct iphdr *ip = (struct iphdr *)p->l3;
+
+	if(p->fam == AF_INET){
+		ip->check = csum_update16(ip->check,ip->id,id);
+		ip->id = id;
+	}
+}
+
+// UDP and TCP both lead with the source and destination ports.
+void probe_ports(probe *p,uint16_t sport,uint16_t dport){
+	struct udphdr *l4 = (struct udphdr *)p->l4;
+	uint16_t *check,c;
+	int udp;
+
+	if( (check = pseudo_check(p,&udp)) ){
+		c = csum_update16(*check,l4->source,sport);
+		c = csum_update16(c,l4->dest,dport);
+		set_check(check,c,udp);
+	}
+	l4->source = sport;
+	l4->dest = dport;
+}
+
+void probe_tcp_seq(probe *p,uint32_t seq){
+	struct tcphdr *tcp = (struct tcphdr *)p->l4;
+
+	tcp->check = csum_update32(tcp->check,tcp->seq,seq);
+	tcp->seq = seq;
+}
+
+void probe_nd_target(probe *p,const void *addr){
+	struct nd_neighbor_solicit *ns = (struct nd_neighbor_solicit *)p->l4;
+	uint16_t c = ns->nd_ns_cksum;
+	uint32_t target[4];
+	unsigned z;
+
+	memcpy(target,addr,sizeof(target));
+	for(z = 0 ; z < 4 ; ++z){
+		c = csum_update32(c,ns->nd_ns_target.s6_addr32[z],target[z]);
+	}
+	ns->nd_ns_cksum = c;
+	memcpy(&ns->nd_ns_target,target,sizeof(target));
+}
+
+void probe_arp_target(probe *p,const void *hwaddr,const uint32_t *paddr){
+	const struct arphdr *ahdr = (const struct arphdr *)p->l3;
+	unsigned char *payload = p->l3 + sizeof(*ahdr);
+
+	// sender hardware and protocol addresses, then the target's
+	memcpy(payload + ahdr->ar_hln + ahdr->ar_pln,hwaddr,ahdr->ar_hln);
+	memcpy(payload + ahdr->ar_hln * 2 + ahdr->ar_pln,paddr,ahdr->ar_pln);
+}
+
+void *probe_tail(const probe *p,size_t *avail){
+	const struct tpacket_hdr *thdr = p->frame;
+
+	*avail = p->flen - thdr->tp_mac - p->len;
+	return p->l2 + p->len;
+}
+
+int probe_extend(probe *p,size_t n){
+	struct udphdr *udp = (struct udphdr *)p->l4;
+	struct tpacket_hdr *thdr = p->frame;
+	uint16_t olen,nlen,c;
+	uint32_t sum;
+	size_t avail;
+	int isudp;
+
+	if(pseudo_check(p,&isudp) == NULL || !isudp){
+		return -1;
+	}
+	probe_tail(p,&avail);
+	if(n > avail || ntohs(udp->len) + n > 0xffffu){
+		return -1;
+	}
+	sum = csum_fold(csum_partial(p->l2 + p->len,n));
+	// Bytes at odd offsets into the datagram occupy the other half of
+	// each 16-bit word.
+	if((p->l2 + p->len - p->l4) % 2){
+		sum = ((sum & 0xffu) << 8u) | (sum >> 8u);
+	}
+	olen = udp->len;
+	nlen = htons(ntohs(olen) + n);
+	if(p->fam == AF_INET){
+		struct iphdr *ip = (struct iphdr *)p->l3;
+		uint16_t tlen = htons(ntohs(ip->tot_len) + n);
+
+		ip->check = csum_update16(ip->check,ip->tot_len,tlen);
+		ip->tot_len = tlen;
+	}else{
+		struct ip6_hdr *ip = (struct ip6_hdr *)p->l3;
+
+		ip->ip6_ctlun.ip6_un1.ip6_un1_plen = nlen;
+	}
+	// Once in the pseudo-header, once in the UDP header
+	c = csum_update16(udp->check,olen,nlen);
+	c = csum_update16(c,olen,nlen);
+	set_check(&udp->check,csum_extend(c,sum),1);
+	udp->len = nlen;
+	p->len += n;
+	thdr->tp_len = p->len;
+	return 0;
+}
+
+void free_probe_templates(interface *i){
+	probe_template *t;
+
+	while( (t = i->probes) ){
+		i->probes = t->next;
+		free(t);
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef OMPHALOS_PROBE
+#define OMPHALOS_PROBE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct interface;
+
+// Prebuilt probe frames. The first probe of a given type from a given source
+// address on an interface builds a template; later ones copy it into their TX
+// frame, and patch the few fields which vary (destination, IP ID, ports,
+// payload), updating the checksums incrementally rather than recomputing
+// them. Templates are never modified once published, and live until the
+// interface is freed; one built against an old hardware address simply
+// stops matching.
+
+typedef enum {
+	PROBE_ARP,	// ARP request; target patched per probe
+	PROBE_PING,	// ICMP(v6) echo request to all hosts
+	PROBE_SSDP,	// SSDP M-SEARCH to the SSDP group
+	PROBE_MDNS,	// UDP to the mDNS group; payload appended per probe
+	PROBE_DNS,	// UDP; destination, ports and payload patched per probe
+	PROBE_SYN,	// TCP SYN; destination, ports and sequence patched
+	PROBE_RST,	// TCP RST; destination, ports and sequence patched
+	PROBE_RPING,	// ICMPv6 echo request to all routers
+	PROBE_MLDQ,	// MLD general query to all nodes
+	PROBE_NS,	// Neighbor Solicitation; destination and target patched
+	PROBE_TYPES
+} probe_type;
+
+// Writes a template into the buffer (from the L2 header), returning its
+// length or -1. The family and source address are as provided to
+// probe_start().
+typedef int (*probe_builder)(const struct interface *,void *,size_t,int,const void *);
+
+// A probe under construction, within a TX frame.
+typedef struct probe {
+	void *frame;		// from get_tx_frame()
+	size_t flen;		// its size
+	int fam;
+	unsigned char *l2;	// L2 header
+	unsigned char *l3;	// IP(v6) or ARP header
+	unsigned char *l4;	// UDP, TCP or ICMP header, NULL for ARP
+	size_t len;		// bytes from l2
+} probe;
+
+// Instantiate the template for (interface, type, family, source address),
+// building it with the builder should there be none. tp_len is kept current.
+int probe_start(probe *,struct interface *,void *,size_t,probe_type,
+			probe_builder,int,const void *);
+
+// Patches, keeping the IP and transport checksums current.
+void probe_l2dst(probe *,const void *);
+void probe_l3dst(probe *,const void *);
+void probe_ip4id(probe *,uint16_t);
+void probe_ports(probe *,uint16_t,uint16_t);	// UDP or TCP, network byte order
+void probe_tcp_seq(probe *,uint32_t);		// network byte order
+void probe_nd_target(probe *,const void *);	// NS/NA target address
+void probe_arp_target(probe *,const void *,const uint32_t *);
+
+// Space for UDP payload beyond what's been written. probe_extend() accounts
+// for bytes written there, fixing up the lengths and checksums.
+void *probe_tail(const probe *,size_t *);
+int probe_extend(probe *,size_t);
+
+// Release the interface's templates. No frames may be outstanding.
+void free_probe_templates(struct interface *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
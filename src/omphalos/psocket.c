@@ -5,16 +5,23 @@
 #include <signal.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <pcap/pcap.h>
 #include <sys/poll.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <net/if_arp.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
 #include <omphalos/pci.h>
 #include <omphalos/pcap.h>
 #include <omphalos/diag.h>
+#include <omphalos/epoch.h>
 #include <omphalos/privs.h>
 #include <linux/if_packet.h>
 #include <omphalos/netlink.h>
+#include <omphalos/sweep.h>
+#include <omphalos/hostcap.h>
+#include <omphalos/txsched.h>
 #include <omphalos/psocket.h>
 #include <omphalos/netaddrs.h>
 #include <omphalos/omphalos.h>
@@ -24,6 +31,110 @@
 #ifndef PACKET_TX_RING
 #define PACKET_TX_RING 13
 #endif
+#ifndef PACKET_LOSS
+#define PACKET_LOSS 14
+#endif
+#ifndef PACKET_TIMESTAMP
+#define PACKET_TIMESTAMP 17
+#endif
+#ifndef TP_STATUS_CSUMNOTREADY
+#define TP_STATUS_CSUMNOTREADY (1u << 3)
+#endif
+#ifndef TP_STATUS_CSUM_VALID
+#define TP_STATUS_CSUM_VALID (1u << 7)
+#endif
+#ifndef TP_STATUS_TS_RAW_HARDWARE
+#define TP_STATUS_TS_RAW_HARDWARE (1u << 31)
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+#define RX_BLOCK_BYTES (1u << 20)	// Preferred TPACKET_V3 block size
+#define RX_BLOCK_RETIRE_MSEC 32		// Retire partially-filled V3 blocks
+#define HUGEPAGE_BYTES (1u << 21)	// MAP_HUGETLB rounds up to at least this
+#define BUSY_POLL_BUDGET 64		// Frames per NAPI busy poll
+#define BUSY_POLL_KICK_SPINS 64		// Spins between busy poll syscalls
+#define BUSY_POLL_MIN_SHIFT 4		// Spin budgets decay to 1/16th
+
+// The "discovery" filter preset: traffic which tells us about the network,
+// as opposed to bulk data. Routing, first-hop redundancy, naming, address
+// configuration and service discovery, ICMP, and all 802.3 LLC (STP, CDP...).
+#define DISCOVERY_L3 "icmp or icmp6 or igmp or vrrp or pim or ip proto 89 or " \
+	"ip6 proto 89 or (tcp and port 179) or (udp and (port 53 or port 67 or " \
+	"port 68 or port 137 or port 138 or port 520 or port 521 or port 546 or " \
+	"port 547 or port 1900 or port 5350 or port 5351 or port 5353 or port 5355))"
+#define DISCOVERY_ETH "arp or rarp or ether proto 0x88cc or ether proto 0x88d9 " \
+	"or ether[12:2] <= 1500 or " DISCOVERY_L3
+#define DISCOVERY_WLAN "type mgt or arp or " DISCOVERY_L3
+
+static int
+arptype_dlt(unsigned arptype){
+	switch(arptype){
+		case ARPHRD_ETHER: case ARPHRD_LOOPBACK:
+			return DLT_EN10MB;
+		case ARPHRD_IEEE80211_RADIOTAP:
+			return DLT_IEEE802_11_RADIO;
+		case ARPHRD_IEEE80211:
+			return DLT_IEEE802_11;
+		case ARPHRD_NONE: case ARPHRD_TUNNEL: case ARPHRD_TUNNEL6:
+		case ARPHRD_SIT:
+			return DLT_RAW;
+	}
+	return -1;
+}
+
+// Compile a pcap-filter(7) expression (or the "discovery" preset) for the
+// interface's link type, and attach it to the packet socket. This ought be
+// done before the socket is bound and its ring set up, so that unwanted
+// frames never leave the kernel.
+int filter_psocket(int fd,unsigned arptype,const char *expr){
+	struct bpf_program bpf;
+	struct sock_fprog fprog;
+	pcap_t *p;
+	int dlt;
+
+	if((dlt = arptype_dlt(arptype)) < 0){
+		diagnostic("Can't filter link type %u",arptype);
+		return -1;
+	}
+	if(strcmp(expr,"discovery") == 0){
+		if(dlt == DLT_EN10MB){
+			expr = DISCOVERY_ETH;
+		}else if(dlt == DLT_RAW){
+			expr = DISCOVERY_L3;
+		}else{
+			expr = DISCOVERY_WLAN;
+		}
+	}
+	if((p = pcap_open_dead(dlt,65535)) == NULL){
+		diagnostic("Couldn't open pcap for link type %u",arptype);
+		return -1;
+	}
+	if(pcap_compile(p,&bpf,expr,1,PCAP_NETMASK_UNKNOWN)){
+		diagnostic("Couldn't compile filter \"%s\" (%s)",expr,pcap_geterr(p));
+		pcap_close(p);
+		return -1;
+	}
+	pcap_close(p);
+	// struct bpf_insn and struct sock_filter share a layout
+	memset(&fprog,0,sizeof(fprog));
+	fprog.len = bpf.bf_len;
+	fprog.filter = (struct sock_filter *)bpf.bf_insns;
+	if(setsockopt(fd,SOL_SOCKET,SO_ATTACH_FILTER,&fprog,sizeof(fprog))){
+		diagnostic("Couldn't attach filter (%s?)",strerror(errno));
+		pcap_freecode(&bpf);
+		return -1;
+	}
+	pcap_freecode(&bpf);
+	return 0;
+}
 
 // See packet(7) and Documentation/networking/packet_mmap.txt
 int packet_socket(unsigned protocol){
@@ -36,6 +147,45 @@ int packet_socket(unsigned protocol){
 	return fd;
 }
 
+// Have the kernel stamp ring frames with the NIC's raw hardware timestamp
+// where one's available (see iface_rx_hwtstamp()), software otherwise.
+int timestamp_psocket(int fd){
+	int ts = SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if(setsockopt(fd,SOL_PACKET,PACKET_TIMESTAMP,&ts,sizeof(ts))){
+		diagnostic("Couldn't set PACKET_TIMESTAMP (%s?)",strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Only the SO_BUSY_POLL failure is reported; the others are merely
+// refinements, unknown prior to 5.11.
+int busypoll_socket(int fd,unsigned usecs){
+	int val = usecs;
+
+	if(setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL,&val,sizeof(val))){
+		diagnostic("Couldn't set SO_BUSY_POLL (%s?)",strerror(errno));
+		return -1;
+	}
+	val = 1;
+	setsockopt(fd,SOL_SOCKET,SO_PREFER_BUSY_POLL,&val,sizeof(val));
+	val = BUSY_POLL_BUDGET;
+	setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL_BUDGET,&val,sizeof(val));
+	return 0;
+}
+
+static inline void
+cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
 static int
 get_block_size(unsigned fsize,unsigned *bsize){
 	int b;
@@ -78,22 +228,49 @@ size_mmap_psocket(struct tpacket_req *treq,unsigned maxframe,unsigned blknum){
 	treq->tp_frame_size = treq->tp_block_size / fperblk;
 	// Array of pointers to blocks, allocated via slab -- cannot be
 	// larger than largest slabbable allocation. FIXME do better
-	treq->tp_block_nr = blknum / (treq->tp_block_size / getpagesize());
+	if((treq->tp_block_nr = blknum / (treq->tp_block_size / getpagesize())) == 0){
+		treq->tp_block_nr = 1;
+	}
 	// tp_frame_nr is derived from the other three parameters.
 	treq->tp_frame_nr = (treq->tp_block_size / treq->tp_frame_size)
 		* treq->tp_block_nr;
 	return treq->tp_block_nr * treq->tp_block_size;
 }
 
+// TPACKET_V3 packs variable-length frames into blocks, and only hands a block
+// to userspace once it's full or its retire timer fires. tp_frame_size is
+// then merely a bookkeeping value, but the kernel still validates it. We keep
+// the same number of pages as the V1 ring, in fewer, larger blocks.
 static size_t
-mmap_psocket(int op,int idx,int fd,unsigned maxframe,void **map,
-			struct tpacket_req *treq,unsigned blknum){
-	size_t size;
+size_mmap_psocket3(struct tpacket_req3 *treq,unsigned maxframe,unsigned blknum){
+	unsigned pgsize = getpagesize();
 
-	*map = MAP_FAILED;
-	if((size = size_mmap_psocket(treq,maxframe,blknum)) == 0){
+	memset(treq,0,sizeof(*treq));
+	treq->tp_frame_size = TPACKET_ALIGN(TPACKET3_HDRLEN + maxframe);
+	if(get_block_size(treq->tp_frame_size,&treq->tp_block_size) < 0){
 		return 0;
 	}
+	// Grow the blocks towards RX_BLOCK_BYTES, but retain at least two.
+	while(treq->tp_block_size < RX_BLOCK_BYTES &&
+			(treq->tp_block_size / pgsize) * 4 <= blknum){
+		treq->tp_block_size <<= 1u;
+	}
+	if((treq->tp_block_nr = blknum / (treq->tp_block_size / pgsize)) == 0){
+		treq->tp_block_nr = 1;
+	}
+	treq->tp_frame_nr = (treq->tp_block_size / treq->tp_frame_size)
+		* treq->tp_block_nr;
+	treq->tp_retire_blk_tov = RX_BLOCK_RETIRE_MSEC;
+	return (size_t)treq->tp_block_nr * treq->tp_block_size;
+}
+
+// op 0 gets an anonymous mapping (no kernel ring), which alone can be backed
+// by huge pages. A ring's pages are allocated by the kernel on setsockopt(),
+// and can't be hugetlbfs or THP no matter how we map them.
+static size_t
+mmap_psocket(int op,int idx,int fd,size_t size,void **map,
+			const void *treq,socklen_t tlen,int huge){
+	*map = MAP_FAILED;
 	if(idx >= 0){
 		struct sockaddr_ll sll;
 
@@ -109,29 +286,71 @@ mmap_psocket(int op,int idx,int fd,unsigned maxframe,void **map,
 		return -1;
 	}
 	if(op){
-		if(setsockopt(fd,SOL_PACKET,op,treq,sizeof(*treq)) < 0){
+		if(setsockopt(fd,SOL_PACKET,op,treq,tlen) < 0){
 			diagnostic("Couldn't set socket option (%s?)",strerror(errno));
 			return 0;
 		}
+	}else if(huge){
+		// MAP_HUGETLB needs pages reserved via vm.nr_hugepages. Should
+		// there be none, fall back to asking for transparent ones.
+		size = (size + HUGEPAGE_BYTES - 1) / HUGEPAGE_BYTES * HUGEPAGE_BYTES;
+		if((*map = mmap(0,size,PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0)) != MAP_FAILED){
+			return size;
+		}
+		diagnostic("Couldn't get %zub of huge pages (%s?)",size,strerror(errno));
 	}
 	if((*map = mmap(0,size,PROT_READ|PROT_WRITE,
-				MAP_SHARED | (op ? 0 : MAP_ANONYMOUS),
+				op ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS,
 				op ? fd : -1,0)) == MAP_FAILED){
 		diagnostic("Couldn't mmap %zub (%s?)",size,strerror(errno));
 		return 0;
 	}
-	// FIXME MADV_HUGEPAGE support was dropped in 2.6.38.4, it seems.
 #ifdef MADV_HUGEPAGE
-	if(madvise(*map,size,MADV_HUGEPAGE)){
-		//diagnostic("Couldn't advise hugepages for %zu (%s?)",size,strerror(errno));
+	if(!op && huge){
+		if(madvise(*map,size,MADV_HUGEPAGE)){
+			diagnostic("Couldn't advise hugepages for %zub (%s?)",size,strerror(errno));
+		}
 	}
 #endif
 	return size;
 }
 
-size_t mmap_tx_psocket(int fd,int idx,unsigned maxframe,void **map,
-					struct tpacket_req *treq){
-	return mmap_psocket(0/*PACKET_TX_RING*/,idx,fd,maxframe,map,treq,256);
+size_t mmap_tx_psocket(int fd,int idx,unsigned maxframe,size_t bytes,
+				int huge,void **map,struct tpacket_req *treq){
+	size_t size;
+
+	*map = MAP_FAILED;
+	if(bytes == 0){
+		bytes = TX_RING_DEFAULT_BYTES;
+	}
+	if((size = size_mmap_psocket(treq,maxframe,bytes / getpagesize())) == 0){
+		return 0;
+	}
+	// Frames are built here, and copied into the kernel's PACKET_TX_RING
+	// (see mmap_txring_psocket()) only once they're to be sent.
+	return mmap_psocket(0,idx,fd,size,map,treq,sizeof(*treq),huge);
+}
+
+// With PACKET_LOSS, the kernel skips (and returns) any frame it can't send,
+// rather than marking it TP_STATUS_WRONG_FORMAT and stalling the ring there.
+size_t mmap_txring_psocket(int fd,int idx,unsigned maxframe,size_t bytes,
+					void **map,struct tpacket_req *treq){
+	int loss = 1;
+	size_t size;
+
+	*map = MAP_FAILED;
+	if(bytes == 0){
+		bytes = TX_RING_DEFAULT_BYTES;
+	}
+	if((size = size_mmap_psocket(treq,maxframe,bytes / getpagesize())) == 0){
+		return 0;
+	}
+	if(setsockopt(fd,SOL_PACKET,PACKET_LOSS,&loss,sizeof(loss))){
+		diagnostic("Couldn't set PACKET_LOSS (%s?)",strerror(errno));
+		return 0;
+	}
+	return mmap_psocket(PACKET_TX_RING,idx,fd,size,map,treq,sizeof(*treq),0);
 }
 
 int unmap_psocket(void *map,size_t size){
@@ -143,170 +362,382 @@ int unmap_psocket(void *map,size_t size){
 }
 
 static int
-recover_truncated_packet(interface *iface,int fd,unsigned tlen){
+recover_truncated_packet(rxworker *w,int fd,unsigned tlen){
 	int r;
 
-	if(iface->truncbuflen < tlen){
+	if(w->truncbuflen < tlen){
 		void **tmp;
 
-		if((tmp = realloc(iface->truncbuf,tlen)) == NULL){
+		if((tmp = realloc(w->truncbuf,tlen)) == NULL){
 			return -1;
 		}
-		iface->truncbuf = tmp;
-		iface->truncbuflen = tlen;
+		w->truncbuf = tmp;
+		w->truncbuflen = tlen;
 	}
 	// Passing MSG_TRUNC ensures that we get the true length of the packet
 	// from the wire (see packet(7)).
-	if((r = recvfrom(fd,iface->truncbuf,iface->truncbuflen,MSG_DONTWAIT|MSG_TRUNC,NULL,0)) <= 0){
-		diagnostic("Error in recvfrom(%s): %s",iface->name,strerror(errno));
+	if((r = recvfrom(fd,w->truncbuf,w->truncbuflen,MSG_DONTWAIT|MSG_TRUNC,NULL,0)) <= 0){
+		diagnostic("Error in recvfrom(%s): %s",w->i->name,strerror(errno));
 		return r;
 	}
-	if((unsigned)r > iface->truncbuflen){
-		diagnostic("Couldn't recover truncated packet (%d > %zu)",r,iface->truncbuflen);
+	if((unsigned)r > w->truncbuflen){
+		diagnostic("Couldn't recover truncated packet (%d > %zu)",r,w->truncbuflen);
 		return -1;
 	}
 	return r;
 }
 
-// -1: error; don't call us anymore. 0: handled frame. 1: interrupted; we
-// return for a cancellation check, and the frameptr oughtn't be advanced. The
-// interface lock must be held upon entry.
-int handle_ring_packet(interface *iface,int fd,void *frame){
-	const struct omphalos_ctx *ctx = get_octx();
-	const omphalos_iface *octx = &ctx->iface;
-	struct tpacket_hdr *thdr = frame;
-	omphalos_packet packet;
-	int len;
+// The ring itself is filled from softirq context, so we needn't touch the
+// socket at all to see frames arrive. A periodic nonblocking recv() is only
+// made so that, with SO_BUSY_POLL, we drive the NIC queue's NAPI processing
+// from this core rather than waiting on an interrupt. poll() won't do: it
+// only busy polls given the net.core.busy_poll sysctl, off by default. We
+// peek, lest we eat a truncated frame queued to the socket for recovery;
+// XSKs refuse MSG_PEEK, but have nothing queued to eat.
+int ring_spin(rxworker *w,int fd,ring_readyfxn ready,const void *arg){
+	const interface *iface = w->i;
+	unsigned budget = w->spinusecs;
+	int kick = MSG_DONTWAIT | MSG_PEEK;
+	unsigned spins = 0;
+	uint64_t deadline;
+	int r;
 
-	memset(&packet,0,sizeof(packet));
-	packet.i = iface;
-	while(thdr->tp_status == 0){
-		struct pollfd pfd[1];
-		int events,msec;
-
-		pfd[0].fd = fd;
-		pfd[0].revents = 0;
-		pfd[0].events = POLLIN | POLLRDNORM | POLLERR;
-		msec = IFACE_TIMESTAT_USECS / 1000;
-		pthread_mutex_unlock(&iface->lock);
-		events = poll(pfd,sizeof(pfd) / sizeof(*pfd),msec);
-		pthread_mutex_lock(&iface->lock);
-		if(events == 0){
-			gettimeofday(&packet.tv,NULL);
-			timestat_inc(&iface->fps,&packet.tv,0);
-			timestat_inc(&iface->bps,&packet.tv,0);
-			if(octx->packet_read){
-				octx->packet_read(&packet);
+	if(budget == 0){
+		return 0;
+	}
+	pthread_mutex_unlock(w->lock);
+	deadline = mono_ns() + budget * 1000ull;
+	while(!(r = ready(arg))){
+		if(++spins % BUSY_POLL_KICK_SPINS == 0){
+			if(recv(fd,NULL,0,kick) < 0 && errno == EOPNOTSUPP){
+				kick = MSG_DONTWAIT;
 			}
-			return 1;
-		}else if(events < 0){
-			if(errno != EINTR){
-				diagnostic("Error in poll() on %s (%s?)",
-						iface->name,strerror(errno));
-				return -1;
+			if(mono_ns() >= deadline){
+				break;
 			}
-			return 1;
-		}else if(pfd[0].revents & POLLERR){
-			// FIXME don't want to print this every time a device
-			// is removed from underneath us, but also don't want
-			// to race against notification...check to see if
-			// device is down here? FIXME
-			//diagnostic("Error polling psocket %d on %s",fd,i->name);
+		}
+		cpu_relax();
+	}
+	pthread_mutex_lock(w->lock);
+	if(r){
+		budget *= 2;
+		w->spinusecs = budget > iface->busypoll ? iface->busypoll : budget;
+	}else if(budget / 2 >= (iface->busypoll >> BUSY_POLL_MIN_SHIFT) && budget > 1){
+		w->spinusecs = budget / 2;
+	}
+	return r;
+}
+
+// The sweeps want the interface to themselves. A lone ring's worker has it
+// already. With several, any idle worker might tick them, stepping aside
+// should the interface be busy. The worker's lock must be held.
+static int
+ring_sweep_tick(rxworker *w){
+	int ms;
+
+	if(w->lock == &w->i->lock){
+		return sweep_tick(w->i);
+	}
+	pthread_mutex_unlock(w->lock);
+	if(trylock_interface(w->i) == 0){
+		ms = sweep_tick(w->i);
+		unlock_interface(w->i);
+	}else{
+		ms = __atomic_load_n(&w->i->sweeplisted,__ATOMIC_RELAXED) ? SWEEP_TICK_MSEC : -1;
+	}
+	pthread_mutex_lock(w->lock);
+	return ms;
+}
+
+int ring_wait(rxworker *rw,int fd){
+	const struct omphalos_ctx *ctx = get_octx();
+	const omphalos_iface *octx = &ctx->iface;
+	interface *iface = rw->i;
+	struct pollfd pfd[1];
+	int events,msec,w;
+
+	pfd[0].fd = fd;
+	pfd[0].revents = 0;
+	pfd[0].events = POLLIN | POLLRDNORM | POLLERR;
+	msec = IFACE_TIMESTAT_USECS / 1000;
+	// The ring's empty; use the lull to send any paced TX and sweep
+	// probes, and wake up in time to send more.
+	if((w = drain_tx_sched(iface)) >= 0 && w < msec){
+		msec = w;
+	}
+	if((w = ring_sweep_tick(rw)) >= 0 && w < msec){
+		msec = w;
+	}
+	pthread_mutex_unlock(rw->lock);
+	epoch_offline();
+	events = poll(pfd,sizeof(pfd) / sizeof(*pfd),msec);
+	epoch_online();
+	pthread_mutex_lock(rw->lock);
+	if(events == 0){
+		omphalos_packet packet;
+
+		memset(&packet,0,sizeof(packet));
+		packet.i = iface;
+		packet.ts = now_ns();
+		pthread_mutex_lock(&iface->statlock);
+		timestat_inc(&iface->fps,packet.ts,0);
+		timestat_inc(&iface->bps,packet.ts,0);
+		pthread_mutex_unlock(&iface->statlock);
+		if(octx->packet_read){
+			octx->packet_read(&packet);
+		}
+		return 1;
+	}else if(events < 0){
+		if(errno != EINTR){
+			diagnostic("Error in poll() on %s (%s?)",
+					iface->name,strerror(errno));
 			return -1;
 		}
+		return 1;
+	}else if(pfd[0].revents & POLLERR){
+		// FIXME don't want to print this every time a device
+		// is removed from underneath us, but also don't want
+		// to race against notification...check to see if
+		// device is down here? FIXME
+		//diagnostic("Error polling psocket %d on %s",fd,i->name);
+		return -1;
 	}
-	++iface->frames;
-	packet.tv.tv_sec = thdr->tp_sec;
-	packet.tv.tv_usec = thdr->tp_usec;
-	timestat_inc(&iface->fps,&packet.tv,1);
-	if(thdr->tp_status & TP_STATUS_LOSING){
-		struct tpacket_stats tstats;
-		socklen_t slen;
-
-		// FIXME only call once for each burst of TP_STATUS_LOSING
-		slen = sizeof(tstats);
-		if(getsockopt(fd,SOL_PACKET,PACKET_STATISTICS,&tstats,&slen)){
-			diagnostic("Error reading stats on %s (%s?)",iface->name,strerror(errno));
-		}else if(tstats.tp_drops){
-			iface->drops += tstats.tp_drops;
-			diagnostic("[%s] %u/%ju drops",iface->name,tstats.tp_drops,iface->drops);
+	return 0;
+}
+
+static void
+ring_losses(rxworker *w,int fd){
+	struct tpacket_stats_v3 tstats;
+	socklen_t slen;
+
+	// FIXME only call once for each burst of TP_STATUS_LOSING
+	memset(&tstats,0,sizeof(tstats));
+	slen = sizeof(tstats);
+	if(getsockopt(fd,SOL_PACKET,PACKET_STATISTICS,&tstats,&slen)){
+		diagnostic("Error reading stats on %s (%s?)",w->i->name,strerror(errno));
+	}else if(tstats.tp_drops){
+		w->drops += tstats.tp_drops;
+		diagnostic("[%s] %u drops on ring %d",w->i->name,tstats.tp_drops,fd);
+	}
+}
+
+uintmax_t fold_rx_stats(rxworker *w){
+	interface *i = w->i;
+	uintmax_t frames = w->frames;
+
+	if(frames == 0 && w->drops == 0){
+		return 0;
+	}
+	pthread_mutex_lock(&i->statlock);
+	if(frames){
+		timestat_inc(&i->fps,w->lastts,frames);
+		timestat_inc(&i->bps,w->lastts,w->bytes);
+		i->frames += frames;
+		i->bytes += w->bytes;
+		i->truncated += w->truncated;
+		i->truncated_recovered += w->truncated_recovered;
+		i->malformed += w->malformed;
+		i->noprotocol += w->noprotocol;
+		i->csumtrusted += w->csumtrusted;
+		++i->rxbatches;
+		if(frames > i->rxbatchmax){
+			i->rxbatchmax = frames;
 		}
 	}
-	if((thdr->tp_status & TP_STATUS_COPY) || thdr->tp_snaplen != thdr->tp_len){
-		++iface->truncated;
-		if((len = recover_truncated_packet(iface,fd,thdr->tp_len)) <= 0){
+	i->drops += w->drops;
+	pthread_mutex_unlock(&i->statlock);
+	w->frames = w->bytes = w->truncated = w->truncated_recovered = 0;
+	w->malformed = w->noprotocol = w->csumtrusted = w->drops = 0;
+	return frames;
+}
+
+void trim_rx_hosts(rxworker *w){
+	interface *i = w->i;
+
+	if(w->lock == &i->lock){
+		trim_hosts(i);
+	}else if(hosts_over_caps(i)){
+		pthread_mutex_unlock(w->lock);
+		lock_interface(i);
+		trim_hosts(i);
+		unlock_interface(i);
+		pthread_mutex_lock(w->lock);
+	}
+}
+
+// Truncated frames are recovered via recvfrom() only when the ring supports
+// PACKET_COPY_THRESH (V1); V3 has no such mechanism, and we analyze what we
+// got.
+void handle_ring_frame(rxworker *w,int fd,omphalos_packet *packet,void *hdr,
+		unsigned mac,unsigned snaplen,unsigned tlen,unsigned status,
+		int recoverable){
+	const struct omphalos_ctx *ctx = get_octx();
+	const omphalos_iface *octx = &ctx->iface;
+	interface *iface = w->i;
+	void *frame;
+	int len;
+
+	++w->frames;
+	w->lastts = packet->ts;
+	if((status & TP_STATUS_COPY) || snaplen != tlen){
+		++w->truncated;
+		if(!recoverable || (len = recover_truncated_packet(w,fd,tlen)) <= 0){
 			diagnostic("Partial capture on %s (%u/%ub)",
-				iface->name,thdr->tp_snaplen,thdr->tp_len);
-			frame = (char *)frame + thdr->tp_mac;
-			len = thdr->tp_snaplen;
+				iface->name,snaplen,tlen);
+			frame = (char *)hdr + mac;
+			len = snaplen;
 		}else{
-			frame = iface->truncbuf;
-			++iface->truncated_recovered;
-			len = thdr->tp_len;
+			frame = w->truncbuf;
+			++w->truncated_recovered;
+			len = tlen;
 		}
 	}else{
-		frame = (char *)frame + thdr->tp_mac;
-		len = thdr->tp_len;
+		frame = (char *)hdr + mac;
+		len = tlen;
 	}
-	timestat_inc(&iface->bps,&packet.tv,len);
-	iface->bytes += len;
-	iface->analyzer(&packet,frame,len);
-	thdr->tp_status = TP_STATUS_KERNEL; // return the frame
-	if(packet.l2s){
-		l2srcpkt(packet.l2s);
+	w->bytes += len;
+	packet->csumok = !!(status & (TP_STATUS_CSUM_VALID | TP_STATUS_CSUMNOTREADY));
+	iface->analyzer(packet,frame,len);
+	if(packet->l2s){
+		l2srcpkt(packet->l2s);
 	}
-	if(packet.l2d){
-		l2dstpkt(packet.l2d);
+	if(packet->l2d){
+		l2dstpkt(packet->l2d);
 	}
-	if(packet.l3s){
-		l3_srcpkt(packet.l3s);
+	if(packet->l3s){
+		l3_srcpkt(packet->l3s);
 	}
-	if(packet.l3d){
-		l3_dstpkt(packet.l3d);
+	if(packet->l3d){
+		l3_dstpkt(packet->l3d);
 	}
-	if(packet.malformed || packet.noproto){
-		if(packet.malformed){
-			++iface->malformed;
+	if(packet->csumtrusted){
+		++w->csumtrusted;
+	}
+	if(packet->malformed || packet->noproto){
+		if(packet->malformed){
+			++w->malformed;
 		}
-		if(packet.noproto){
-			++iface->noprotocol;
+		if(packet->noproto){
+			++w->noprotocol;
 		}
-		if(packet.pcap_ethproto){
+		if(packet->pcap_ethproto){
 			struct pcap_pkthdr pcap;
 			size_t scribble = 0;
 			struct pcap_ll pll;
 
-			if(frame != iface->truncbuf){
-				scribble = thdr->tp_mac;
-				frame -= thdr->tp_mac;
+			if(frame != w->truncbuf){
+				scribble = mac;
+				frame = hdr;
 			}else{
 				scribble = 0;
 			}
 			pcap.caplen = pcap.len = len + scribble;
-			pcap.ts = packet.tv;
+			pcap_set_ts(&pcap,packet->hwts ? packet->hwts : packet->ts);
 			memset(&pll,0,sizeof(pll));
-			pll.arphrd = htons(packet.i->arptype);
-			pll.llen = htons(packet.i->addrlen);
-			if(packet.l2s){
-				hwaddrint hw = get_hwaddr(packet.l2s);
-				memcpy(&pll.haddr,&hw,packet.i->addrlen > sizeof(pll.haddr) ?
-						sizeof(pll.haddr) : packet.i->addrlen);
+			pll.arphrd = htons(packet->i->arptype);
+			pll.llen = htons(packet->i->addrlen);
+			if(packet->l2s){
+				hwaddrint hw = get_hwaddr(packet->l2s);
+				memcpy(&pll.haddr,&hw,packet->i->addrlen > sizeof(pll.haddr) ?
+						sizeof(pll.haddr) : packet->i->addrlen);
 				// FIXME handle other pkttypes
-				if(memcmp(&hw,packet.i->addr,packet.i->addrlen) == 0){
+				if(memcmp(&hw,packet->i->addr,packet->i->addrlen) == 0){
 					pll.pkttype = htons(4);
 				}
 			}
-			pll.ethproto = htons(packet.pcap_ethproto);
-			// 'frame' starts at the L2 header, *not* the tpacket_thdr
-			log_pcap_packet(&pcap,frame,packet.i->l2hlen + scribble,&pll);
-			if(scribble){
-				frame += thdr->tp_mac;
-			}
+			pll.ethproto = htons(packet->pcap_ethproto);
+			// 'frame' starts at the tpacket header, *not* the L2 header
+			log_pcap_packet(&pcap,frame,packet->i->l2hlen + scribble,&pll);
 		}
 	}
 	if(octx->packet_read){
-		octx->packet_read(&packet);
+		octx->packet_read(packet);
+	}
+}
+
+// With hardware timestamping (PACKET_TIMESTAMP), the ring carries the NIC's
+// clock, which needn't have anything to do with ours. Stats and naming then
+// use the time of analysis, sampled at most once per call (*now is 0 until
+// first needed).
+static inline void
+ring_stamp(omphalos_packet *packet,unsigned status,uint64_t ns,uint64_t *now){
+	if(status & TP_STATUS_TS_RAW_HARDWARE){
+		packet->hwts = ns;
+		if(*now == 0){
+			*now = now_ns();
+		}
+		packet->ts = *now;
+	}else{
+		packet->ts = ns;
+	}
+}
+
+// -1: error; don't call us anymore. 0: handled frame. 1: interrupted; we
+// return for a cancellation check, and the frameptr oughtn't be advanced. The
+// worker's lock must be held upon entry. For TPACKET_V1 rings.
+int handle_ring_packet(rxworker *w,int fd,void *frame){
+	struct tpacket_hdr *thdr = frame;
+	omphalos_packet packet;
+	uint64_t now = 0;
+	int r;
+
+	while(!ring_frame_ready(thdr)){
+		if(ring_spin(w,fd,ring_frame_ready,thdr)){
+			break;
+		}
+		if( (r = ring_wait(w,fd)) ){
+			return r;
+		}
+	}
+	if(thdr->tp_status & TP_STATUS_LOSING){
+		ring_losses(w,fd);
+	}
+	memset(&packet,0,sizeof(packet));
+	packet.i = w->i;
+	ring_stamp(&packet,thdr->tp_status,(uint64_t)thdr->tp_sec * NSEC_PER_SEC +
+			thdr->tp_usec * 1000ull,&now);
+	handle_ring_frame(w,fd,&packet,thdr,thdr->tp_mac,thdr->tp_snaplen,
+				thdr->tp_len,thdr->tp_status,1);
+	thdr->tp_status = TP_STATUS_KERNEL; // return the frame
+	return 0;
+}
+
+// As handle_ring_packet(), but for TPACKET_V3 rings: wait on a block, and
+// analyze each of its frames before returning it to the kernel as a whole.
+int handle_ring_block(rxworker *w,int fd,void *block){
+	struct tpacket_block_desc *bd = block;
+	struct tpacket3_hdr *thdr;
+	omphalos_packet packet;
+	uint64_t now = 0;
+	unsigned p;
+	int r;
+
+	while(!ring_block_ready(bd)){
+		if(ring_spin(w,fd,ring_block_ready,bd)){
+			break;
+		}
+		if( (r = ring_wait(w,fd)) ){
+			return r;
+		}
+	}
+	if(bd->hdr.bh1.block_status & TP_STATUS_LOSING){
+		ring_losses(w,fd);
+	}
+	thdr = (struct tpacket3_hdr *)((char *)block + bd->hdr.bh1.offset_to_first_pkt);
+	for(p = 0 ; p < bd->hdr.bh1.num_pkts ; ++p){
+		memset(&packet,0,sizeof(packet));
+		packet.i = w->i;
+		ring_stamp(&packet,thdr->tp_status,(uint64_t)thdr->tp_sec *
+				NSEC_PER_SEC + thdr->tp_nsec,&now);
+		handle_ring_frame(w,fd,&packet,thdr,thdr->tp_mac,
+				thdr->tp_snaplen,thdr->tp_len,thdr->tp_status,0);
+		thdr = (struct tpacket3_hdr *)((char *)thdr + thdr->tp_next_offset);
+		// The block remains ours while we step aside, so a large
+		// block needn't starve netlink and UI writers.
+		yield_rxworker(w);
 	}
+	// return the block
+	__atomic_store_n(&bd->hdr.bh1.block_status,TP_STATUS_KERNEL,__ATOMIC_RELEASE);
 	return 0;
 }
 
@@ -324,23 +755,151 @@ packet_multicast(int fd,int ifindex){
 	return 0;
 }
 
-size_t mmap_rx_psocket(int fd,int idx,unsigned maxframe,void **map,
-					struct tpacket_req *treq){
+// Add the (bound) packet socket to a PACKET_FANOUT group. If *group is 0, a
+// new group is created, and its id written back to *group. The kernel picks
+// a unique id where it can (4.20+); otherwise we derive one from our pid and
+// the interface, lest we join some other process's group.
+int join_psocket_fanout(int fd,int idx,int mode,unsigned *group){
+	int arg,flags = 0;
+
+	if(mode == PACKET_FANOUT_HASH){
+		flags |= PACKET_FANOUT_FLAG_DEFRAG; // keep fragments together
+	}
+#ifdef PACKET_FANOUT_FLAG_UNIQUEID
+	if(*group == 0){
+		socklen_t alen = sizeof(arg);
+
+		arg = (mode | flags | PACKET_FANOUT_FLAG_UNIQUEID) << 16;
+		if(setsockopt(fd,SOL_PACKET,PACKET_FANOUT,&arg,sizeof(arg)) == 0){
+			if(getsockopt(fd,SOL_PACKET,PACKET_FANOUT,&arg,&alen) == 0){
+				*group = arg & 0xffff;
+				return 0;
+			}
+			diagnostic("Couldn't get fanout group on %d (%s?)",idx,strerror(errno));
+			return -1;
+		}
+	}
+#endif
+	if(*group == 0){
+		*group = ((getpid() << 4) ^ idx) & 0xffff;
+		if(*group == 0){
+			*group = 1;
+		}
+	}
+	arg = ((mode | flags) << 16) | *group;
+	if(setsockopt(fd,SOL_PACKET,PACKET_FANOUT,&arg,sizeof(arg))){
+		diagnostic("Couldn't join fanout group %u on %d (%s?)",*group,idx,strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Size, request and map an RX ring of bytes (approximately) using the
+// socket's current TPACKET version, first binding to idx if it's valid.
+static size_t
+rx_ring(int fd,int idx,int tpver,unsigned maxframe,size_t bytes,void **map,
+						struct tpacket_req *treq){
+	unsigned pages = bytes / getpagesize();
+	struct tpacket_req3 treq3;
+	size_t ret;
+
+	if(tpver != TPACKET_V3){
+		if((ret = size_mmap_psocket(treq,maxframe,pages)) == 0){
+			return 0;
+		}
+		return mmap_psocket(PACKET_RX_RING,idx,fd,ret,map,treq,sizeof(*treq),0);
+	}
+	if((ret = size_mmap_psocket3(&treq3,maxframe,pages)) == 0){
+		return 0;
+	}
+	if((ret = mmap_psocket(PACKET_RX_RING,idx,fd,ret,map,&treq3,sizeof(treq3),0)) == 0){
+		return 0;
+	}
+	treq->tp_block_size = treq3.tp_block_size;
+	treq->tp_block_nr = treq3.tp_block_nr;
+	treq->tp_frame_size = treq3.tp_frame_size;
+	treq->tp_frame_nr = treq3.tp_frame_nr;
+	return ret;
+}
+
+// Try for a TPACKET_V3 ring, falling back to TPACKET_V1 on kernels which
+// don't support it (pre-3.2). The version used is written to tpver.
+size_t mmap_rx_psocket(int fd,int idx,unsigned maxframe,size_t bytes,void **map,
+				struct tpacket_req *treq,int *tpver){
+	struct tpacket_req3 treq3;
 	size_t ret;
 	int thresh;
 
-	ret = mmap_psocket(PACKET_RX_RING,idx,fd,maxframe,map,treq,8192 * 4);
-	if(ret == 0){
+	if(bytes == 0){
+		bytes = RX_RING_DEFAULT_BYTES;
+	}
+	*tpver = TPACKET_V3;
+	if(setsockopt(fd,SOL_PACKET,PACKET_VERSION,tpver,sizeof(*tpver)) == 0){
+		if( (ret = rx_ring(fd,idx,*tpver,maxframe,bytes,map,treq)) ){
+			if(packet_multicast(fd,idx)){
+				unmap_psocket(*map,ret);
+				*map = MAP_FAILED;
+				return 0;
+			}
+			return ret;
+		}
+		// Tear down any V3 ring we did manage to set up
+		memset(&treq3,0,sizeof(treq3));
+		setsockopt(fd,SOL_PACKET,PACKET_RX_RING,&treq3,sizeof(treq3));
+		diagnostic("Falling back to TPACKET_V1 on %d",idx);
+	}
+	*tpver = TPACKET_V1;
+	if(setsockopt(fd,SOL_PACKET,PACKET_VERSION,tpver,sizeof(*tpver))){
+		diagnostic("Couldn't set TPACKET_V1 (%s?)",strerror(errno));
+		return 0;
+	}
+	if((ret = rx_ring(fd,idx,*tpver,maxframe,bytes,map,treq)) == 0){
 		return 0;
 	}
 	thresh = 1;
 	if(setsockopt(fd,SOL_PACKET,PACKET_COPY_THRESH,&thresh,sizeof(thresh))){
 		unmap_psocket(*map,ret);
-		return -1;
+		*map = MAP_FAILED;
+		return 0;
 	}
 	if(packet_multicast(fd,idx)){
 		unmap_psocket(*map,ret);
-		return -1;
+		*map = MAP_FAILED;
+		return 0;
+	}
+	return ret;
+}
+
+// We keep the socket, and with it the binding, filter, multicast and fanout
+// memberships. Only the ring is replaced. Frames arriving while there's no
+// ring are queued to the socket instead; we've no use for them, and count
+// them as the worker's drops. Should the new ring fail, we try to restore the
+// old size.
+size_t resize_rx_psocket(rxworker *w,int fd,int tpver,unsigned maxframe,
+		size_t bytes,void **map,size_t size,struct tpacket_req *treq){
+	const interface *iface = w->i;
+	struct tpacket_req3 treq3;
+	size_t ret;
+	char c;
+
+	unmap_psocket(*map,size);
+	memset(&treq3,0,sizeof(treq3));
+	if(setsockopt(fd,SOL_PACKET,PACKET_RX_RING,&treq3,
+			tpver == TPACKET_V3 ? sizeof(treq3) : sizeof(*treq))){
+		diagnostic("Couldn't release ring on %s (%s?)",iface->name,strerror(errno));
+		// The old ring is still in place; map it back in.
+		if((*map = mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0)) == MAP_FAILED){
+			diagnostic("Couldn't mmap %zub (%s?)",size,strerror(errno));
+			return 0;
+		}
+		return size;
+	}
+	if((ret = rx_ring(fd,-1,tpver,maxframe,bytes,map,treq)) == 0){
+		diagnostic("Restoring %zub ring on %s",size,iface->name);
+		ret = rx_ring(fd,-1,tpver,maxframe,size,map,treq);
+	}
+	while(recv(fd,&c,sizeof(c),MSG_DONTWAIT | MSG_TRUNC) >= 0){
+		++w->drops;
 	}
 	return ret;
 }
@@ -5,24 +5,117 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <linux/if_packet.h>
 
+struct rxworker;
 struct interface;
 struct tpacket_req;
 
+// Ring sizes used unless configured otherwise (see iface_opts).
+#define RX_RING_DEFAULT_BYTES ((size_t)128 << 20u)
+#define TX_RING_DEFAULT_BYTES ((size_t)1 << 20u)
+
 // Open a packet socket. Requires superuser or network admin capabilities.
 int packet_socket(unsigned);
 
+// Attach a pcap-filter(7) expression, or the built-in "discovery" preset,
+// compiled for the given ARPHRD_* link type.
+int filter_psocket(int,unsigned,const char *);
+
+// Request NIC hardware timestamps in ring frames (TP_STATUS_TS_RAW_HARDWARE).
+int timestamp_psocket(int);
+
 // Returns the size of the map, or 0 if the operation fails (in this case,
-// map will be set to MAP_FAILED).
-size_t mmap_rx_psocket(int,int,unsigned,void **,struct tpacket_req *);
-size_t mmap_tx_psocket(int,int,unsigned,void **,struct tpacket_req *);
+// map will be set to MAP_FAILED). The requested ring size (0 for the default)
+// is rounded to whole blocks. The RX ring is TPACKET_V3 where supported; the
+// version is written to the final argument. tpacket_req then describes the
+// V3 geometry (tp_block_size, tp_block_nr etc). The TX map can be backed by
+// huge pages, in which case its size is rounded up to a huge page multiple.
+size_t mmap_rx_psocket(int,int,unsigned,size_t,void **,struct tpacket_req *,int *);
+size_t mmap_tx_psocket(int,int,unsigned,size_t,int,void **,struct tpacket_req *);
+
+// Set up a kernel PACKET_TX_RING on the (TX) packet socket, with arguments as
+// for mmap_tx_psocket() (less huge pages, which a kernel ring can't use).
+// Frames marked TP_STATUS_SEND_REQUEST are sent, strictly in ring order, on
+// the next send(), and handed back as TP_STATUS_AVAILABLE once done.
+size_t mmap_txring_psocket(int,int,unsigned,size_t,void **,struct tpacket_req *);
+
+// Replace the worker's RX ring (fd, TPACKET version, max frame) with one of
+// the given size. The ring must be quiescent: every frame returned to the
+// kernel, and nothing servicing it elsewhere. Returns the new size, having
+// updated the map and tpacket_req, or 0 if we were left with no usable ring.
+size_t resize_rx_psocket(struct rxworker *,int,int,unsigned,size_t,void **,
+					size_t,struct tpacket_req *);
+
+// Join the RX socket to a PACKET_FANOUT group of the given mode
+// (PACKET_FANOUT_HASH etc), creating the group if the last argument is 0.
+int join_psocket_fanout(int,int,int,unsigned *);
+
+// Enable kernel busy polling (SO_BUSY_POLL, and where available (5.11+)
+// SO_PREFER_BUSY_POLL) on an RX socket, for up to the given microseconds.
+int busypoll_socket(int,unsigned);
+
+// Busy-wait on the ring, with the worker's lock released, until the
+// predicate is true of its argument or the worker's spin budget runs out.
+// The budget adapts between iface->busypoll and a fraction thereof: it
+// doubles whenever the ring becomes ready within it, and halves otherwise,
+// so idle rings soon fall back to sleeping in ring_wait(). Returns nonzero if
+// the ring became ready. The worker's lock must be held upon entry.
+typedef int (*ring_readyfxn)(const void *);
+int ring_spin(struct rxworker *,int,ring_readyfxn,const void *);
 
-int handle_ring_packet(struct interface *,int,void *);
+// Wait for the ring (or any pollable RX fd) to become readable, with the
+// worker's lock released. Returns 0 if we ought recheck the ring, 1 if we
+// timed out (an empty packet is delivered to the packet_read callback for the
+// sake of the UI's rate stats) or were interrupted, and -1 on error. The
+// worker's lock must be held upon entry.
+int ring_wait(struct rxworker *,int);
+
+// Analyze a single received frame, with the worker's lock held, counting it
+// against the worker (see fold_rx_stats()). hdr is the frame's ring header,
+// and the L2 header begins mac bytes past it; those bytes are scribbled over
+// to log malformed packets, and ought be at least a struct pcap_ll's worth.
+// status holds TP_STATUS_* bits. Truncated frames are recovered from the fd
+// if the last argument is nonzero.
+struct omphalos_packet;
+void handle_ring_frame(struct rxworker *,int,struct omphalos_packet *,void *,
+			unsigned,unsigned,unsigned,unsigned,int);
+
+// Handle a TPACKET_V1 frame, or a TPACKET_V3 block of frames, respectively.
+int handle_ring_packet(struct rxworker *,int,void *);
+int handle_ring_block(struct rxworker *,int,void *);
+
+// Add what the worker has counted since last called into the interface's
+// stats, as one batch. Returns the frames so added. The worker's lock must
+// be held.
+uintmax_t fold_rx_stats(struct rxworker *);
+
+// Evict idle hosts past the interface's caps (see hostcap.h). Another
+// worker mid-frame might hold a reference to any of them, so with several
+// workers, this waits for the interface to itself. Call between batches,
+// with the worker's lock held.
+void trim_rx_hosts(struct rxworker *);
 
 // map and size ought have been returned by mmap_*_psocket().
 int unmap_psocket(void *,size_t);
 
+// Has the kernel handed us this TPACKET_V1 frame?
+static inline int
+ring_frame_ready(const void *frame){
+	const struct tpacket_hdr *thdr = frame;
+
+	return __atomic_load_n(&thdr->tp_status,__ATOMIC_ACQUIRE) != TP_STATUS_KERNEL;
+}
+
+// Has the kernel handed us this TPACKET_V3 block?
+static inline int
+ring_block_ready(const void *block){
+	const struct tpacket_block_desc *bd = block;
+
+	return __atomic_load_n(&bd->hdr.bh1.block_status,__ATOMIC_ACQUIRE) & TP_STATUS_USER;
+}
+
 // Calculate the relative address of the next frame, respecting blocks.
 static inline
 ssize_t inclen(unsigned *idx,const struct tpacket_req *treq){
@@ -42,6 +135,28 @@ ssize_t inclen(unsigned *idx,const struct tpacket_req *treq){
 	return inc;
 }
 
+// Address of the idx'th frame (modulo tp_frame_nr) of a V1-geometry ring.
+static inline void *
+ring_frame(void *map,const struct tpacket_req *treq,unsigned idx){
+	unsigned fperb = treq->tp_block_size / treq->tp_frame_size;
+
+	idx %= treq->tp_frame_nr;
+	return (char *)map + (size_t)(idx / fperb) * treq->tp_block_size +
+				(idx % fperb) * treq->tp_frame_size;
+}
+
+// Calculate the relative address of the next TPACKET_V3 block.
+static inline
+ssize_t incblock(unsigned *idx,const struct tpacket_req *treq){
+	ssize_t inc = treq->tp_block_size;
+
+	if(++*idx == treq->tp_block_nr){
+		inc -= (ssize_t)treq->tp_block_nr * treq->tp_block_size;
+		*idx = 0;
+	}
+	return inc;
+}
+
 #ifdef __cplusplus
 }
 #endif
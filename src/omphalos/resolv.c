@@ -160,7 +160,9 @@ int offer_wresolution(int fam,const void *addr,const wchar_t *name,namelevel nle
 		return 0;
 	}
 	// FIXME needs to lock the interface to touch l3 objs
-	l2 = l3_getlastl2(l3);
+	if((l2 = l3_getlastl2(l3)) == NULL){ // evicted (see hostcap.h)
+		return 0;
+	}
 	i = l2_getiface(l2);
 	wname_l3host_absolute(i,l2,l3,name,nlevel);
 	/*{
@@ -414,6 +414,8 @@ int get_routed_frame(int fam,const void *addr,struct routepath *rp,
 		return -1;
 	}
 	assert(hlen); // FIXME set up the l2/l3 headers
+	abort_tx_frame(rp->i,*frame);
+	*frame = NULL;
 	return -1;
 }
 
@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <omphalos/diag.h>
+#include <omphalos/epoch.h>
+#include <omphalos/rxpool.h>
+#include <omphalos/sweep.h>
+#include <omphalos/txsched.h>
+#include <omphalos/omphalos.h>
+
+#define RXPOOL_EVENTS 32	// epoll_event slots per epoll_wait()
+
+typedef struct rxpool_reg {
+	int fd;
+	int (*cb)(void *);
+	void *arg;
+	int registered;		// cleared by rxpool_del()
+	unsigned busy;		// workers in the callback
+	struct rxpool_reg *next;// freelist
+} rxpool_reg;
+
+static int epfd = -1;		// shared epoll fd
+static int stopfd = -1;		// eventfd, written to stop the workers
+static unsigned workers;
+static pthread_t *tids;
+static const omphalos_ctx *poolctx;
+
+// A worker might pull an event for a registration from epoll_wait() just
+// before it's deregistered, so registrations are never freed while the pool
+// is running. They're instead recycled; a stale event can then at worst
+// result in a spurious (harmless) callback.
+static rxpool_reg *freeregs;
+
+// Protects the registrations' registered and busy flags, and freeregs
+static pthread_mutex_t poollock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolcond = PTHREAD_COND_INITIALIZER;
+
+static void
+dispatch(rxpool_reg *reg){
+	struct epoll_event ev;
+	int r;
+
+	pthread_mutex_lock(&poollock);
+	if(!reg->registered){
+		pthread_mutex_unlock(&poollock);
+		return;
+	}
+	++reg->busy;
+	pthread_mutex_unlock(&poollock);
+	r = reg->cb(reg->arg);
+	pthread_mutex_lock(&poollock);
+	--reg->busy;
+	if(reg->registered && r == 0){
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = reg;
+		if(epoll_ctl(epfd,EPOLL_CTL_MOD,reg->fd,&ev)){
+			diagnostic("Couldn't rearm %d (%s?)",reg->fd,strerror(errno));
+		}
+	}
+	pthread_cond_broadcast(&poolcond);
+	pthread_mutex_unlock(&poollock);
+}
+
+// msec until paced TX or a sweep next wants servicing, or -1.
+static int
+service_tx(void){
+	int ms = drain_tx_scheds();
+	int w = sweep_ticks();
+
+	if(w >= 0 && (ms < 0 || w < ms)){
+		ms = w;
+	}
+	return ms;
+}
+
+static void *
+rxpool_loop(void){
+	struct epoll_event evs[RXPOOL_EVENTS];
+	int n,z,ms;
+
+	for( ; ; ){
+		// Pooled rings have no idle ticks of their own; we instead
+		// wake up to send paced TX and sweeps for any interface that
+		// needs it.
+		ms = service_tx();
+		epoch_offline();
+		n = epoll_wait(epfd,evs,sizeof(evs) / sizeof(*evs),ms);
+		epoch_online();
+		if(n < 0){
+			if(errno != EINTR){
+				diagnostic("Error in epoll_wait() (%s?)",strerror(errno));
+				return "calamitous error";
+			}
+			continue;
+		}
+		for(z = 0 ; z < n ; ++z){
+			if(evs[z].data.ptr == NULL){ // stopfd; never reset
+				return PTHREAD_CANCELED;
+			}
+			dispatch(evs[z].data.ptr);
+		}
+		epoch_quiescent();
+	}
+}
+
+static void *
+rxpool_thread(void *unused __attribute__ ((unused))){
+	void *r;
+
+	if(pthread_setspecific(omphalos_ctx_key,poolctx)){
+		return "couldn't set TSD";
+	}
+	if(epoch_register()){
+		return "couldn't register with the reclaimer";
+	}
+	r = rxpool_loop();
+	epoch_unregister();
+	return r;
+}
+
+int rxpool_active(void){
+	return workers != 0;
+}
+
+int init_rxpool(const omphalos_ctx *octx,unsigned count){
+	struct epoll_event ev;
+
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+		diagnostic("Couldn't create epoll fd (%s?)",strerror(errno));
+		return -1;
+	}
+	if((stopfd = eventfd(0,EFD_CLOEXEC | EFD_NONBLOCK)) < 0){
+		diagnostic("Couldn't create eventfd (%s?)",strerror(errno));
+		close(epfd);
+		epfd = -1;
+		return -1;
+	}
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN; // level-triggered: wakes every worker
+	ev.data.ptr = NULL;
+	if(epoll_ctl(epfd,EPOLL_CTL_ADD,stopfd,&ev)){
+		diagnostic("Couldn't add eventfd (%s?)",strerror(errno));
+		stop_rxpool();
+		return -1;
+	}
+	if((tids = malloc(sizeof(*tids) * count)) == NULL){
+		stop_rxpool();
+		return -1;
+	}
+	poolctx = octx;
+	while(workers < count){
+		if( (errno = pthread_create(&tids[workers],NULL,rxpool_thread,NULL)) ){
+			diagnostic("Couldn't launch RX worker (%s?)",strerror(errno));
+			stop_rxpool();
+			return -1;
+		}
+		++workers;
+	}
+	return 0;
+}
+
+int stop_rxpool(void){
+	uint64_t one = 1;
+	int ret = 0;
+
+	if(workers){
+		if(write(stopfd,&one,sizeof(one)) != sizeof(one)){
+			diagnostic("Couldn't stop RX workers (%s?)",strerror(errno));
+			return -1;
+		}
+		while(workers){
+			--workers;
+			if( (errno = pthread_join(tids[workers],NULL)) ){
+				diagnostic("Couldn't join RX worker (%s?)",strerror(errno));
+				ret = -1;
+			}
+		}
+	}
+	free(tids);
+	tids = NULL;
+	while(freeregs){
+		rxpool_reg *reg = freeregs->next;
+
+		free(freeregs);
+		freeregs = reg;
+	}
+	if(stopfd >= 0){
+		close(stopfd);
+		stopfd = -1;
+	}
+	if(epfd >= 0){
+		close(epfd);
+		epfd = -1;
+	}
+	return ret;
+}
+
+rxpool_reg *rxpool_add(int fd,int (*cb)(void *),void *arg){
+	struct epoll_event ev;
+	rxpool_reg *reg;
+
+	pthread_mutex_lock(&poollock);
+	if( (reg = freeregs) ){
+		freeregs = reg->next;
+	}else if((reg = malloc(sizeof(*reg))) == NULL){
+		pthread_mutex_unlock(&poollock);
+		return NULL;
+	}
+	reg->fd = fd;
+	reg->cb = cb;
+	reg->arg = arg;
+	reg->busy = 0;
+	reg->registered = 1;
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = reg;
+	if(epoll_ctl(epfd,EPOLL_CTL_ADD,fd,&ev)){
+		diagnostic("Couldn't register %d (%s?)",fd,strerror(errno));
+		reg->registered = 0;
+		reg->next = freeregs;
+		freeregs = reg;
+		reg = NULL;
+	}
+	pthread_mutex_unlock(&poollock);
+	return reg;
+}
+
+int rxpool_del(rxpool_reg *reg){
+	int ret = 0;
+
+	pthread_mutex_lock(&poollock);
+	reg->registered = 0;
+	if(epoll_ctl(epfd,EPOLL_CTL_DEL,reg->fd,NULL)){
+		diagnostic("Couldn't deregister %d (%s?)",reg->fd,strerror(errno));
+		ret = -1;
+	}
+	while(reg->busy){
+		pthread_cond_wait(&poolcond,&poollock);
+	}
+	reg->next = freeregs;
+	freeregs = reg;
+	pthread_mutex_unlock(&poollock);
+	return ret;
+}
@@ -0,0 +1,34 @@
+#ifndef OMPHALOS_RXPOOL
+#define OMPHALOS_RXPOOL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct omphalos_ctx;
+struct rxpool_reg;
+
+// A fixed pool of worker threads multiplexing any number of RX fds via
+// epoll(7), as an alternative to a thread per ring. Each registered fd is
+// armed one-shot, so only one worker drains a given ring at a time. Idle
+// rings cost no wakeups.
+int init_rxpool(const struct omphalos_ctx *,unsigned);
+int stop_rxpool(void);
+
+// Nonzero if the pool is running (and thus ought be used).
+int rxpool_active(void);
+
+// The callback drains whatever's ready on the fd, without blocking, and
+// returns 0 to be rearmed, or -1 if the fd is no longer usable (it is then
+// no longer polled, but remains registered until rxpool_del()).
+struct rxpool_reg *rxpool_add(int,int (*)(void *),void *);
+
+// Deregister the fd, waiting for any in-progress callback to complete. The
+// callback must not be holding any lock held by our caller!
+int rxpool_del(struct rxpool_reg *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,24 +1,50 @@
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <omphalos/diag.h>
+#include <omphalos/slab.h>
 #include <omphalos/service.h>
 #include <omphalos/netaddrs.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/interface.h>
 
+// Carved from the interface's slab (see slab.h), aligned to a cache line. The
+// fields compared while walking a host's services come first.
 typedef struct l4srv {
 	unsigned proto,port;
 	wchar_t *srv,*srvver;		// srvver might be NULL
 	struct l4srv *next;
+	uint64_t seen;			// observation clock, for eviction
 	void *opaque;			// callback state
+	struct slab *slab;		// whence we came
 } l4srv;
 
+#define L4SRV_ALIGN 64
+
+// Orders observations, so the least recently observed service on a host can
+// be evicted once the host is past its cap (see hostcap.h).
+static uint64_t observations;
+
+static inline uint64_t
+observe(void){
+	return __atomic_add_fetch(&observations,1,__ATOMIC_RELAXED);
+}
+
+// Requires the interface lock.
 static l4srv *
-new_service(unsigned proto,unsigned port,const wchar_t *srv,const wchar_t *srvver){
+new_service(interface *i,unsigned proto,unsigned port,const wchar_t *srv,
+					const wchar_t *srvver){
 	l4srv *r;
 
-	if( (r = malloc(sizeof(*r))) ){
+	if(i->l4slab == NULL){
+		if((i->l4slab = create_slab(sizeof(*r),L4SRV_ALIGN)) == NULL){
+			diagnostic("%s couldn't create slab on %s",__func__,i->name);
+			return NULL;
+		}
+	}
+	if( (r = slab_alloc(i->l4slab)) ){
+		r->slab = i->l4slab;
 		r->srvver = NULL;
 		if(!srvver ||  (r->srvver = wcsdup(srvver)) ){
 			if( (r->srv = wcsdup(srv)) ){
@@ -29,7 +55,7 @@ new_service(unsigned proto,unsigned port,const wchar_t *srv,const wchar_t *srvve
 			}
 			free(r->srvver);
 		}
-		free(r);
+		slab_free(r->slab,r);
 	}
 	return NULL;
 }
@@ -39,7 +65,7 @@ free_service(l4srv *l){
 	if(l){
 		free(l->srvver);
 		free(l->srv);
-		free(l);
+		slab_free(l->slab,l);
 	}
 }
 
@@ -49,7 +75,38 @@ void observe_proto(interface *i,struct l2host *l2,const wchar_t *proto){
 	// FIXME
 }
 
-void observe_service(interface *i,struct l2host *l2,struct l3host *l3,
+// Past the cap, evict the least recently observed service other than the one
+// just added.
+static void
+trim_services(interface *i,struct l2host *l2,struct l3host *l3,const l4srv *added){
+	const omphalos_ctx *octx = get_octx();
+	l4srv *services,**prev,*cur,**oldest;
+	unsigned count = 0;
+
+	oldest = NULL;
+	services = l3_getservices(l3);
+	for(prev = &services ; (cur = *prev) ; prev = &cur->next){
+		if(cur != added && (oldest == NULL || cur->seen < (*oldest)->seen)){
+			oldest = prev;
+		}
+		++count;
+	}
+	if(count <= i->hostcap.services || oldest == NULL){
+		return;
+	}
+	cur = *oldest;
+	*oldest = cur->next;
+	l3_setservices(l3,services);
+	if(octx->iface.srv_evicted){
+		octx->iface.srv_evicted(i,l2,l3,cur,cur->opaque);
+	}
+	free_service(cur);
+	++i->l4evicted;
+}
+
+// Host lock needs be held upon entry (see lock_hosts())
+static void
+observe_service_locked(interface *i,struct l2host *l2,struct l3host *l3,
 			unsigned proto,unsigned port,
 			const wchar_t *srv,const wchar_t *srvver){
 	const omphalos_ctx *octx = get_octx();
@@ -66,6 +123,7 @@ void observe_service(interface *i,struct l2host *l2,struct l3host *l3,
 				int r;
 
 				if((r = wcscmp(cur->srv,srv)) == 0){
+					cur->seen = observe();
 					return;
 				}else if(r > 0){
 					break;
@@ -73,17 +131,31 @@ void observe_service(interface *i,struct l2host *l2,struct l3host *l3,
 			}
 		}
 	}
-	if((cur = new_service(proto,port,srv,srvver)) == NULL){
+	if((cur = new_service(i,proto,port,srv,srvver)) == NULL){
 		return;
 	}
+	cur->seen = observe();
 	cur->next = *prev;
 	*prev = cur;
 	if(l3_setservices(l3,services)){
 		*prev = cur->next;
 		free_service(cur);
-	}else if(octx->iface.srv_event){
+		return;
+	}
+	if(octx->iface.srv_event){
 		cur->opaque = octx->iface.srv_event(i,l2,l3,cur);
 	}
+	if(i->hostcap.services){
+		trim_services(i,l2,l3,cur);
+	}
+}
+
+void observe_service(interface *i,struct l2host *l2,struct l3host *l3,
+			unsigned proto,unsigned port,
+			const wchar_t *srv,const wchar_t *srvver){
+	lock_hosts(i);
+	observe_service_locked(i,l2,l3,proto,port,srv,srvver);
+	unlock_hosts(i);
 }
 
 // Destroy a services structure.
@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <omphalos/diag.h>
+#include <omphalos/slab.h>
+#include <omphalos/epoch.h>
+
+#define SLAB_CHUNK_BYTES 65536	// per chunk, including its header
+
+typedef struct slabchunk {
+	struct slabchunk *next;
+} slabchunk;
+
+typedef struct slab {
+	size_t objsize;		// rounded up to align
+	size_t align;
+	size_t hdrsize;		// chunk header, rounded up to align
+	unsigned perchunk;	// objects per chunk
+	unsigned carved;	// objects handed out from the newest chunk
+	slabchunk *chunks;	// newest first
+	void *free;		// owner's free objects, linked via first word
+	void *rfree;		// objects freed since the owner last looked.
+				//  Pushed by anyone, only ever taken whole by
+				//  the owner, so there's no ABA (atomic).
+	epoch_entry retire;
+} slab;
+
+slab *create_slab(size_t size,size_t align){
+	slab *s;
+
+	if(align < sizeof(void *) || (align & (align - 1))){
+		diagnostic("%s invalid alignment %zu",__func__,align);
+		return NULL;
+	}
+	if( (s = malloc(sizeof(*s))) ){
+		s->align = align;
+		s->objsize = (size + align - 1) & ~(align - 1);
+		s->hdrsize = (sizeof(slabchunk) + align - 1) & ~(align - 1);
+		if(s->hdrsize + s->objsize > SLAB_CHUNK_BYTES){
+			s->perchunk = 1;
+		}else{
+			s->perchunk = (SLAB_CHUNK_BYTES - s->hdrsize) / s->objsize;
+		}
+		s->carved = 0;
+		s->chunks = NULL;
+		s->free = s->rfree = NULL;
+	}
+	return s;
+}
+
+void *slab_alloc(slab *s){
+	slabchunk *c;
+	void *o;
+
+	if((o = s->free) == NULL){
+		o = __atomic_exchange_n(&s->rfree,NULL,__ATOMIC_ACQUIRE);
+	}
+	if(o){
+		s->free = *(void **)o;
+		return o;
+	}
+	if((c = s->chunks) == NULL || s->carved == s->perchunk){
+		if(posix_memalign((void **)&c,s->align,s->hdrsize + s->perchunk * s->objsize)){
+			return NULL;
+		}
+		c->next = s->chunks;
+		s->chunks = c;
+		s->carved = 0;
+	}
+	return (char *)c + s->hdrsize + s->carved++ * s->objsize;
+}
+
+void slab_free(slab *s,void *o){
+	void *head = __atomic_load_n(&s->rfree,__ATOMIC_RELAXED);
+
+	do{
+		*(void **)o = head;
+	}while(!__atomic_compare_exchange_n(&s->rfree,&head,o,1,
+				__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+}
+
+static void
+free_slab(epoch_entry *e){
+	slab *s = (slab *)((char *)e - offsetof(slab,retire));
+	slabchunk *c;
+
+	while( (c = s->chunks) ){
+		s->chunks = c->next;
+		free(c);
+	}
+	free(s);
+}
+
+void retire_slab(slab *s){
+	if(s){
+		epoch_retire(&s->retire,free_slab);
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef OMPHALOS_SLAB
+#define OMPHALOS_SLAB
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+struct slab;
+
+// Fixed-size object allocators. Each interface owns one per host type (see
+// interface.h), so that hosts are carved from large aligned chunks rather
+// than malloc()ed one at a time, and released in bulk with the interface.
+// Allocation requires the owner's lock (the interface's host lock, see
+// lock_hosts()); objects may be freed from any thread. Freed objects are
+// reused, and their first word overwritten, but chunks are only released by
+// retire_slab(), so a stale pointer never refers to unmapped memory while the
+// slab lives.
+
+// Objects are size bytes rounded up to align (a power of 2, at least a
+// pointer), and start on an align boundary. Returns NULL on failure.
+struct slab *create_slab(size_t size,size_t align);
+
+void *slab_alloc(struct slab *);
+
+void slab_free(struct slab *,void *);
+
+// Release all chunks once every participant has quiesced (see epoch.h).
+// Objects retired before the slab will have been destroyed by then, and can
+// still be freed to it. NULL is accepted.
+void retire_slab(struct slab *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
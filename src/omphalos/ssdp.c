@@ -1,3 +1,5 @@
+#include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <linux/ip.h>
 #include <linux/udp.h>
@@ -8,6 +10,8 @@
 #include <omphalos/csum.h>
 #include <omphalos/diag.h>
 #include <omphalos/ssdp.h>
+#include <omphalos/probe.h>
+#include <omphalos/txsched.h>
 #include <omphalos/ethernet.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/interface.h>
@@ -48,35 +52,25 @@ setup_ssdp_query(void *frame,size_t flen){
 }
 
 static int
-ssdp_ip4_msearch(interface *i,const uint32_t *saddr){
+build_ip4_msearch(const interface *i,void *frame,size_t flen,int fam,const void *saddr){
 	const unsigned char hw[ETH_ALEN] = { 0x01, 0x00, 0x5e, 0x00, 0x00, 0xc };
 	uint32_t net = htonl(SSDP_NET4);
-	struct tpacket_hdr *thdr;
 	struct udphdr *udp;
 	struct iphdr *ip;
-	size_t flen,tlen;
-	void *frame;
+	size_t tlen;
 	int r;
 
-	if((frame = get_tx_frame(i,&flen)) == NULL){
+	assert(fam == AF_INET);
+	if((r = prep_eth_header(frame,flen,i,hw,ETH_P_IP)) < 0){
 		return -1;
 	}
-	thdr = frame;
-	tlen = thdr->tp_mac;
-	if((r = prep_eth_header((char *)frame + tlen,flen - tlen,i,
-					hw,ETH_P_IP)) < 0){
-		abort_tx_frame(i,frame);
-		return -1;
-	}
-	tlen += r;
+	tlen = r;
 	ip = (struct iphdr *)((char *)frame + tlen);
-	if((r = prep_ipv4_header(ip,flen - tlen,*saddr,net,IPPROTO_UDP)) < 0){
-		abort_tx_frame(i,frame);
+	if((r = prep_ipv4_header(ip,flen - tlen,*(const uint32_t *)saddr,net,IPPROTO_UDP)) < 0){
 		return -1;
 	}
 	tlen += r;
 	if(flen - tlen < sizeof(*udp)){
-		abort_tx_frame(i,frame);
 		return -1;
 	}
 	udp = (struct udphdr *)((char *)frame + tlen);
@@ -85,7 +79,6 @@ ssdp_ip4_msearch(interface *i,const uint32_t *saddr){
 	tlen += sizeof(*udp);
 	r = setup_ssdp_query((char *)frame + tlen,flen - tlen);
 	if(r < 0){
-		abort_tx_frame(i,frame);
 		return -1;
 	}
 	tlen += r;
@@ -93,41 +86,32 @@ ssdp_ip4_msearch(interface *i,const uint32_t *saddr){
 	ip->check = ipv4_csum(ip);
 	udp->len = htons(ntohs(ip->tot_len) - ip->ihl * 4u);
 	udp->check = udp4_csum(ip);
-	thdr->tp_len = tlen - thdr->tp_mac;
-	return send_tx_frame(i,frame);
+	return tlen;
 }
 
 static int
-ssdp_ip6_msearch(interface *i,const uint128_t saddr){
+build_ip6_msearch(const interface *i,void *frame,size_t flen,int fam,const void *saddr){
 	const unsigned char hw[ETH_ALEN] = { 0x33, 0x33, 0x00, 0x00, 0x00, 0xc };
 	uint128_t net = { htonl(0xff020000ul), htonl(0x0ul),
 				htonl(0x0ul), htonl(0xcul) };
-	struct tpacket_hdr *thdr;
 	struct udphdr *udp;
 	struct ip6_hdr *ip;
-	size_t flen,tlen;
-	void *frame;
+	uint128_t src;
+	size_t tlen;
 	int r;
 
-	if((frame = get_tx_frame(i,&flen)) == NULL){
-		return -1;
-	}
-	thdr = frame;
-	tlen = thdr->tp_mac;
-	if((r = prep_eth_header((char *)frame + tlen,flen - tlen,i,
-					hw,ETH_P_IPV6)) < 0){
-		abort_tx_frame(i,frame);
+	assert(fam == AF_INET6);
+	assign128(src,saddr);
+	if((r = prep_eth_header(frame,flen,i,hw,ETH_P_IPV6)) < 0){
 		return -1;
 	}
-	tlen += r;
+	tlen = r;
 	ip = (struct ip6_hdr *)((char *)frame + tlen);
-	if((r = prep_ipv6_header(ip,flen - tlen,saddr,net,IPPROTO_UDP)) < 0){
-		abort_tx_frame(i,frame);
+	if((r = prep_ipv6_header(ip,flen - tlen,src,net,IPPROTO_UDP)) < 0){
 		return -1;
 	}
 	tlen += r;
 	if(flen - tlen < sizeof(*udp)){
-		abort_tx_frame(i,frame);
 		return -1;
 	}
 	udp = (struct udphdr *)((char *)frame + tlen);
@@ -136,23 +120,33 @@ ssdp_ip6_msearch(interface *i,const uint128_t saddr){
 	tlen += sizeof(*udp);
 	r = setup_ssdp_query((char *)frame + tlen,flen - tlen);
 	if(r < 0){
-		abort_tx_frame(i,frame);
 		return -1;
 	}
 	tlen += r;
-	thdr->tp_len = tlen;
-	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(thdr->tp_len -
+	ip->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(tlen -
 		((const char *)udp - (const char *)frame));
 	udp->len = ip->ip6_ctlun.ip6_un1.ip6_un1_plen;
 	udp->check = udp6_csum(ip);
-	thdr->tp_len -= thdr->tp_mac;
-	return send_tx_frame(i,frame);
+	return tlen;
 }
 
 int ssdp_msearch(int fam,interface *i,const void *saddr){
-	switch(fam){
-		case AF_INET: return ssdp_ip4_msearch(i,saddr);
-		case AF_INET6: return ssdp_ip6_msearch(i,saddr);
-		default: return -1;
+	size_t flen;
+	void *frame;
+	probe p;
+
+	if(fam != AF_INET && fam != AF_INET6){
+		return -1;
+	}
+	if((frame = get_tx_frame(i,&flen)) == NULL){
+		return -1;
+	}
+	if(probe_start(&p,i,frame,flen,PROBE_SSDP,fam == AF_INET ?
+			build_ip4_msearch : build_ip6_msearch,fam,saddr)){
+		abort_tx_frame(i,frame);
+		return -1;
 	}
+	// Only the IPv4 ID varies between M-SEARCHes from a given source.
+	probe_ip4id(&p,random());
+	return pace_tx_frame(i,frame,TXCLASS_SWEEP);
 }
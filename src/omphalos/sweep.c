@@ -0,0 +1,74 @@
+#include <pthread.h>
+#include <omphalos/sweep.h>
+#include <omphalos/synscan.h>
+#include <omphalos/ndsweep.h>
+#include <omphalos/arpsweep.h>
+#include <omphalos/interface.h>
+
+// Taken after an interface lock, or before one only via trylock.
+static pthread_mutex_t sweeplock = PTHREAD_MUTEX_INITIALIZER;
+static interface *sweeping;
+
+void list_sweeping(interface *i){
+	pthread_mutex_lock(&sweeplock);
+	if(!i->sweeplisted){
+		i->sweepnext = sweeping;
+		sweeping = i;
+		i->sweeplisted = 1;
+	}
+	pthread_mutex_unlock(&sweeplock);
+}
+
+void unlist_sweeping(interface *i){
+	interface **prev;
+
+	pthread_mutex_lock(&sweeplock);
+	if(i->sweeplisted){
+		for(prev = &sweeping ; *prev != i ; prev = &(*prev)->sweepnext){
+			;
+		}
+		*prev = i->sweepnext;
+		i->sweeplisted = 0;
+	}
+	pthread_mutex_unlock(&sweeplock);
+}
+
+static inline int
+earliest(int ms,int w){
+	return w >= 0 && (ms < 0 || w < ms) ? w : ms;
+}
+
+int sweep_tick(interface *i){
+	int ms = -1;
+
+	ms = earliest(ms,arp_sweep_tick(i));
+	ms = earliest(ms,nd_sweep_tick(i));
+	ms = earliest(ms,syn_scan_tick(i));
+	return ms;
+}
+
+int sweep_ticks(void){
+	interface *i,**prev;
+	int ms = -1;
+
+	pthread_mutex_lock(&sweeplock);
+	for(prev = &sweeping ; (i = *prev) ; ){
+		int w;
+
+		if(trylock_interface(i)){
+			w = SWEEP_TICK_MSEC;
+		}else{
+			w = sweep_tick(i);
+			unlock_interface(i);
+		}
+		if(w < 0){
+			*prev = i->sweepnext;
+			i->sweeplisted = 0;
+			continue;
+		}
+		ms = earliest(ms,w);
+		prev = &i->sweepnext;
+	}
+	pthread_mutex_unlock(&sweeplock);
+	return ms;
+}
@@ -0,0 +1,72 @@
+#ifndef OMPHALOS_SWEEP
+#define OMPHALOS_SWEEP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+struct interface;
+
+// Active enumeration (ARP and ND sweeps, SYN scans) is driven by ticks: from the
+// capture thread's idle path (see ring_wait()), or, for pooled rings, from
+// the RX pool. A tick sends what the TX scheduler has room for, so that the
+// sweeps run at the interface's --txrate without their frames being shed.
+
+#define SWEEP_TICK_MAX 64	// probes per engine per tick
+#define SWEEP_TICK_MSEC 10	// tick interval while the scheduler has room
+
+// A keyed bijection on [0, mask], the smallest power of two covering some n,
+// so that n targets can be visited in a scattered order with no more state
+// than a cursor. Inputs mapping beyond n are skipped.
+typedef struct permutation {
+	uint32_t mask,seed,mul1,mul2;
+	unsigned shift;
+} permutation;
+
+static inline void
+permutation_init(permutation *p,uint32_t n){
+	unsigned bits;
+
+	for(bits = 0 ; (1ull << bits) < n ; ++bits){
+		;
+	}
+	p->mask = (1ull << bits) - 1;
+	p->shift = bits / 2 + 1;
+	p->seed = random() & p->mask;
+	p->mul1 = random() | 1u;
+	p->mul2 = random() | 1u;
+}
+
+// An offset, then multiplication by odd constants around an xorshift, all
+// modulo a power of two.
+static inline uint32_t
+permute(const permutation *p,uint32_t x){
+	x = (x + p->seed) & p->mask;
+	x = (x * p->mul1) & p->mask;
+	x ^= x >> p->shift;
+	return (x * p->mul2) & p->mask;
+}
+
+// Note that the interface has a sweep in progress, so that the RX pool will
+// tick it. The interface lock must be held.
+void list_sweeping(struct interface *);
+
+// Take the interface off the list, prior to freeing its sweeps.
+void unlist_sweeping(struct interface *);
+
+// Tick each of the interface's sweeps. Returns the msec until they next want
+// ticking, or -1 if none is in progress. The interface lock must be held.
+int sweep_tick(struct interface *);
+
+// Tick every listed interface, returning as sweep_tick(). Takes the interface
+// locks itself, skipping (for now) any which are busy.
+int sweep_ticks(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
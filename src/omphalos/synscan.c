@@ -0,0 +1,522 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <wchar.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <arpa/inet.h>
+#include <netinet/ip6.h>
+#include <linux/filter.h>
+#include <omphalos/ip.h>
+#include <omphalos/tx.h>
+#include <omphalos/128.h>
+#include <omphalos/csum.h>
+#include <omphalos/diag.h>
+#include <omphalos/probe.h>
+#include <omphalos/sweep.h>
+#include <omphalos/timing.h>
+#include <omphalos/ethernet.h>
+#include <omphalos/hwaddrs.h>
+#include <omphalos/service.h>
+#include <omphalos/txsched.h>
+#include <omphalos/synscan.h>
+#include <omphalos/omphalos.h>
+#include <omphalos/interface.h>
+
+#define SYNSCAN_MAX_HOSTS 4096	// hosts pending the next epoch
+#define SYNSCAN_WINDOW 1024	// advertised in our SYNs
+
+typedef struct scantarget {
+	int fam;
+	uint128_t addr;		// IPv4 addresses are zero-extended
+	uint128_t src;		// our address on the target's network
+	hwaddrint hw;
+} scantarget;
+
+typedef struct synscan {
+	uint16_t ports[SYNSCAN_MAX_PORTS];	// network byte order
+	unsigned portcount;
+	scantarget *hosts;	// the current epoch's targets
+	unsigned hostcount,hostalloc;
+	scantarget *pending;	// targets discovered since it began
+	unsigned pendcount,pendalloc;
+	permutation perm;	// over hostcount * portcount probes
+	uint32_t cursor;	// next permutation input
+	int active;		// the current epoch is underway
+	uint32_t probed,open,closed;
+} synscan;
+
+// A listening socket, bound to the port we scan from, which drops all it
+// receives. -1 if we're not scanning.
+static int guardfd = -1;
+static uint16_t scanport;	// network byte order
+static uint64_t cookiekey[2];
+
+int lex_syn_ports(const char *str,uint16_t *ports,unsigned max){
+	unsigned count = 0;
+
+	do{
+		unsigned long lo,hi;
+		char *e;
+
+		if(*str < '0' || *str > '9'){
+			return -1;
+		}
+		errno = 0;
+		lo = hi = strtoul(str,&e,10);
+		if(*e == '-'){
+			if(e[1] < '0' || e[1] > '9'){
+				return -1;
+			}
+			hi = strtoul(e + 1,&e,10);
+		}
+		if(errno || lo == 0 || hi > 65535 || lo > hi){
+			return -1;
+		}
+		if(*e && *e != ','){
+			return -1;
+		}
+		while(lo <= hi){
+			if(count == max){
+				return -1;
+			}
+			ports[count++] = htons(lo++);
+		}
+		str = e + (*e == ',');
+	}while(*str);
+	return count;
+}
+
+static int
+scanning_any(void){
+	const omphalos_ctx *octx = get_octx();
+	const iface_opts *io;
+
+	if(octx->mode == OMPHALOS_MODE_SILENT){
+		return 0;
+	}
+	for(io = octx->ifopts ; io ; io = io->next){
+		if(io->synscan){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+guard_socket(int fam){
+	struct sock_filter drop = BPF_STMT(BPF_RET | BPF_K,0);
+	struct sock_fprog prog = { .len = 1, .filter = &drop, };
+	struct sockaddr_storage ss;
+	socklen_t slen;
+	int fd,v6only = 0;
+
+	if((fd = socket(fam,SOCK_STREAM | SOCK_CLOEXEC,IPPROTO_TCP)) < 0){
+		return -1;
+	}
+	memset(&ss,0,sizeof(ss));
+	ss.ss_family = fam;
+	if(fam == AF_INET6){
+		// Cover IPv4 with the same port
+		if(setsockopt(fd,IPPROTO_IPV6,IPV6_V6ONLY,&v6only,sizeof(v6only))){
+			close(fd);
+			return -1;
+		}
+		slen = sizeof(struct sockaddr_in6);
+	}else{
+		slen = sizeof(struct sockaddr_in);
+	}
+	if(setsockopt(fd,SOL_SOCKET,SO_ATTACH_FILTER,&prog,sizeof(prog))){
+		close(fd);
+		return -1;
+	}
+	if(bind(fd,(const struct sockaddr *)&ss,slen) || listen(fd,1)){
+		close(fd);
+		return -1;
+	}
+	if(getsockname(fd,(struct sockaddr *)&ss,&slen)){
+		close(fd);
+		return -1;
+	}
+	if(fam == AF_INET6){
+		scanport = ((const struct sockaddr_in6 *)&ss)->sin6_port;
+	}else{
+		scanport = ((const struct sockaddr_in *)&ss)->sin_port;
+	}
+	return fd;
+}
+
+int init_syn_scan(void){
+	int fd;
+
+	if(!scanning_any()){
+		return 0;
+	}
+	if((fd = open("/dev/urandom",O_RDONLY | O_CLOEXEC)) >= 0){
+		if(read(fd,cookiekey,sizeof(cookiekey)) != sizeof(cookiekey)){
+			cookiekey[0] = cookiekey[1] = 0;
+		}
+		close(fd);
+	}
+	if(cookiekey[0] == 0 && cookiekey[1] == 0){
+		cookiekey[0] = ((uint64_t)random() << 32u) ^ random() ^ now_ns();
+		cookiekey[1] = ((uint64_t)random() << 32u) ^ random() ^ getpid();
+	}
+	if((guardfd = guard_socket(AF_INET6)) < 0){
+		if((guardfd = guard_socket(AF_INET)) < 0){
+			diagnostic("Couldn't reserve a SYN scan port (%s?)",strerror(errno));
+			return -1;
+		}
+	}
+	diagnostic("SYN scanning from port %u",ntohs(scanport));
+	return 0;
+}
+
+int stop_syn_scan(void){
+	int ret = 0;
+
+	if(guardfd >= 0){
+		if(close(guardfd)){
+			diagnostic("Error closing %d (%s?)",guardfd,strerror(errno));
+			ret = -1;
+		}
+		guardfd = -1;
+	}
+	return ret;
+}
+
+static inline uint64_t
+mix64(uint64_t h){
+	h ^= h >> 33u;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33u;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33u;
+	return h;
+}
+
+// The initial sequence number of our SYN from local to remote. Addresses and
+// ports are in network byte order; the result is in host byte order.
+static uint32_t
+syn_cookie(int fam,const uint32_t *local,const uint32_t *remote,
+			uint16_t lport,uint16_t rport){
+	unsigned words = fam == AF_INET ? 1 : 4,z;
+	uint64_t h = cookiekey[0];
+
+	for(z = 0 ; z < words ; ++z){
+		h = mix64(h ^ local[z]);
+		h = mix64(h ^ remote[z]);
+	}
+	h = mix64(h ^ cookiekey[1] ^ ((uint64_t)lport << 16u) ^ rport);
+	return (uint32_t)h;
+}
+
+// A SYN, or otherwise a RST. Destination address, ports and sequence are
+// patched in per probe.
+static int
+build_tcp_probe(const interface *i,void *frame,size_t flen,int fam,
+				const void *src,int syn){
+	const uint128_t zeroes = ZERO128;
+	struct tcphdr *tcp;
+	void *iphdr;
+	size_t tlen;
+	int r;
+
+	if((r = prep_eth_header(frame,flen,i,zeroes,
+				fam == AF_INET ? ETH_P_IP : ETH_P_IPV6)) < 0){
+		return -1;
+	}
+	tlen = r;
+	iphdr = (char *)frame + tlen;
+	if(fam == AF_INET){
+		r = prep_ipv4_header(iphdr,flen - tlen,*(const uint32_t *)src,0,IPPROTO_TCP);
+	}else if(fam == AF_INET6){
+		uint128_t src6;
+
+		assign128(src6,src);
+		r = prep_ipv6_header(iphdr,flen - tlen,src6,zeroes,IPPROTO_TCP);
+	}else{
+		return -1;
+	}
+	if(r < 0){
+		return -1;
+	}
+	tlen += r;
+	if(flen - tlen < sizeof(*tcp)){
+		return -1;
+	}
+	tcp = (struct tcphdr *)((char *)frame + tlen);
+	memset(tcp,0,sizeof(*tcp));
+	tcp->doff = sizeof(*tcp) / 4;
+	if(syn){
+		tcp->syn = 1;
+		tcp->window = htons(SYNSCAN_WINDOW);
+	}else{
+		tcp->rst = 1;
+	}
+	tlen += sizeof(*tcp);
+	if(fam == AF_INET){
+		((struct iphdr *)iphdr)->tot_len = htons(r + sizeof(*tcp));
+		((struct iphdr *)iphdr)->check = ipv4_csum(iphdr);
+		tcp->check = tcp4_csum(iphdr,sizeof(*tcp));
+	}else{
+		((struct ip6_hdr *)iphdr)->ip6_ctlun.ip6_un1.ip6_un1_plen = htons(sizeof(*tcp));
+		tcp->check = tcp6_csum(iphdr,sizeof(*tcp));
+	}
+	return tlen;
+}
+
+static int
+build_syn_probe(const interface *i,void *frame,size_t flen,int fam,const void *src){
+	return build_tcp_probe(i,frame,flen,fam,src,1);
+}
+
+static int
+build_rst_probe(const interface *i,void *frame,size_t flen,int fam,const void *src){
+	return build_tcp_probe(i,frame,flen,fam,src,0);
+}
+
+// seq is in network byte order.
+static int
+send_tcp_probe(interface *i,probe_type type,int fam,const void *src,
+		const void *hw,const void *dst,uint16_t dport,uint32_t seq){
+	void *frame;
+	size_t flen;
+	probe p;
+
+	if((frame = get_tx_frame(i,&flen)) == NULL){
+		return -1;
+	}
+	if(probe_start(&p,i,frame,flen,type,type == PROBE_SYN ? build_syn_probe :
+				build_rst_probe,fam,src)){
+		abort_tx_frame(i,frame);
+		return -1;
+	}
+	probe_l2dst(&p,hw);
+	probe_l3dst(&p,dst);
+	probe_ports(&p,scanport,dport);
+	probe_ip4id(&p,random());
+	probe_tcp_seq(&p,seq);
+	return pace_tx_frame(i,frame,TXCLASS_SWEEP);
+}
+
+void free_syn_scan(interface *i){
+	synscan *s = i->synscan;
+
+	if(s){
+		free(s->hosts);
+		free(s->pending);
+		free(s);
+		i->synscan = NULL;
+	}
+}
+
+static synscan *
+create_syn_scan(interface *i,const char *portlist){
+	synscan *s;
+	int r;
+
+	if((s = malloc(sizeof(*s))) == NULL){
+		diagnostic("Couldn't allocate SYN scan for %s",i->name);
+		return NULL;
+	}
+	memset(s,0,sizeof(*s));
+	if((r = lex_syn_ports(portlist,s->ports,SYNSCAN_MAX_PORTS)) <= 0){
+		diagnostic("Invalid SYN scan ports for %s: %s",i->name,portlist);
+		free(s);
+		return NULL;
+	}
+	s->portcount = r;
+	return s;
+}
+
+void syn_scan_host(interface *i,struct l2host *l2,int fam,const void *addr){
+	const char *portlist;
+	scantarget *t;
+	synscan *s;
+
+	if(guardfd < 0 || (portlist = get_iface_opts(i->name)->synscan) == NULL){
+		return;
+	}
+	if((s = i->synscan) == NULL){
+		if((s = i->synscan = create_syn_scan(i,portlist)) == NULL){
+			return;
+		}
+	}
+	if(s->pendcount == s->pendalloc){
+		unsigned n = s->pendalloc ? s->pendalloc * 2 : 16;
+
+		if(n > SYNSCAN_MAX_HOSTS){
+			return;
+		}
+		if((t = realloc(s->pending,sizeof(*t) * n)) == NULL){
+			return;
+		}
+		s->pending = t;
+		s->pendalloc = n;
+	}
+	t = &s->pending[s->pendcount];
+	memset(t,0,sizeof(*t));
+	if(get_source_address(i,fam,addr,&t->src) == NULL){
+		return;
+	}
+	t->fam = fam;
+	memcpy(t->addr,addr,fam == AF_INET ? 4 : 16);
+	t->hw = get_hwaddr(l2);
+	++s->pendcount;
+	list_sweeping(i);
+}
+
+// Begin an epoch covering the pending hosts.
+static void
+start_epoch(synscan *s){
+	scantarget *t = s->hosts;
+	unsigned alloc = s->hostalloc;
+
+	s->hosts = s->pending;
+	s->hostalloc = s->pendalloc;
+	s->hostcount = s->pendcount;
+	s->pending = t;
+	s->pendalloc = alloc;
+	s->pendcount = 0;
+	permutation_init(&s->perm,s->hostcount * s->portcount);
+	s->cursor = 0;
+	s->active = 1;
+}
+
+int syn_scan_tick(interface *i){
+	synscan *s = i->synscan;
+	uint32_t total;
+	unsigned room,n = 0;
+
+	if(s == NULL || guardfd < 0){
+		return -1;
+	}
+	if(!s->active){
+		if(s->pendcount == 0){
+			return -1;
+		}
+		start_epoch(s);
+	}
+	total = s->hostcount * s->portcount;
+	room = tx_sched_room(i,TXCLASS_SWEEP);
+	while(n < room && n < SWEEP_TICK_MAX){
+		uint32_t idx;
+
+		if(s->cursor > s->perm.mask){
+			s->active = 0;
+			return s->pendcount ? 0 : -1;
+		}
+		if((idx = permute(&s->perm,s->cursor)) < total){
+			const scantarget *t = &s->hosts[idx / s->portcount];
+			uint16_t port = s->ports[idx % s->portcount];
+			uint32_t seq;
+
+			seq = syn_cookie(t->fam,t->src,t->addr,scanport,port);
+			// Try this probe again next time
+			if(send_tcp_probe(i,PROBE_SYN,t->fam,t->src,&t->hw,
+						t->addr,port,htonl(seq))){
+				break;
+			}
+			++s->probed;
+			++n;
+		}
+		++s->cursor;
+	}
+	return n == SWEEP_TICK_MAX ? 0 : SWEEP_TICK_MSEC;
+}
+
+static const struct {
+	unsigned port;
+	const wchar_t *name;
+} tcp_services[] = {
+	{ 21,	L"FTP",		},
+	{ 22,	L"SSH",		},
+	{ 23,	L"Telnet",	},
+	{ 25,	L"SMTP",	},
+	{ 53,	L"DNS",		},
+	{ 80,	L"HTTP",	},
+	{ 110,	L"POP3",	},
+	{ 139,	L"NetBIOS",	},
+	{ 143,	L"IMAP",	},
+	{ 443,	L"HTTPS",	},
+	{ 445,	L"SMB",		},
+	{ 3389,	L"RDP",		},
+	{ 5900,	L"VNC",		},
+	{ 8080,	L"HTTP",	},
+};
+
+void syn_scan_reply(omphalos_packet *op,const struct tcphdr *tcp){
+	interface *i = op->i;
+	synscan *s = i->synscan;
+	uint32_t cookie;
+	int fam;
+
+	if(s == NULL || guardfd < 0 || tcp->dest != scanport || !tcp->ack){
+		return;
+	}
+	if(op->l3proto == ETH_P_IP){
+		fam = AF_INET;
+	}else if(op->l3proto == ETH_P_IPV6){
+		fam = AF_INET6;
+	}else{
+		return;
+	}
+	cookie = syn_cookie(fam,op->l3daddr,op->l3saddr,scanport,tcp->source);
+	if(ntohl(tcp->ack_seq) != cookie + 1){
+		return;
+	}
+	// Replies might be credited by several rings' workers at once
+	if(tcp->rst){
+		lock_hosts(i);
+		++s->closed;
+		unlock_hosts(i);
+	}else if(tcp->syn){
+		const unsigned port = ntohs(tcp->source);
+		const wchar_t *name = NULL;
+		wchar_t buf[16];
+		hwaddrint hw;
+		unsigned z;
+
+		lock_hosts(i);
+		++s->open;
+		unlock_hosts(i);
+		for(z = 0 ; z < sizeof(tcp_services) / sizeof(*tcp_services) ; ++z){
+			if(tcp_services[z].port == port){
+				name = tcp_services[z].name;
+				break;
+			}
+		}
+		if(name == NULL){
+			swprintf(buf,sizeof(buf) / sizeof(*buf),L"TCP %u",port);
+			name = buf;
+		}
+		if(op->l2s && op->l3s){
+			observe_service(i,op->l2s,op->l3s,IPPROTO_TCP,port,name,NULL);
+		}
+		// Tear down the remote's half-open connection
+		if(op->l2s){
+			hw = get_hwaddr(op->l2s);
+			send_tcp_probe(i,PROBE_RST,fam,op->l3daddr,&hw,op->l3saddr,
+						tcp->source,tcp->ack_seq);
+		}
+	}
+}
+
+int syn_scan_stats(const interface *i,synscan_stats *st){
+	const synscan *s = i->synscan;
+
+	if(s == NULL){
+		return -1;
+	}
+	st->hosts = s->hostcount;
+	st->pending = s->pendcount;
+	st->ports = s->portcount;
+	st->probed = s->probed;
+	st->open = s->open;
+	st->closed = s->closed;
+	st->active = s->active;
+	return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef OMPHALOS_SYNSCAN
+#define OMPHALOS_SYNSCAN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct l2host;
+struct tcphdr;
+struct interface;
+struct omphalos_packet;
+
+// Stateless TCP service discovery. Each on-link unicast host, upon discovery,
+// is queued for a SYN to each of the interface's ports; queued hosts are
+// swept an epoch at a time, in a permuted (host, port) order, paced as
+// TXCLASS_SWEEP. The SYN's sequence number is a keyed hash of the endpoints,
+// so a SYN-ACK (or RST) can be validated from its acknowledgement number
+// alone. Open ports are reported through observe_service(), and torn down
+// with our own RST.
+//
+// The kernel would otherwise RST the SYN-ACKs itself. We instead send from
+// the port of a listening socket which drops everything via its socket
+// filter: the filter runs before any TCP processing, so the kernel never
+// answers. The RX path sees the SYN-ACKs regardless.
+
+// Used when --syn-scan is provided without a port list.
+#define SYNSCAN_DEFAULT_PORTS "21-23,25,53,80,110,139,143,443,445,3389,5900,8080"
+
+#define SYNSCAN_MAX_PORTS 1024
+
+typedef struct synscan_stats {
+	unsigned hosts;		// hosts in the current epoch
+	unsigned pending;	// hosts awaiting the next epoch
+	unsigned ports;		// ports per host
+	uint32_t probed;	// SYNs sent
+	uint32_t open;		// SYN-ACKs received
+	uint32_t closed;	// RSTs received
+	int active;		// an epoch is in progress
+} synscan_stats;
+
+// Parse a port list ("22,80,8000-8099") into at most the given number of
+// ports (network byte order). Returns the count, or -1 on a malformed list.
+int lex_syn_ports(const char *,uint16_t *,unsigned);
+
+// Reserve the scanning port, if any interface is to be scanned. Requires a
+// valid omphalos_ctx.
+int init_syn_scan(void);
+int stop_syn_scan(void);
+
+// Queue a newly-discovered on-link host (of the given family and address),
+// if scanning is enabled on the interface. Requires the host lock (see
+// lock_hosts()), under which it's discovered.
+void syn_scan_host(struct interface *,struct l2host *,int,const void *);
+
+// Send whatever SYNs the TX scheduler can take. Returns the msec until it
+// ought next be called, or -1 if there's nothing to scan. Called via
+// sweep_tick().
+int syn_scan_tick(struct interface *);
+
+// Validate and account for a TCP segment addressed to the scanning port.
+void syn_scan_reply(struct omphalos_packet *,const struct tcphdr *);
+
+// Returns -1 if the interface isn't being scanned.
+int syn_scan_stats(const struct interface *,synscan_stats *);
+
+void free_syn_scan(struct interface *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
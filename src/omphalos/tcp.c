@@ -1,6 +1,7 @@
 #include <linux/tcp.h>
 #include <omphalos/tcp.h>
 #include <omphalos/diag.h>
+#include <omphalos/synscan.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/interface.h>
 
@@ -22,5 +23,6 @@ void handle_tcp_packet(omphalos_packet *op,const void *frame,size_t len){
 		op->malformed = 1;
 		return;
 	}
+	syn_scan_reply(op,tcp);
 	// FIXME need reassemble the TCP stream before analyzing it...
 }
@@ -7,7 +7,7 @@ int timestat_prep(timestat *ts,unsigned usec,unsigned total){
 		return -1;
 	}
 	memset(ts->counts,0,sizeof(*ts->counts) * total);
-	gettimeofday(&ts->firstsamp,NULL);
+	ts->firstsamp = now_ns();
 	ts->firstidx = 0;
 	ts->total = total;
 	ts->usec = usec;
@@ -19,14 +19,11 @@ ringinc(unsigned idx,unsigned move,unsigned s){
 	return (idx + move) % s;
 }
 
-void timestat_inc(timestat *ts,const struct timeval *tv,unsigned val){
-	struct timeval diff;
+void timestat_inc(timestat *ts,uint64_t ns,unsigned val){
 	unsigned long usec;
 	unsigned distance;
 
-	//assert(!timercmp(tv,&ts->firstsamp,<));
-	timersub(tv,&ts->firstsamp,&diff);
-       	usec = timerusec(&diff);
+	usec = ns > ts->firstsamp ? (ns - ts->firstsamp) / 1000 : 0;
 	// Get the number of samples between us and the first sample
 	distance = usec / ts->usec;
 	// This is equivalent to moving forward a slot, since we can't move
@@ -38,7 +35,6 @@ void timestat_inc(timestat *ts,const struct timeval *tv,unsigned val){
 	// we always zero our own new slot. There's thus no need to track a
 	// last sample time; the first tracked sample time is sufficient.
 	if(distance >= ts->total){
-		struct timeval adv;
 		unsigned expired;
 
 		// Some counts have expired (if the distance is greater than or
@@ -80,9 +76,7 @@ void timestat_inc(timestat *ts,const struct timeval *tv,unsigned val){
 		}
 		// Base the time off distance * ts->usec + firstsamp,
 		// normalizing time of the sample within the period.
-		adv.tv_sec = (expired * ts->usec) / 1000000;
-		adv.tv_usec = (expired * ts->usec) % 1000000;
-		timeradd(&ts->firstsamp,&adv,&ts->firstsamp);
+		ts->firstsamp += (uint64_t)expired * ts->usec * 1000;
 	}
 	ts->counts[ringinc(ts->firstidx,distance,ts->total)] += val;
 	ts->valtotal += val;
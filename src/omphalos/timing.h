@@ -8,24 +8,29 @@ extern "C" {
 // We want to support finite time-sliced statistics, to for instance show the
 // bitrate on an interface for the last 5s at 50Hz sampling. Sampling at a
 // higher rate than the video sync isn't useful for UI's, but might be
-// desirable for headless drivers. We operate at microsecond resolution, though
-// might not get that much from gettimeofday().
+// desirable for headless drivers. Slots are microsecond-granular; samples are
+// timestamped in nanoseconds since the epoch, as are packets.
 
+#include <time.h>
 #include <stdint.h>
 #include <sys/time.h>
 
+#define NSEC_PER_SEC 1000000000ull
+
 // Total time domain in microseconds == total * usec
 typedef struct timestat {
 	uint32_t *counts;		// ringbuf of values
 	unsigned usec,total;		// usec per count, number of counts
 	unsigned firstidx;		// index of first sample in ringbuffer
-	struct timeval firstsamp;	// time associated with first sample
+	uint64_t firstsamp;		// time (ns) associated with first sample
 	uintmax_t valtotal;		// sum of all counts
 } timestat;
 
 // For 5s at 50Hz, provide 20000 and 250 -- 50Hz means 20ms per counter.
 int timestat_prep(timestat *,unsigned,unsigned);
-void timestat_inc(timestat *,const struct timeval *tv,unsigned);
+// Samples older than the first slot (reordered, or from another clock) are
+// counted in the first slot.
+void timestat_inc(timestat *,uint64_t,unsigned);
 void timestat_destroy(timestat *);
 
 static inline uintmax_t
@@ -38,6 +43,29 @@ timerusec(const struct timeval *tv){
 	return tv->tv_sec * 1000000 + tv->tv_usec;
 }
 
+static inline uint64_t
+timespec_ns(const struct timespec *ts){
+	return (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+// Current CLOCK_REALTIME in nanoseconds since the epoch.
+static inline uint64_t
+now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return timespec_ns(&ts);
+}
+
+// CLOCK_MONOTONIC in nanoseconds, for deadlines.
+static inline uint64_t
+mono_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return timespec_ns(&ts);
+}
+
 // We don't expect to have very many timers active for an interface (certainly
 // not as many as 10), so we use a trivial linked list implementation of our
 // timing wheel. Should this ever get serious (eg, TCP implementation), use the
@@ -1,12 +1,17 @@
 #include <stdio.h>
 #include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include <linux/ip.h>
-#include <linux/udp.h>
 #include <sys/socket.h>
 #include <net/if_arp.h>
 #include <netinet/ip6.h>
 #include <omphalos/tx.h>
+#include <omphalos/xdp.h>
 #include <omphalos/diag.h>
 #include <omphalos/pcap.h>
 #include <linux/if_ether.h>
@@ -26,6 +31,9 @@
 // terms of performance and power, we can order mechanisms from most desirable
 // to least desirable:
 //
+//  - AF_XDP sockets, when the interface is captured via XDP (see xdp.h).
+//     Frames are copied into the UMEM and go straight to the driver, unseen
+//     by the host's PF_PACKET sockets. Require CAP_NET_ADMIN.
 //  - PACKET_TX_MMAP-enabled PF_PACKET, SOCK_RAW sockets. Only available on
 //     properly-configured late 2.6-series Linux kernels. Require CAP_NET_ADMIN.
 //  - PF_PACKET, SOCK_RAW sockets. Require CAP_NET_ADMIN.
@@ -70,37 +78,59 @@
 // it via unicast (multi/broadcast). Note that other PF_PACKET listeners will
 // thus see two packets for outgoing multicast and broadcasts of ours.
 
+// Neither handing out frames nor queueing them on the kernel's ring touches
+// the interface lock, which the RX thread holds while analyzing; probes from
+// other threads needn't wait out a batch. Staging frames are claimed with a
+// compare-and-swap on their status, and may be returned in any order. Kernel
+// ring slots must be filled in order, and are claimed by advancing txrhead,
+// but only over a slot the kernel has returned. Stats are atomics.
+//
+// Teardown (unmap_iface_rings()) clears txm, then waits for txinflight (the
+// frames handed out but not yet sent or aborted, including those queued to
+// ourselves) to drain; see release_self_tx().
+#define TX_CLAIM_TRIES 8
+
+static inline void
+tx_stat(uintmax_t *stat,uintmax_t n){
+	__atomic_add_fetch(stat,n,__ATOMIC_RELAXED);
+}
+
+static inline void
+tx_release(interface *i){
+	__atomic_sub_fetch(&i->txinflight,1,__ATOMIC_RELEASE);
+}
+
 // Acquire a frame from the ringbuffer. Start writing, given return value
 // 'frame', at: (char *)frame + ((struct tpacket_hdr *)frame)->tp_mac.
 void *get_tx_frame(interface *i,size_t *fsize){
 	struct tpacket_hdr *thdr;
-	void *ret;
+	unsigned t;
+	void *txm;
 
-	assert(pthread_mutex_lock(&i->lock) == 0);
-	thdr = i->curtxm;
-	if(thdr == NULL){
-		pthread_mutex_unlock(&i->lock);
+	__atomic_add_fetch(&i->txinflight,1,__ATOMIC_SEQ_CST);
+	if((txm = __atomic_load_n(&i->txm,__ATOMIC_SEQ_CST)) == NULL){
+		tx_release(i);
 		diagnostic("Can't transmit on %s (fd %d)",i->name,i->fd);
 		return NULL;
 	}
-	if(thdr->tp_status != TP_STATUS_AVAILABLE){
-		if(thdr->tp_status != TP_STATUS_WRONG_FORMAT){
-			pthread_mutex_unlock(&i->lock);
-			diagnostic("No available TX frames on %s",i->name);
-			return NULL;
+	for(t = 0 ; t < TX_CLAIM_TRIES ; ++t){
+		unsigned long avail = TP_STATUS_AVAILABLE;
+
+		// Claims don't depend on order, so txhead can run free.
+		thdr = ring_frame(txm,&i->ttpr,__atomic_fetch_add(&i->txhead,1,__ATOMIC_RELAXED));
+		// Need indicate that this one is in use, but don't want to
+		// indicate that it should be sent yet
+		if(__atomic_compare_exchange_n(&thdr->tp_status,&avail,TP_STATUS_PREPARING,
+					0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)){
+			// FIXME we ought be able to set this once for each packet, and be done
+			thdr->tp_net = thdr->tp_mac = TPACKET_ALIGN(sizeof(struct tpacket_hdr));
+			*fsize = i->ttpr.tp_frame_size;
+			return thdr;
 		}
-		thdr->tp_status = TP_STATUS_AVAILABLE;
 	}
-	// Need indicate that this one is in use, but don't want to
-	// indicate that it should be sent yet
-	thdr->tp_status = TP_STATUS_PREPARING;
-	// FIXME we ought be able to set this once for each packet, and be done
-	thdr->tp_net = thdr->tp_mac = TPACKET_ALIGN(sizeof(struct tpacket_hdr));
-	ret = i->curtxm;
-	i->curtxm += inclen(&i->txidx,&i->ttpr);
-	pthread_mutex_unlock(&i->lock);
-	*fsize = i->ttpr.tp_frame_size;
-	return ret;
+	tx_release(i);
+	diagnostic("No available TX frames on %s",i->name);
+	return NULL;
 }
 
 // Loopback devices don't play nicely with PF_PACKET sockets; transmitting on
@@ -109,25 +139,131 @@ void *get_tx_frame(interface *i,size_t *fsize){
 // not portable across systems, either; FreeBSD and OpenBSD do things
 // differently, to the point of a distinct loopback header type.
 //
-// So, we take the packet as prepared, and sendto() over the (unbound) TX
-// sockets (we need one per protocol family -- effectively, AF_INET and
-// AF_INET6). This suffers a copy, of course.
+// So, we take the packet as prepared, and send it (from the L3 header on) over
+// the TX raw sockets, one per protocol family. Both are IPPROTO_RAW, and thus
+// include the IP header we provide; any transport protocol will do. This
+// suffers a copy, of course.
 //
-// We currently only support IPv4, but ought support IPv6 also. UDP and ICMP
-// are the only transport protocols supported now.
-static ssize_t
-send_to_self(interface *i,void *frame){
+// query_network() and friends send a burst of broadcasts and multicasts on
+// each new address, every one of which comes here. Rather than a sendto()
+// apiece, frames are queued (still holding their staging frame; nothing is
+// copied) and sent with one sendmmsg() per socket. The queue is flushed when
+// full, when its oldest frame has waited SELFTX_DEADLINE_NS, and whenever
+// the ring is (see send_tx_frame() and end_tx_batch()).
+#define SELFTX_BATCH 32
+#define SELFTX_DEADLINE_NS 1000000ull
+
+typedef struct selftx {
+	pthread_mutex_t lock;
+	unsigned count;			// frames queued
+	uint64_t deadline;		// mono_ns() by which they must go
+	int fds[SELFTX_BATCH];
+	void *frames[SELFTX_BATCH];	// held staging frames
+	struct iovec iovs[SELFTX_BATCH];
+	struct mmsghdr msgs[SELFTX_BATCH];
+	union {
+		struct sockaddr_in sina;
+		struct sockaddr_in6 sina6;
+	} addrs[SELFTX_BATCH];
+} selftx;
+
+int prepare_self_tx(interface *i){
+	selftx *q;
+	int r;
+
+	if((q = malloc(sizeof(*q))) == NULL){
+		diagnostic("Couldn't allocate self-TX queue for %s",i->name);
+		return -1;
+	}
+	if( (r = pthread_mutex_init(&q->lock,NULL)) ){
+		diagnostic("Couldn't initialize self-TX lock for %s (%s?)",i->name,strerror(r));
+		free(q);
+		return -1;
+	}
+	q->count = 0;
+	i->selftx = q;
+	return 0;
+}
+
+// Send everything queued, in runs sharing a socket, and return the frames.
+// The queue lock must be held.
+static void
+flush_self_locked(interface *i,selftx *q){
+	unsigned s,z;
+
+	for(s = 0 ; s < q->count ; ){
+		unsigned e = s + 1;
+		int r;
+
+		while(e < q->count && q->fds[e] == q->fds[s]){
+			++e;
+		}
+		// A short count means the next message failed; its error will
+		// be returned on the following call.
+		if((r = sendmmsg(q->fds[s],q->msgs + s,e - s,0)) <= 0){
+			diagnostic("Error self-TXing %zu on %s:%d (%s)",q->iovs[s].iov_len,
+					i->name,q->fds[s],strerror(errno));
+			tx_stat(&i->txerrors,1);
+			r = 1;
+		}else{
+			for(z = s ; z < s + (unsigned)r ; ++z){
+				tx_stat(&i->txbytes,q->msgs[z].msg_len);
+			}
+			tx_stat(&i->txframes,r);
+		}
+		s += r;
+	}
+	for(z = 0 ; z < q->count ; ++z){
+		struct tpacket_hdr *thdr = q->frames[z];
+
+		__atomic_store_n(&thdr->tp_status,TP_STATUS_AVAILABLE,__ATOMIC_RELEASE);
+		tx_release(i);
+	}
+	q->count = 0;
+}
+
+static void
+flush_self_tx(interface *i){
+	selftx *q = i->selftx;
+
+	pthread_mutex_lock(&q->lock);
+	flush_self_locked(i,q);
+	pthread_mutex_unlock(&q->lock);
+}
+
+// Queued frames count against txinflight, so we must send them on behalf of
+// anyone still queueing until it drains. txm is already NULL, so nothing new
+// can be acquired.
+void release_self_tx(interface *i){
+	selftx *q;
+
+	if((q = i->selftx) == NULL){
+		return;
+	}
+	do{
+		flush_self_tx(i);
+		sched_yield();
+	}while(__atomic_load_n(&i->txinflight,__ATOMIC_SEQ_CST));
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+	i->selftx = NULL;
+}
+
+// Queue the frame (starting from the L3 header) to be sent to ourselves. On
+// success, the frame belongs to the queue until it's flushed.
+static int
+queue_to_self(interface *i,void *frame){
 	struct tpacket_hdr *thdr = frame;
-	struct sockaddr_in6 sina6;
-	struct sockaddr_in sina;
 	unsigned short l2proto;
 	struct sockaddr *ss;
 	const void *payload;
 	socklen_t slen;
 	const char *l2;
-	unsigned plen;
+	selftx *q;
+	size_t plen;
 	size_t l2len;
-	int fd,r;
+	unsigned n;
+	int fd;
 
 	l2 = ((const char *)frame + thdr->tp_mac);
 	switch(i->arptype){
@@ -147,65 +283,61 @@ send_to_self(interface *i,void *frame){
 			assert(0);
 			break;
 	}
+	q = i->selftx;
+	pthread_mutex_lock(&q->lock);
+	n = q->count;
 	if(l2proto == ntohs(ETH_P_IP)){
-		const struct iphdr *ip;
+		const struct iphdr *ip = (const struct iphdr *)(l2 + l2len);
+		struct sockaddr_in *sina = &q->addrs[n].sina;
 
 		fd = i->fd4;
-		ss = (struct sockaddr *)&sina;
-		slen = sizeof(sina);
+		ss = (struct sockaddr *)sina;
+		slen = sizeof(*sina);
 		memset(ss,0,slen);
-		sina.sin_family = AF_INET;
-		ip = (const struct iphdr *)(l2 + l2len);
-		if(ip->protocol == IPPROTO_UDP){
-			const struct udphdr *udp;
-
-			sina.sin_addr.s_addr = ip->daddr;
-			udp = (const struct udphdr *)((const char *)ip + ip->ihl * 4u);
-			sina.sin_port = udp->dest;
-			plen = ntohs(ip->tot_len);
-		}else if(ip->protocol == IPPROTO_ICMP){
-			sina.sin_addr.s_addr = ip->daddr;
-			sina.sin_port = 0;
-			plen = ntohs(ip->tot_len);
-		}else{
-			assert(0);
-		}
+		sina->sin_family = AF_INET;
+		sina->sin_addr.s_addr = ip->daddr;
+		plen = ntohs(ip->tot_len);
 		payload = ip;
 	}else if(l2proto == ntohs(ETH_P_IPV6)){
-		const struct ip6_hdr *ip;
+		const struct ip6_hdr *ip = (const struct ip6_hdr *)(l2 + l2len);
+		struct sockaddr_in6 *sina6 = &q->addrs[n].sina6;
 
-		ss = (struct sockaddr *)&sina6;
-		slen = sizeof(sina6);
+		fd = i->fd6;
+		ss = (struct sockaddr *)sina6;
+		slen = sizeof(*sina6);
 		memset(ss,0,slen);
-		sina6.sin6_family = AF_INET6;
-		ip = (const struct ip6_hdr *)(l2 + l2len);
-		// IPv6 doesn't support IP_HDRINCL.
-		if(ip->ip6_ctlun.ip6_un1.ip6_un1_nxt == IPPROTO_UDP){
-			const struct udphdr *udp;
-
-			fd = i->fd6udp;
-			udp = (const struct udphdr *)((const char *)ip + sizeof(*ip));
-			payload = udp;
-			sina6.sin6_port = htons(IPPROTO_UDP);
-		}else if(ip->ip6_ctlun.ip6_un1.ip6_un1_nxt == IPPROTO_ICMPV6){
-			const struct icmp6_hdr *icmp;
-
-			fd = i->fd6icmp;
-			icmp = (const struct icmp6_hdr *)((const char *)ip + sizeof(*ip));
-			payload = icmp;
-			sina6.sin6_port = htons(IPPROTO_ICMPV6);
-		}else{
-			assert(0);
-		}
-		plen = ntohs(ip->ip6_ctlun.ip6_un1.ip6_un1_plen);
-		memcpy(&sina6.sin6_addr,&ip->ip6_dst,sizeof(ip->ip6_dst));
+		sina6->sin6_family = AF_INET6;
+		// Only consulted for link-local destinations
+		sina6->sin6_scope_id = idx_of_iface(i);
+		memcpy(&sina6->sin6_addr,&ip->ip6_dst,sizeof(ip->ip6_dst));
+		plen = sizeof(*ip) + ntohs(ip->ip6_ctlun.ip6_un1.ip6_un1_plen);
+		payload = ip;
 	}else{
+		pthread_mutex_unlock(&q->lock);
+		return -1;
+	}
+	if(l2len + plen > thdr->tp_len){
+		pthread_mutex_unlock(&q->lock);
+		diagnostic("Bad L3 length %zu for self-TX on %s",plen,i->name);
 		return -1;
 	}
-	if((r = sendto(fd,payload,plen,0,ss,slen)) < 0){
-		diagnostic("Error self-TXing %d on %s:%d (%s)",plen,i->name,fd,strerror(errno));
+	q->fds[n] = fd;
+	q->frames[n] = frame;
+	q->iovs[n].iov_base = (void *)payload;
+	q->iovs[n].iov_len = plen;
+	memset(&q->msgs[n],0,sizeof(q->msgs[n]));
+	q->msgs[n].msg_hdr.msg_name = ss;
+	q->msgs[n].msg_hdr.msg_namelen = slen;
+	q->msgs[n].msg_hdr.msg_iov = &q->iovs[n];
+	q->msgs[n].msg_hdr.msg_iovlen = 1;
+	if(q->count++ == 0){
+		q->deadline = mono_ns() + SELFTX_DEADLINE_NS;
 	}
-	return r;
+	if(q->count == SELFTX_BATCH || mono_ns() >= q->deadline){
+		flush_self_locked(i,q);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return 0;
 }
 
 // Determine whether the packet is (a) self-directed and/or (b) out-directed.
@@ -241,9 +373,55 @@ categorize_tx(const interface *i,const void *frame,int *self,int *out){
 	return r;
 }
 
-// Mark a frame as ready-to-send. Must have come from get_tx_frame() using this
-// same interface. Yes, we will see packets we generate on the RX ring.
-int send_tx_frame(interface *i,void *frame){
+// Copy the frame into the next kernel TX ring slot, and mark it for sending.
+// The kernel consumes its ring strictly in order, with no way to skip a slot,
+// so frames are built in the staging buffer (where they can be aborted, or
+// sent only to ourselves) and only enter the ring once committed. A slot is
+// ours once we've advanced txrhead over it, which we only do once the kernel
+// has handed it back. txrhead is kept modulo the ring's frame count, which
+// needn't be a power of 2, so a free-running counter would lose step with the
+// kernel upon wrapping. Should the next slot still be in flight, we flush
+// whatever's queued and try once more.
+static int kick_tx_frames(interface *);
+
+static int
+ring_tx_frame(interface *i,const void *frame,uint32_t len){
+	const size_t off = TPACKET_ALIGN(sizeof(struct tpacket_hdr));
+	struct tpacket_hdr *thdr;
+	int flushed = 0;
+	unsigned head,next;
+
+	if(len > i->txrpr.tp_frame_size - off){
+		errno = EMSGSIZE;
+		return -1;
+	}
+	head = __atomic_load_n(&i->txrhead,__ATOMIC_RELAXED);
+	for( ; ; ){
+		thdr = ring_frame(i->txr,&i->txrpr,head);
+		if(__atomic_load_n(&thdr->tp_status,__ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE){
+			if(flushed++){
+				errno = ENOBUFS;
+				return -1;
+			}
+			kick_tx_frames(i);
+			head = __atomic_load_n(&i->txrhead,__ATOMIC_RELAXED);
+			continue;
+		}
+		next = head + 1 == i->txrpr.tp_frame_nr ? 0 : head + 1;
+		// On failure, head is updated to the current value.
+		if(__atomic_compare_exchange_n(&i->txrhead,&head,next,0,
+					__ATOMIC_ACQ_REL,__ATOMIC_RELAXED)){
+			break;
+		}
+	}
+	memcpy((char *)thdr + off,frame,len);
+	thdr->tp_len = len;
+	__atomic_store_n(&thdr->tp_status,TP_STATUS_SEND_REQUEST,__ATOMIC_RELEASE);
+	__atomic_add_fetch(&i->txqueued,1,__ATOMIC_RELEASE);
+	return len;
+}
+
+int queue_tx_frame(interface *i,void *frame){
 	const omphalos_ctx *octx = get_octx();
 	struct tpacket_hdr *thdr = frame;
 	int ret = 0;
@@ -253,53 +431,132 @@ int send_tx_frame(interface *i,void *frame){
 		int self,out;
 
 		categorize_tx(i,(const char *)frame + thdr->tp_mac,&self,&out);
-		if(self){
-			int r;
-
-			r = send_to_self(i,frame);
-			if(r < 0){
-				++i->txerrors;
-			}else{
-				i->txbytes += r;
-				++i->txframes;
-			}
-			ret |= r < 0 ? -1 : 0;
-		}
+		// Out first: once queued to ourselves, the frame isn't ours.
 		if(out){
 			uint32_t tplen = thdr->tp_len;
+			const char *l2 = (const char *)frame + thdr->tp_mac;
 			int r;
 
-			//thdr->tp_status = TP_STATUS_SEND_REQUEST;
-			//r = send(i->fd,NULL,0,0);
-			r = send(i->fd,(const char *)frame + thdr->tp_mac,tplen,0);
-			if(r == 0){
+			if(i->xdp){
+				r = xsk_send(i,l2,tplen);
+			}else if(i->txr){
+				r = ring_tx_frame(i,l2,tplen);
+			}else if((r = send(i->fd,l2,tplen,0)) == 0){
 				r = tplen;
 			}
 			//diagnostic("Transmitted %d on %s",ret,i->name);
 			if(r < 0){
 				diagnostic("Error out-TXing %u on %s (%s)",tplen,i->name,strerror(errno));
-				++i->txerrors;
+				tx_stat(&i->txerrors,1);
 			}else{
-				i->txbytes += r;
-				++i->txframes;
+				tx_stat(&i->txbytes,r);
+				tx_stat(&i->txframes,1);
 			}
 			ret |= r < 0 ? -1 : 0;
 		}
-		thdr->tp_status = TP_STATUS_AVAILABLE;
+		if(self){
+			if(queue_to_self(i,frame) == 0){
+				return ret;
+			}
+			tx_stat(&i->txerrors,1);
+			ret = -1;
+		}
+		__atomic_store_n(&thdr->tp_status,TP_STATUS_AVAILABLE,__ATOMIC_RELEASE);
 	}else{
 		abort_tx_frame(i,frame);
-		ret = 0;
+		return 0;
+	}
+	tx_release(i);
+	return ret;
+}
+
+// With MSG_DONTWAIT, the kernel sends what it can and returns; anything left
+// (due to a full qdisc, say) remains marked, and goes with the next flush.
+// The kernel serializes concurrent flushes itself.
+static int
+kick_tx_frames(interface *i){
+	unsigned queued;
+
+	if((queued = __atomic_exchange_n(&i->txqueued,0,__ATOMIC_ACQ_REL)) == 0){
+		return 0;
+	}
+	if(send(i->fd,NULL,0,MSG_DONTWAIT) < 0){
+		__atomic_add_fetch(&i->txqueued,queued,__ATOMIC_RELAXED);
+		if(errno != EAGAIN && errno != ENOBUFS){
+			diagnostic("Error flushing %u TX on %s (%s)",queued,i->name,strerror(errno));
+			tx_stat(&i->txerrors,1);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+// Both queues. The caller must hold a txinflight claim.
+static int
+flush_all_tx(interface *i){
+	int r = 0;
+
+	if(kick_tx_frames(i) && errno != EAGAIN && errno != ENOBUFS){
+		r = -1;
+	}
+	flush_self_tx(i);
+	return r;
+}
+
+int flush_tx_frames(interface *i){
+	int r = 0;
+
+	__atomic_add_fetch(&i->txinflight,1,__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&i->txm,__ATOMIC_SEQ_CST)){
+		r = flush_all_tx(i);
 	}
+	tx_release(i);
+	return r;
+}
+
+// Mark a frame as ready-to-send. Must have come from get_tx_frame() using this
+// same interface. Yes, we will see packets we generate on the RX ring.
+int send_tx_frame(interface *i,void *frame){
+	int ret;
+
+	// Hold our claim across the flush, lest the socket go away beneath us.
+	__atomic_add_fetch(&i->txinflight,1,__ATOMIC_RELAXED);
+	ret = queue_tx_frame(i,frame);
+	if(__atomic_load_n(&i->txbatch,__ATOMIC_ACQUIRE) == 0){
+		ret |= flush_all_tx(i);
+	}
+	tx_release(i);
 	return ret;
 }
 
+void begin_tx_batch(interface *i){
+	__atomic_add_fetch(&i->txbatch,1,__ATOMIC_ACQ_REL);
+}
+
+int end_tx_batch(interface *i){
+	if(__atomic_sub_fetch(&i->txbatch,1,__ATOMIC_ACQ_REL)){
+		return 0;
+	}
+	return flush_tx_frames(i);
+}
+
+void shed_tx_frame(interface *i,void *frame){
+	struct tpacket_hdr *thdr = frame;
+
+	__atomic_add_fetch(&i->txshed,1,__ATOMIC_RELAXED);
+	__atomic_store_n(&thdr->tp_status,TP_STATUS_AVAILABLE,__ATOMIC_RELEASE);
+	tx_release(i);
+}
+
 void abort_tx_frame(interface *i,void *frame){
 	const omphalos_ctx *octx = get_octx();
 	struct tpacket_hdr *thdr = frame;
+	uintmax_t aborts;
 
-	++i->txaborts;
-	thdr->tp_status = TP_STATUS_AVAILABLE;
+	aborts = __atomic_add_fetch(&i->txaborts,1,__ATOMIC_RELAXED);
+	__atomic_store_n(&thdr->tp_status,TP_STATUS_AVAILABLE,__ATOMIC_RELEASE);
+	tx_release(i);
 	if(octx->mode != OMPHALOS_MODE_SILENT){
-		diagnostic("Aborted TX %ju on %s",i->txaborts,i->name);
+		diagnostic("Aborted TX %ju on %s",aborts,i->name);
 	}
 }
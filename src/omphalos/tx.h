@@ -10,15 +10,42 @@ extern "C" {
 
 struct interface;
 
-// Acquire a frame from the ringbuffer. Interface lock must be held.
+// None of these take the interface lock; they may be called with or without
+// it held, from any thread.
+
+// Acquire a frame from the ringbuffer. It must be passed to one of
+// send_tx_frame(), queue_tx_frame(), pace_tx_frame() or abort_tx_frame().
 void *get_tx_frame(struct interface *,size_t *);
 
-// Mark a frame as ready-to-send. Interface lock must be held.
+// Mark a frame as ready-to-send, and flush.
 int send_tx_frame(struct interface *,void *);
 
-// Release a frame for reuse without transmitting it. Interface lock must be held.
+// As send_tx_frame(), but only queue the frame on the kernel's TX ring.
+// Nothing goes out until flush_tx_frames(), which sends everything queued
+// (by any thread) with a single system call.
+int queue_tx_frame(struct interface *,void *);
+int flush_tx_frames(struct interface *);
+
+// Release a frame for reuse without transmitting it.
 void abort_tx_frame(struct interface *,void *);
 
+// As abort_tx_frame(), but quietly, for frames the scheduler declined (see
+// txsched.h).
+void shed_tx_frame(struct interface *,void *);
+
+// Bracket a burst of sends (as from query_network()). Within a batch,
+// send_tx_frame() only queues; frames go out with end_tx_batch() of the
+// outermost batch, or earlier should a queue fill or grow stale. Batches on
+// an interface are shared across threads.
+void begin_tx_batch(struct interface *);
+int end_tx_batch(struct interface *);
+
+// The queue of frames to be sent to ourselves via sendmmsg() (see tx.c).
+// release_self_tx() must only be called once txm has been cleared, and waits
+// until no frames remain outstanding.
+int prepare_self_tx(struct interface *);
+void release_self_tx(struct interface *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,469 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <omphalos/tx.h>
+#include <omphalos/diag.h>
+#include <linux/if_packet.h>
+#include <omphalos/timing.h>
+#include <omphalos/txsched.h>
+#include <omphalos/omphalos.h>
+#include <omphalos/interface.h>
+
+#define USEC_PER_SEC 1000000ll
+
+// Buckets hold 100ms worth of tokens, but always enough for one max-sized
+// frame, lest it never be admitted.
+#define TXSCHED_BURST_DIV 10
+#define TXSCHED_MIN_BITS (65535 * 8)
+
+#define TXSCHED_DRAIN_MAX 32	// frames sent per drain
+#define TXSCHED_LIST_MAX 32	// interfaces drained per drain_tx_scheds()
+
+// Levels are kept in token-microseconds, so that refilling needs no division.
+typedef struct tokenbucket {
+	uint64_t rate;		// tokens per second, 0 for unlimited
+	int64_t depth;		// capacity
+	int64_t level;		// may go negative, through user-initiated debt
+	uint64_t last;		// mono_ns() of the last refill
+} tokenbucket;
+
+typedef struct txsched {
+	pthread_mutex_t lock;
+	tokenbucket pps,bps;
+	unsigned cap;		// per-class backlog limit
+	struct {
+		void **frames;	// ring of held staging frames
+		unsigned head,count;
+	} q[TXCLASS_COUNT];
+	unsigned backlog;	// frames held across all classes (atomic reads)
+	interface *i;
+	int listed;		// on the backlogged list (protected by glock)
+	struct txsched *next;
+} txsched;
+
+// Taken after any scheduler's lock, never before.
+static pthread_mutex_t glock = PTHREAD_MUTEX_INITIALIZER;
+static tokenbucket gpps,gbps;
+static txsched *backlogged;
+
+int lex_txrate(const char *str,unsigned *pps,uint64_t *bps){
+	unsigned long long ull;
+	unsigned long ul;
+	char *e;
+
+	*pps = 0;
+	*bps = 0;
+	if(strcmp(str,"none") == 0){
+		return 0;
+	}
+	if(*str < '0' || *str > '9'){
+		return -1;
+	}
+	errno = 0;
+	ul = strtoul(str,&e,10);
+	if(errno || ul > UINT32_MAX){
+		return -1;
+	}
+	*pps = ul;
+	if(*e == '\0'){
+		return 0;
+	}
+	if(*e != ':' || e[1] < '0' || e[1] > '9'){
+		return -1;
+	}
+	ull = strtoull(e + 1,&e,10);
+	if(errno){
+		return -1;
+	}
+	switch(*e){
+		case 'K': case 'k': ull *= 1000ull; ++e; break;
+		case 'M': case 'm': ull *= 1000000ull; ++e; break;
+		case 'G': case 'g': ull *= 1000000000ull; ++e; break;
+	}
+	// Keep depth (a tenth of a second's tokens) well within an int64_t.
+	if(*e || ull > 1000000000000ull){
+		return -1;
+	}
+	*bps = ull;
+	return 0;
+}
+
+static void
+bucket_init(tokenbucket *tb,uint64_t rate,uint64_t min){
+	uint64_t depth = rate / TXSCHED_BURST_DIV;
+
+	tb->rate = rate;
+	tb->depth = (int64_t)(depth > min ? depth : min) * USEC_PER_SEC;
+	tb->level = tb->depth;
+	tb->last = mono_ns();
+}
+
+static void
+bucket_refill(tokenbucket *tb,uint64_t now){
+	uint64_t usec;
+
+	if(tb->rate == 0 || now <= tb->last){
+		return;
+	}
+	usec = (now - tb->last) / 1000;
+	tb->last += usec * 1000;
+	// Avoid overflow following a long quiet period.
+	if(usec >= (uint64_t)(tb->depth - tb->level) / tb->rate + 1){
+		tb->level = tb->depth;
+	}else{
+		tb->level += usec * tb->rate;
+	}
+}
+
+static inline int
+bucket_has(const tokenbucket *tb,uint64_t n){
+	return tb->rate == 0 || tb->level >= (int64_t)n * USEC_PER_SEC;
+}
+
+// Debt is bounded by the depth, so that a user can't starve everyone else
+// for longer than a burst's time.
+static inline void
+bucket_take(tokenbucket *tb,uint64_t n){
+	if(tb->rate){
+		tb->level -= (int64_t)n * USEC_PER_SEC;
+		if(tb->level < -tb->depth){
+			tb->level = -tb->depth;
+		}
+	}
+}
+
+// msec until n tokens will be available.
+static unsigned
+bucket_wait(const tokenbucket *tb,uint64_t n){
+	int64_t need;
+
+	if(tb->rate == 0 || (need = (int64_t)n * USEC_PER_SEC - tb->level) <= 0){
+		return 0;
+	}
+	return need / tb->rate / 1000 + 1;
+}
+
+static inline uint64_t
+frame_bits(const void *frame){
+	return ((const struct tpacket_hdr *)frame)->tp_len * 8ull;
+}
+
+static int
+rate_setup(const char *rate,const char *def,unsigned *pps,uint64_t *bps){
+	if(lex_txrate(rate ? rate : def,pps,bps)){
+		diagnostic("Invalid TX rate: %s",rate ? rate : def);
+		return -1;
+	}
+	return 0;
+}
+
+int init_tx_sched(const char *rate){
+	uint64_t bps;
+	unsigned pps;
+
+	if(rate_setup(rate,TXSCHED_DEFAULT_TOTAL_RATE,&pps,&bps)){
+		return -1;
+	}
+	pthread_mutex_lock(&glock);
+	bucket_init(&gpps,pps,1);
+	bucket_init(&gbps,bps,TXSCHED_MIN_BITS);
+	pthread_mutex_unlock(&glock);
+	return 0;
+}
+
+int prepare_tx_sched(interface *i,const char *rate){
+	txsched *s;
+	uint64_t bps;
+	unsigned pps,c;
+
+	if(rate_setup(rate,TXSCHED_DEFAULT_RATE,&pps,&bps)){
+		return -1;
+	}
+	if((s = malloc(sizeof(*s))) == NULL){
+		diagnostic("Couldn't allocate TX scheduler for %s",i->name);
+		return -1;
+	}
+	memset(s,0,sizeof(*s));
+	// Leave at least half the staging frames for whatever's admitted.
+	if((s->cap = i->ttpr.tp_frame_nr / 2 / (TXCLASS_COUNT - 1)) == 0){
+		s->cap = 1;
+	}
+	if((s->q[0].frames = malloc(sizeof(void *) * s->cap * TXCLASS_COUNT)) == NULL){
+		diagnostic("Couldn't allocate TX backlog for %s",i->name);
+		free(s);
+		return -1;
+	}
+	for(c = 1 ; c < TXCLASS_COUNT ; ++c){
+		s->q[c].frames = s->q[0].frames + s->cap * c;
+	}
+	if(pthread_mutex_init(&s->lock,NULL)){
+		diagnostic("Couldn't initialize TX scheduler lock for %s",i->name);
+		free(s->q[0].frames);
+		free(s);
+		return -1;
+	}
+	bucket_init(&s->pps,pps,1);
+	bucket_init(&s->bps,bps,TXSCHED_MIN_BITS);
+	s->i = i;
+	i->txsched = s;
+	return 0;
+}
+
+// Both the interface's buckets and the global ones must admit the frame. The
+// scheduler's lock must be held.
+static int
+admit(txsched *s,uint64_t bits,uint64_t now){
+	int ok;
+
+	bucket_refill(&s->pps,now);
+	bucket_refill(&s->bps,now);
+	if(!bucket_has(&s->pps,1) || !bucket_has(&s->bps,bits)){
+		return 0;
+	}
+	pthread_mutex_lock(&glock);
+	bucket_refill(&gpps,now);
+	bucket_refill(&gbps,now);
+	if( (ok = bucket_has(&gpps,1) && bucket_has(&gbps,bits)) ){
+		bucket_take(&gpps,1);
+		bucket_take(&gbps,bits);
+	}
+	pthread_mutex_unlock(&glock);
+	if(ok){
+		bucket_take(&s->pps,1);
+		bucket_take(&s->bps,bits);
+	}
+	return ok;
+}
+
+static void
+charge(txsched *s,uint64_t bits,uint64_t now){
+	bucket_refill(&s->pps,now);
+	bucket_refill(&s->bps,now);
+	bucket_take(&s->pps,1);
+	bucket_take(&s->bps,bits);
+	pthread_mutex_lock(&glock);
+	bucket_refill(&gpps,now);
+	bucket_refill(&gbps,now);
+	bucket_take(&gpps,1);
+	bucket_take(&gbps,bits);
+	pthread_mutex_unlock(&glock);
+}
+
+static unsigned
+admit_wait(const txsched *s,uint64_t bits){
+	unsigned ms,w;
+
+	ms = bucket_wait(&s->pps,1);
+	if((w = bucket_wait(&s->bps,bits)) > ms){
+		ms = w;
+	}
+	pthread_mutex_lock(&glock);
+	if((w = bucket_wait(&gpps,1)) > ms){
+		ms = w;
+	}
+	if((w = bucket_wait(&gbps,bits)) > ms){
+		ms = w;
+	}
+	pthread_mutex_unlock(&glock);
+	return ms;
+}
+
+// The highest-priority class with anything held, or TXCLASS_COUNT.
+static txclass
+backlog_head(const txsched *s){
+	txclass c;
+
+	for(c = TXCLASS_USER ; c < TXCLASS_COUNT ; ++c){
+		if(s->q[c].count){
+			break;
+		}
+	}
+	return c;
+}
+
+static void *
+backlog_peek(const txsched *s,txclass c){
+	return s->q[c].frames[s->q[c].head];
+}
+
+static void *
+backlog_pop(txsched *s,txclass c){
+	void *frame = backlog_peek(s,c);
+
+	s->q[c].head = (s->q[c].head + 1) % s->cap;
+	--s->q[c].count;
+	__atomic_sub_fetch(&s->backlog,1,__ATOMIC_RELAXED);
+	return frame;
+}
+
+// Both locks must be held.
+static void
+backlog_unlist(txsched *s){
+	txsched **prev;
+
+	if(!s->listed){
+		return;
+	}
+	for(prev = &backlogged ; *prev != s ; prev = &(*prev)->next){
+		;
+	}
+	*prev = s->next;
+	s->listed = 0;
+}
+
+int pace_tx_frame(interface *i,void *frame,txclass cls){
+	const omphalos_ctx *octx = get_octx();
+	const uint64_t bits = frame_bits(frame);
+	txsched *s = i->txsched;
+	uint64_t now;
+	unsigned tail;
+
+	if(s == NULL || octx->mode == OMPHALOS_MODE_SILENT){
+		return send_tx_frame(i,frame);
+	}
+	now = mono_ns();
+	pthread_mutex_lock(&s->lock);
+	if(cls == TXCLASS_USER){
+		charge(s,bits,now);
+		pthread_mutex_unlock(&s->lock);
+		return send_tx_frame(i,frame);
+	}
+	// Don't jump the queue of our own class, or any above it.
+	if(backlog_head(s) > cls && admit(s,bits,now)){
+		pthread_mutex_unlock(&s->lock);
+		return send_tx_frame(i,frame);
+	}
+	// Once txm is cleared, purge_tx_sched() might already have run.
+	if(s->q[cls].count == s->cap || __atomic_load_n(&i->txm,__ATOMIC_SEQ_CST) == NULL){
+		pthread_mutex_unlock(&s->lock);
+		shed_tx_frame(i,frame);
+		return -1;
+	}
+	tail = (s->q[cls].head + s->q[cls].count++) % s->cap;
+	s->q[cls].frames[tail] = frame;
+	__atomic_add_fetch(&s->backlog,1,__ATOMIC_RELAXED);
+	if(!s->listed){
+		pthread_mutex_lock(&glock);
+		s->next = backlogged;
+		backlogged = s;
+		s->listed = 1;
+		pthread_mutex_unlock(&glock);
+	}
+	pthread_mutex_unlock(&s->lock);
+	__atomic_add_fetch(&i->txdeferred,1,__ATOMIC_RELAXED);
+	return 0;
+}
+
+unsigned tx_sched_room(interface *i,txclass cls){
+	txsched *s = i->txsched;
+	unsigned room;
+
+	if(s == NULL){
+		return UINT_MAX;
+	}
+	pthread_mutex_lock(&s->lock);
+	room = s->cap - s->q[cls].count;
+	pthread_mutex_unlock(&s->lock);
+	return room;
+}
+
+int drain_tx_sched(interface *i){
+	void *frames[TXSCHED_DRAIN_MAX];
+	txsched *s = i->txsched;
+	unsigned n = 0,z;
+	uint64_t now;
+	txclass c;
+	int ms;
+
+	if(s == NULL || __atomic_load_n(&s->backlog,__ATOMIC_RELAXED) == 0){
+		return -1;
+	}
+	now = mono_ns();
+	pthread_mutex_lock(&s->lock);
+	while(n < TXSCHED_DRAIN_MAX && (c = backlog_head(s)) < TXCLASS_COUNT){
+		if(!admit(s,frame_bits(backlog_peek(s,c)),now)){
+			break;
+		}
+		frames[n++] = backlog_pop(s,c);
+	}
+	if((c = backlog_head(s)) == TXCLASS_COUNT){
+		pthread_mutex_lock(&glock);
+		backlog_unlist(s);
+		pthread_mutex_unlock(&glock);
+		ms = -1;
+	}else if(n == TXSCHED_DRAIN_MAX){
+		ms = 0;
+	}else{
+		ms = admit_wait(s,frame_bits(backlog_peek(s,c)));
+	}
+	pthread_mutex_unlock(&s->lock);
+	if(n){
+		begin_tx_batch(i);
+		for(z = 0 ; z < n ; ++z){
+			send_tx_frame(i,frames[z]);
+		}
+		end_tx_batch(i);
+	}
+	return ms;
+}
+
+// The list is protected by glock, which can't be held while taking a
+// scheduler's lock. We instead take a TX claim on each listed interface (as
+// if we held a frame), which keeps its scheduler alive until we're done.
+int drain_tx_scheds(void){
+	interface *ifaces[TXSCHED_LIST_MAX];
+	unsigned n = 0,z;
+	txsched *s;
+	int ms = -1;
+
+	pthread_mutex_lock(&glock);
+	for(s = backlogged ; s && n < TXSCHED_LIST_MAX ; s = s->next){
+		__atomic_add_fetch(&s->i->txinflight,1,__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&s->i->txm,__ATOMIC_SEQ_CST) == NULL){
+			__atomic_sub_fetch(&s->i->txinflight,1,__ATOMIC_RELEASE);
+			continue;
+		}
+		ifaces[n++] = s->i;
+	}
+	pthread_mutex_unlock(&glock);
+	for(z = 0 ; z < n ; ++z){
+		int w = drain_tx_sched(ifaces[z]);
+
+		if(w >= 0 && (ms < 0 || w < ms)){
+			ms = w;
+		}
+		__atomic_sub_fetch(&ifaces[z]->txinflight,1,__ATOMIC_RELEASE);
+	}
+	return ms;
+}
+
+void purge_tx_sched(interface *i){
+	txsched *s = i->txsched;
+	txclass c;
+
+	if(s == NULL){
+		return;
+	}
+	pthread_mutex_lock(&s->lock);
+	while((c = backlog_head(s)) < TXCLASS_COUNT){
+		shed_tx_frame(i,backlog_pop(s,c));
+	}
+	pthread_mutex_lock(&glock);
+	backlog_unlist(s);
+	pthread_mutex_unlock(&glock);
+	pthread_mutex_unlock(&s->lock);
+}
+
+void release_tx_sched(interface *i){
+	txsched *s = i->txsched;
+
+	if(s == NULL){
+		return;
+	}
+	pthread_mutex_destroy(&s->lock);
+	free(s->q[0].frames);
+	free(s);
+	i->txsched = NULL;
+}
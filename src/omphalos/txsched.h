@@ -0,0 +1,67 @@
+#ifndef OMPHALOS_TXSCHED
+#define OMPHALOS_TXSCHED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct interface;
+
+// Pacing for the frames we originate, so that active mode can run on
+// production segments without bursting switch CPUs or tripping storm
+// control. Each interface has packets- and bits-per-second token buckets, as
+// does the process as a whole; a frame must be admitted by all four. Frames
+// which can't yet go are held (still in their staging frame) on a backlog per
+// class, drained in priority order as tokens accrue: from the capture
+// threads' idle ticks, and from the RX pool's workers. A full backlog sheds
+// new frames of its class.
+
+typedef enum {
+	TXCLASS_USER,	// user-initiated: charged, but never held back
+	TXCLASS_NAMING,	// name resolution (DNS and mDNS PTR queries)
+	TXCLASS_SWEEP,	// discovery: network queries, probes and scans
+	TXCLASS_COUNT
+} txclass;
+
+#define TXSCHED_DEFAULT_RATE "200:2M"		// per interface
+#define TXSCHED_DEFAULT_TOTAL_RATE "1000:10M"	// across all interfaces
+
+// Parse "pps[:bits[K|M|G]]" (decimal multiples), or "none". 0 for either
+// rate means unlimited.
+int lex_txrate(const char *,unsigned *,uint64_t *);
+
+// Set the process-wide rate (NULL for the default).
+int init_tx_sched(const char *);
+
+// Set up the interface's scheduler, at the given rate (NULL for the default).
+int prepare_tx_sched(struct interface *,const char *);
+
+// Shed anything still held. txm must already have been cleared.
+void purge_tx_sched(struct interface *);
+
+// Free the scheduler, once no frames remain outstanding.
+void release_tx_sched(struct interface *);
+
+// Send a frame from get_tx_frame() once the scheduler admits it. Returns 0
+// if it was sent or deferred, and -1 if it failed or was shed.
+int pace_tx_frame(struct interface *,void *,txclass);
+
+// Frames of the class which could be passed to pace_tx_frame() right now
+// without being shed, for senders (such as sweeps) able to hold off.
+unsigned tx_sched_room(struct interface *,txclass);
+
+// Send whatever the buckets now allow of the interface's backlog. Returns the
+// msec until more can go, or -1 if nothing is held. Only the thread servicing
+// the interface's ring (or one holding a TX frame) may call this.
+int drain_tx_sched(struct interface *);
+
+// Drain every interface with a backlog, returning as drain_tx_sched().
+int drain_tx_scheds(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
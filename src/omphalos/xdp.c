@@ -0,0 +1,679 @@
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/if_xdp.h>
+#include <sys/resource.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+// libpcap (via omphalos.h) has its own, incompatible struct bpf_insn.
+#define bpf_insn xdp_insn
+#include <linux/bpf.h>
+#undef bpf_insn
+#include <omphalos/xdp.h>
+#include <omphalos/diag.h>
+#include <omphalos/timing.h>
+#include <omphalos/psocket.h>
+#include <omphalos/affinity.h>
+#include <omphalos/omphalos.h>
+#include <omphalos/interface.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define HUGEPAGE_BYTES (1u << 21)
+
+// RX descriptors (and UMEM chunks) per XSK absent a configured ring size, and
+// the bounds on a configured one. TX is only used for the odd probe.
+#define XSK_RX_DEFAULT 2048u
+#define XSK_RX_MIN 64u
+#define XSK_RX_MAX 32768u
+#define XSK_TX_FRAMES 512u
+
+// Slack beyond the MTU for L2 headers and VLAN tags when choosing a chunk.
+#define XSK_L2_SLACK 32u
+
+// Read the kernel's drop counters every so many batches (as well as on idle).
+#define XSK_STAT_BATCHES 256u
+
+// A single-producer, single-consumer ring shared with the kernel. We only
+// ever touch our own end's index; the other is read with acquire semantics.
+typedef struct xsk_ring {
+	uint32_t *producer,*consumer,*flags;
+	void *descs;
+	uint32_t mask;
+	void *map;
+	size_t maplen;
+} xsk_ring;
+
+typedef struct xsk {
+	int fd;
+	unsigned queue;
+	void *umem;
+	size_t umemlen;
+	unsigned chunk;		// bytes per UMEM chunk, a power of 2
+	xsk_ring fill,comp,rx,tx;
+	// The first nrx chunks belong to RX, and cycle between the fill and
+	// RX rings. The remainder belong to TX, and are on txfree when not in
+	// flight.
+	unsigned nrx;
+	uint64_t *txfree;
+	unsigned ntxfree;
+	uintmax_t kdrops;	// kernel's drop count when last read
+	unsigned batches;
+} xsk;
+
+static inline long
+sys_bpf(int cmd,union bpf_attr *attr){
+	return syscall(SYS_bpf,cmd,attr,sizeof(*attr));
+}
+
+// Prior to 5.11, both maps and UMEMs are charged against RLIMIT_MEMLOCK,
+// which defaults to a paltry 64KiB (or 8MiB on newer distributions).
+static void
+raise_memlock(void){
+	struct rlimit rl = { .rlim_cur = RLIM_INFINITY, .rlim_max = RLIM_INFINITY, };
+
+	if(setrlimit(RLIMIT_MEMLOCK,&rl)){
+		if(getrlimit(RLIMIT_MEMLOCK,&rl) == 0 && rl.rlim_cur < rl.rlim_max){
+			rl.rlim_cur = rl.rlim_max;
+			setrlimit(RLIMIT_MEMLOCK,&rl);
+		}
+	}
+}
+
+// An XSKMAP with an entry per RX queue, and a program redirecting each frame
+// to its queue's entry. Should the entry be empty, bpf_redirect_map() returns
+// the low bits of its flags (5.3+), and we pass the frame up the stack.
+static int
+load_xdp_prog(xdp_iface *xi){
+	struct xdp_insn prog[] = {
+		// r2 = ctx->rx_queue_index
+		{ .code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2,
+		  .src_reg = BPF_REG_1, .off = offsetof(struct xdp_md,rx_queue_index), },
+		// r1 = xskmap (a 16-byte immediate load)
+		{ .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+		  .src_reg = BPF_PSEUDO_MAP_FD, .imm = xi->mapfd, },
+		{ .code = 0, },
+		// r3 = XDP_PASS
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3,
+		  .imm = XDP_PASS, },
+		{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map, },
+		{ .code = BPF_JMP | BPF_EXIT, },
+	};
+	union bpf_attr attr;
+
+	memset(&attr,0,sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(int);
+	attr.max_entries = xi->nqueues;
+	if((xi->mapfd = sys_bpf(BPF_MAP_CREATE,&attr)) < 0){
+		diagnostic("Couldn't create XSKMAP (%s?)",strerror(errno));
+		return -1;
+	}
+	prog[1].imm = xi->mapfd;
+	memset(&attr,0,sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(*prog);
+	attr.license = (uintptr_t)"GPL";
+	if((xi->progfd = sys_bpf(BPF_PROG_LOAD,&attr)) < 0){
+		diagnostic("Couldn't load XDP program (%s?)",strerror(errno));
+		close(xi->mapfd);
+		xi->mapfd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+// Attach (or, with a progfd of -1, detach) an XDP program via RTM_SETLINK.
+static int
+set_xdp_prog(int idx,int progfd,unsigned flags){
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+		char attrs[RTA_SPACE(0) + RTA_SPACE(sizeof(int)) + RTA_SPACE(sizeof(flags))];
+	} req;
+	struct { struct nlmsghdr nh; struct nlmsgerr err; } ack;
+	struct rtattr *nest,*rta;
+	int fd,r;
+
+	memset(&req,0,sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nh.nlmsg_type = RTM_SETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = idx;
+	nest = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+	nest->rta_type = IFLA_XDP | NLA_F_NESTED;
+	nest->rta_len = RTA_LENGTH(0);
+	rta = (struct rtattr *)((char *)nest + RTA_ALIGN(nest->rta_len));
+	rta->rta_type = IFLA_XDP_FD;
+	rta->rta_len = RTA_LENGTH(sizeof(progfd));
+	memcpy(RTA_DATA(rta),&progfd,sizeof(progfd));
+	nest->rta_len += RTA_ALIGN(rta->rta_len);
+	rta = (struct rtattr *)((char *)nest + RTA_ALIGN(nest->rta_len));
+	rta->rta_type = IFLA_XDP_FLAGS;
+	rta->rta_len = RTA_LENGTH(sizeof(flags));
+	memcpy(RTA_DATA(rta),&flags,sizeof(flags));
+	nest->rta_len += RTA_ALIGN(rta->rta_len);
+	req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + nest->rta_len;
+	if((fd = socket(AF_NETLINK,SOCK_RAW | SOCK_CLOEXEC,NETLINK_ROUTE)) < 0){
+		diagnostic("Couldn't open NETLINK_ROUTE socket (%s?)",strerror(errno));
+		return -1;
+	}
+	if(send(fd,&req,req.nh.nlmsg_len,0) < 0){
+		diagnostic("Couldn't send RTM_SETLINK (%s?)",strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if((r = recv(fd,&ack,sizeof(ack),0)) < 0){
+		diagnostic("Couldn't read RTM_SETLINK ack (%s?)",strerror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if((size_t)r < sizeof(ack) || ack.nh.nlmsg_type != NLMSG_ERROR){
+		diagnostic("Unexpected RTM_SETLINK reply (%d)",ack.nh.nlmsg_type);
+		return -1;
+	}
+	if(ack.err.error){
+		errno = -ack.err.error;
+		return -1;
+	}
+	return 0;
+}
+
+// Prefer native (driver) XDP, which alone supports zero-copy; generic XDP
+// works on anything, veths included, at skb speeds. We refuse to replace
+// anyone else's program.
+static int
+attach_xdp_prog(const char *name,int idx,xdp_iface *xi,xdp_backend backend){
+	const unsigned modes[] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE, };
+	unsigned m;
+
+	for(m = 0 ; m < sizeof(modes) / sizeof(*modes) ; ++m){
+		if(modes[m] == XDP_FLAGS_SKB_MODE && backend == XDP_BACKEND_ZEROCOPY){
+			break;
+		}
+		if(set_xdp_prog(idx,xi->progfd,modes[m] | XDP_FLAGS_UPDATE_IF_NOEXIST) == 0){
+			xi->attachflags = modes[m];
+			return 0;
+		}
+		if(errno == EBUSY || errno == EEXIST){
+			diagnostic("An XDP program is already attached to %s",name);
+			return -1;
+		}
+	}
+	diagnostic("Couldn't attach XDP program to %s (%s?)",name,strerror(errno));
+	return -1;
+}
+
+static void
+detach_xdp_prog(const char *name,int idx,xdp_iface *xi){
+	if(xi->attachflags){
+		if(set_xdp_prog(idx,-1,xi->attachflags)){
+			diagnostic("Couldn't detach XDP program from %s (%s?)",name,strerror(errno));
+		}
+		xi->attachflags = 0;
+	}
+}
+
+// One XSK per combined or RX queue, as enumerated in sysfs.
+static unsigned
+count_rx_queues(const char *name){
+	char path[PATH_MAX];
+	struct dirent *d;
+	unsigned n = 0;
+	DIR *dir;
+
+	snprintf(path,sizeof(path),"/sys/class/net/%s/queues",name);
+	if( (dir = opendir(path)) ){
+		while( (d = readdir(dir)) ){
+			if(strncmp(d->d_name,"rx-",3) == 0){
+				++n;
+			}
+		}
+		closedir(dir);
+	}
+	return n ? n : 1;
+}
+
+static void *
+umem_alloc(size_t *len,int huge,int node){
+	void *map;
+
+	if(huge){
+		size_t hlen = (*len + HUGEPAGE_BYTES - 1) / HUGEPAGE_BYTES * HUGEPAGE_BYTES;
+
+		if((map = mmap(0,hlen,PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0)) != MAP_FAILED){
+			*len = hlen;
+			bind_node(map,hlen,node);
+			return map;
+		}
+		diagnostic("Couldn't get %zub of huge pages (%s?)",hlen,strerror(errno));
+	}
+	if((map = mmap(0,*len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,
+					-1,0)) == MAP_FAILED){
+		diagnostic("Couldn't mmap %zub UMEM (%s?)",*len,strerror(errno));
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if(huge){
+		madvise(map,*len,MADV_HUGEPAGE);
+	}
+#endif
+	bind_node(map,*len,node);
+	return map;
+}
+
+static int
+map_xsk_ring(int fd,xsk_ring *r,const struct xdp_ring_offset *off,off_t pgoff,
+				unsigned entries,size_t descsize){
+	r->maplen = off->desc + entries * descsize;
+	if((r->map = mmap(0,r->maplen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+					fd,pgoff)) == MAP_FAILED){
+		diagnostic("Couldn't mmap %zub XSK ring (%s?)",r->maplen,strerror(errno));
+		r->map = NULL;
+		return -1;
+	}
+	r->producer = (uint32_t *)((char *)r->map + off->producer);
+	r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+	r->flags = (uint32_t *)((char *)r->map + off->flags);
+	r->descs = (char *)r->map + off->desc;
+	r->mask = entries - 1;
+	return 0;
+}
+
+static void
+unmap_xsk_ring(xsk_ring *r){
+	if(r->map){
+		munmap(r->map,r->maplen);
+		r->map = NULL;
+	}
+}
+
+static void
+free_xsk(xsk *x){
+	unmap_xsk_ring(&x->rx);
+	unmap_xsk_ring(&x->tx);
+	unmap_xsk_ring(&x->fill);
+	unmap_xsk_ring(&x->comp);
+	if(x->fd >= 0){
+		close(x->fd);
+		x->fd = -1;
+	}
+	if(x->umem){
+		munmap(x->umem,x->umemlen);
+		x->umem = NULL;
+	}
+	free(x->txfree);
+	x->txfree = NULL;
+}
+
+static int
+xsk_setopt(int fd,int opt,unsigned val,const char *what){
+	if(setsockopt(fd,SOL_XDP,opt,&val,sizeof(val))){
+		diagnostic("Couldn't size XSK %s ring to %u (%s?)",what,val,strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Build an XSK on the given queue, with a UMEM of its own, and bind it.
+static int
+open_xsk(xsk *x,const interface *iface,int idx,const xdp_iface *xi,
+		unsigned chunk,unsigned nrx,int huge,int node){
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	struct xdp_umem_reg ureg;
+	uint32_t *fill;
+	socklen_t slen;
+	unsigned z;
+
+	x->chunk = chunk;
+	x->nrx = nrx;
+	x->umemlen = (size_t)(nrx + XSK_TX_FRAMES) * chunk;
+	if((x->fd = socket(AF_XDP,SOCK_RAW | SOCK_CLOEXEC,0)) < 0){
+		diagnostic("Couldn't open AF_XDP socket (%s?)",strerror(errno));
+		return -1;
+	}
+	if((x->umem = umem_alloc(&x->umemlen,huge,node)) == NULL){
+		goto err;
+	}
+	memset(&ureg,0,sizeof(ureg));
+	ureg.addr = (uintptr_t)x->umem;
+	ureg.len = x->umemlen;
+	ureg.chunk_size = chunk;
+	if(setsockopt(x->fd,SOL_XDP,XDP_UMEM_REG,&ureg,sizeof(ureg))){
+		diagnostic("Couldn't register %zub UMEM (%s?)",x->umemlen,strerror(errno));
+		goto err;
+	}
+	if(xsk_setopt(x->fd,XDP_UMEM_FILL_RING,nrx,"fill") ||
+			xsk_setopt(x->fd,XDP_UMEM_COMPLETION_RING,XSK_TX_FRAMES,"completion") ||
+			xsk_setopt(x->fd,XDP_RX_RING,nrx,"RX") ||
+			xsk_setopt(x->fd,XDP_TX_RING,XSK_TX_FRAMES,"TX")){
+		goto err;
+	}
+	slen = sizeof(off);
+	if(getsockopt(x->fd,SOL_XDP,XDP_MMAP_OFFSETS,&off,&slen)){
+		diagnostic("Couldn't get XSK ring offsets (%s?)",strerror(errno));
+		goto err;
+	}
+	if(map_xsk_ring(x->fd,&x->fill,&off.fr,XDP_UMEM_PGOFF_FILL_RING,nrx,sizeof(uint64_t)) ||
+		map_xsk_ring(x->fd,&x->comp,&off.cr,XDP_UMEM_PGOFF_COMPLETION_RING,
+				XSK_TX_FRAMES,sizeof(uint64_t)) ||
+		map_xsk_ring(x->fd,&x->rx,&off.rx,XDP_PGOFF_RX_RING,nrx,sizeof(struct xdp_desc)) ||
+		map_xsk_ring(x->fd,&x->tx,&off.tx,XDP_PGOFF_TX_RING,
+				XSK_TX_FRAMES,sizeof(struct xdp_desc))){
+		goto err;
+	}
+	if((x->txfree = malloc(sizeof(*x->txfree) * XSK_TX_FRAMES)) == NULL){
+		goto err;
+	}
+	for(z = 0 ; z < XSK_TX_FRAMES ; ++z){
+		x->txfree[z] = (uint64_t)(nrx + z) * chunk;
+	}
+	x->ntxfree = XSK_TX_FRAMES;
+	// Hand every RX chunk to the kernel up front.
+	fill = x->fill.descs;
+	for(z = 0 ; z < nrx ; ++z){
+		fill[z] = (uint64_t)z * chunk;
+	}
+	__atomic_store_n(x->fill.producer,nrx,__ATOMIC_RELEASE);
+	memset(&sxdp,0,sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = idx;
+	sxdp.sxdp_queue_id = x->queue;
+	sxdp.sxdp_flags = (xi->zerocopy ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP;
+	if(bind(x->fd,(const struct sockaddr *)&sxdp,sizeof(sxdp))){
+		diagnostic("Couldn't bind %s XSK to %s:%u (%s?)",xi->zerocopy ?
+			"zero-copy" : "copy",iface->name,x->queue,strerror(errno));
+		goto err;
+	}
+	return 0;
+
+err:
+	free_xsk(x);
+	return -1;
+}
+
+static int
+xsk_map_insert(const xdp_iface *xi,const xsk *x){
+	union bpf_attr attr;
+	uint32_t key = x->queue;
+	int val = x->fd;
+
+	memset(&attr,0,sizeof(attr));
+	attr.map_fd = xi->mapfd;
+	attr.key = (uintptr_t)&key;
+	attr.value = (uintptr_t)&val;
+	if(sys_bpf(BPF_MAP_UPDATE_ELEM,&attr)){
+		diagnostic("Couldn't add XSK %u to XSKMAP (%s?)",x->queue,strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// A power of 2 worth of chunks, so far as it fits within the ring bytes.
+static unsigned
+xsk_rx_frames(size_t bytes,unsigned chunk){
+	unsigned n;
+
+	if(bytes == 0){
+		return XSK_RX_DEFAULT;
+	}
+	for(n = XSK_RX_MIN ; n < XSK_RX_MAX && (size_t)n * 2 * chunk <= bytes ; n *= 2){
+		;
+	}
+	return n;
+}
+
+xdp_iface *open_xdp(interface *iface,int idx,xdp_backend backend,size_t rxbytes,
+						int huge,int node){
+	unsigned chunk,nrx,q;
+	xdp_iface *xi;
+
+	if(iface->mtu + XSK_L2_SLACK + XDP_PACKET_HEADROOM <= 2048){
+		chunk = 2048;
+	}else if(iface->mtu + XSK_L2_SLACK + XDP_PACKET_HEADROOM <= 4096){
+		chunk = 4096;
+	}else{
+		diagnostic("MTU %d too large for XDP on %s",iface->mtu,iface->name);
+		return NULL;
+	}
+	nrx = xsk_rx_frames(rxbytes,chunk);
+	if((xi = malloc(sizeof(*xi))) == NULL){
+		return NULL;
+	}
+	memset(xi,0,sizeof(*xi));
+	if(pthread_mutex_init(&xi->txlock,NULL)){
+		free(xi);
+		return NULL;
+	}
+	xi->progfd = xi->mapfd = -1;
+	xi->nqueues = count_rx_queues(iface->name);
+	if((xi->socks = malloc(sizeof(*xi->socks) * xi->nqueues)) == NULL){
+		pthread_mutex_destroy(&xi->txlock);
+		free(xi);
+		return NULL;
+	}
+	memset(xi->socks,0,sizeof(*xi->socks) * xi->nqueues);
+	for(q = 0 ; q < xi->nqueues ; ++q){
+		xi->socks[q].fd = -1;
+		xi->socks[q].queue = q;
+	}
+	raise_memlock();
+	if(load_xdp_prog(xi) || attach_xdp_prog(iface->name,idx,xi,backend)){
+		goto err;
+	}
+	xi->zerocopy = backend != XDP_BACKEND_COPY &&
+			xi->attachflags == XDP_FLAGS_DRV_MODE;
+	for(q = 0 ; q < xi->nqueues ; ++q){
+		if(open_xsk(&xi->socks[q],iface,idx,xi,chunk,nrx,huge,node)){
+			// Zero-copy is all or nothing; the driver decides.
+			if(q || !xi->zerocopy || backend == XDP_BACKEND_ZEROCOPY){
+				goto err;
+			}
+			xi->zerocopy = 0;
+			if(open_xsk(&xi->socks[q],iface,idx,xi,chunk,nrx,huge,node)){
+				goto err;
+			}
+		}
+		if(xsk_map_insert(xi,&xi->socks[q])){
+			goto err;
+		}
+	}
+	diagnostic("XDP (%s, %s) on %s: %u queue%s, %ux%ub chunks",
+			xi->attachflags == XDP_FLAGS_DRV_MODE ? "native" : "generic",
+			xi->zerocopy ? "zero-copy" : "copy",iface->name,xi->nqueues,
+			xi->nqueues == 1 ? "" : "s",nrx + XSK_TX_FRAMES,chunk);
+	return xi;
+
+err:
+	close_xdp(iface,xi);
+	return NULL;
+}
+
+// The program goes first, so that nothing more is redirected at XSKs
+// we're about to close.
+void close_xdp(interface *iface,xdp_iface *xi){
+	unsigned q;
+
+	detach_xdp_prog(iface->name,idx_of_iface(iface),xi);
+	for(q = 0 ; q < xi->nqueues ; ++q){
+		free_xsk(&xi->socks[q]);
+	}
+	if(xi->progfd >= 0){
+		close(xi->progfd);
+	}
+	if(xi->mapfd >= 0){
+		close(xi->mapfd);
+	}
+	pthread_mutex_destroy(&xi->txlock);
+	free(xi->socks);
+	free(xi);
+}
+
+int xsk_fd(const xdp_iface *xi,unsigned q){
+	return xi->socks[q].fd;
+}
+
+xsk *xsk_nth(xdp_iface *xi,unsigned q){
+	return &xi->socks[q];
+}
+
+int xsk_ready(const xsk *x){
+	return __atomic_load_n(x->rx.producer,__ATOMIC_ACQUIRE) != *x->rx.consumer;
+}
+
+// Fold the kernel's drops (no RX descriptor free, or no fill chunk) into the
+// worker's. rx_ring_full arrived in 5.9; older kernels return less.
+static void
+xsk_losses(rxworker *w,xsk *x){
+	struct xdp_statistics xstats;
+	socklen_t slen;
+	uintmax_t drops;
+
+	memset(&xstats,0,sizeof(xstats));
+	slen = sizeof(xstats);
+	if(getsockopt(x->fd,SOL_XDP,XDP_STATISTICS,&xstats,&slen)){
+		diagnostic("Error reading XSK stats on %s (%s?)",w->i->name,strerror(errno));
+		return;
+	}
+	drops = xstats.rx_dropped + xstats.rx_ring_full;
+	if(drops > x->kdrops){
+		w->drops += drops - x->kdrops;
+		diagnostic("[%s] %ju/%ju drops on XSK %d",w->i->name,drops - x->kdrops,drops,x->fd);
+	}
+	x->kdrops = drops;
+}
+
+static int
+xsk_ready_fxn(const void *x){
+	return xsk_ready(x);
+}
+
+int handle_xsk_batch(rxworker *w,xsk *x,unsigned batch){
+	uint32_t cons,prod,fprod,n,z;
+	const struct xdp_desc *descs = x->rx.descs;
+	uint64_t *fill = x->fill.descs;
+	omphalos_packet packet;
+	uint64_t now;
+	int r;
+
+	cons = *x->rx.consumer;
+	while((prod = __atomic_load_n(x->rx.producer,__ATOMIC_ACQUIRE)) == cons){
+		if(ring_spin(w,x->fd,xsk_ready_fxn,x)){
+			continue;
+		}
+		if( (r = ring_wait(w,x->fd)) ){
+			if(r > 0){
+				xsk_losses(w,x);
+			}
+			return r;
+		}
+	}
+	if((n = prod - cons) > batch){
+		n = batch;
+	}
+	// Every chunk we're handed came off the fill ring, which is sized to
+	// hold them all; there's always room to put it back.
+	fprod = *x->fill.producer;
+	now = now_ns();
+	for(z = 0 ; z < n ; ++z){
+		const struct xdp_desc *d = &descs[(cons + z) & x->rx.mask];
+		uint64_t base = d->addr & ~(uint64_t)(x->chunk - 1);
+
+		// The kernel leaves XDP_PACKET_HEADROOM ahead of the frame,
+		// plenty for handle_ring_frame() to scribble upon.
+		memset(&packet,0,sizeof(packet));
+		packet.i = w->i;
+		packet.ts = now;
+		handle_ring_frame(w,x->fd,&packet,(char *)x->umem + base,
+				d->addr - base,d->len,d->len,0,0);
+		fill[fprod++ & x->fill.mask] = base;
+		if(interface_contended(w->i)){
+			++z;
+			break;
+		}
+	}
+	__atomic_store_n(x->rx.consumer,cons + z,__ATOMIC_RELEASE);
+	__atomic_store_n(x->fill.producer,fprod,__ATOMIC_RELEASE);
+	if(__atomic_load_n(x->fill.flags,__ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP){
+		recvfrom(x->fd,NULL,0,MSG_DONTWAIT,NULL,NULL);
+	}
+	if(++x->batches % XSK_STAT_BATCHES == 0){
+		xsk_losses(w,x);
+	}
+	return 0;
+}
+
+static void
+xsk_reclaim(xsk *x){
+	uint32_t cons,prod;
+	const uint64_t *comp = x->comp.descs;
+
+	cons = *x->comp.consumer;
+	prod = __atomic_load_n(x->comp.producer,__ATOMIC_ACQUIRE);
+	while(cons != prod){
+		x->txfree[x->ntxfree++] = comp[cons++ & x->comp.mask];
+	}
+	__atomic_store_n(x->comp.consumer,cons,__ATOMIC_RELEASE);
+}
+
+static inline void
+xsk_kick(const xsk *x){
+	if(__atomic_load_n(x->tx.flags,__ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP){
+		// EAGAIN/EBUSY merely mean the kernel's still working on it.
+		sendto(x->fd,NULL,0,MSG_DONTWAIT,NULL,0);
+	}
+}
+
+int xsk_send(interface *iface,const void *frame,size_t len){
+	xdp_iface *xi = iface->xdp;
+	xsk *x = &xi->socks[0];
+	struct xdp_desc *d;
+	uint32_t prod;
+
+	if(len > x->chunk){
+		errno = EMSGSIZE;
+		return -1;
+	}
+	pthread_mutex_lock(&xi->txlock);
+	xsk_reclaim(x);
+	if(x->ntxfree == 0){
+		xsk_kick(x);
+		xsk_reclaim(x);
+		if(x->ntxfree == 0){
+			pthread_mutex_unlock(&xi->txlock);
+			errno = ENOBUFS;
+			return -1;
+		}
+	}
+	// The TX ring holds as many descriptors as there are TX chunks, so
+	// it has room whenever a chunk is free.
+	prod = *x->tx.producer;
+	d = &((struct xdp_desc *)x->tx.descs)[prod & x->tx.mask];
+	d->addr = x->txfree[--x->ntxfree];
+	d->len = len;
+	d->options = 0;
+	memcpy((char *)x->umem + d->addr,frame,len);
+	__atomic_store_n(x->tx.producer,prod + 1,__ATOMIC_RELEASE);
+	xsk_kick(x);
+	pthread_mutex_unlock(&xi->txlock);
+	return len;
+}
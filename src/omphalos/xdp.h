@@ -0,0 +1,69 @@
+#ifndef OMPHALOS_XDP
+#define OMPHALOS_XDP
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <pthread.h>
+
+struct xsk;
+struct rxworker;
+struct interface;
+
+// An AF_XDP (XSK) capture backend, as an alternative to PACKET_MMAP rings.
+// We attach a minimal XDP program which redirects every frame received on
+// each of the interface's RX queues to an XSK bound to that queue. Each XSK
+// has its own UMEM, shared between its RX and TX rings. Frames so redirected
+// never reach the kernel's network stack; this is only suitable for
+// interfaces dedicated to monitoring (SPAN ports, taps, test veths).
+
+typedef enum {
+	XDP_BACKEND_NONE,	// PACKET_MMAP
+	XDP_BACKEND_ANY,	// zero-copy if supported, otherwise copy
+	XDP_BACKEND_COPY,	// copy mode, native or generic XDP
+	XDP_BACKEND_ZEROCOPY,	// zero-copy (native XDP) or nothing
+} xdp_backend;
+
+typedef struct xdp_iface {
+	int progfd,mapfd;	// XDP program and its XSKMAP
+	unsigned attachflags;	// XDP_FLAGS_{DRV,SKB}_MODE it's attached with
+	int zerocopy;		// XSKs are bound XDP_ZEROCOPY
+	unsigned nqueues;	// one XSK per RX queue
+	struct xsk *socks;
+	pthread_mutex_t txlock;	// the first XSK's TX and completion rings
+} xdp_iface;
+
+// Set up XSKs on every RX queue of the interface (whose index is given), and
+// attach the redirecting program. RX chunks are sized from the MTU; ring
+// bytes (0 for a default) determine how many. The UMEM can be backed by huge
+// pages, and is placed on the given NUMA node (-1 for no preference).
+xdp_iface *open_xdp(struct interface *,int,xdp_backend,size_t,int,int);
+
+// Detach the program, and release everything. Any threads servicing the
+// XSKs must already have been reaped.
+void close_xdp(struct interface *,xdp_iface *);
+
+// The pollable fd of the nth XSK.
+int xsk_fd(const xdp_iface *,unsigned);
+struct xsk *xsk_nth(xdp_iface *,unsigned);
+
+// Has the kernel handed us any frames on this XSK?
+int xsk_ready(const struct xsk *);
+
+// Analyze up to the given number of frames from the XSK, waiting for the
+// first if necessary, and return their chunks to the fill ring. Return
+// values are as for handle_ring_packet(). The worker's lock must be held.
+int handle_xsk_batch(struct rxworker *,struct xsk *,unsigned);
+
+// Transmit a frame (starting with the L2 header) via the first XSK, copying
+// it into the UMEM. Returns the length sent, or -1. Senders are serialized
+// on txlock, not the interface lock.
+int xsk_send(struct interface *,const void *,size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
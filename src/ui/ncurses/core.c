@@ -7,6 +7,9 @@
 #include <ui/ncurses/iface.h>
 #include <omphalos/ethtool.h>
 #include <omphalos/service.h>
+#include <omphalos/synscan.h>
+#include <omphalos/ndsweep.h>
+#include <omphalos/arpsweep.h>
 #include <omphalos/netaddrs.h>
 #include <omphalos/omphalos.h>
 #include <omphalos/interface.h>
@@ -172,7 +175,7 @@ int new_display_panel(WINDOW *w,struct panel_state *ps,int rows,int cols,const w
 	return OK;
 }
 
-#define DETAILROWS 9
+#define DETAILROWS 12
 
 static int
 iface_details(WINDOW *hw,const interface *i,int rows){
@@ -189,17 +192,58 @@ iface_details(WINDOW *hw,const interface *i,int rows){
 	}
 	switch(z){ // Intentional fallthroughs all the way to 0
 	case (DETAILROWS - 1):{
-		assert(mvwprintw(hw,row + z,col,"drops: "U64FMT" truncs: "U64FMT" (%ju recov)%-*s",
+		synscan_stats ss;
+
+		if(syn_scan_stats(i,&ss)){
+			assert(mvwprintw(hw,row + z,col,"SYN scan: none%-*s",
+						scrcols - 2 - 14,"") != ERR);
+		}else{
+			assert(mvwprintw(hw,row + z,col,"SYN scan: %u hosts%s x %u ports sent: %u open: %u closed: %u%-*s",
+						ss.hosts + ss.pending,ss.active ? "" : " (idle)",
+						ss.ports,ss.probed,ss.open,ss.closed,
+						scrcols - 2 - 72,"") != ERR);
+		}
+		--z;
+	}case 10:{
+		ndsweep_stats ns;
+
+		if(nd_sweep_stats(i,&ns)){
+			assert(mvwprintw(hw,row + z,col,"ND sweep: none%-*s",
+						scrcols - 2 - 14,"") != ERR);
+		}else{
+			assert(mvwprintw(hw,row + z,col,"ND sweep: %u prefixes %u neighbours sent: %u found: %u%-*s",
+						ns.prefixes,ns.neighbours,ns.probed,ns.found,
+						scrcols - 2 - 68,"") != ERR);
+		}
+		--z;
+	}case 9:{
+		arpsweep_stats as;
+
+		if(arp_sweep_stats(i,&as)){
+			assert(mvwprintw(hw,row + z,col,"ARP sweep: none%-*s",
+						scrcols - 2 - 15,"") != ERR);
+		}else{
+			assert(mvwprintw(hw,row + z,col,"ARP sweep: %u/%u%s found: %u pps: %u%-*s",
+						as.probed,as.targets,as.done ? " (done)" : "",
+						as.found,as.pps,scrcols - 2 - 60,"") != ERR);
+		}
+		--z;
+	}case 8:{
+		assert(mvwprintw(hw,row + z,col,"drops: "U64FMT" truncs: "U64FMT" (%ju recov) evicted: %ju/%ju/%ju%-*s",
 					i->drops,i->truncated,i->truncated_recovered,
+					i->l2evicted,i->l3evicted,i->l4evicted,
 					scrcols - 2 - 72,"") != ERR);
 		--z;
 	}case 7:{
-		assert(mvwprintw(hw,row + z,col,"mform: "U64FMT" noprot: "U64FMT,
-					i->malformed,i->noprotocol) != ERR);
+		assert(mvwprintw(hw,row + z,col,"mform: "U64FMT" noprot: "U64FMT" badcsum ip4/tcp/udp/icmp: %ju/%ju/%ju/%ju",
+					i->malformed,i->noprotocol,i->ip4csumerrs,
+					i->tcpcsumerrs,i->udpcsumerrs,i->icmpcsumerrs) != ERR);
 		--z;
 	}case 6:{
-		assert(mvwprintw(hw,row + z,col,"Rbyte: "U64FMT" frames: "U64FMT,
-					i->bytes,i->frames) != ERR);
+		assert(mvwprintw(hw,row + z,col,"Rbyte: "U64FMT" frames: "U64FMT" batch: %ju/%ju",
+					i->bytes,i->frames,
+					i->rxbatches ? i->frames / i->rxbatches : 0,
+					i->rxbatchmax) != ERR);
 		--z;
 	}case 5:{
 		char b[PREFIXSTRLEN];
@@ -695,8 +739,6 @@ void hide_panel_locked(struct panel_state *ps){
 
 int packet_cb_locked(const interface *i,omphalos_packet *op,struct panel_state *ps){
 	iface_state *is = op->i->opaque;
-	struct timeval tdiff;
-	unsigned long udiff;
 	reelbox *rb;
 
 	if(!is){
@@ -705,12 +747,10 @@ int packet_cb_locked(const interface *i,omphalos_packet *op,struct panel_state *
 	if((rb = is->rb) == NULL){
 		return 0;
 	}
-	timersub(&op->tv,&is->lastprinted,&tdiff);
-	udiff = timerusec(&tdiff);
-	if(udiff < 500000){ // At most one update every 1/2s
+	if(op->ts - is->lastprinted < NSEC_PER_SEC / 2){ // At most one update every 1/2s
 		return 0;
 	}
-	is->lastprinted = op->tv;
+	is->lastprinted = op->ts;
 	if(rb == current_iface && ps->p){
 		iface_details(panel_window(ps->p),i,ps->ysize);
 	}
@@ -943,6 +983,52 @@ struct l3obj *host_callback_locked(const interface *i,struct l2host *l2,
 	return ret;
 }
 
+// The eviction callbacks return non-zero if the display changed.
+static int
+evicted_locked(iface_state *is){
+	reelbox *rb;
+
+	if( (rb = is->rb) ){
+		resize_iface(rb);
+		redraw_iface_generic(rb);
+	}
+	return 1;
+}
+
+int service_evicted_locked(const interface *i,struct l3host *l3,void *opaque){
+	struct l3obj *l3o;
+	iface_state *is;
+
+	if((is = i->opaque) == NULL || opaque == NULL){
+		return 0;
+	}
+	if((l3o = l3host_get_opaque(l3)) == NULL){
+		return 0;
+	}
+	remove_service_from_iface(is,l3o,opaque);
+	return evicted_locked(is);
+}
+
+int host_evicted_locked(const interface *i,void *opaque){
+	iface_state *is;
+
+	if((is = i->opaque) == NULL || opaque == NULL){
+		return 0;
+	}
+	remove_l3_from_iface(is,opaque);
+	return evicted_locked(is);
+}
+
+int neighbor_evicted_locked(const interface *i,void *opaque){
+	iface_state *is;
+
+	if((is = i->opaque) == NULL || opaque == NULL){
+		return 0;
+	}
+	remove_l2_from_iface(is,opaque);
+	return evicted_locked(is);
+}
+
 // to be called only while ncurses lock is held
 int draw_main_window(WINDOW *w){
 	int rows,cols;
@@ -77,7 +77,7 @@ iface_state *create_interface_state(interface *i){
 		ret->l2objs = NULL;
 		ret->devaction = 0;
 		ret->typestr = tstr;
-		ret->lastprinted.tv_sec = ret->lastprinted.tv_usec = 0;
+		ret->lastprinted = 0;
 		ret->iface = i;
 		ret->expansion = EXPANSION_MAX;
 	}
@@ -281,6 +281,69 @@ l4obj *add_service_to_iface(iface_state *is,struct l2obj *l2,struct l3obj *l3,
 	return l4;
 }
 
+// Hosts keep their nodes from being evicted, so there ought be no l3objs left
+// by the time a node goes, but we oughtn't leak them if there are.
+void remove_l2_from_iface(iface_state *is,l2obj *l2){
+	const l3obj *l3;
+	reelbox *rb;
+
+	for(l3 = l2->l3objs ; l3 ; l3 = l3->next){
+		--is->hosts;
+		if(l3->l4objs){
+			--is->srvs;
+		}
+	}
+	if(l2->cat == RTN_LOCAL || l2->cat == RTN_UNICAST){
+		--is->nodes;
+	}else{
+		--is->vnodes;
+	}
+	if( (rb = is->rb) && rb->selected == l2){
+		if((rb->selected = l2->next ? l2->next : l2->prev) == NULL){
+			rb->selline = -1;
+		}
+	}
+	if(l2->prev){
+		l2->prev->next = l2->next;
+	}else{
+		is->l2objs = l2->next;
+	}
+	if(l2->next){
+		l2->next->prev = l2->prev;
+	}
+	free_l2obj(l2);
+}
+
+void remove_l3_from_iface(iface_state *is,l3obj *l3){
+	l2obj *l2 = l3->l2;
+	l3obj **prev;
+
+	for(prev = &l2->l3objs ; *prev != l3 ; prev = &(*prev)->next){
+		assert(*prev);
+	}
+	*prev = l3->next;
+	--is->hosts;
+	if(l3->l4objs){
+		--is->srvs;
+	}
+	free_l3obj(l3);
+	l2->lines = node_lines(is->expansion,l2);
+}
+
+void remove_service_from_iface(iface_state *is,l3obj *l3,l4obj *l4){
+	l4obj **prev;
+
+	for(prev = &l3->l4objs ; *prev != l4 ; prev = &(*prev)->next){
+		assert(*prev);
+	}
+	*prev = l4->next;
+	if(l3->l4objs == NULL){
+		--is->srvs;
+	}
+	free_l4obj(l4);
+	l3->l2->lines = node_lines(is->expansion,l3->l2);
+}
+
 static void
 print_host_services(WINDOW *w,const interface *i,const l3obj *l,int *line,
 			int rows,int cols,wchar_t selectchar,int attrs,
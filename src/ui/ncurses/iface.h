@@ -35,7 +35,7 @@ enum {
 typedef struct iface_state {
 	struct interface *iface;	// corresponding omphalos iface struct
 	const char *typestr;		// looked up using iface->arptype
-	struct timeval lastprinted;	// last time we printed the iface
+	uint64_t lastprinted;		// last time (ns) we printed the iface
 	int devaction;			// 1 == down, -1 == up, 0 == nothing
 	int nodes;			// number of nodes
 	unsigned vnodes;		// virtual nodecount (multicast etc)	
@@ -65,6 +65,12 @@ struct l3obj *add_l3_to_iface(struct iface_state *,struct l2obj *,struct l3host
 struct l4obj *add_service_to_iface(struct iface_state *,struct l2obj *,
 				struct l3obj *,struct l4srv *,unsigned);
 
+// Drop objects for evicted l2hosts, l3hosts and l4srvs (see
+// omphalos/hostcap.h), along with anything beneath them.
+void remove_l2_from_iface(struct iface_state *,struct l2obj *);
+void remove_l3_from_iface(struct iface_state *,struct l3obj *);
+void remove_service_from_iface(struct iface_state *,struct l3obj *,struct l4obj *);
+
 // Call after changing the degree of collapse/expansion, and resizing, but
 // before redrawing.
 void recompute_selection(iface_state *,int,int,int);
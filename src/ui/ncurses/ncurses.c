@@ -29,6 +29,7 @@
 #include <linux/rtnetlink.h>
 #include <ui/ncurses/util.h>
 #include <ui/ncurses/core.h>
+#include <omphalos/epoch.h>
 #include <omphalos/timing.h>
 #include <ui/ncurses/color.h>
 #include <ncursesw/ncurses.h>
@@ -159,6 +160,17 @@ static void
 toggle_subwindow_pinning(void){
 }
 
+// Don't hold up host reclamation while we wait on the user.
+static int
+input_getch(void){
+	int ch;
+
+	epoch_offline();
+	ch = getch();
+	epoch_online();
+	return ch;
+}
+
 static void *
 ncurses_input_thread(void *unsafe_marsh){
 	struct ncurses_input_marshal *nim = unsafe_marsh;
@@ -166,7 +178,10 @@ ncurses_input_thread(void *unsafe_marsh){
 	int ch;
 
 	active = NULL; // No subpanels initially
-	while((ch = getch()) != 'q' && ch != 'Q'){
+	if(epoch_register()){
+		wstatus(w,"%s","couldn't register with the reclaimer");
+	}
+	while((ch = input_getch()) != 'q' && ch != 'Q'){
 	switch(ch){
 		case KEY_HOME:
 			lock_ncurses();
@@ -328,6 +343,7 @@ ncurses_input_thread(void *unsafe_marsh){
 		}
 	}
 	}
+	epoch_unregister();
 	wstatus(w,"%s","shutting down");
 	// we can't use raise() here, as that sends the signal only
 	// to ourselves, and we have it masked.
@@ -619,6 +635,37 @@ neighbor_callback(const interface *i,struct l2host *l2){
 	return ret;
 }
 
+static void
+service_evicted_callback(const interface *i,struct l2host *l2 __attribute__ ((unused)),
+			struct l3host *l3,struct l4srv *l4 __attribute__ ((unused)),
+			void *opaque){
+	pthread_mutex_lock(&bfl);
+	if(service_evicted_locked(i,l3,opaque)){
+		screen_update();
+	}
+	pthread_mutex_unlock(&bfl);
+}
+
+static void
+host_evicted_callback(const interface *i,struct l2host *l2 __attribute__ ((unused)),
+			struct l3host *l3 __attribute__ ((unused)),void *opaque){
+	pthread_mutex_lock(&bfl);
+	if(host_evicted_locked(i,opaque)){
+		screen_update();
+	}
+	pthread_mutex_unlock(&bfl);
+}
+
+static void
+neighbor_evicted_callback(const interface *i,struct l2host *l2 __attribute__ ((unused)),
+				void *opaque){
+	pthread_mutex_lock(&bfl);
+	if(neighbor_evicted_locked(i,opaque)){
+		screen_update();
+	}
+	pthread_mutex_unlock(&bfl);
+}
+
 static void
 interface_removed_callback(const interface *i __attribute__ ((unused)),void *unsafe){
 	lock_ncurses();
@@ -671,6 +718,9 @@ int main(int argc,char * const *argv){
 	pctx.iface.srv_event = service_callback;
 	pctx.iface.neigh_event = neighbor_callback;
 	pctx.iface.host_event = host_callback;
+	pctx.iface.srv_evicted = service_evicted_callback;
+	pctx.iface.host_evicted = host_evicted_callback;
+	pctx.iface.neigh_evicted = neighbor_evicted_callback;
 	pctx.iface.network_event = network_callback;
 	if(ncurses_setup() == NULL){
 		return EXIT_FAILURE;
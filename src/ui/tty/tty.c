@@ -16,6 +16,7 @@
 #include <wireless.h>
 #include <omphalos/diag.h>
 #include <omphalos/pcap.h>
+#include <omphalos/epoch.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <omphalos/service.h>
@@ -344,10 +345,16 @@ tty_handler(void *v){
 	};
 	pthread_t *maintid = v;
 
+	if(epoch_register()){
+		fprintf(stderr,"Couldn't register with the reclaimer\n");
+	}
 	while(!cancelled){
 		char *l;
 
+		// Don't hold up host reclamation while we wait on the user
+		epoch_offline();
 		l = readline(promptbuf);
+		epoch_online();
 		if(l == NULL){
 			break;
 		}
@@ -378,6 +385,7 @@ tty_handler(void *v){
 		}
 		free(l);
 	}
+	epoch_unregister();
 	printf("Shutting down...\n");
 	pthread_kill(*maintid,SIGINT);
 	pthread_exit(NULL);
@@ -1,27 +1,108 @@
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <linux/ip.h>
+#include <omphalos/csum.h>
 
-static uint16_t
-ipv4_csum(const void *hdr){
-	size_t len = ((const struct iphdr *)hdr)->ihl << 2u;
-	const uint16_t *cur;
-	uint32_t sum;
-	unsigned z;
+#define BENCH_BYTES (1ull << 30)	// per kernel per size
+#define MAX_LEN 65536
+
+static const size_t sizes[] = { 20, 40, 64, 128, 576, 1500, 4096, 9000, 65536, };
+
+static uint64_t
+now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Every kernel must agree with the scalar reference, at every length and
+// alignment.
+static int
+check_kernels(unsigned char *buf){
+	size_t len,off;
+	int k;
+
+	for(k = 0 ; k < CSUM_KERNELS ; ++k){
+		if(!csum_kernel_supported(k)){
+			printf("%8s: unsupported\n",csum_kernel_name(k));
+			continue;
+		}
+		for(off = 0 ; off < 32 ; ++off){
+			for(len = 0 ; len < 2048 + off ; ++len){
+				uint16_t ref,cs;
 
-	sum = 0;
-	cur = hdr;
-	for(z = 0 ; z < len / sizeof(*cur) ; ++z){
-		sum += cur[z];
+				set_csum_kernel(CSUM_KERNEL_SCALAR);
+				ref = csum_fold(csum_partial(buf + off,len));
+				set_csum_kernel(k);
+				cs = csum_fold(csum_partial(buf + off,len));
+				if(cs != ref){
+					fprintf(stderr,"%s: 0x%04hx != 0x%04hx (len %zu off %zu)\n",
+						csum_kernel_name(k),cs,ref,len,off);
+					return -1;
+				}
+			}
+		}
+		printf("%8s: ok\n",csum_kernel_name(k));
 	}
-	fprintf(stderr,"SUM: %u (0x%08x)\n",sum,sum);
-	while(sum >> 16){
-		sum = (sum & 0xffffu) + (sum >> 16);
+	return 0;
+}
+
+// A header carrying its computed checksum sums to zero.
+static int
+check_header(const char *hdr){
+	unsigned char ip[20];
+	uint16_t cs;
+
+	memcpy(ip,hdr,sizeof(ip));
+	((struct iphdr *)ip)->check = 0;
+	cs = ipv4_csum(ip);
+	((struct iphdr *)ip)->check = cs;
+	if(ipv4_csum(ip)){
+		fprintf(stderr,"Bad IPv4 checksum 0x%04hx\n",cs);
+		return -1;
 	}
-	return ~sum;
+	printf("IPv4 checksum: 0x%04hx\n",cs);
+	return 0;
 }
 
+static void
+bench_kernels(const unsigned char *buf){
+	unsigned z;
+	int k;
+
+	printf("%8s","bytes");
+	for(k = 0 ; k < CSUM_KERNELS ; ++k){
+		if(csum_kernel_supported(k)){
+			printf(" %10s",csum_kernel_name(k));
+		}
+	}
+	printf("   (Gbps)\n");
+	for(z = 0 ; z < sizeof(sizes) / sizeof(*sizes) ; ++z){
+		const size_t len = sizes[z];
+
+		printf("%8zu",len);
+		for(k = 0 ; k < CSUM_KERNELS ; ++k){
+			volatile uint32_t sink = 0;
+			uint64_t iters,n,ns;
+
+			if(set_csum_kernel(k)){
+				continue;
+			}
+			iters = BENCH_BYTES / len;
+			ns = now_ns();
+			for(n = 0 ; n < iters ; ++n){
+				sink += csum_partial(buf,len);
+			}
+			ns = now_ns() - ns;
+			printf(" %10.2f",ns ? iters * len * 8.0 / ns : 0.0);
+		}
+		printf("\n");
+	}
+}
 
 int main(void){
 	const char a[] = { 0x45, 0x00, 0x00, 0x46, 0x51, 0xdc, 0x00, 0x00,
@@ -30,11 +111,38 @@ int main(void){
 	const char b[] = { 0x45, 0x00, 0x00, 0x48, 0x67, 0x45, 0x00, 0x00,
 				0x40, 0x11, 0x52, 0xba, 0x00, 0x00, 0x00, 0x00,
 				0xc0, 0xa8, 0x01, 0xfe, };
-	uint16_t cs;
+	unsigned char *buf;
+	unsigned z;
 
-	cs = ipv4_csum(a);
-	fprintf(stderr,"csum: 0x%04hx\n",cs);
-	cs = ipv4_csum(b);
-	fprintf(stderr,"csum: 0x%04hx\n",cs);
+	if(init_csum()){
+		fprintf(stderr,"Couldn't select a checksum kernel\n");
+		return EXIT_FAILURE;
+	}
+	printf("Selected kernel: %s\n",csum_kernel_name(get_csum_kernel()));
+	if(check_header(a) || check_header(b)){
+		return EXIT_FAILURE;
+	}
+	if((buf = malloc(MAX_LEN + 64)) == NULL){
+		return EXIT_FAILURE;
+	}
+	srandom(time(NULL));
+	for(z = 0 ; z < MAX_LEN + 64 ; ++z){
+		buf[z] = random();
+	}
+	if(check_kernels(buf)){
+		free(buf);
+		return EXIT_FAILURE;
+	}
+	// All ones stress the carries
+	memset(buf,0xff,MAX_LEN + 64);
+	if(check_kernels(buf)){
+		free(buf);
+		return EXIT_FAILURE;
+	}
+	for(z = 0 ; z < MAX_LEN + 64 ; ++z){
+		buf[z] = random();
+	}
+	bench_kernels(buf);
+	free(buf);
 	return EXIT_SUCCESS;
 }